@@ -170,3 +170,51 @@ bool update_buffer(GLenum target, GLuint buffer, void *data, size_t size)
 	gl_bind_buffer(target, 0);
 	return success;
 }
+
+/* creates an immutable buffer that stays mapped for its whole lifetime, the
+ * memory is coherent so writes need no flushing, but must be fenced */
+bool gl_create_persistent_buffer(GLenum target, GLuint *buffer,
+		GLsizeiptr size, GLbitfield access, void **ptr)
+{
+	GLbitfield flags = access | GL_MAP_PERSISTENT_BIT |
+		GL_MAP_COHERENT_BIT;
+	bool success;
+
+	*ptr = NULL;
+
+	if (!gl_gen_buffers(1, buffer))
+		return false;
+	if (!gl_bind_buffer(target, *buffer))
+		return false;
+
+	glBufferStorage(target, size, NULL, flags);
+	success = gl_success("glBufferStorage");
+
+	if (success) {
+		*ptr = glMapBufferRange(target, 0, size, flags);
+		success = gl_success("glMapBufferRange") && *ptr;
+	}
+
+	gl_bind_buffer(target, 0);
+	return success;
+}
+
+/* waits for the GPU to pass a fence and deletes it */
+bool gl_wait_fence(GLsync *fence)
+{
+	bool success = true;
+	GLenum ret;
+
+	if (!*fence)
+		return true;
+
+	ret = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+			1000000000ULL);
+	if (ret == GL_WAIT_FAILED)
+		success = gl_success("glClientWaitSync");
+	else if (ret == GL_TIMEOUT_EXPIRED)
+		blog(LOG_WARNING, "gl_wait_fence: timed out waiting for GPU");
+
+	gl_delete_fence(fence);
+	return success;
+}
@@ -159,3 +159,17 @@ extern bool gl_create_buffer(GLenum target, GLuint *buffer, GLsizeiptr size,
 
 extern bool update_buffer(GLenum target, GLuint buffer, void *data,
 		size_t size);
+
+extern bool gl_create_persistent_buffer(GLenum target, GLuint *buffer,
+		GLsizeiptr size, GLbitfield access, void **ptr);
+
+extern bool gl_wait_fence(GLsync *fence);
+
+static inline void gl_delete_fence(GLsync *fence)
+{
+	if (*fence) {
+		glDeleteSync(*fence);
+		gl_success("glDeleteSync");
+		*fence = NULL;
+	}
+}
@@ -16,6 +16,10 @@
 ******************************************************************************/
 
 #include <assert.h>
+#include <ctype.h>
+
+#include <util/platform.h>
+#include <util/dstr.h>
 
 #include <graphics/vec2.h>
 #include <graphics/vec3.h>
@@ -187,6 +191,26 @@ static inline bool gl_process_attribs(struct gs_shader *shader,
 	return true;
 }
 
+/* 64-bit FNV-1a */
+#define HASH_INIT 14695981039346656037ULL
+
+static uint64_t hash_data(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static inline uint64_t hash_string(uint64_t hash, const char *str)
+{
+	return str ? hash_data(hash, str, strlen(str) + 1) : hash;
+}
+
 static bool gl_shader_init(struct gs_shader *shader,
 		struct gl_shader_parser *glsp,
 		const char *file, char **error_string)
@@ -199,6 +223,8 @@ static bool gl_shader_init(struct gs_shader *shader,
 	if (!gl_success("glCreateShader") || !shader->obj)
 		return false;
 
+	shader->hash = hash_string(HASH_INIT, glsp->gl_string.array);
+
 	glShaderSource(shader->obj, 1, (const GLchar**)&glsp->gl_string.array,
 			0);
 	if (!gl_success("glShaderSource"))
@@ -590,27 +616,249 @@ static inline bool assign_program_params(struct gs_program *program)
 	return true;
 }
 
-struct gs_program *gs_program_create(struct gs_device *device)
+static void remove_cache_dir(const char *path)
 {
-	struct gs_program *program = bzalloc(sizeof(*program));
+	struct os_dirent *ent;
+	struct dstr file = {0};
+	os_dir_t *dir = os_opendir(path);
+
+	if (dir) {
+		while ((ent = os_readdir(dir)) != NULL) {
+			if (ent->directory)
+				continue;
+
+			dstr_printf(&file, "%s/%s", path, ent->d_name);
+			os_unlink(file.array);
+		}
+
+		os_closedir(dir);
+	}
+
+	dstr_free(&file);
+	os_rmdir(path);
+}
+
+static inline bool is_driver_dir(const char *name)
+{
+	if (strlen(name) != 16)
+		return false;
+
+	for (; *name; name++) {
+		if (!isxdigit((unsigned char)*name))
+			return false;
+	}
+
+	return true;
+}
+
+/* binaries of other drivers can never be loaded again, so each driver gets
+ * its own subdirectory and those of the others are removed */
+static void prune_program_cache(const char *path, const char *driver_dir)
+{
+	struct os_dirent *ent;
+	struct dstr sub = {0};
+	os_dir_t *dir = os_opendir(path);
+
+	if (!dir)
+		return;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		if (!ent->directory || !is_driver_dir(ent->d_name) ||
+		    strcmp(ent->d_name, driver_dir) == 0)
+			continue;
+
+		dstr_printf(&sub, "%s/%s", path, ent->d_name);
+		remove_cache_dir(sub.array);
+	}
+
+	os_closedir(dir);
+	dstr_free(&sub);
+}
+
+void device_set_shader_cache_path(gs_device_t *device, const char *path)
+{
+	const char *strings[3];
+	struct dstr driver_path = {0};
+	char driver_dir[17];
+
+	bfree(device->program_cache_path);
+	device->program_cache_path = NULL;
+
+	if (!device->program_binary || !path || !*path)
+		return;
+
+	/* binaries are only valid for the driver that created them */
+	strings[0] = (const char*)glGetString(GL_VENDOR);
+	strings[1] = (const char*)glGetString(GL_RENDERER);
+	strings[2] = (const char*)glGetString(GL_VERSION);
+
+	device->driver_hash = HASH_INIT;
+	for (size_t i = 0; i < 3; i++)
+		device->driver_hash = hash_string(device->driver_hash,
+				strings[i]);
+
+	snprintf(driver_dir, sizeof(driver_dir), "%016llx",
+			(unsigned long long)device->driver_hash);
+	dstr_printf(&driver_path, "%s/%s", path, driver_dir);
+
+	if (os_mkdirs(driver_path.array) == MKDIR_ERROR) {
+		blog(LOG_WARNING, "Could not create program cache directory "
+		                  "'%s'", driver_path.array);
+		dstr_free(&driver_path);
+		return;
+	}
+
+	prune_program_cache(path, driver_dir);
+	device->program_cache_path = driver_path.array;
+}
+
+struct program_cache_header {
+	uint64_t driver_hash;
+	uint64_t vertex_hash;
+	uint64_t pixel_hash;
+	uint32_t format;
+	uint32_t size;
+};
+
+static inline void get_program_header(struct gs_program *program,
+		struct program_cache_header *header)
+{
+	memset(header, 0, sizeof(*header));
+	header->driver_hash = program->device->driver_hash;
+	header->vertex_hash = program->vertex_shader->hash;
+	header->pixel_hash  = program->pixel_shader->hash;
+}
+
+static void get_program_cache_file(struct gs_program *program,
+		struct dstr *file)
+{
+	struct program_cache_header key;
+	uint64_t hash;
+
+	get_program_header(program, &key);
+	hash = hash_data(HASH_INIT, &key,
+			offsetof(struct program_cache_header, format));
+
+	dstr_printf(file, "%s/%016llx.bin", program->device->program_cache_path,
+			(unsigned long long)hash);
+}
+
+static bool load_program_binary(struct gs_program *program)
+{
+	struct program_cache_header header, expected;
+	struct dstr file = {0};
+	void *data = NULL;
 	int linked = false;
+	int64_t file_size;
+	FILE *f;
 
-	program->device        = device;
-	program->vertex_shader = device->cur_vertex_shader;
-	program->pixel_shader  = device->cur_pixel_shader;
+	get_program_cache_file(program, &file);
+	f = os_fopen(file.array, "rb");
+	dstr_free(&file);
 
-	program->obj = glCreateProgram();
-	if (!gl_success("glCreateProgram"))
-		goto error_detach_neither;
+	if (!f)
+		return false;
+
+	get_program_header(program, &expected);
+	file_size = os_fgetsize(f);
+
+	/* the size comes from the file, so don't trust it with an allocation
+	 * before making sure the file actually holds that much */
+	if (fread(&header, 1, sizeof(header), f) != sizeof(header) ||
+	    header.driver_hash != expected.driver_hash ||
+	    header.vertex_hash != expected.vertex_hash ||
+	    header.pixel_hash  != expected.pixel_hash  ||
+	    !header.size ||
+	    file_size != (int64_t)sizeof(header) + (int64_t)header.size)
+		goto fail;
+
+	data = bmalloc(header.size);
+	if (fread(data, 1, header.size, f) != header.size)
+		goto fail;
+
+	glProgramBinary(program->obj, header.format, data, header.size);
+	if (!gl_success("glProgramBinary"))
+		goto fail;
+
+	/* the driver may still reject a binary, after which the program
+	 * is linked normally */
+	glGetProgramiv(program->obj, GL_LINK_STATUS, &linked);
+	if (!gl_success("glGetProgramiv"))
+		linked = false;
+
+fail:
+	bfree(data);
+	fclose(f);
+	return linked != GL_FALSE;
+}
+
+static void save_program_binary(struct gs_program *program)
+{
+	struct program_cache_header header;
+	struct dstr file = {0};
+	struct dstr temp = {0};
+	GLint size = 0;
+	GLsizei length = 0;
+	GLenum format = 0;
+	void *data = NULL;
+	bool success = false;
+	FILE *f;
+
+	glGetProgramiv(program->obj, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (!gl_success("glGetProgramiv") || size <= 0)
+		return;
+
+	data = bmalloc(size);
+	glGetProgramBinary(program->obj, size, &length, &format, data);
+	if (!gl_success("glGetProgramBinary") || length <= 0)
+		goto exit;
+
+	get_program_header(program, &header);
+	header.format = (uint32_t)format;
+	header.size   = (uint32_t)length;
+
+	/* written under a temporary name so that an interrupted write never
+	 * leaves a partial binary behind */
+	get_program_cache_file(program, &file);
+	dstr_copy_dstr(&temp, &file);
+	dstr_cat(&temp, ".tmp");
+
+	f = os_fopen(temp.array, "wb");
+	if (!f)
+		goto exit;
+
+	success = fwrite(&header, 1, sizeof(header), f) == sizeof(header) &&
+	          fwrite(data, 1, length, f) == (size_t)length;
+	fclose(f);
+
+	if (!success || os_rename(temp.array, file.array) != 0)
+		os_unlink(temp.array);
+
+exit:
+	dstr_free(&file);
+	dstr_free(&temp);
+	bfree(data);
+}
+
+static bool link_program(struct gs_program *program)
+{
+	int linked = false;
+	bool success = false;
 
 	glAttachShader(program->obj, program->vertex_shader->obj);
 	if (!gl_success("glAttachShader (vertex)"))
-		goto error_detach_neither;
+		return false;
 
 	glAttachShader(program->obj, program->pixel_shader->obj);
 	if (!gl_success("glAttachShader (pixel)"))
 		goto error_detach_vertex;
 
+	if (program->device->program_cache_path) {
+		glProgramParameteri(program->obj,
+				GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		gl_success("glProgramParameteri");
+	}
+
 	glLinkProgram(program->obj);
 	if (!gl_success("glLinkProgram"))
 		goto error;
@@ -619,21 +867,54 @@ struct gs_program *gs_program_create(struct gs_device *device)
 	if (!gl_success("glGetProgramiv"))
 		goto error;
 
-	if (linked == GL_FALSE) {
+	if (linked == GL_FALSE)
 		print_link_errors(program->obj);
+	else
+		success = true;
+
+error:
+	glDetachShader(program->obj, program->pixel_shader->obj);
+	gl_success("glDetachShader (pixel)");
+
+error_detach_vertex:
+	glDetachShader(program->obj, program->vertex_shader->obj);
+	gl_success("glDetachShader (vertex)");
+
+	return success;
+}
+
+struct gs_program *gs_program_create(struct gs_device *device)
+{
+	struct gs_program *program = bzalloc(sizeof(*program));
+	bool cached = false;
+
+	program->device        = device;
+	program->vertex_shader = device->cur_vertex_shader;
+	program->pixel_shader  = device->cur_pixel_shader;
+
+	program->obj = glCreateProgram();
+	if (!gl_success("glCreateProgram"))
+		goto error;
+
+	if (device->program_cache_path)
+		cached = load_program_binary(program);
+
+	if (!cached && !link_program(program))
 		goto error;
-	}
 
 	if (!assign_program_attribs(program))
 		goto error;
 	if (!assign_program_params(program))
 		goto error;
 
-	glDetachShader(program->obj, program->vertex_shader->obj);
-	gl_success("glDetachShader (vertex)");
-
-	glDetachShader(program->obj, program->pixel_shader->obj);
-	gl_success("glDetachShader (pixel)");
+	if (device->program_cache_path) {
+		if (cached) {
+			device->programs_loaded++;
+		} else {
+			save_program_binary(program);
+			device->programs_linked++;
+		}
+	}
 
 	program->next = device->first_program;
 	program->prev_next = &device->first_program;
@@ -644,14 +925,6 @@ struct gs_program *gs_program_create(struct gs_device *device)
 	return program;
 
 error:
-	glDetachShader(program->obj, program->pixel_shader->obj);
-	gl_success("glDetachShader (pixel)");
-
-error_detach_vertex:
-	glDetachShader(program->obj, program->vertex_shader->obj);
-	gl_success("glDetachShader (vertex)");
-
-error_detach_neither:
 	gs_program_destroy(program);
 	return NULL;
 }
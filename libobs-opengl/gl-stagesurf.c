@@ -68,6 +68,7 @@ gs_stagesurf_t *device_stagesurface_create(gs_device_t *device, uint32_t width,
 void gs_stagesurface_destroy(gs_stagesurf_t *stagesurf)
 {
 	if (stagesurf) {
+		gl_delete_fence(&stagesurf->fence);
 		if (stagesurf->pack_buffer)
 			gl_delete_buffers(1, &stagesurf->pack_buffer);
 
@@ -106,6 +107,17 @@ static bool can_stage(struct gs_stage_surface *dst, struct gs_texture_2d *src)
 	return true;
 }
 
+/* fences the copy so that mapping can tell whether it's done */
+static void fence_copy(gs_device_t *device, struct gs_stage_surface *dst)
+{
+	gl_delete_fence(&dst->fence);
+
+	if (device->fence_sync) {
+		dst->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl_success("glFenceSync");
+	}
+}
+
 #ifdef __APPLE__
 
 /* Apparently for mac, PBOs won't do an asynchronous transfer unless you use
@@ -141,6 +153,7 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glReadPixels"))
 		goto failed_unbind_all;
 
+	fence_copy(device, dst);
 	success = true;
 
 failed_unbind_all:
@@ -172,6 +185,8 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glGetTexImage"))
 		goto failed;
 
+	fence_copy(device, dst);
+
 	gl_bind_texture(GL_TEXTURE_2D, 0);
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 	return;
@@ -180,8 +195,6 @@ failed:
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 	gl_bind_texture(GL_TEXTURE_2D, 0);
 	blog(LOG_ERROR, "device_stage_texture (GL) failed");
-
-	UNUSED_PARAMETER(device);
 }
 
 #endif
@@ -205,6 +218,11 @@ enum gs_color_format gs_stagesurface_get_color_format(
 bool gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data,
 		uint32_t *linesize)
 {
+	/* waiting on the fence rather than in glMapBuffer lets the driver
+	 * keep working on other commands while we wait */
+	if (!gl_wait_fence(&stagesurf->fence))
+		goto fail;
+
 	if (!gl_bind_buffer(GL_PIXEL_PACK_BUFFER, stagesurf->pack_buffer))
 		goto fail;
 
@@ -214,7 +232,9 @@ bool gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data,
 
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 
-	*linesize = stagesurf->bytes_per_pixel * stagesurf->width;
+	/* rows in the pack buffer are 4-byte aligned */
+	*linesize = (stagesurf->bytes_per_pixel * stagesurf->width + 3) &
+		0xFFFFFFFC;
 	return true;
 
 fail:
@@ -232,3 +252,20 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 }
+
+bool gs_stagesurface_ready(gs_stagesurf_t *stagesurf)
+{
+	GLenum ret;
+
+	if (!stagesurf->fence)
+		return true;
+
+	ret = glClientWaitSync(stagesurf->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (ret == GL_TIMEOUT_EXPIRED)
+		return false;
+	if (ret == GL_WAIT_FAILED)
+		gl_success("glClientWaitSync");
+
+	gl_delete_fence(&stagesurf->fence);
+	return true;
+}
@@ -142,6 +142,19 @@ static bool gl_init_extensions(struct gs_device* device)
 	else
 		device->copy_type = COPY_TYPE_FBO_BLIT;
 
+	device->fence_sync = GLAD_GL_VERSION_3_2 || GLAD_GL_ARB_sync;
+
+	/* persistently mapped buffers need fences to be safe to reuse */
+	device->buffer_storage = device->fence_sync &&
+		(GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage);
+
+	/* drivers can expose the extension without any binary formats */
+	if (GLAD_GL_VERSION_4_1 || GLAD_GL_ARB_get_program_binary) {
+		GLint formats = 0;
+		gl_get_integer_v(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		device->program_binary = formats > 0;
+	}
+
 	return true;
 }
 
@@ -243,6 +256,13 @@ void device_destroy(gs_device_t *device)
 		while (device->first_program)
 			gs_program_destroy(device->first_program);
 
+		if (device->program_cache_path)
+			blog(LOG_INFO, "Program binary cache: %u programs "
+					"loaded, %u linked",
+					device->programs_loaded,
+					device->programs_linked);
+
+		bfree(device->program_cache_path);
 		da_free(device->proj_stack);
 		da_free(device->fbos);
 		gl_platform_destroy(device->plat);
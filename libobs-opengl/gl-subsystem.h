@@ -330,6 +330,7 @@ struct gs_shader {
 	gs_device_t          *device;
 	enum gs_shader_type  type;
 	GLuint               obj;
+	uint64_t             hash;
 
 	struct gs_shader_param  *viewproj;
 	struct gs_shader_param  *world;
@@ -410,13 +411,22 @@ struct gs_texture {
 	gs_samplerstate_t    *cur_sampler;
 };
 
+#define NUM_UNPACK_BUFFERS 3
+
 struct gs_texture_2d {
 	struct gs_texture    base;
 
 	uint32_t             width;
 	uint32_t             height;
 	bool                 gen_mipmaps;
-	GLuint               unpack_buffer;
+
+	/* dynamic textures stream through a ring of unpack buffers, which
+	 * stay mapped and are fenced when persistent mapping is supported */
+	GLuint               unpack_buffers[NUM_UNPACK_BUFFERS];
+	GLsync               unpack_fences[NUM_UNPACK_BUFFERS];
+	uint8_t              *unpack_ptrs[NUM_UNPACK_BUFFERS];
+	GLsizeiptr           unpack_size;
+	size_t               cur_unpack;
 };
 
 struct gs_texture_cube {
@@ -437,6 +447,7 @@ struct gs_stage_surface {
 	GLint                gl_internal_format;
 	GLenum               gl_type;
 	GLuint               pack_buffer;
+	GLsync               fence;
 };
 
 struct gs_zstencil_buffer {
@@ -476,6 +487,16 @@ static inline void fbo_info_destroy(struct fbo_info *fbo)
 struct gs_device {
 	struct gl_platform   *plat;
 	enum copy_type       copy_type;
+	bool                 fence_sync;
+	bool                 buffer_storage;
+	bool                 program_binary;
+
+	/* linked programs are saved here, keyed by their shaders and the
+	 * driver, and loaded back instead of linking them again */
+	char                 *program_cache_path;
+	uint64_t             driver_hash;
+	uint32_t             programs_loaded;
+	uint32_t             programs_linked;
 
 	gs_texture_t         *cur_render_target;
 	gs_zstencil_t        *cur_zstencil_buffer;
@@ -43,18 +43,10 @@ static bool upload_texture_2d(struct gs_texture_2d *tex, const uint8_t **data)
 	return success;
 }
 
-static bool create_pixel_unpack_buffer(struct gs_texture_2d *tex)
+static GLsizeiptr get_unpack_size(const struct gs_texture_2d *tex)
 {
-	GLsizeiptr size;
-	bool success = true;
+	GLsizeiptr size = tex->width * gs_get_format_bpp(tex->base.format);
 
-	if (!gl_gen_buffers(1, &tex->unpack_buffer))
-		return false;
-
-	if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, tex->unpack_buffer))
-		return false;
-
-	size = tex->width * gs_get_format_bpp(tex->base.format);
 	if (!gs_is_compressed_format(tex->base.format)) {
 		size /= 8;
 		size  = (size+3) & 0xFFFFFFFC;
@@ -64,14 +56,35 @@ static bool create_pixel_unpack_buffer(struct gs_texture_2d *tex)
 		size /= 8;
 	}
 
-	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_DYNAMIC_DRAW);
-	if (!gl_success("glBufferData"))
-		success = false;
+	return size;
+}
 
-	if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0))
-		success = false;
+static bool create_pixel_unpack_buffers(struct gs_texture_2d *tex)
+{
+	bool persistent = tex->base.device->buffer_storage;
+
+	tex->unpack_size = get_unpack_size(tex);
+
+	for (size_t i = 0; i < NUM_UNPACK_BUFFERS; i++) {
+		bool success;
+
+		if (persistent)
+			success = gl_create_persistent_buffer(
+					GL_PIXEL_UNPACK_BUFFER,
+					&tex->unpack_buffers[i],
+					tex->unpack_size, GL_MAP_WRITE_BIT,
+					(void**)&tex->unpack_ptrs[i]);
+		else
+			success = gl_create_buffer(GL_PIXEL_UNPACK_BUFFER,
+					&tex->unpack_buffers[i],
+					tex->unpack_size, NULL,
+					GL_STREAM_DRAW);
+
+		if (!success)
+			return false;
+	}
 
-	return success;
+	return true;
 }
 
 gs_texture_t *device_texture_create(gs_device_t *device, uint32_t width,
@@ -98,7 +111,7 @@ gs_texture_t *device_texture_create(gs_device_t *device, uint32_t width,
 		goto fail;
 
 	if (!tex->base.is_dummy) {
-		if (tex->base.is_dynamic && !create_pixel_unpack_buffer(tex))
+		if (tex->base.is_dynamic && !create_pixel_unpack_buffers(tex))
 			goto fail;
 		if (!upload_texture_2d(tex, data))
 			goto fail;
@@ -132,8 +145,13 @@ void gs_texture_destroy(gs_texture_t *tex)
 	if (tex->cur_sampler)
 		gs_samplerstate_destroy(tex->cur_sampler);
 
-	if (!tex->is_dummy && tex->is_dynamic && tex2d->unpack_buffer)
-		gl_delete_buffers(1, &tex2d->unpack_buffer);
+	if (!tex->is_dummy && tex->is_dynamic) {
+		for (size_t i = 0; i < NUM_UNPACK_BUFFERS; i++) {
+			gl_delete_fence(&tex2d->unpack_fences[i]);
+			if (tex2d->unpack_buffers[i])
+				gl_delete_buffers(1, &tex2d->unpack_buffers[i]);
+		}
+	}
 
 	if (tex->texture)
 		gl_delete_textures(1, &tex->texture);
@@ -167,6 +185,7 @@ enum gs_color_format gs_texture_get_color_format(const gs_texture_t *tex)
 bool gs_texture_map(gs_texture_t *tex, uint8_t **ptr, uint32_t *linesize)
 {
 	struct gs_texture_2d *tex2d = (struct gs_texture_2d*)tex;
+	size_t idx;
 
 	if (!is_texture_2d(tex, "gs_texture_map"))
 		goto fail;
@@ -176,20 +195,38 @@ bool gs_texture_map(gs_texture_t *tex, uint8_t **ptr, uint32_t *linesize)
 		goto fail;
 	}
 
-	if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, tex2d->unpack_buffer))
-		goto fail;
+	/* each map writes to the next buffer of the ring, so the CPU copy
+	 * never waits on the GPU still reading from the previous uploads */
+	idx = (tex2d->cur_unpack + 1) % NUM_UNPACK_BUFFERS;
+	tex2d->cur_unpack = idx;
 
-	*ptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-	if (!gl_success("glMapBuffer"))
-		goto fail;
+	if (tex2d->unpack_ptrs[idx]) {
+		if (!gl_wait_fence(&tex2d->unpack_fences[idx]))
+			goto fail;
 
-	gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		*ptr = tex2d->unpack_ptrs[idx];
+
+	} else {
+		if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+					tex2d->unpack_buffers[idx]))
+			goto fail;
+
+		*ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+				tex2d->unpack_size,
+				GL_MAP_WRITE_BIT |
+				GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (!gl_success("glMapBufferRange") || !*ptr)
+			goto fail;
+
+		gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
 
 	*linesize = tex2d->width * gs_get_format_bpp(tex->format) / 8;
 	*linesize = (*linesize + 3) & 0xFFFFFFFC;
 	return true;
 
 fail:
+	gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	blog(LOG_ERROR, "gs_texture_map (GL) failed");
 	return false;
 }
@@ -197,25 +234,40 @@ fail:
 void gs_texture_unmap(gs_texture_t *tex)
 {
 	struct gs_texture_2d *tex2d = (struct gs_texture_2d*)tex;
+	size_t idx;
+
 	if (!is_texture_2d(tex, "gs_texture_unmap"))
 		goto failed;
 
-	if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, tex2d->unpack_buffer))
-		goto failed;
+	idx = tex2d->cur_unpack;
 
-	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-	if (!gl_success("glUnmapBuffer"))
+	if (!gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+				tex2d->unpack_buffers[idx]))
 		goto failed;
 
+	if (!tex2d->unpack_ptrs[idx]) {
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		if (!gl_success("glUnmapBuffer"))
+			goto failed;
+	}
+
 	if (!gl_bind_texture(GL_TEXTURE_2D, tex2d->base.texture))
 		goto failed;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, tex->gl_internal_format,
-			tex2d->width, tex2d->height, 0,
+	/* storage was allocated on creation, so only the contents change */
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tex2d->width, tex2d->height,
 			tex->gl_format, tex->gl_type, 0);
-	if (!gl_success("glTexImage2D"))
+	if (!gl_success("glTexSubImage2D"))
 		goto failed;
 
+	/* the buffer can be written again once the GPU has copied it */
+	if (tex2d->unpack_ptrs[idx]) {
+		tex2d->unpack_fences[idx] = glFenceSync(
+				GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (!gl_success("glFenceSync"))
+			goto failed;
+	}
+
 	gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	gl_bind_texture(GL_TEXTURE_2D, 0);
 	return;
@@ -33,6 +33,8 @@ EXPORT int device_create(gs_device_t **device, uint32_t adapter);
 EXPORT void device_destroy(gs_device_t *device);
 EXPORT void device_enter_context(gs_device_t *device);
 EXPORT void device_leave_context(gs_device_t *device);
+EXPORT void device_set_shader_cache_path(gs_device_t *device,
+		const char *path);
 EXPORT gs_swapchain_t *device_swapchain_create(gs_device_t *device,
 		const struct gs_init_data *data);
 EXPORT void device_resize(gs_device_t *device, uint32_t x, uint32_t y);
@@ -18,6 +18,7 @@
 #include <assert.h>
 
 #include "../util/base.h"
+#include "../util/profiler.h"
 #include "../util/bmem.h"
 #include "../util/platform.h"
 #include "graphics-internal.h"
@@ -294,6 +295,18 @@ graphics_t *gs_get_context(void)
 	return thread_graphics;
 }
 
+void gs_set_shader_cache_path(const char *path)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid("gs_set_shader_cache_path"))
+		return;
+
+	if (graphics->exports.device_set_shader_cache_path)
+		graphics->exports.device_set_shader_cache_path(
+				graphics->device, path);
+}
+
 const char *gs_get_device_name(void)
 {
 	return gs_valid("gs_get_device_name") ?
@@ -789,6 +802,7 @@ static inline struct gs_effect *find_cached_effect(const char *filename)
 	return effect;
 }
 
+static const char *effect_create_from_file_name = "gs_effect_create_from_file";
 gs_effect_t *gs_effect_create_from_file(const char *file, char **error_string)
 {
 	char *file_string;
@@ -801,15 +815,19 @@ gs_effect_t *gs_effect_create_from_file(const char *file, char **error_string)
 	if (effect)
 		return effect;
 
+	profile_start(effect_create_from_file_name);
+
 	file_string = os_quick_read_utf8_file(file);
 	if (!file_string) {
 		blog(LOG_ERROR, "Could not load effect file '%s'", file);
-		return NULL;
+		goto exit;
 	}
 
 	effect = gs_effect_create(file_string, file, error_string);
 	bfree(file_string);
 
+exit:
+	profile_end(effect_create_from_file_name);
 	return effect;
 }
 
@@ -2323,6 +2341,20 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 	graphics->exports.gs_stagesurface_unmap(stagesurf);
 }
 
+/* returns true if mapping the surface will not wait on the GPU */
+bool gs_stagesurface_ready(gs_stagesurf_t *stagesurf)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid_p("gs_stagesurface_ready", stagesurf))
+		return false;
+
+	if (graphics->exports.gs_stagesurface_ready)
+		return graphics->exports.gs_stagesurface_ready(stagesurf);
+	else
+		return true;
+}
+
 void gs_zstencil_destroy(gs_zstencil_t *zstencil)
 {
 	if (!gs_valid("gs_zstencil_destroy"))
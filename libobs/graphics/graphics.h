@@ -462,6 +462,9 @@ EXPORT void gs_enter_context(graphics_t *graphics);
 EXPORT void gs_leave_context(void);
 EXPORT graphics_t *gs_get_context(void);
 
+/** Sets the directory the backend may store compiled shader programs in */
+EXPORT void gs_set_shader_cache_path(const char *path);
+
 EXPORT void gs_matrix_push(void);
 EXPORT void gs_matrix_pop(void);
 EXPORT void gs_matrix_identity(void);
@@ -702,6 +705,7 @@ EXPORT enum gs_color_format gs_stagesurface_get_color_format(
 EXPORT bool     gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data,
 		uint32_t *linesize);
 EXPORT void     gs_stagesurface_unmap(gs_stagesurf_t *stagesurf);
+EXPORT bool     gs_stagesurface_ready(gs_stagesurf_t *stagesurf);
 
 EXPORT void     gs_zstencil_destroy(gs_zstencil_t *zstencil);
 
@@ -0,0 +1,415 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* compiled with AVX2 enabled, only called when the CPU supports it */
+
+#include "format-conversion-internal.h"
+#include <immintrin.h>
+
+#define Z -1
+
+#define load128(ptr)      _mm_loadu_si128((const __m128i*)(ptr))
+#define load256(ptr)      _mm256_loadu_si256((const __m256i*)(ptr))
+#define store128(ptr, v)  _mm_storeu_si128((__m128i*)(ptr), v)
+#define store256(ptr, v)  _mm256_storeu_si256((__m256i*)(ptr), v)
+#define storel64(ptr, v)  _mm_storel_epi64((__m128i*)(ptr), v)
+
+#define lo128(v)          _mm256_castsi256_si128(v)
+#define hi128(v)          _mm256_extracti128_si256(v, 1)
+
+/* same 16 byte pattern in both lanes */
+#define set_lanes(...) \
+	_mm256_broadcastsi128_si256(_mm_setr_epi8(__VA_ARGS__))
+
+/* pixels 0-3 in the low lane and 8-11 in the high lane (or 4-7 and 12-15
+ * with an offset of 16 bytes), so each lane covers 8 neighbouring pixels and
+ * the compression below never has to cross lanes until the final store */
+static inline __m256i load_split(const uint8_t *ptr)
+{
+	return _mm256_inserti128_si256(
+			_mm256_castsi128_si256(load128(ptr)),
+			load128(ptr + 32), 1);
+}
+
+/* ------------------------------------------------------------------------- */
+/* packed 444 -> planar, 16 pixels per block                                 */
+
+struct uyvx_masks {
+	__m256i lum1_lo, lum1_hi;
+	__m256i lum2_lo, lum2_hi;
+	__m256i uv;
+	__m256i ch_lo, ch_hi;
+};
+
+static inline void init_lum_masks(struct uyvx_masks *m)
+{
+	/* first row luma in bytes 0-7 of each lane, second row in 8-15 */
+	m->lum1_lo = set_lanes(1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z);
+	m->lum1_hi = set_lanes(Z,Z,Z,Z, 1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z);
+	m->lum2_lo = set_lanes(Z,Z,Z,Z, Z,Z,Z,Z, 1,5,9,13, Z,Z,Z,Z);
+	m->lum2_hi = set_lanes(Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z, 1,5,9,13);
+	m->uv      = _mm256_set1_epi16(0x00FF);
+}
+
+static inline void store_lum_pair(const struct uyvx_masks *m,
+		__m256i l1a, __m256i l1b, __m256i l2a, __m256i l2b,
+		uint8_t *lum0, uint8_t *lum1)
+{
+	__m256i lum = _mm256_or_si256(
+		_mm256_or_si256(_mm256_shuffle_epi8(l1a, m->lum1_lo),
+		                _mm256_shuffle_epi8(l1b, m->lum1_hi)),
+		_mm256_or_si256(_mm256_shuffle_epi8(l2a, m->lum2_lo),
+		                _mm256_shuffle_epi8(l2b, m->lum2_hi)));
+
+	/* qwords are [row1 0-7, row2 0-7 | row1 8-15, row2 8-15], reorder to
+	 * [row1 0-15 | row2 0-15] */
+	lum = _mm256_permute4x64_epi64(lum, _MM_SHUFFLE(3, 1, 2, 0));
+
+	store128(lum0, lo128(lum));
+	store128(lum1, hi128(lum));
+}
+
+static inline __m256i average_chroma(const struct uyvx_masks *m,
+		__m256i line1, __m256i line2)
+{
+	__m256i sum = _mm256_add_epi16(_mm256_and_si256(line1, m->uv),
+	                               _mm256_and_si256(line2, m->uv));
+	sum = _mm256_add_epi16(sum, _mm256_srli_epi64(sum, 32));
+	return _mm256_srli_epi16(sum, 2);
+}
+
+static inline __m256i pack_chroma(const struct uyvx_masks *m,
+		__m256i l1a, __m256i l1b, __m256i l2a, __m256i l2b)
+{
+	return _mm256_or_si256(
+		_mm256_shuffle_epi8(average_chroma(m, l1a, l2a), m->ch_lo),
+		_mm256_shuffle_epi8(average_chroma(m, l1b, l2b), m->ch_hi));
+}
+
+static void compress_uyvx_to_i420_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~15U;
+	uint32_t y;
+
+	__m256i ch_order = _mm256_setr_epi32(0, 4, 2, 6, 1, 3, 5, 7);
+
+	struct uyvx_masks m;
+	init_lum_masks(&m);
+	m.ch_lo = set_lanes(0,8,Z,Z, Z,Z,Z,Z, 2,10,Z,Z, Z,Z,Z,Z);
+	m.ch_hi = set_lanes(Z,Z,0,8, Z,Z,Z,Z, Z,Z,2,10, Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u    = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v    = output[2] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width_blocks; x += 16) {
+			const uint8_t *img1 = line1 + x * 4;
+			const uint8_t *img2 = line2 + x * 4;
+			__m256i l1a = load_split(img1);
+			__m256i l1b = load_split(img1 + 16);
+			__m256i l2a = load_split(img2);
+			__m256i l2b = load_split(img2 + 16);
+			__m128i ch;
+
+			store_lum_pair(&m, l1a, l1b, l2a, l2b,
+					lum0 + x, lum1 + x);
+
+			/* U in dwords 0 and 4, V in dwords 2 and 6 */
+			ch = lo128(_mm256_permutevar8x32_epi32(
+				pack_chroma(&m, l1a, l1b, l2a, l2b),
+				ch_order));
+
+			storel64(u + (x>>1), ch);
+			storel64(v + (x>>1), _mm_srli_si128(ch, 8));
+		}
+
+		uyvx_row_pair_to_i420_c(line1, line2, lum0, lum1, u, v,
+				x, width);
+	}
+}
+
+static void compress_uyvx_to_nv12_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~15U;
+	uint32_t y;
+
+	struct uyvx_masks m;
+	init_lum_masks(&m);
+	m.ch_lo = set_lanes(0,2,8,10, Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.ch_hi = set_lanes(Z,Z,Z,Z, 0,2,8,10, Z,Z,Z,Z, Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *uv   = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width_blocks; x += 16) {
+			const uint8_t *img1 = line1 + x * 4;
+			const uint8_t *img2 = line2 + x * 4;
+			__m256i l1a = load_split(img1);
+			__m256i l1b = load_split(img1 + 16);
+			__m256i l2a = load_split(img2);
+			__m256i l2b = load_split(img2 + 16);
+			__m256i ch;
+
+			store_lum_pair(&m, l1a, l1b, l2a, l2b,
+					lum0 + x, lum1 + x);
+
+			ch = _mm256_permute4x64_epi64(
+				pack_chroma(&m, l1a, l1b, l2a, l2b),
+				_MM_SHUFFLE(3, 1, 2, 0));
+
+			store128(uv + x, lo128(ch));
+		}
+
+		uyvx_row_pair_to_nv12_c(line1, line2, lum0, lum1, uv,
+				x, width);
+	}
+}
+
+static void convert_uyvx_to_i444_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~15U;
+	uint32_t y;
+
+	/* Y in dword 0, U in dword 1, V in dword 2 of each lane */
+	__m256i split = set_lanes(1,5,9,13, 0,4,8,12, 2,6,10,14, Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t i;
+
+		for (i = 0; i < 2; i++) {
+			const uint8_t *line = input + (y + i) * in_linesize;
+			uint32_t pos = (y + i) * out_linesize[0];
+			uint8_t *lum = output[0] + pos;
+			uint8_t *u   = output[1] + pos;
+			uint8_t *v   = output[2] + pos;
+			uint32_t x;
+
+			for (x = 0; x < width_blocks; x += 16) {
+				const uint8_t *img = line + x * 4;
+				__m256i a = _mm256_shuffle_epi8(
+						load_split(img), split);
+				__m256i b = _mm256_shuffle_epi8(
+						load_split(img + 16), split);
+				__m256i yu = _mm256_permute4x64_epi64(
+						_mm256_unpacklo_epi32(a, b),
+						_MM_SHUFFLE(3, 1, 2, 0));
+				__m256i vz = _mm256_permute4x64_epi64(
+						_mm256_unpackhi_epi32(a, b),
+						_MM_SHUFFLE(3, 1, 2, 0));
+
+				store128(lum + x, lo128(yu));
+				store128(u + x,   hi128(yu));
+				store128(v + x,   lo128(vz));
+			}
+
+			uyvx_row_to_i444_c(line, lum, u, v, x, width);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* planar -> packed 444, 16 pixels per block                                 */
+
+struct planar_masks {
+	__m256i lum[2];
+	__m256i ch[2];
+};
+
+static inline void init_planar_masks(struct planar_masks *m)
+{
+	for (int i = 0; i < 2; i++) {
+		/* pixels 0-3 of each group of 8 in the low lane, 4-7 in the
+		 * high lane */
+		char l0 = (char)(i * 8), l1 = (char)(i * 8 + 4);
+		char c0 = (char)(i * 8), c1 = (char)(i * 8 + 4);
+
+		m->lum[i] = _mm256_setr_epi8(
+				l0,   Z,Z,Z, l0+1, Z,Z,Z,
+				l0+2, Z,Z,Z, l0+3, Z,Z,Z,
+				l1,   Z,Z,Z, l1+1, Z,Z,Z,
+				l1+2, Z,Z,Z, l1+3, Z,Z,Z);
+
+		/* chroma words are placed at bits 8-23 of each dword */
+		m->ch[i] = _mm256_setr_epi8(
+				Z, c0,   c0+1, Z, Z, c0,   c0+1, Z,
+				Z, c0+2, c0+3, Z, Z, c0+2, c0+3, Z,
+				Z, c1,   c1+1, Z, Z, c1,   c1+1, Z,
+				Z, c1+2, c1+3, Z, Z, c1+2, c1+3, Z);
+	}
+}
+
+/* uv holds 8 interleaved U/V pairs for 16 pixels.  the sources are
+ * broadcast to both lanes so every expansion is a single in-lane shuffle */
+static inline void expand_row_pair(const struct planar_masks *m,
+		__m128i lum0, __m128i lum1, __m128i uv,
+		uint32_t *output0, uint32_t *output1)
+{
+	__m256i uv2   = _mm256_broadcastsi128_si256(uv);
+	__m256i lum02 = _mm256_broadcastsi128_si256(lum0);
+	__m256i lum12 = _mm256_broadcastsi128_si256(lum1);
+
+	for (int i = 0; i < 2; i++) {
+		__m256i ch = _mm256_shuffle_epi8(uv2, m->ch[i]);
+
+		store256(output0 + i * 8, _mm256_or_si256(ch,
+				_mm256_shuffle_epi8(lum02, m->lum[i])));
+		store256(output1 + i * 8, _mm256_or_si256(ch,
+				_mm256_shuffle_epi8(lum12, m->lum[i])));
+	}
+}
+
+static void decompress_420_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t blocks_d2  = width_d2 & ~7U;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	struct planar_masks m;
+	init_planar_masks(&m);
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *lum0    = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1    = lum0 + in_linesize[0];
+		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
+		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
+		uint32_t *output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		uint32_t *output1 = (uint32_t*)((uint8_t*)output0 +
+				out_linesize);
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 8) {
+			__m128i uv = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i*)(chroma0 + x)),
+				_mm_loadl_epi64((const __m128i*)(chroma1 + x)));
+
+			expand_row_pair(&m, load128(lum0 + x * 2),
+					load128(lum1 + x * 2), uv,
+					output0 + x * 2, output1 + x * 2);
+		}
+
+		row_pair_from_420_c(lum0, lum1, chroma0, chroma1,
+				output0, output1, x, width_d2);
+	}
+}
+
+static void decompress_nv12_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t blocks_d2  = width_d2 & ~7U;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	struct planar_masks m;
+	init_planar_masks(&m);
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *lum0   = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1   = lum0 + in_linesize[0];
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		uint32_t *output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		uint32_t *output1 = (uint32_t*)((uint8_t*)output0 +
+				out_linesize);
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 8)
+			expand_row_pair(&m, load128(lum0 + x * 2),
+					load128(lum1 + x * 2),
+					load128(chroma + x * 2),
+					output0 + x * 2, output1 + x * 2);
+
+		row_pair_from_nv12_c(lum0, lum1, chroma, output0, output1,
+				x, width_d2);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* packed 422 -> packed 444, 16 pixels per block                             */
+
+static void decompress_422_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2  = fc_min_uint32(in_linesize, out_linesize/2)/4;
+	uint32_t blocks_d2 = width_d2 & ~7U;
+	uint32_t y;
+
+	/* each input dword is copied, then followed by its second pixel */
+	__m256i expand = leading_lum ?
+		set_lanes(0,1,2,3, 2,1,2,3, 4,5,6,7, 6,5,6,7) :
+		set_lanes(0,1,2,3, 0,3,2,3, 4,5,6,7, 4,7,6,7);
+
+	for (y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *out = output + y * out_linesize;
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 8) {
+			__m256i in = load256(line + x * 4);
+			__m256i a  = _mm256_permute4x64_epi64(in,
+					_MM_SHUFFLE(1, 1, 0, 0));
+			__m256i b  = _mm256_permute4x64_epi64(in,
+					_MM_SHUFFLE(3, 3, 2, 2));
+
+			store256(out + x * 8,      _mm256_shuffle_epi8(a, expand));
+			store256(out + x * 8 + 32, _mm256_shuffle_epi8(b, expand));
+		}
+
+		row_from_422_c(line, out, x, width_d2, leading_lum);
+	}
+}
+
+const struct format_conversion_kernels format_conversion_kernels_avx2 = {
+	compress_uyvx_to_i420_avx2,
+	compress_uyvx_to_nv12_avx2,
+	convert_uyvx_to_i444_avx2,
+	decompress_420_avx2,
+	decompress_nv12_avx2,
+	decompress_422_avx2
+};
@@ -0,0 +1,171 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "format-conversion.h"
+
+/*
+ * Per-instruction-set conversion kernels.  Each table implements exactly the
+ * same output as the scalar reference; the vector versions process as many
+ * whole blocks as fit in a row and finish the remainder with the scalar row
+ * helpers below, so they are safe for any width.
+ */
+
+typedef void (*compress_func_t)(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+
+typedef void (*decompress_planar_func_t)(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize);
+
+typedef void (*decompress_packed_func_t)(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum);
+
+struct format_conversion_kernels {
+	compress_func_t          uyvx_to_i420;
+	compress_func_t          uyvx_to_nv12;
+	compress_func_t          uyvx_to_i444;
+	decompress_planar_func_t decompress_420;
+	decompress_planar_func_t decompress_nv12;
+	decompress_packed_func_t decompress_422;
+};
+
+extern const struct format_conversion_kernels format_conversion_kernels_c;
+extern const struct format_conversion_kernels format_conversion_kernels_sse2;
+extern const struct format_conversion_kernels format_conversion_kernels_ssse3;
+extern const struct format_conversion_kernels format_conversion_kernels_avx2;
+
+static inline uint32_t fc_min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar row helpers, shared by the reference and the vector tails          */
+
+/* input pixels are packed as U, Y, V, X */
+
+static inline void uyvx_row_pair_to_i420_c(
+		const uint8_t *line1, const uint8_t *line2,
+		uint8_t *lum0, uint8_t *lum1, uint8_t *u, uint8_t *v,
+		uint32_t x, uint32_t width)
+{
+	for (; x < width; x += 2) {
+		const uint8_t *p1 = line1 + x * 4;
+		const uint8_t *p2 = line2 + x * 4;
+
+		lum0[x]     = p1[1];
+		lum0[x + 1] = p1[5];
+		lum1[x]     = p2[1];
+		lum1[x + 1] = p2[5];
+
+		u[x >> 1] = (uint8_t)((p1[0] + p1[4] + p2[0] + p2[4]) >> 2);
+		v[x >> 1] = (uint8_t)((p1[2] + p1[6] + p2[2] + p2[6]) >> 2);
+	}
+}
+
+static inline void uyvx_row_pair_to_nv12_c(
+		const uint8_t *line1, const uint8_t *line2,
+		uint8_t *lum0, uint8_t *lum1, uint8_t *uv,
+		uint32_t x, uint32_t width)
+{
+	for (; x < width; x += 2) {
+		const uint8_t *p1 = line1 + x * 4;
+		const uint8_t *p2 = line2 + x * 4;
+
+		lum0[x]     = p1[1];
+		lum0[x + 1] = p1[5];
+		lum1[x]     = p2[1];
+		lum1[x + 1] = p2[5];
+
+		uv[x]     = (uint8_t)((p1[0] + p1[4] + p2[0] + p2[4]) >> 2);
+		uv[x + 1] = (uint8_t)((p1[2] + p1[6] + p2[2] + p2[6]) >> 2);
+	}
+}
+
+static inline void uyvx_row_to_i444_c(const uint8_t *line,
+		uint8_t *lum, uint8_t *u, uint8_t *v,
+		uint32_t x, uint32_t width)
+{
+	for (; x < width; x++) {
+		const uint8_t *p = line + x * 4;
+
+		lum[x] = p[1];
+		u[x]   = p[0];
+		v[x]   = p[2];
+	}
+}
+
+static inline void row_pair_from_420_c(
+		const uint8_t *lum0, const uint8_t *lum1,
+		const uint8_t *chroma0, const uint8_t *chroma1,
+		uint32_t *output0, uint32_t *output1,
+		uint32_t x, uint32_t width_d2)
+{
+	for (; x < width_d2; x++) {
+		uint32_t out = ((uint32_t)chroma0[x] << 8) |
+		               ((uint32_t)chroma1[x] << 16);
+
+		output0[x * 2]     = lum0[x * 2]     | out;
+		output0[x * 2 + 1] = lum0[x * 2 + 1] | out;
+		output1[x * 2]     = lum1[x * 2]     | out;
+		output1[x * 2 + 1] = lum1[x * 2 + 1] | out;
+	}
+}
+
+static inline void row_pair_from_nv12_c(
+		const uint8_t *lum0, const uint8_t *lum1,
+		const uint8_t *chroma,
+		uint32_t *output0, uint32_t *output1,
+		uint32_t x, uint32_t width_d2)
+{
+	for (; x < width_d2; x++) {
+		uint32_t out = ((uint32_t)chroma[x * 2]     << 8) |
+		               ((uint32_t)chroma[x * 2 + 1] << 16);
+
+		output0[x * 2]     = lum0[x * 2]     | out;
+		output0[x * 2 + 1] = lum0[x * 2 + 1] | out;
+		output1[x * 2]     = lum1[x * 2]     | out;
+		output1[x * 2 + 1] = lum1[x * 2 + 1] | out;
+	}
+}
+
+static inline void row_from_422_c(const uint8_t *input, uint8_t *output,
+		uint32_t x, uint32_t width_d2, bool leading_lum)
+{
+	for (; x < width_d2; x++) {
+		const uint8_t *in  = input  + x * 4;
+		uint8_t       *out = output + x * 8;
+
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = in[3];
+
+		out[4] = leading_lum ? in[2] : in[0];
+		out[5] = leading_lum ? in[1] : in[3];
+		out[6] = in[2];
+		out[7] = in[3];
+	}
+}
@@ -0,0 +1,363 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* compiled with SSSE3 enabled, only called when the CPU supports it */
+
+#include "format-conversion-internal.h"
+#include <tmmintrin.h>
+
+#define Z -1
+
+#define load128(ptr)      _mm_loadu_si128((const __m128i*)(ptr))
+#define store128(ptr, v)  _mm_storeu_si128((__m128i*)(ptr), v)
+#define storel64(ptr, v)  _mm_storel_epi64((__m128i*)(ptr), v)
+#define storeh64(ptr, v)  _mm_storel_epi64((__m128i*)(ptr), \
+		_mm_unpackhi_epi64(v, v))
+
+static inline void store32(uint8_t *ptr, __m128i v)
+{
+	*(uint32_t*)ptr = (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+/* ------------------------------------------------------------------------- */
+/* packed 444 -> planar, 8 pixels per block                                  */
+
+struct uyvx_masks {
+	__m128i lum_lo, lum_hi;
+	__m128i uv;
+	__m128i ch_lo, ch_hi;
+};
+
+/* luma of pixels 0-3 and 4-7 of one row, packed in to the low 8 bytes */
+static inline __m128i extract_lum(const struct uyvx_masks *m,
+		__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_shuffle_epi8(a, m->lum_lo),
+	                    _mm_shuffle_epi8(b, m->lum_hi));
+}
+
+/* averaged chroma of 4 pixels (two rows) as 16 bit values, U/V pairs for
+ * pixels 0+1 in words 0-1 and pixels 2+3 in words 4-5 */
+static inline __m128i average_chroma(const struct uyvx_masks *m,
+		__m128i line1, __m128i line2)
+{
+	__m128i sum = _mm_add_epi16(_mm_and_si128(line1, m->uv),
+	                            _mm_and_si128(line2, m->uv));
+	sum = _mm_add_epi16(sum, _mm_srli_epi64(sum, 32));
+	return _mm_srli_epi16(sum, 2);
+}
+
+static void compress_uyvx_to_i420_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~7U;
+	uint32_t y;
+
+	struct uyvx_masks m;
+	m.lum_lo = _mm_setr_epi8(1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.lum_hi = _mm_setr_epi8(Z,Z,Z,Z, 1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.uv     = _mm_set1_epi16(0x00FF);
+	m.ch_lo  = _mm_setr_epi8(0,8,Z,Z, Z,Z,Z,Z, 2,10,Z,Z, Z,Z,Z,Z);
+	m.ch_hi  = _mm_setr_epi8(Z,Z,0,8, Z,Z,Z,Z, Z,Z,2,10, Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u    = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v    = output[2] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width_blocks; x += 8) {
+			__m128i l1a = load128(line1 + x * 4);
+			__m128i l1b = load128(line1 + x * 4 + 16);
+			__m128i l2a = load128(line2 + x * 4);
+			__m128i l2b = load128(line2 + x * 4 + 16);
+			__m128i ch;
+
+			storel64(lum0 + x, extract_lum(&m, l1a, l1b));
+			storel64(lum1 + x, extract_lum(&m, l2a, l2b));
+
+			ch = _mm_or_si128(
+				_mm_shuffle_epi8(average_chroma(&m, l1a, l2a),
+					m.ch_lo),
+				_mm_shuffle_epi8(average_chroma(&m, l1b, l2b),
+					m.ch_hi));
+
+			store32(u + (x>>1), ch);
+			store32(v + (x>>1), _mm_srli_si128(ch, 8));
+		}
+
+		uyvx_row_pair_to_i420_c(line1, line2, lum0, lum1, u, v,
+				x, width);
+	}
+}
+
+static void compress_uyvx_to_nv12_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~7U;
+	uint32_t y;
+
+	struct uyvx_masks m;
+	m.lum_lo = _mm_setr_epi8(1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.lum_hi = _mm_setr_epi8(Z,Z,Z,Z, 1,5,9,13, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.uv     = _mm_set1_epi16(0x00FF);
+	m.ch_lo  = _mm_setr_epi8(0,2,8,10, Z,Z,Z,Z, Z,Z,Z,Z, Z,Z,Z,Z);
+	m.ch_hi  = _mm_setr_epi8(Z,Z,Z,Z, 0,2,8,10, Z,Z,Z,Z, Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *uv   = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width_blocks; x += 8) {
+			__m128i l1a = load128(line1 + x * 4);
+			__m128i l1b = load128(line1 + x * 4 + 16);
+			__m128i l2a = load128(line2 + x * 4);
+			__m128i l2b = load128(line2 + x * 4 + 16);
+			__m128i ch;
+
+			storel64(lum0 + x, extract_lum(&m, l1a, l1b));
+			storel64(lum1 + x, extract_lum(&m, l2a, l2b));
+
+			ch = _mm_or_si128(
+				_mm_shuffle_epi8(average_chroma(&m, l1a, l2a),
+					m.ch_lo),
+				_mm_shuffle_epi8(average_chroma(&m, l1b, l2b),
+					m.ch_hi));
+
+			storel64(uv + x, ch);
+		}
+
+		uyvx_row_pair_to_nv12_c(line1, line2, lum0, lum1, uv,
+				x, width);
+	}
+}
+
+static void convert_uyvx_to_i444_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width_blocks = width & ~7U;
+	uint32_t y;
+
+	/* Y in dword 0, U in dword 1, V in dword 2 */
+	__m128i split = _mm_setr_epi8(1,5,9,13, 0,4,8,12, 2,6,10,14,
+			Z,Z,Z,Z);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t i;
+
+		for (i = 0; i < 2; i++) {
+			const uint8_t *line = input + (y + i) * in_linesize;
+			uint32_t pos = (y + i) * out_linesize[0];
+			uint8_t *lum = output[0] + pos;
+			uint8_t *u   = output[1] + pos;
+			uint8_t *v   = output[2] + pos;
+			uint32_t x;
+
+			for (x = 0; x < width_blocks; x += 8) {
+				__m128i a = _mm_shuffle_epi8(
+						load128(line + x * 4), split);
+				__m128i b = _mm_shuffle_epi8(
+						load128(line + x * 4 + 16),
+						split);
+				__m128i yu = _mm_unpacklo_epi32(a, b);
+				__m128i vz = _mm_unpackhi_epi32(a, b);
+
+				storel64(lum + x, yu);
+				storeh64(u + x, yu);
+				storel64(v + x, vz);
+			}
+
+			uyvx_row_to_i444_c(line, lum, u, v, x, width);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* planar -> packed 444, 16 pixels per block                                 */
+
+struct planar_masks {
+	__m128i lum[4];
+	__m128i ch[4];
+};
+
+static inline void init_planar_masks(struct planar_masks *m)
+{
+	for (int i = 0; i < 4; i++) {
+		char l = (char)(i * 4);
+		char c = (char)(i * 4);
+
+		m->lum[i] = _mm_setr_epi8(
+				l,   Z,Z,Z, l+1, Z,Z,Z,
+				l+2, Z,Z,Z, l+3, Z,Z,Z);
+
+		/* chroma words are placed at bits 8-23 of each dword */
+		m->ch[i] = _mm_setr_epi8(
+				Z, c,   c+1, Z, Z, c,   c+1, Z,
+				Z, c+2, c+3, Z, Z, c+2, c+3, Z);
+	}
+}
+
+/* uv holds 8 interleaved U/V pairs for 16 pixels */
+static inline void expand_row_pair(const struct planar_masks *m,
+		__m128i lum0, __m128i lum1, __m128i uv,
+		uint32_t *output0, uint32_t *output1)
+{
+	for (int i = 0; i < 4; i++) {
+		__m128i ch = _mm_shuffle_epi8(uv, m->ch[i]);
+
+		store128(output0 + i * 4, _mm_or_si128(ch,
+				_mm_shuffle_epi8(lum0, m->lum[i])));
+		store128(output1 + i * 4, _mm_or_si128(ch,
+				_mm_shuffle_epi8(lum1, m->lum[i])));
+	}
+}
+
+static void decompress_420_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t blocks_d2  = width_d2 & ~7U;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	struct planar_masks m;
+	init_planar_masks(&m);
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *lum0    = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1    = lum0 + in_linesize[0];
+		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
+		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
+		uint32_t *output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		uint32_t *output1 = (uint32_t*)((uint8_t*)output0 +
+				out_linesize);
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 8) {
+			__m128i uv = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i*)(chroma0 + x)),
+				_mm_loadl_epi64((const __m128i*)(chroma1 + x)));
+
+			expand_row_pair(&m,
+					load128(lum0 + x * 2),
+					load128(lum1 + x * 2),
+					uv,
+					output0 + x * 2, output1 + x * 2);
+		}
+
+		row_pair_from_420_c(lum0, lum1, chroma0, chroma1,
+				output0, output1, x, width_d2);
+	}
+}
+
+static void decompress_nv12_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t blocks_d2  = width_d2 & ~7U;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	struct planar_masks m;
+	init_planar_masks(&m);
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *lum0   = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1   = lum0 + in_linesize[0];
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		uint32_t *output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		uint32_t *output1 = (uint32_t*)((uint8_t*)output0 +
+				out_linesize);
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 8)
+			expand_row_pair(&m,
+					load128(lum0 + x * 2),
+					load128(lum1 + x * 2),
+					load128(chroma + x * 2),
+					output0 + x * 2, output1 + x * 2);
+
+		row_pair_from_nv12_c(lum0, lum1, chroma, output0, output1,
+				x, width_d2);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* packed 422 -> packed 444, 8 pixels per block                              */
+
+static void decompress_422_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2  = fc_min_uint32(in_linesize, out_linesize/2)/4;
+	uint32_t blocks_d2 = width_d2 & ~3U;
+	uint32_t y;
+
+	/* each input dword is copied, then followed by its second pixel */
+	__m128i lo = leading_lum ?
+		_mm_setr_epi8(0,1,2,3, 2,1,2,3, 4,5,6,7, 6,5,6,7) :
+		_mm_setr_epi8(0,1,2,3, 0,3,2,3, 4,5,6,7, 4,7,6,7);
+	__m128i hi = _mm_add_epi8(lo, _mm_set1_epi8(8));
+
+	for (y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *out = output + y * out_linesize;
+		uint32_t x;
+
+		for (x = 0; x < blocks_d2; x += 4) {
+			__m128i in = load128(line + x * 4);
+
+			store128(out + x * 8,      _mm_shuffle_epi8(in, lo));
+			store128(out + x * 8 + 16, _mm_shuffle_epi8(in, hi));
+		}
+
+		row_from_422_c(line, out, x, width_d2, leading_lum);
+	}
+}
+
+const struct format_conversion_kernels format_conversion_kernels_ssse3 = {
+	compress_uyvx_to_i420_ssse3,
+	compress_uyvx_to_nv12_ssse3,
+	convert_uyvx_to_i444_ssse3,
+	decompress_420_ssse3,
+	decompress_nv12_ssse3,
+	decompress_422_ssse3
+};
@@ -15,10 +15,19 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
-#include "format-conversion.h"
+#include "format-conversion-internal.h"
+#include "../util/threading.h"
+#include "../util/platform.h"
+#include "../util/base.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
 
@@ -84,12 +93,7 @@ do {                                                                          \
 } while (false)
 
 
-static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
-{
-	return a < b ? a : b;
-}
-
-void compress_uyvx_to_i420(
+static void compress_uyvx_to_i420_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -97,7 +101,7 @@ void compress_uyvx_to_i420(
 	uint8_t  *lum_plane   = output[0];
 	uint8_t  *u_plane     = output[1];
 	uint8_t  *v_plane     = output[2];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = fc_min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
@@ -127,14 +131,14 @@ void compress_uyvx_to_i420(
 	}
 }
 
-void compress_uyvx_to_nv12(
+static void compress_uyvx_to_nv12_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane    = output[0];
 	uint8_t *chroma_plane = output[1];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = fc_min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
@@ -163,7 +167,7 @@ void compress_uyvx_to_nv12(
 	}
 }
 
-void convert_uyvx_to_i444(
+static void convert_uyvx_to_i444_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -171,7 +175,7 @@ void convert_uyvx_to_i444(
 	uint8_t  *lum_plane   = output[0];
 	uint8_t  *u_plane     = output[1];
 	uint8_t  *v_plane     = output[2];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = fc_min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
@@ -202,123 +206,635 @@ void convert_uyvx_to_i444(
 	}
 }
 
-void decompress_420(
-		const uint8_t *const input[], const uint32_t in_linesize[],
+/* ------------------------------------------------------------------------- */
+/* scalar reference                                                          */
+
+static void compress_uyvx_to_i420_c(
+		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
-		uint8_t *output, uint32_t out_linesize)
+		uint8_t *output[], const uint32_t out_linesize[])
 {
-	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
-	uint32_t height_d2  = end_y/2;
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
-	for (y = start_y_d2; y < height_d2; y++) {
-		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
-		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+
+		uyvx_row_pair_to_i420_c(line1, line1 + in_linesize,
+				lum0, lum0 + out_linesize[0],
+				output[1] + chroma_y_pos,
+				output[2] + chroma_y_pos,
+				0, width);
+	}
+}
+
+static void compress_uyvx_to_nv12_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t y;
 
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t*)(output + y * 2 * in_linesize[0]);
-		output1 = (uint32_t*)((uint8_t*)output0 + in_linesize[0]);
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out;
-			out = (*(chroma0++) << 8) | (*(chroma1++) << 16);
+		uyvx_row_pair_to_nv12_c(line1, line1 + in_linesize,
+				lum0, lum0 + out_linesize[0],
+				output[1] + (y>>1) * out_linesize[1],
+				0, width);
+	}
+}
+
+static void convert_uyvx_to_i444_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = fc_min_uint32(in_linesize, out_linesize[0]);
+	uint32_t y;
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t i;
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+		for (i = 0; i < 2; i++) {
+			uint32_t pos = lum_y_pos + i * out_linesize[0];
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
+			uyvx_row_to_i444_c(input + (y + i) * in_linesize,
+					output[0] + pos,
+					output[1] + pos,
+					output[2] + pos,
+					0, width);
 		}
 	}
 }
 
-void decompress_nv12(
+static void decompress_420_c(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize)
 {
 	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
 	uint32_t height_d2  = end_y/2;
 	uint32_t y;
 
 	for (y = start_y_d2; y < height_d2; y++) {
-		const uint16_t *chroma;
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
-
-		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t*)(output + y * 2 * out_linesize);
-		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
-
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out = *(chroma++) << 8;
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		uint8_t *output0 = output + y * 2 * out_linesize;
+
+		row_pair_from_420_c(lum0, lum0 + in_linesize[0],
+				input[1] + y * in_linesize[1],
+				input[2] + y * in_linesize[2],
+				(uint32_t*)output0,
+				(uint32_t*)(output0 + out_linesize),
+				0, width_d2);
+	}
+}
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+static void decompress_nv12_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = fc_min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
-		}
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		uint8_t *output0 = output + y * 2 * out_linesize;
+
+		row_pair_from_nv12_c(lum0, lum0 + in_linesize[0],
+				input[1] + y * in_linesize[1],
+				(uint32_t*)output0,
+				(uint32_t*)(output0 + out_linesize),
+				0, width_d2);
 	}
 }
 
-void decompress_422(
+static void decompress_422_c(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize,
 		bool leading_lum)
 {
-	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
+	/* each input dword holds two pixels */
+	uint32_t width_d2 = fc_min_uint32(in_linesize, out_linesize/2)/4;
 	uint32_t y;
 
-	register const uint32_t *input32;
-	register const uint32_t *input32_end;
-	register uint32_t       *output32;
+	for (y = start_y; y < end_y; y++)
+		row_from_422_c(input + y * in_linesize,
+				output + y * out_linesize,
+				0, width_d2, leading_lum);
+}
 
-	if (leading_lum) {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
+const struct format_conversion_kernels format_conversion_kernels_c = {
+	compress_uyvx_to_i420_c,
+	compress_uyvx_to_nv12_c,
+	convert_uyvx_to_i444_c,
+	decompress_420_c,
+	decompress_nv12_c,
+	decompress_422_c
+};
+
+/* the original SSE2 kernels only cover compression */
+const struct format_conversion_kernels format_conversion_kernels_sse2 = {
+	compress_uyvx_to_i420_sse2,
+	compress_uyvx_to_nv12_sse2,
+	convert_uyvx_to_i444_sse2,
+	decompress_420_c,
+	decompress_nv12_c,
+	decompress_422_c
+};
+
+/* ------------------------------------------------------------------------- */
+/* runtime CPU feature detection                                             */
+
+#ifdef _MSC_VER
+static inline void get_cpuid(int leaf, int regs[4])
+{
+	__cpuidex(regs, leaf, 0);
+}
 
-			while(input32 < input32_end) {
-				register uint32_t dw = *input32;
+static inline uint64_t get_xcr0(void)
+{
+	return _xgetbv(0);
+}
+#else
+static inline void get_cpuid(int leaf, int regs[4])
+{
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	regs[0] = (int)a;
+	regs[1] = (int)b;
+	regs[2] = (int)c;
+	regs[3] = (int)d;
+}
 
-				output32[0] = dw;
-				dw &= 0xFFFFFF00;
-				dw |= (uint8_t)(dw>>16);
-				output32[1] = dw;
+static inline uint64_t get_xcr0(void)
+{
+	uint32_t eax, edx;
+	/* xgetbv, spelled out for older assemblers */
+	__asm__ volatile (".byte 0x0f, 0x01, 0xd0"
+			: "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+}
+#endif
 
-				output32 += 2;
-				input32++;
-			}
-		}
-	} else {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
-
-			while (input32 < input32_end) {
-				register uint32_t dw = *input32;
-
-				output32[0] = dw;
-				dw &= 0xFFFF00FF;
-				dw |= (dw>>16) & 0xFF00;
-				output32[1] = dw;
-
-				output32 += 2;
-				input32++;
-			}
+#define CPUID1_ECX_SSSE3   (1 << 9)
+#define CPUID1_ECX_OSXSAVE (1 << 27)
+#define CPUID1_ECX_AVX     (1 << 28)
+#define CPUID7_EBX_AVX2    (1 << 5)
+#define XCR0_SSE_AVX_STATE 0x6
+
+static enum format_conversion_isa detect_isa(void)
+{
+	int regs[4];
+	int max_leaf;
+
+	get_cpuid(0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 1)
+		return FORMAT_CONVERSION_ISA_SSE2;
+
+	get_cpuid(1, regs);
+	if ((regs[2] & CPUID1_ECX_SSSE3) == 0)
+		return FORMAT_CONVERSION_ISA_SSE2;
+
+	if (max_leaf >= 7 &&
+	    (regs[2] & CPUID1_ECX_OSXSAVE) != 0 &&
+	    (regs[2] & CPUID1_ECX_AVX) != 0 &&
+	    (get_xcr0() & XCR0_SSE_AVX_STATE) == XCR0_SSE_AVX_STATE) {
+		get_cpuid(7, regs);
+		if ((regs[1] & CPUID7_EBX_AVX2) != 0)
+			return FORMAT_CONVERSION_ISA_AVX2;
+	}
+
+	return FORMAT_CONVERSION_ISA_SSSE3;
+}
+
+static pthread_once_t isa_init_token = PTHREAD_ONCE_INIT;
+static enum format_conversion_isa best_isa;
+static enum format_conversion_isa cur_isa;
+static const struct format_conversion_kernels *volatile kernels;
+
+static const struct format_conversion_kernels *kernels_for_isa(
+		enum format_conversion_isa isa)
+{
+	switch (isa) {
+	case FORMAT_CONVERSION_ISA_C:     return &format_conversion_kernels_c;
+	case FORMAT_CONVERSION_ISA_SSE2:  return &format_conversion_kernels_sse2;
+	case FORMAT_CONVERSION_ISA_SSSE3: return &format_conversion_kernels_ssse3;
+	case FORMAT_CONVERSION_ISA_AVX2:  return &format_conversion_kernels_avx2;
+	case FORMAT_CONVERSION_ISA_AUTO:  break;
+	}
+
+	return &format_conversion_kernels_c;
+}
+
+static void init_isa(void)
+{
+	best_isa = detect_isa();
+	cur_isa  = best_isa;
+	kernels  = kernels_for_isa(best_isa);
+
+	blog(LOG_INFO, "format conversion: using %s kernels",
+			format_conversion_isa_name(best_isa));
+}
+
+static inline const struct format_conversion_kernels *get_kernels(void)
+{
+	pthread_once(&isa_init_token, init_isa);
+	return kernels;
+}
+
+const char *format_conversion_isa_name(enum format_conversion_isa isa)
+{
+	switch (isa) {
+	case FORMAT_CONVERSION_ISA_AUTO:  return "auto";
+	case FORMAT_CONVERSION_ISA_C:     return "C";
+	case FORMAT_CONVERSION_ISA_SSE2:  return "SSE2";
+	case FORMAT_CONVERSION_ISA_SSSE3: return "SSSE3";
+	case FORMAT_CONVERSION_ISA_AVX2:  return "AVX2";
+	}
+
+	return "unknown";
+}
+
+enum format_conversion_isa format_conversion_set_isa(
+		enum format_conversion_isa isa)
+{
+	pthread_once(&isa_init_token, init_isa);
+
+	if (isa == FORMAT_CONVERSION_ISA_AUTO || isa > best_isa)
+		isa = best_isa;
+
+	cur_isa = isa;
+	kernels = kernels_for_isa(isa);
+	return isa;
+}
+
+enum format_conversion_isa format_conversion_get_isa(void)
+{
+	pthread_once(&isa_init_token, init_isa);
+	return cur_isa;
+}
+
+/* ------------------------------------------------------------------------- */
+/* row-sliced conversion                                                     */
+
+/* only bother splitting frames of roughly 4K and above; below that the wake
+ * up latency eats most of what the extra threads would save */
+#define MT_MIN_PIXELS           (1920 * 1080 * 2)
+#define MAX_CONVERSION_THREADS  16
+#define AUTO_CONVERSION_THREADS 4
+
+enum conversion_type {
+	CONVERSION_UYVX_TO_I420,
+	CONVERSION_UYVX_TO_NV12,
+	CONVERSION_UYVX_TO_I444,
+	CONVERSION_DECOMPRESS_420,
+	CONVERSION_DECOMPRESS_NV12,
+	CONVERSION_DECOMPRESS_422
+};
+
+struct conversion_job {
+	enum conversion_type                   type;
+	const struct format_conversion_kernels *kernels;
+
+	const uint8_t                          *input;
+	const uint8_t *const                   *inputs;
+	uint32_t                               in_linesize;
+	const uint32_t                         *in_linesizes;
+
+	uint8_t                                *output;
+	uint8_t                                **outputs;
+	uint32_t                               out_linesize;
+	const uint32_t                         *out_linesizes;
+
+	bool                                   leading_lum;
+};
+
+static void run_job(const struct conversion_job *job,
+		uint32_t start_y, uint32_t end_y)
+{
+	const struct format_conversion_kernels *k = job->kernels;
+
+	switch (job->type) {
+	case CONVERSION_UYVX_TO_I420:
+		k->uyvx_to_i420(job->input, job->in_linesize, start_y, end_y,
+				job->outputs, job->out_linesizes);
+		break;
+	case CONVERSION_UYVX_TO_NV12:
+		k->uyvx_to_nv12(job->input, job->in_linesize, start_y, end_y,
+				job->outputs, job->out_linesizes);
+		break;
+	case CONVERSION_UYVX_TO_I444:
+		k->uyvx_to_i444(job->input, job->in_linesize, start_y, end_y,
+				job->outputs, job->out_linesizes);
+		break;
+	case CONVERSION_DECOMPRESS_420:
+		k->decompress_420(job->inputs, job->in_linesizes,
+				start_y, end_y,
+				job->output, job->out_linesize);
+		break;
+	case CONVERSION_DECOMPRESS_NV12:
+		k->decompress_nv12(job->inputs, job->in_linesizes,
+				start_y, end_y,
+				job->output, job->out_linesize);
+		break;
+	case CONVERSION_DECOMPRESS_422:
+		k->decompress_422(job->input, job->in_linesize,
+				start_y, end_y,
+				job->output, job->out_linesize,
+				job->leading_lum);
+		break;
+	}
+}
+
+struct conversion_pool {
+	uint32_t                    threads;
+	size_t                      num_workers;
+	pthread_t                   workers[MAX_CONVERSION_THREADS];
+	os_sem_t                    *start[MAX_CONVERSION_THREADS];
+	os_sem_t                    *done;
+	bool                        stop;
+
+	const struct conversion_job *job;
+	uint32_t                    start_y;
+	uint32_t                    end_y;
+	uint32_t                    slice_rows;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct conversion_pool pool;
+
+static void run_slice(size_t idx)
+{
+	uint32_t start_y = pool.start_y + (uint32_t)idx * pool.slice_rows;
+	uint32_t end_y   = start_y + pool.slice_rows;
+
+	if (end_y > pool.end_y)
+		end_y = pool.end_y;
+	if (start_y < end_y)
+		run_job(pool.job, start_y, end_y);
+}
+
+static void *conversion_worker(void *data)
+{
+	size_t idx = (size_t)(uintptr_t)data;
+
+	os_set_thread_name("format-conversion: worker");
+
+	for (;;) {
+		os_sem_wait(pool.start[idx]);
+		if (pool.stop)
+			break;
+
+		run_slice(idx + 1);
+		os_sem_post(pool.done);
+	}
+
+	return NULL;
+}
+
+/* pool_mutex must be held */
+static void free_workers(void)
+{
+	pool.stop = true;
+
+	for (size_t i = 0; i < pool.num_workers; i++)
+		os_sem_post(pool.start[i]);
+
+	for (size_t i = 0; i < pool.num_workers; i++) {
+		pthread_join(pool.workers[i], NULL);
+		os_sem_destroy(pool.start[i]);
+		pool.start[i] = NULL;
+	}
+
+	os_sem_destroy(pool.done);
+	pool.done        = NULL;
+	pool.num_workers = 0;
+	pool.stop        = false;
+}
+
+static uint32_t resolve_threads(void)
+{
+	uint32_t threads = pool.threads;
+
+	if (!threads) {
+		threads = (uint32_t)os_get_logical_cores() / 2;
+		if (threads > AUTO_CONVERSION_THREADS)
+			threads = AUTO_CONVERSION_THREADS;
+	}
+
+	if (threads < 1)
+		threads = 1;
+	else if (threads > MAX_CONVERSION_THREADS)
+		threads = MAX_CONVERSION_THREADS;
+
+	return threads;
+}
+
+/* pool_mutex must be held */
+static bool ensure_workers(uint32_t threads)
+{
+	size_t count = threads - 1;
+
+	if (pool.num_workers == count)
+		return count > 0;
+
+	free_workers();
+
+	if (os_sem_init(&pool.done, 0) != 0)
+		return false;
+
+	for (size_t i = 0; i < count; i++) {
+		if (os_sem_init(&pool.start[i], 0) != 0)
+			break;
+
+		if (pthread_create(&pool.workers[i], NULL, conversion_worker,
+					(void*)(uintptr_t)i) != 0) {
+			os_sem_destroy(pool.start[i]);
+			pool.start[i] = NULL;
+			break;
 		}
+
+		pool.num_workers++;
+	}
+
+	if (pool.num_workers < count)
+		blog(LOG_WARNING, "format conversion: only started %d of %d "
+		                  "worker threads",
+		                  (int)pool.num_workers, (int)count);
+
+	return pool.num_workers > 0;
+}
+
+static void convert(struct conversion_job *job, uint32_t start_y,
+		uint32_t end_y, uint32_t width)
+{
+	uint32_t rows = end_y > start_y ? end_y - start_y : 0;
+	size_t slices;
+
+	job->kernels = get_kernels();
+
+	/* if another thread is already using the pool (e.g. an async source
+	 * decompressing while the video thread converts output), just convert
+	 * inline rather than waiting on it */
+	if ((uint64_t)rows * width < MT_MIN_PIXELS ||
+	    pthread_mutex_trylock(&pool_mutex) != 0) {
+		run_job(job, start_y, end_y);
+		return;
+	}
+
+	if (!ensure_workers(resolve_threads())) {
+		pthread_mutex_unlock(&pool_mutex);
+		run_job(job, start_y, end_y);
+		return;
 	}
+
+	slices = pool.num_workers + 1;
+
+	/* slices start on even rows so 4:2:0 row pairs are never split */
+	pool.job        = job;
+	pool.start_y    = start_y;
+	pool.end_y      = end_y;
+	pool.slice_rows = (uint32_t)((rows + slices - 1) / slices + 1) & ~1U;
+
+	for (size_t i = 0; i < pool.num_workers; i++)
+		os_sem_post(pool.start[i]);
+
+	run_slice(0);
+
+	for (size_t i = 0; i < pool.num_workers; i++)
+		os_sem_wait(pool.done);
+
+	pool.job = NULL;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void format_conversion_set_threads(uint32_t threads)
+{
+	if (threads > MAX_CONVERSION_THREADS)
+		threads = MAX_CONVERSION_THREADS;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	/* workers are recreated on demand by the next large conversion */
+	pool.threads = threads;
+	free_workers();
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+uint32_t format_conversion_get_threads(void)
+{
+	uint32_t threads;
+
+	pthread_mutex_lock(&pool_mutex);
+	threads = resolve_threads();
+	pthread_mutex_unlock(&pool_mutex);
+
+	return threads;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void compress_uyvx_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	struct conversion_job job = {0};
+	job.type          = CONVERSION_UYVX_TO_I420;
+	job.input         = input;
+	job.in_linesize   = in_linesize;
+	job.outputs       = output;
+	job.out_linesizes = out_linesize;
+
+	convert(&job, start_y, end_y, out_linesize[0]);
+}
+
+void compress_uyvx_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	struct conversion_job job = {0};
+	job.type          = CONVERSION_UYVX_TO_NV12;
+	job.input         = input;
+	job.in_linesize   = in_linesize;
+	job.outputs       = output;
+	job.out_linesizes = out_linesize;
+
+	convert(&job, start_y, end_y, out_linesize[0]);
+}
+
+void convert_uyvx_to_i444(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	struct conversion_job job = {0};
+	job.type          = CONVERSION_UYVX_TO_I444;
+	job.input         = input;
+	job.in_linesize   = in_linesize;
+	job.outputs       = output;
+	job.out_linesizes = out_linesize;
+
+	convert(&job, start_y, end_y, out_linesize[0]);
+}
+
+void decompress_420(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	struct conversion_job job = {0};
+	job.type         = CONVERSION_DECOMPRESS_420;
+	job.inputs       = input;
+	job.in_linesizes = in_linesize;
+	job.output       = output;
+	job.out_linesize = out_linesize;
+
+	convert(&job, start_y, end_y, in_linesize[0]);
+}
+
+void decompress_nv12(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	struct conversion_job job = {0};
+	job.type         = CONVERSION_DECOMPRESS_NV12;
+	job.inputs       = input;
+	job.in_linesizes = in_linesize;
+	job.output       = output;
+	job.out_linesize = out_linesize;
+
+	convert(&job, start_y, end_y, in_linesize[0]);
+}
+
+void decompress_422(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	struct conversion_job job = {0};
+	job.type         = CONVERSION_DECOMPRESS_422;
+	job.input        = input;
+	job.in_linesize  = in_linesize;
+	job.output       = output;
+	job.out_linesize = out_linesize;
+	job.leading_lum  = leading_lum;
+
+	convert(&job, start_y, end_y, in_linesize / 2);
 }
@@ -25,8 +25,38 @@ extern "C" {
 
 /*
  * Functions for converting to and from packed 444 YUV
+ *
+ *   The converters pick the fastest kernel supported by the CPU at runtime,
+ * and large frames are split in to row slices that are converted in parallel
+ * by a small worker pool.  Every kernel produces output identical to the
+ * scalar reference.
  */
 
+enum format_conversion_isa {
+	FORMAT_CONVERSION_ISA_AUTO,
+	FORMAT_CONVERSION_ISA_C,
+	FORMAT_CONVERSION_ISA_SSE2,
+	FORMAT_CONVERSION_ISA_SSSE3,
+	FORMAT_CONVERSION_ISA_AVX2
+};
+
+/**
+ * Forces a specific kernel set.  Falls back to the best supported set if the
+ * CPU lacks the requested instructions.  Returns the set actually selected.
+ */
+EXPORT enum format_conversion_isa format_conversion_set_isa(
+		enum format_conversion_isa isa);
+EXPORT enum format_conversion_isa format_conversion_get_isa(void);
+EXPORT const char *format_conversion_isa_name(enum format_conversion_isa isa);
+
+/**
+ * Sets the number of threads used for large frames, including the calling
+ * thread.  0 picks a count based on the number of logical cores, 1 disables
+ * slicing and frees the worker threads.
+ */
+EXPORT void format_conversion_set_threads(uint32_t threads);
+EXPORT uint32_t format_conversion_get_threads(void);
+
 EXPORT void compress_uyvx_to_i420(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
@@ -32,9 +32,21 @@ extern profiler_name_store_t *obs_get_profiler_name_store(void);
 #define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
 
+/* frames are handed from the graphics thread to the inputs through a single
+ * producer/multiple consumer ring.  each slot is stamped with the sequence
+ * number of the frame it holds, and has a reader count that is set to -1
+ * while the producer is writing to it.  every input consumes the ring on its
+ * own thread with its own read cursor, so a slow input only ever causes
+ * itself to skip frames. */
+
+#define SLOT_WRITING -1
+
 struct cached_frame_info {
 	struct video_data frame;
 	int count;
+
+	volatile long seq;
+	volatile long readers;
 };
 
 struct video_input {
@@ -45,6 +57,23 @@ struct video_input {
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
+
+	uint32_t                  max_frames;
+	enum video_drop_policy    drop_policy;
+	int                       pending_count;
+
+	struct video_output       *video;
+	pthread_t                 thread;
+	os_sem_t                  *update_semaphore;
+	bool                      thread_initialized;
+	volatile bool             stop;
+	bool                      detached;
+
+	long                      read_seq;
+	volatile long             lag;
+	volatile long             max_lag;
+	volatile long             skipped_frames;
+	volatile long             total_frames;
 };
 
 static inline void video_input_free(struct video_input *input)
@@ -52,33 +81,37 @@ static inline void video_input_free(struct video_input *input)
 	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
 		video_frame_free(&input->frame[i]);
 	video_scaler_destroy(input->scaler);
+	os_sem_destroy(input->update_semaphore);
+	bfree(input);
 }
 
 struct video_output {
 	struct video_output_info   info;
 
-	pthread_t                  thread;
-	pthread_mutex_t            data_mutex;
-	bool                       stop;
+	volatile bool              stop;
 
-	os_sem_t                   *update_semaphore;
 	uint64_t                   frame_time;
-	uint32_t                   skipped_frames;
-	uint32_t                   total_frames;
+	volatile long              skipped_frames;
+	volatile long              total_frames;
 
 	bool                       initialized;
 
 	pthread_mutex_t            input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input*) inputs;
 
-	size_t                     available_frames;
-	size_t                     first_added;
-	size_t                     last_added;
+	volatile long              write_seq;
+	struct cached_frame_info   *locked_slot;
+	int                        pending_count;
 	struct cached_frame_info   cache[MAX_CACHE_SIZE];
 };
 
 /* ------------------------------------------------------------------------- */
 
+static inline long seq_diff(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
 static inline bool scale_video_output(struct video_input *input,
 		struct video_data *data)
 {
@@ -110,58 +143,133 @@ static inline bool scale_video_output(struct video_input *input,
 	return success;
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+static inline bool acquire_slot(struct cached_frame_info *slot)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
+	for (;;) {
+		long readers = os_atomic_load_long(&slot->readers);
+		if (readers == SLOT_WRITING)
+			return false;
+		if (os_atomic_compare_swap_long(&slot->readers, readers,
+					readers + 1))
+			return true;
+	}
+}
 
-	/* -------------------------------- */
+/* only counted for the input, the skipped frames of the output are the ones
+ * the producer couldn't write */
+static inline void skip_input_frames(struct video_input *input, long frames)
+{
+	input->read_seq += frames;
 
-	pthread_mutex_lock(&video->data_mutex);
+	if (input->drop_policy == VIDEO_DROP_REPEAT)
+		input->pending_count += (int)frames;
 
-	frame_info = &video->cache[video->first_added];
+	for (long i = 0; i < frames; i++)
+		os_atomic_inc_long(&input->skipped_frames);
+}
 
-	pthread_mutex_unlock(&video->data_mutex);
+static inline void update_input_lag(struct video_input *input, long lag)
+{
+	os_atomic_set_long(&input->lag, lag);
+	if (lag > os_atomic_load_long(&input->max_lag))
+		os_atomic_set_long(&input->max_lag, lag);
+}
 
-	/* -------------------------------- */
+static inline bool repeat_blocks_producer(struct video_output *video,
+		struct video_input *input)
+{
+	long write_seq = os_atomic_load_long(&video->write_seq);
+	long lag       = seq_diff(write_seq, input->read_seq);
 
-	pthread_mutex_lock(&video->input_mutex);
+	return lag >= (long)video->info.cache_size - 1;
+}
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
-		struct video_data frame = frame_info->frame;
+/* returns true if a frame was consumed or skipped, false if the input has
+ * caught up with the producer */
+static bool video_input_cur_frame(struct video_output *video,
+		struct video_input *input)
+{
+	struct cached_frame_info *slot;
+	struct video_data        frame;
+	long write_seq = os_atomic_load_long(&video->write_seq);
+	long lag       = seq_diff(write_seq, input->read_seq);
+	long cache_size = (long)video->info.cache_size;
+	int  count;
+
+	update_input_lag(input, lag);
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+	if (lag <= 0)
+		return false;
+
+	/* the queue of an input is bounded to at most half the ring, so that
+	 * a slow input never ends up holding on to the slot the producer
+	 * needs next and stalls everyone else with it */
+	if (lag > (long)input->max_frames) {
+		if (input->drop_policy == VIDEO_DROP_REPEAT)
+			skip_input_frames(input, lag - 1);
+		else
+			skip_input_frames(input,
+					lag - (long)input->max_frames);
+		return true;
 	}
 
-	pthread_mutex_unlock(&video->input_mutex);
+	slot = &video->cache[(unsigned long)input->read_seq % cache_size];
 
-	/* -------------------------------- */
+	if (!acquire_slot(slot)) {
+		skip_input_frames(input, 1);
+		return true;
+	}
 
-	pthread_mutex_lock(&video->data_mutex);
+	if (os_atomic_load_long(&slot->seq) != input->read_seq) {
+		os_atomic_dec_long(&slot->readers);
+		skip_input_frames(input, 1);
+		return true;
+	}
 
-	frame_info->frame.timestamp += video->frame_time;
-	complete = --frame_info->count == 0;
+	frame = slot->frame;
+	count = slot->count;
 
-	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
+	/* repeat this frame in place of the ones that were skipped */
+	if (input->pending_count) {
+		if (input->pending_count > cache_size)
+			input->pending_count = (int)cache_size;
 
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
+		frame.timestamp -= (uint64_t)input->pending_count *
+			video->frame_time;
+		count += input->pending_count;
+		input->pending_count = 0;
 	}
 
-	pthread_mutex_unlock(&video->data_mutex);
+	for (int i = 0; i < count; i++) {
+		struct video_data scaled = frame;
+
+		if (os_atomic_load_bool(&input->stop))
+			break;
+
+		/* don't hold on to the slot while repeating it if the
+		 * producer is about to need it, carry the repeats over to
+		 * the next frame instead */
+		if (i && repeat_blocks_producer(video, input)) {
+			input->pending_count = count - i;
+			break;
+		}
+
+		if (scale_video_output(input, &scaled))
+			input->callback(input->param, &scaled);
 
-	/* -------------------------------- */
+		frame.timestamp += video->frame_time;
+		os_atomic_inc_long(&input->total_frames);
+	}
 
-	return complete;
+	os_atomic_dec_long(&slot->readers);
+	input->read_seq++;
+	return true;
 }
 
-static void *video_thread(void *param)
+static void *video_input_thread(void *param)
 {
-	struct video_output *video = param;
+	struct video_input  *input = param;
+	struct video_output *video = input->video;
 
 	os_set_thread_name("video-io: video thread");
 
@@ -169,24 +277,49 @@ static void *video_thread(void *param)
 		profile_store_name(obs_get_profiler_name_store(),
 				"video_thread(%s)", video->info.name);
 
-	while (os_sem_wait(video->update_semaphore) == 0) {
-		if (video->stop)
+	while (os_sem_wait(input->update_semaphore) == 0) {
+		if (os_atomic_load_bool(&input->stop))
 			break;
 
 		profile_start(video_thread_name);
-		while (!video->stop && !video_output_cur_frame(video)) {
-			video->total_frames++;
-		}
-
-		video->total_frames++;
+		while (!os_atomic_load_bool(&input->stop) &&
+		       video_input_cur_frame(video, input));
 		profile_end(video_thread_name);
 
 		profile_reenable_thread();
 	}
 
+	/* the input disconnected itself from within its own callback */
+	if (input->detached)
+		video_input_free(input);
+
 	return NULL;
 }
 
+static void video_input_stop(struct video_input *input)
+{
+	if (!input->thread_initialized)
+		return;
+
+	input->thread_initialized = false;
+	os_atomic_set_bool(&input->stop, true);
+	os_sem_post(input->update_semaphore);
+
+	if (pthread_equal(pthread_self(), input->thread)) {
+		pthread_detach(input->thread);
+		input->detached = true;
+	} else {
+		pthread_join(input->thread, NULL);
+	}
+}
+
+static inline void video_input_destroy(struct video_input *input)
+{
+	video_input_stop(input);
+	if (!input->detached)
+		video_input_free(input);
+}
+
 /* ------------------------------------------------------------------------- */
 
 static inline bool valid_video_params(const struct video_output_info *info)
@@ -195,10 +328,14 @@ static inline bool valid_video_params(const struct video_output_info *info)
 	       info->fps_num != 0;
 }
 
+#define MIN_CACHE_SIZE 4
+
 static inline void init_cache(struct video_output *video)
 {
 	if (video->info.cache_size > MAX_CACHE_SIZE)
 		video->info.cache_size = MAX_CACHE_SIZE;
+	else if (video->info.cache_size < MIN_CACHE_SIZE)
+		video->info.cache_size = MIN_CACHE_SIZE;
 
 	for (size_t i = 0; i < video->info.cache_size; i++) {
 		struct video_frame *frame;
@@ -206,9 +343,9 @@ static inline void init_cache(struct video_output *video)
 
 		video_frame_init(frame, video->info.format,
 				video->info.width, video->info.height);
-	}
 
-	video->available_frames = video->info.cache_size;
+		video->cache[i].seq = -1;
+	}
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -232,14 +369,8 @@ int video_output_open(video_t **video, struct video_output_info *info)
 		goto fail;
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		goto fail;
-	if (pthread_mutex_init(&out->data_mutex, &attr) != 0)
-		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, &attr) != 0)
 		goto fail;
-	if (os_sem_init(&out->update_semaphore, 0) != 0)
-		goto fail;
-	if (pthread_create(&out->thread, NULL, video_thread, out) != 0)
-		goto fail;
 
 	init_cache(out);
 
@@ -260,14 +391,12 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_destroy(video->inputs.array[i]);
 	da_free(video->inputs);
 
 	for (size_t i = 0; i < video->info.cache_size; i++)
 		video_frame_free((struct video_frame*)&video->cache[i]);
 
-	os_sem_destroy(video->update_semaphore);
-	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
 	bfree(video);
 }
@@ -277,7 +406,7 @@ static size_t video_get_input_idx(const video_t *video,
 		void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -288,6 +417,8 @@ static size_t video_get_input_idx(const video_t *video,
 static inline bool video_input_init(struct video_input *input,
 		struct video_output *video)
 {
+	uint32_t max_frames;
+
 	if (input->conversion.width  != video->info.width ||
 	    input->conversion.height != video->info.height ||
 	    input->conversion.format != video->info.format) {
@@ -318,6 +449,20 @@ static inline bool video_input_init(struct video_input *input,
 					input->conversion.height);
 	}
 
+	input->video    = video;
+	input->read_seq = os_atomic_load_long(&video->write_seq);
+
+	max_frames = (uint32_t)video->info.cache_size / 2;
+	if (!input->max_frames || input->max_frames > max_frames)
+		input->max_frames = max_frames;
+
+	if (os_sem_init(&input->update_semaphore, 0) != 0)
+		return false;
+	if (pthread_create(&input->thread, NULL, video_input_thread,
+				input) != 0)
+		return false;
+
+	input->thread_initialized = true;
 	return true;
 }
 
@@ -325,6 +470,16 @@ bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
+{
+	return video_output_connect_queued(video, conversion, NULL, callback,
+			param);
+}
+
+bool video_output_connect_queued(video_t *video,
+		const struct video_scale_info *conversion,
+		const struct video_queue_info *queue,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
 {
 	bool success = false;
 
@@ -334,28 +489,34 @@ bool video_output_connect(video_t *video,
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param    = param;
+		input->callback = callback;
+		input->param    = param;
+
+		if (queue) {
+			input->max_frames  = queue->max_frames;
+			input->drop_policy = queue->drop_policy;
+		}
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format    = video->info.format;
-			input.conversion.width     = video->info.width;
-			input.conversion.height    = video->info.height;
+			input->conversion.format    = video->info.format;
+			input->conversion.width     = video->info.width;
+			input->conversion.height    = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		success = video_input_init(input, video);
 		if (success)
 			da_push_back(video->inputs, &input);
+		else
+			video_input_destroy(input);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -367,6 +528,8 @@ void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
 {
+	struct video_input *input = NULL;
+
 	if (!video || !callback)
 		return;
 
@@ -374,11 +537,14 @@ void video_output_disconnect(video_t *video,
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array+idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	if (input)
+		video_input_destroy(input);
 }
 
 bool video_output_active(const video_t *video)
@@ -396,47 +562,56 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 		int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
-	bool locked;
+	long write_seq;
 
 	if (!video) return false;
 
-	pthread_mutex_lock(&video->data_mutex);
+	write_seq = os_atomic_load_long(&video->write_seq);
+	cfi = &video->cache[(unsigned long)write_seq % video->info.cache_size];
 
-	if (video->available_frames == 0) {
-		video->skipped_frames += count;
-		video->cache[video->last_added].count += count;
-		locked = false;
-
-	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
-
-		cfi = &video->cache[video->last_added];
-		cfi->frame.timestamp = timestamp;
-		cfi->count = count;
-
-		memcpy(frame, &cfi->frame, sizeof(*frame));
-
-		locked = true;
+	/* an input is still reading the oldest frame, so this one has to be
+	 * dropped.  it is made up for by repeating the next frame. */
+	if (!os_atomic_compare_swap_long(&cfi->readers, 0, SLOT_WRITING)) {
+		for (int i = 0; i < count; i++)
+			os_atomic_inc_long(&video->skipped_frames);
+		video->pending_count += count;
+		return false;
 	}
 
-	pthread_mutex_unlock(&video->data_mutex);
+	cfi->frame.timestamp = timestamp -
+		(uint64_t)video->pending_count * video->frame_time;
+	cfi->count = count + video->pending_count;
+	video->pending_count = 0;
+	video->locked_slot = cfi;
 
-	return locked;
+	memcpy(frame, &cfi->frame, sizeof(*frame));
+	return true;
 }
 
 void video_output_unlock_frame(video_t *video)
 {
-	if (!video) return;
+	struct cached_frame_info *cfi;
+	long write_seq;
 
-	pthread_mutex_lock(&video->data_mutex);
+	if (!video || !video->locked_slot) return;
 
-	video->available_frames--;
-	os_sem_post(video->update_semaphore);
+	cfi = video->locked_slot;
+	video->locked_slot = NULL;
 
-	pthread_mutex_unlock(&video->data_mutex);
+	write_seq = os_atomic_load_long(&video->write_seq);
+	for (int i = 0; i < cfi->count; i++)
+		os_atomic_inc_long(&video->total_frames);
+
+	os_atomic_set_long(&cfi->seq, write_seq);
+	os_atomic_compare_swap_long(&cfi->readers, SLOT_WRITING, 0);
+	os_atomic_inc_long(&video->write_seq);
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	for (size_t i = 0; i < video->inputs.num; i++)
+		os_sem_post(video->inputs.array[i]->update_semaphore);
+
+	pthread_mutex_unlock(&video->input_mutex);
 }
 
 uint64_t video_output_get_frame_time(const video_t *video)
@@ -446,16 +621,26 @@ uint64_t video_output_get_frame_time(const video_t *video)
 
 void video_output_stop(video_t *video)
 {
-	void *thread_ret;
-
 	if (!video)
 		return;
 
 	if (video->initialized) {
+		DARRAY(struct video_input*) inputs;
+
+		da_init(inputs);
+
 		video->initialized = false;
 		video->stop = true;
-		os_sem_post(video->update_semaphore);
-		pthread_join(video->thread, &thread_ret);
+
+		/* input threads can disconnect themselves, so don't hold the
+		 * input mutex while waiting for them */
+		pthread_mutex_lock(&video->input_mutex);
+		da_move(inputs, video->inputs);
+		pthread_mutex_unlock(&video->input_mutex);
+
+		for (size_t i = 0; i < inputs.num; i++)
+			video_input_destroy(inputs.array[i]);
+		da_free(inputs);
 	}
 }
 
@@ -492,10 +677,40 @@ double video_output_get_frame_rate(const video_t *video)
 
 uint32_t video_output_get_skipped_frames(const video_t *video)
 {
-	return video->skipped_frames;
+	return (uint32_t)os_atomic_load_long(&video->skipped_frames);
 }
 
 uint32_t video_output_get_total_frames(const video_t *video)
 {
-	return video->total_frames;
+	return (uint32_t)os_atomic_load_long(&video->total_frames);
+}
+
+bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats)
+{
+	bool found = false;
+
+	if (!video || !callback || !stats)
+		return false;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	size_t idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID) {
+		struct video_input *input = video->inputs.array[idx];
+
+		stats->lag = (uint32_t)os_atomic_load_long(&input->lag);
+		stats->max_lag = (uint32_t)os_atomic_load_long(
+				&input->max_lag);
+		stats->skipped_frames = (uint32_t)os_atomic_load_long(
+				&input->skipped_frames);
+		stats->total_frames = (uint32_t)os_atomic_load_long(
+				&input->total_frames);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return found;
 }
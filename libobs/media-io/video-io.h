@@ -157,6 +157,36 @@ EXPORT bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
+enum video_drop_policy {
+	/**
+	 * Frames the input was too slow to receive are made up for by
+	 * repeating the next frame, so the input always sees a contiguous
+	 * sequence of frames.
+	 */
+	VIDEO_DROP_REPEAT,
+
+	/**
+	 * The oldest queued frames are dropped and never delivered.  The
+	 * input must use frame timestamps rather than count frames.
+	 */
+	VIDEO_DROP_OLDEST,
+};
+
+/**
+ * Bounds the number of frames that may be waiting for an input before frames
+ * are dropped.  The queue is limited to half of the output's cache size, and
+ * 0 uses that limit.
+ */
+struct video_queue_info {
+	uint32_t               max_frames;
+	enum video_drop_policy drop_policy;
+};
+
+EXPORT bool video_output_connect_queued(video_t *video,
+		const struct video_scale_info *conversion,
+		const struct video_queue_info *queue,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
 EXPORT void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
@@ -180,6 +210,21 @@ EXPORT double video_output_get_frame_rate(const video_t *video);
 EXPORT uint32_t video_output_get_skipped_frames(const video_t *video);
 EXPORT uint32_t video_output_get_total_frames(const video_t *video);
 
+/**
+ * Per-input frame statistics.  Each connected input consumes frames on its own
+ * thread, so a slow input only skips frames for itself.
+ */
+struct video_input_stats {
+	uint32_t lag;            /**< Frames currently waiting for the input */
+	uint32_t max_lag;        /**< Highest lag seen since connecting */
+	uint32_t skipped_frames; /**< Frames the input was too slow to receive */
+	uint32_t total_frames;   /**< Frames delivered to the input */
+};
+
+EXPORT bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats);
+
 
 #ifdef __cplusplus
 }
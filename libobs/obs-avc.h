@@ -51,8 +51,13 @@ enum {
 EXPORT bool obs_avc_keyframe(const uint8_t *data, size_t size);
 EXPORT const uint8_t *obs_avc_find_startcode(const uint8_t *p,
 		const uint8_t *end);
+/* the parsed packet owns a plain copy, free it with obs_free_encoder_packet */
 EXPORT void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 		const struct encoder_packet *src);
+/* the parsed packet is a shared packet, release it with
+ * obs_encoder_packet_release */
+EXPORT void obs_parse_avc_packet_shared(struct encoder_packet *avc_packet,
+		const struct encoder_packet *src);
 EXPORT size_t obs_parse_avc_header(uint8_t **header, const uint8_t *data,
 		size_t size);
 EXPORT void obs_extract_avc_headers(const uint8_t *packet, size_t size,
@@ -67,6 +67,10 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 	if (encoder->info.get_defaults)
 		encoder->info.get_defaults(encoder->context.settings);
 
+	encoder->encode_time_metric = metric_create(METRIC_HISTOGRAM,
+			"obs_encode_seconds",
+			"Time spent in the encode call of each encoder",
+			"encoder", name);
 	return true;
 }
 
@@ -189,8 +193,8 @@ static void add_connection(struct obs_encoder *encoder)
 		struct video_scale_info info = {0};
 		get_video_info(encoder, &info);
 
-		video_output_connect(encoder->media, &info, receive_video,
-			encoder);
+		video_output_connect_queued(encoder->media, &info,
+				&encoder->frame_queue, receive_video, encoder);
 	}
 
 	set_encoder_active(encoder, true);
@@ -239,6 +243,7 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		pthread_mutex_destroy(&encoder->init_mutex);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		metric_release(encoder->encode_time_metric);
 		obs_context_data_free(&encoder->context);
 		if (encoder->owns_info_id)
 			bfree((void*)encoder->info.id);
@@ -329,11 +334,21 @@ void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings)
 	if (!obs_encoder_valid(encoder, "obs_encoder_update"))
 		return;
 
+	pthread_mutex_lock(&encoder->init_mutex);
+
 	obs_data_apply(encoder->context.settings, settings);
 
-	if (encoder->info.update && encoder->context.data)
-		encoder->info.update(encoder->context.data,
-				encoder->context.settings);
+	/* an active encoder may be in the middle of encoding a frame on its
+	 * own thread, so leave the update to that thread */
+	if (encoder->info.update && encoder->context.data) {
+		if (encoder_active(encoder))
+			os_atomic_set_bool(&encoder->update_pending, true);
+		else
+			encoder->info.update(encoder->context.data,
+					encoder->context.settings);
+	}
+
+	pthread_mutex_unlock(&encoder->init_mutex);
 }
 
 bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
@@ -427,6 +442,7 @@ void obs_encoder_shutdown(obs_encoder_t *encoder)
 		encoder->first_received  = false;
 		encoder->offset_usec     = 0;
 		encoder->start_ts        = 0;
+		os_atomic_set_bool(&encoder->update_pending, false);
 	}
 	pthread_mutex_unlock(&encoder->init_mutex);
 }
@@ -446,6 +462,13 @@ static inline size_t get_callback_idx(
 	return DARRAY_INVALID;
 }
 
+static inline void reset_stats(struct obs_encoder *encoder)
+{
+	os_atomic_set_long(&encoder->encoded_frames, 0);
+	for (size_t i = 0; i < OBS_ENCODER_TIME_BUCKETS; i++)
+		os_atomic_set_long(&encoder->encode_time[i], 0);
+}
+
 static inline void obs_encoder_start_internal(obs_encoder_t *encoder,
 		void (*new_packet)(void *param, struct encoder_packet *packet),
 		void *param)
@@ -468,6 +491,7 @@ static inline void obs_encoder_start_internal(obs_encoder_t *encoder,
 
 	if (first) {
 		encoder->cur_pts = 0;
+		reset_stats(encoder);
 		add_connection(encoder);
 	}
 }
@@ -580,6 +604,28 @@ void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 	encoder->scaled_height = height;
 }
 
+void obs_encoder_set_frame_queue(obs_encoder_t *encoder, uint32_t max_frames,
+		enum video_drop_policy drop_policy)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_frame_queue"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_set_frame_queue: "
+				"encoder '%s' is not a video encoder",
+				obs_encoder_get_name(encoder));
+		return;
+	}
+	if (encoder_active(encoder)) {
+		blog(LOG_WARNING, "encoder '%s': Cannot set the frame queue "
+		                  "while the encoder is active",
+		                  obs_encoder_get_name(encoder));
+		return;
+	}
+
+	encoder->frame_queue.max_frames  = max_frames;
+	encoder->frame_queue.drop_policy = drop_policy;
+}
+
 uint32_t obs_encoder_get_width(const obs_encoder_t *encoder)
 {
 	if (!obs_encoder_valid(encoder, "obs_encoder_get_width"))
@@ -634,6 +680,37 @@ uint32_t obs_encoder_get_sample_rate(const obs_encoder_t *encoder)
 		audio_output_get_sample_rate(encoder->media);
 }
 
+bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_stats"))
+		return false;
+	if (!obs_ptr_valid(stats, "obs_encoder_get_stats"))
+		return false;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (encoder->info.type == OBS_ENCODER_VIDEO && encoder->media) {
+		struct video_input_stats input;
+
+		if (video_output_get_input_stats(encoder->media,
+					receive_video, (void*)encoder,
+					&input)) {
+			stats->queue_depth     = input.lag;
+			stats->max_queue_depth = input.max_lag;
+			stats->skipped_frames  = input.skipped_frames;
+		}
+	}
+
+	stats->encoded_frames = (uint32_t)os_atomic_load_long(
+			&encoder->encoded_frames);
+	for (size_t i = 0; i < OBS_ENCODER_TIME_BUCKETS; i++)
+		stats->encode_time[i] = (uint32_t)os_atomic_load_long(
+				&encoder->encode_time[i]);
+
+	return true;
+}
+
 void obs_encoder_set_video(obs_encoder_t *encoder, video_t *video)
 {
 	const struct video_output_info *voi;
@@ -708,6 +785,19 @@ bool obs_encoder_active(const obs_encoder_t *encoder)
 		encoder_active(encoder) : false;
 }
 
+/* shared payloads are prefixed with their reference count */
+static inline volatile long *packet_refs(const struct encoder_packet *packet)
+{
+	return ((volatile long*)packet->data) - 1;
+}
+
+static uint8_t *create_packet_data(size_t size)
+{
+	long *refs = bmalloc(sizeof(long) + size);
+	*refs = 1;
+	return (uint8_t*)(refs + 1);
+}
+
 static inline bool get_sei(const struct obs_encoder *encoder,
 		uint8_t **sei, size_t *size)
 {
@@ -721,7 +811,6 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 		struct encoder_callback *cb, struct encoder_packet *packet)
 {
 	struct encoder_packet first_packet;
-	DARRAY(uint8_t)       data;
 	uint8_t               *sei;
 	size_t                size;
 
@@ -729,25 +818,22 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 	if (!packet->keyframe)
 		return;
 
-	da_init(data);
-
 	if (!get_sei(encoder, &sei, &size) || !sei || !size) {
 		cb->new_packet(cb->param, packet);
 		cb->sent_first_packet = true;
 		return;
 	}
 
-	da_push_back_array(data, sei, size);
-	da_push_back_array(data, packet->data, packet->size);
-
 	first_packet      = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
+	first_packet.size = size + packet->size;
+	first_packet.data = create_packet_data(first_packet.size);
+	memcpy(first_packet.data, sei, size);
+	memcpy(first_packet.data + size, packet->data, packet->size);
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
 
-	da_free(data);
+	obs_encoder_packet_release(&first_packet);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
@@ -770,27 +856,65 @@ static void full_stop(struct obs_encoder *encoder)
 	}
 }
 
+static inline void add_encode_time(struct obs_encoder *encoder,
+		uint64_t time_ns)
+{
+	uint64_t time_ms = time_ns / 1000000;
+	size_t   bucket  = 0;
+
+	while (time_ms && bucket < OBS_ENCODER_TIME_BUCKETS - 1) {
+		time_ms >>= 1;
+		bucket++;
+	}
+
+	os_atomic_inc_long(&encoder->encode_time[bucket]);
+	os_atomic_inc_long(&encoder->encoded_frames);
+}
+
+/* applies settings from obs_encoder_update on the encoder thread, between
+ * frames */
+static inline void apply_pending_update(struct obs_encoder *encoder)
+{
+	pthread_mutex_lock(&encoder->init_mutex);
+	os_atomic_set_bool(&encoder->update_pending, false);
+
+	if (encoder->info.update && encoder->context.data)
+		encoder->info.update(encoder->context.data,
+				encoder->context.settings);
+
+	pthread_mutex_unlock(&encoder->init_mutex);
+}
+
 static const char *do_encode_name = "do_encode";
 static inline void do_encode(struct obs_encoder *encoder,
 		struct encoder_frame *frame)
 {
 	profile_start(do_encode_name);
+	if (os_atomic_load_bool(&encoder->update_pending))
+		apply_pending_update(encoder);
+
 	if (!encoder->profile_encoder_encode_name)
 		encoder->profile_encoder_encode_name =
 			profile_store_name(obs_get_profiler_name_store(),
 					"encode(%s)", encoder->context.name);
 
 	struct encoder_packet pkt = {0};
+	struct encoder_packet shared_pkt;
 	bool received = false;
 	bool success;
+	uint64_t start_time;
 
 	pkt.timebase_num = encoder->timebase_num;
 	pkt.timebase_den = encoder->timebase_den;
 	pkt.encoder = encoder;
 
 	profile_start(encoder->profile_encoder_encode_name);
+	start_time = os_gettime_ns();
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 			&received);
+	start_time = os_gettime_ns() - start_time;
+	add_encode_time(encoder, start_time);
+	metric_record(encoder->encode_time_metric, start_time);
 	profile_end(encoder->profile_encoder_encode_name);
 	if (!success) {
 		full_stop(encoder);
@@ -810,15 +934,21 @@ static inline void do_encode(struct obs_encoder *encoder,
 		pkt.dts_usec = encoder->start_ts / 1000 +
 			packet_dts_usec(&pkt) - encoder->offset_usec;
 
+		/* the payload belongs to the encoder until the next encode
+		 * call, so copy it once and let every output share it */
+		obs_encoder_packet_create_instance(&shared_pkt, &pkt);
+
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
 		for (size_t i = encoder->callbacks.num; i > 0; i--) {
 			struct encoder_callback *cb;
 			cb = encoder->callbacks.array+(i-1);
-			send_packet(encoder, cb, &pkt);
+			send_packet(encoder, cb, &shared_pkt);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+		obs_encoder_packet_release(&shared_pkt);
 	}
 
 	profile_end(do_encode_name);
@@ -850,6 +980,17 @@ static void receive_video(void *param, struct video_data *frame)
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
+	/* dropped frames leave a gap in the timestamps rather than being
+	 * repeated, so derive the pts from the frame timestamp */
+	if (encoder->frame_queue.drop_policy == VIDEO_DROP_OLDEST) {
+		uint64_t frame_time = video_output_get_frame_time(
+				encoder->media);
+		uint64_t offset = frame->timestamp - encoder->start_ts;
+
+		encoder->cur_pts = (int64_t)((offset + frame_time / 2) /
+				frame_time) * encoder->timebase_num;
+	}
+
 	enc_frame.frames = 1;
 	enc_frame.pts    = encoder->cur_pts;
 
@@ -1033,6 +1174,35 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+void obs_encoder_packet_create_instance(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	*dst = *src;
+	dst->data = create_packet_data(src->size);
+	memcpy(dst->data, src->data, src->size);
+}
+
+void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	if (!src)
+		return;
+
+	if (src->data)
+		os_atomic_inc_long(packet_refs(src));
+	*dst = *src;
+}
+
+void obs_encoder_packet_release(struct encoder_packet *packet)
+{
+	if (!packet)
+		return;
+
+	if (packet->data && os_atomic_dec_long(packet_refs(packet)) == 0)
+		bfree((void*)packet_refs(packet));
+	memset(packet, 0, sizeof(struct encoder_packet));
+}
+
 void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
@@ -236,6 +236,34 @@ struct obs_encoder_info {
 EXPORT void obs_register_encoder_s(const struct obs_encoder_info *info,
 		size_t size);
 
+#define OBS_ENCODER_TIME_BUCKETS 8
+
+/** Encoder statistics */
+struct obs_encoder_stats {
+	/** Frames waiting to be encoded (video only) */
+	uint32_t              queue_depth;
+
+	/** Highest number of frames that have been waiting (video only) */
+	uint32_t              max_queue_depth;
+
+	/** Frames dropped because the encoder fell behind (video only) */
+	uint32_t              skipped_frames;
+
+	/** Number of calls to the encode callback */
+	uint32_t              encoded_frames;
+
+	/**
+	 * Histogram of the time taken by the encode callback.  Bucket 0
+	 * counts calls under 1ms, bucket n counts calls from 2^(n-1)ms up to
+	 * 2^n ms, and the last bucket counts everything slower than that.
+	 */
+	uint32_t              encode_time[OBS_ENCODER_TIME_BUCKETS];
+};
+
+/** Gets the statistics of an encoder since it was last started */
+EXPORT bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats);
+
 /**
  * Register an encoder definition to the current obs context.  This should be
  * used in obs_module_load.
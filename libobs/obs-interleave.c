@@ -0,0 +1,255 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-interleave.h"
+
+static inline bool track_before(struct interleave_queue *q, size_t a, size_t b)
+{
+	return interleave_before(interleave_first(q, a), interleave_first(q, b));
+}
+
+static inline void heap_swap(struct interleave_queue *q, size_t a, size_t b)
+{
+	size_t temp = q->heap[a];
+	q->heap[a] = q->heap[b];
+	q->heap[b] = temp;
+}
+
+static void heap_sift_up(struct interleave_queue *q, size_t idx)
+{
+	while (idx) {
+		size_t parent = (idx - 1) / 2;
+		if (!track_before(q, q->heap[idx], q->heap[parent]))
+			break;
+
+		heap_swap(q, idx, parent);
+		idx = parent;
+	}
+}
+
+static void heap_sift_down(struct interleave_queue *q, size_t idx)
+{
+	for (;;) {
+		size_t left  = idx * 2 + 1;
+		size_t right = left + 1;
+		size_t min   = idx;
+
+		if (left < q->heap_size &&
+		    track_before(q, q->heap[left], q->heap[min]))
+			min = left;
+		if (right < q->heap_size &&
+		    track_before(q, q->heap[right], q->heap[min]))
+			min = right;
+		if (min == idx)
+			break;
+
+		heap_swap(q, idx, min);
+		idx = min;
+	}
+}
+
+/* called after the first packet of the track at the top of the heap was
+ * removed */
+static void heap_update_top(struct interleave_queue *q)
+{
+	if (!interleave_track_size(q, q->heap[0]))
+		q->heap[0] = q->heap[--q->heap_size];
+
+	if (q->heap_size)
+		heap_sift_down(q, 0);
+}
+
+void interleave_reorder(struct interleave_queue *q)
+{
+	q->heap_size = 0;
+
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		if (interleave_track_size(q, i)) {
+			q->heap[q->heap_size] = i;
+			heap_sift_up(q, q->heap_size++);
+		}
+	}
+}
+
+void interleave_free(struct interleave_queue *q)
+{
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		struct circlebuf *track = &q->tracks[i];
+
+		while (track->size) {
+			struct interleave_entry entry;
+			circlebuf_pop_front(track, &entry, sizeof(entry));
+			obs_encoder_packet_release(&entry.packet);
+		}
+
+		circlebuf_free(track);
+	}
+
+	q->heap_size   = 0;
+	q->next_seq    = 0;
+	q->num_packets = 0;
+}
+
+void interleave_push(struct interleave_queue *q, struct encoder_packet *packet)
+{
+	struct interleave_entry entry;
+	size_t track = interleave_track(packet);
+	bool was_empty = !interleave_track_size(q, track);
+
+	entry.packet = *packet;
+	entry.seq    = q->next_seq++;
+	circlebuf_push_back(&q->tracks[track], &entry, sizeof(entry));
+	q->num_packets++;
+
+	/* the first packet of a non-empty track doesn't change, so the heap
+	 * only needs to be touched when a track becomes non-empty */
+	if (was_empty) {
+		q->heap[q->heap_size] = track;
+		heap_sift_up(q, q->heap_size++);
+	}
+}
+
+struct interleave_entry *interleave_peek(struct interleave_queue *q)
+{
+	return q->heap_size ? interleave_first(q, q->heap[0]) : NULL;
+}
+
+bool interleave_pop(struct interleave_queue *q, struct encoder_packet *out)
+{
+	struct interleave_entry entry;
+
+	if (!q->heap_size)
+		return false;
+
+	circlebuf_pop_front(&q->tracks[q->heap[0]], &entry, sizeof(entry));
+	q->num_packets--;
+	heap_update_top(q);
+
+	*out = entry.packet;
+	return true;
+}
+
+struct interleave_entry *interleave_find_closest(struct interleave_queue *q,
+		size_t track, int64_t dts_usec)
+{
+	size_t size = interleave_track_size(q, track);
+	size_t low = 0;
+	size_t high = size;
+	struct interleave_entry *closest;
+
+	if (!size)
+		return NULL;
+
+	/* first packet with a dts at or past dts_usec */
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (interleave_get(q, track, mid)->packet.dts_usec < dts_usec)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == size)
+		return interleave_get(q, track, size - 1);
+
+	closest = interleave_get(q, track, low);
+
+	if (low > 0) {
+		struct interleave_entry *prev = interleave_get(q, track,
+				low - 1);
+		int64_t prev_diff = dts_usec - prev->packet.dts_usec;
+		int64_t diff = closest->packet.dts_usec - dts_usec;
+
+		/* several packets can share the dts before dts_usec, take the
+		 * first of them */
+		if (prev_diff <= diff) {
+			closest = prev;
+			while (low > 1) {
+				prev = interleave_get(q, track, low - 2);
+				if (prev->packet.dts_usec !=
+				    closest->packet.dts_usec)
+					break;
+				closest = prev;
+				low--;
+			}
+		}
+	}
+
+	return closest;
+}
+
+static void discard_front(struct interleave_queue *q, size_t track,
+		size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		struct interleave_entry entry;
+		circlebuf_pop_front(&q->tracks[track], &entry, sizeof(entry));
+		obs_encoder_packet_release(&entry.packet);
+	}
+
+	q->num_packets -= count;
+}
+
+void interleave_discard_to(struct interleave_queue *q,
+		const struct interleave_entry *pos, bool inclusive)
+{
+	/* 'pos' points into the queue, so copy it before discarding */
+	struct interleave_entry end = *pos;
+
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		size_t size = interleave_track_size(q, i);
+		size_t count = 0;
+
+		while (count < size) {
+			struct interleave_entry *entry =
+				interleave_get(q, i, count);
+			if (!interleave_before(entry, &end) &&
+			    !(inclusive && entry->seq == end.seq))
+				break;
+			count++;
+		}
+
+		discard_front(q, i, count);
+	}
+
+	interleave_reorder(q);
+}
+
+void interleave_discard_before_dts(struct interleave_queue *q,
+		int64_t dts_usec)
+{
+	struct interleave_entry *entry;
+
+	while ((entry = interleave_peek(q)) != NULL &&
+	       entry->packet.dts_usec < dts_usec) {
+		discard_front(q, q->heap[0], 1);
+		heap_update_top(q);
+	}
+}
+
+uint64_t interleave_payload_size(struct interleave_queue *q)
+{
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		size_t size = interleave_track_size(q, i);
+		for (size_t j = 0; j < size; j++)
+			total += interleave_get(q, i, j)->packet.size;
+	}
+
+	return total;
+}
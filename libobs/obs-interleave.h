@@ -0,0 +1,132 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/circlebuf.h"
+#include "obs.h"
+
+/*
+ * Interleave queue used by outputs
+ *
+ *   Packets are kept in one FIFO per track (the video track and one per audio
+ *   mix), and a min-heap of the tracks ordered by the dts of their first
+ *   packet merges them into a single dts ordered stream.  Packets with equal
+ *   dts come out in the order they were pushed.
+ *
+ *   Every track must be pushed in dts order, which is the order encoders
+ *   produce packets in.
+ */
+
+#define INTERLEAVE_VIDEO_TRACK 0
+#define INTERLEAVE_MAX_TRACKS  (MAX_AUDIO_MIXES + 1)
+
+struct interleave_entry {
+	struct encoder_packet packet;
+	uint64_t              seq;
+};
+
+struct interleave_queue {
+	struct circlebuf      tracks[INTERLEAVE_MAX_TRACKS];
+	size_t                heap[INTERLEAVE_MAX_TRACKS];
+	size_t                heap_size;
+	uint64_t              next_seq;
+	size_t                num_packets;
+};
+
+static inline size_t interleave_track(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO ?
+		INTERLEAVE_VIDEO_TRACK : packet->track_idx + 1;
+}
+
+/** Releases every queued packet and frees the queue */
+extern void interleave_free(struct interleave_queue *q);
+
+/** Adds a packet to the queue, taking over the caller's reference */
+extern void interleave_push(struct interleave_queue *q,
+		struct encoder_packet *packet);
+
+/** Returns the packet with the lowest dts, or NULL if the queue is empty */
+extern struct interleave_entry *interleave_peek(struct interleave_queue *q);
+
+/** Removes the packet with the lowest dts and gives its reference to 'out' */
+extern bool interleave_pop(struct interleave_queue *q,
+		struct encoder_packet *out);
+
+static inline size_t interleave_track_size(const struct interleave_queue *q,
+		size_t track)
+{
+	return q->tracks[track].size / sizeof(struct interleave_entry);
+}
+
+static inline struct interleave_entry *interleave_get(
+		struct interleave_queue *q, size_t track, size_t idx)
+{
+	return circlebuf_data(&q->tracks[track],
+			idx * sizeof(struct interleave_entry));
+}
+
+static inline struct interleave_entry *interleave_first(
+		struct interleave_queue *q, size_t track)
+{
+	return interleave_track_size(q, track) ?
+		interleave_get(q, track, 0) : NULL;
+}
+
+static inline struct interleave_entry *interleave_last(
+		struct interleave_queue *q, size_t track)
+{
+	size_t size = interleave_track_size(q, track);
+	return size ? interleave_get(q, track, size - 1) : NULL;
+}
+
+/** Returns true if 'a' comes out of the queue before 'b' */
+static inline bool interleave_before(const struct interleave_entry *a,
+		const struct interleave_entry *b)
+{
+	if (a->packet.dts_usec != b->packet.dts_usec)
+		return a->packet.dts_usec < b->packet.dts_usec;
+	return a->seq < b->seq;
+}
+
+/**
+ * Returns the packet of a track with the dts closest to dts_usec, the
+ * earliest one if several are equally close
+ */
+extern struct interleave_entry *interleave_find_closest(
+		struct interleave_queue *q, size_t track, int64_t dts_usec);
+
+/**
+ * Releases every packet that comes out before 'pos', and 'pos' itself if
+ * inclusive is set.  'pos' must be one of the queued packets.
+ */
+extern void interleave_discard_to(struct interleave_queue *q,
+		const struct interleave_entry *pos, bool inclusive);
+
+/** Releases every packet with a dts lower than dts_usec */
+extern void interleave_discard_before_dts(struct interleave_queue *q,
+		int64_t dts_usec);
+
+/**
+ * Restores the merge order after the timestamps of the queued packets were
+ * changed.  The order within each track must not have changed.
+ */
+extern void interleave_reorder(struct interleave_queue *q);
+
+/** Returns the total payload size of the queued packets */
+extern uint64_t interleave_payload_size(struct interleave_queue *q);
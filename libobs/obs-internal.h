@@ -24,6 +24,7 @@
 #include "util/threading.h"
 #include "util/platform.h"
 #include "util/profiler.h"
+#include "util/metrics.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
 
@@ -35,8 +36,12 @@
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #define NUM_TEXTURES 2
+#define NUM_CHANNELS 3
+#define DEFAULT_READBACK_DEPTH 3
+#define MAX_READBACK_DEPTH 8
 #define MICROSECOND_DEN 1000000
 
 static inline int64_t packet_dts_usec(struct encoder_packet *packet)
@@ -218,16 +223,33 @@ struct obs_vframe_info {
 	int count;
 };
 
+#define MAX_TICK_THREADS  8
+#define AUTO_TICK_THREADS 4
+
+/* worker threads for thread-safe source ticks, owned by the graphics thread */
+struct obs_tick_pool {
+	size_t                          num_workers;
+	pthread_t                       workers[MAX_TICK_THREADS - 1];
+	os_sem_t                        *start;
+	os_sem_t                        *done;
+	bool                            stop;
+
+	DARRAY(struct obs_source*)      queue;
+	volatile long                   next;
+	float                           seconds;
+};
+
 struct obs_core_video {
 	graphics_t                      *graphics;
-	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
+	gs_stagesurf_t                  *copy_surfaces[MAX_READBACK_DEPTH][NUM_CHANNELS];
 	gs_texture_t                    *render_textures[NUM_TEXTURES];
 	gs_texture_t                    *output_textures[NUM_TEXTURES];
-	gs_texture_t                    *convert_textures[NUM_TEXTURES];
+	gs_texture_t                    *convert_textures[NUM_TEXTURES][NUM_CHANNELS];
 	bool                            textures_rendered[NUM_TEXTURES];
 	bool                            textures_output[NUM_TEXTURES];
-	bool                            textures_copied[NUM_TEXTURES];
+	bool                            textures_copied[MAX_READBACK_DEPTH];
 	bool                            textures_converted[NUM_TEXTURES];
+	const char                      *copy_map_names[MAX_READBACK_DEPTH];
 	struct circlebuf                vframe_info_buffer;
 	gs_effect_t                     *default_effect;
 	gs_effect_t                     *default_rect_effect;
@@ -238,8 +260,11 @@ struct obs_core_video {
 	gs_effect_t                     *lanczos_effect;
 	gs_effect_t                     *bilinear_lowres_effect;
 	gs_effect_t                     *premultiplied_alpha_effect;
-	gs_stagesurf_t                  *mapped_surface;
+	gs_stagesurf_t                  *mapped_surfaces[NUM_CHANNELS];
 	int                             cur_texture;
+	int                             cur_copy;
+	int                             readback_depth;
+	uint32_t                        skipped_readbacks;
 
 	uint64_t                        video_time;
 	video_t                         *video;
@@ -247,13 +272,12 @@ struct obs_core_video {
 	uint32_t                        total_frames;
 	uint32_t                        lagged_frames;
 	bool                            thread_initialized;
+	struct obs_tick_pool            tick_pool;
 
 	bool                            gpu_conversion;
-	const char                      *conversion_tech;
-	uint32_t                        conversion_height;
-	uint32_t                        plane_offsets[3];
-	uint32_t                        plane_sizes[3];
-	uint32_t                        plane_linewidth[3];
+	const char                      *conversion_techs[NUM_CHANNELS];
+	uint32_t                        plane_widths[NUM_CHANNELS];
+	uint32_t                        plane_heights[NUM_CHANNELS];
 
 	uint32_t                        output_width;
 	uint32_t                        output_height;
@@ -309,9 +333,30 @@ struct obs_core_data {
 
 	long long                       unnamed_index;
 
+	/* last video revision handed out, see obs_source_invalidate_video */
+	volatile long                   video_revision;
+
 	volatile bool                   valid;
 };
 
+/* metrics of the core pipeline, see util/metrics.h */
+struct metrics_server;
+
+struct obs_core_metrics {
+	metric_t                        *render_time;
+	metric_t                        *readback_time;
+	metric_t                        *skipped_readbacks;
+	metric_t                        *rendered_frames;
+	metric_t                        *lagged_frames;
+	metric_t                        *audio_buffering;
+
+	pthread_mutex_t                 server_mutex;
+	struct metrics_server           *server;
+};
+
+extern bool obs_init_metrics(void);
+extern void obs_free_metrics(void);
+
 /* user hotkeys */
 struct obs_core_hotkeys {
 	pthread_mutex_t                 mutex;
@@ -375,6 +420,7 @@ struct obs_core {
 	struct obs_core_audio           audio;
 	struct obs_core_data            data;
 	struct obs_core_hotkeys         hotkeys;
+	struct obs_core_metrics         metrics;
 };
 
 extern struct obs_core *obs;
@@ -539,6 +585,9 @@ struct obs_source {
 	/* used to temporarily disable sources if needed */
 	bool                            enabled;
 
+	/* bumped whenever the source's static video changes */
+	volatile long                   video_revision;
+
 	/* timing (if video is present, is based upon video) */
 	volatile bool                   timing_set;
 	volatile uint64_t               timing_adjust;
@@ -594,6 +643,10 @@ struct obs_source {
 	DARRAY(struct async_frame)      async_cache;
 	DARRAY(struct obs_source_frame*)async_frames;
 	pthread_mutex_t                 async_mutex;
+	enum obs_async_queue_policy     async_queue_policy;
+	uint64_t                        async_max_latency;
+	volatile long                   async_frames_dropped;
+	volatile long                   async_frames_late;
 	uint32_t                        async_width;
 	uint32_t                        async_height;
 	uint32_t                        async_cache_width;
@@ -723,7 +776,19 @@ static inline enum gs_color_format convert_video_format(
 
 extern void obs_source_activate(obs_source_t *source, enum view_type type);
 extern void obs_source_deactivate(obs_source_t *source, enum view_type type);
-extern void obs_source_video_tick(obs_source_t *source, float seconds);
+/* if defer is true and the source's tick is thread-safe, returns true without
+ * calling its video_tick callback, which must then be called with
+ * obs_source_call_video_tick */
+extern bool obs_source_video_tick(obs_source_t *source, float seconds,
+		bool defer);
+extern void obs_source_call_video_tick(obs_source_t *source, float seconds);
+
+/* returns true if the source's video (including its filters) only changes
+ * when invalidated, and the latest revision of it.  revisions come from a
+ * single increasing counter, so a change anywhere in the tree of a source
+ * always raises its revision */
+extern bool obs_source_video_static(obs_source_t *source, long *revision);
+extern bool obs_scene_video_static(obs_scene_t *scene, long *revision);
 extern float obs_source_get_target_volume(obs_source_t *source,
 		obs_source_t *target);
 
@@ -732,6 +797,7 @@ extern void obs_source_audio_render(obs_source_t *source, uint32_t mixers,
 
 extern void add_alignment(struct vec2 *v, uint32_t align, int cx, int cy);
 
+extern bool has_async_video_filters(obs_source_t *source);
 extern struct obs_source_frame *filter_async_video(obs_source_t *source,
 		struct obs_source_frame *in);
 extern bool update_async_texture(struct obs_source *source,
@@ -786,7 +852,7 @@ struct obs_output {
 	int64_t                         highest_audio_ts;
 	int64_t                         highest_video_ts;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct interleave_queue         interleaved_packets;
 
 	int                             reconnect_retry_sec;
 	int                             reconnect_retry_max;
@@ -895,6 +961,10 @@ struct obs_encoder {
 	volatile bool                   active;
 	bool                            initialized;
 
+	/* settings changed while active, applied by the encoder thread
+	 * before its next frame */
+	volatile bool                   update_pending;
+
 	/* indicates ownership of the info.id buffer */
 	bool                            owns_info_id;
 
@@ -903,6 +973,13 @@ struct obs_encoder {
 
 	int64_t                         cur_pts;
 
+	/* video encoders are fed on their own video-io thread, with a bounded
+	 * frame queue */
+	struct video_queue_info         frame_queue;
+
+	volatile long                   encoded_frames;
+	volatile long                   encode_time[OBS_ENCODER_TIME_BUCKETS];
+
 	struct circlebuf                audio_input_buffer[MAX_AV_PLANES];
 	uint8_t                         *audio_output_buffer[MAX_AV_PLANES];
 
@@ -929,6 +1006,7 @@ struct obs_encoder {
 	DARRAY(struct encoder_callback) callbacks;
 
 	const char                      *profile_encoder_encode_name;
+	metric_t                        *encode_time_metric;
 };
 
 extern struct obs_encoder_info *find_encoder(const char *id);
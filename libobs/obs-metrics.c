@@ -0,0 +1,280 @@
+/******************************************************************************
+    Copyright (C) 2016 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define close_socket closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define close_socket close
+#endif
+
+#include "obs-internal.h"
+
+/*
+ * Minimal HTTP responder so Prometheus can scrape the registry directly.
+ * Only listens on the loopback interface, answers every request with the
+ * current metrics and closes the connection.
+ */
+
+#define MAX_REQUEST_SIZE 8192
+
+struct metrics_server {
+	SOCKET     socket;
+	pthread_t  thread;
+	os_event_t *stop_event;
+};
+
+static void read_request(SOCKET client)
+{
+	char buf[1024];
+	size_t total = 0;
+	int ret;
+
+	/* the request itself doesn't matter, but it has to be read before
+	 * closing or the client can get a reset instead of the response */
+	while (total < MAX_REQUEST_SIZE) {
+		ret = recv(client, buf, sizeof(buf) - 1, 0);
+		if (ret <= 0)
+			break;
+
+		buf[ret] = 0;
+		total += (size_t)ret;
+		if (strstr(buf, "\r\n\r\n"))
+			break;
+	}
+}
+
+static void send_all(SOCKET client, const char *data, size_t size)
+{
+	while (size) {
+		int ret = send(client, data, (int)size, 0);
+		if (ret <= 0)
+			break;
+
+		data += ret;
+		size -= (size_t)ret;
+	}
+}
+
+static void respond(SOCKET client)
+{
+	struct dstr body = {0};
+	struct dstr header = {0};
+
+#ifdef _WIN32
+	DWORD timeout = 1000;
+#else
+	struct timeval timeout = {1, 0};
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout,
+			sizeof(timeout));
+
+	read_request(client);
+
+	metrics_dump_prometheus(&body);
+	dstr_printf(&header, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %u\r\n"
+			"Connection: close\r\n\r\n",
+			(unsigned)body.len);
+
+	send_all(client, header.array, header.len);
+	if (body.len)
+		send_all(client, body.array, body.len);
+
+	dstr_free(&header);
+	dstr_free(&body);
+}
+
+static void *metrics_server_thread(void *data)
+{
+	struct metrics_server *server = data;
+
+	os_set_thread_name("libobs: metrics server");
+
+	while (os_event_try(server->stop_event) == EAGAIN) {
+		struct timeval tv = {0, 100000};
+		fd_set fds;
+		SOCKET client;
+
+		FD_ZERO(&fds);
+		FD_SET(server->socket, &fds);
+
+		if (select((int)server->socket + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		client = accept(server->socket, NULL, NULL);
+		if (client == INVALID_SOCKET)
+			continue;
+
+		respond(client);
+		close_socket(client);
+	}
+
+	return NULL;
+}
+
+static void metrics_server_destroy(struct metrics_server *server)
+{
+	if (server->socket != INVALID_SOCKET)
+		close_socket(server->socket);
+	os_event_destroy(server->stop_event);
+	bfree(server);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+bool obs_metrics_server_start(uint16_t port)
+{
+	struct obs_core_metrics *metrics;
+	struct metrics_server *server;
+	struct sockaddr_in addr = {0};
+	int reuse = 1;
+
+	if (!obs)
+		return false;
+
+	metrics = &obs->metrics;
+	obs_metrics_server_stop();
+
+#ifdef _WIN32
+	WSADATA wsad;
+	if (WSAStartup(MAKEWORD(2, 2), &wsad) != 0)
+		return false;
+#endif
+
+	server = bzalloc(sizeof(struct metrics_server));
+	server->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (server->socket == INVALID_SOCKET)
+		goto fail;
+	if (os_event_init(&server->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+
+	setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR,
+			(const char*)&reuse, sizeof(reuse));
+
+	addr.sin_family      = AF_INET;
+	addr.sin_port        = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(server->socket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		blog(LOG_WARNING, "obs_metrics_server_start: could not bind "
+				"to port %u", (unsigned)port);
+		goto fail;
+	}
+	if (listen(server->socket, 4) != 0)
+		goto fail;
+
+	if (pthread_create(&server->thread, NULL, metrics_server_thread,
+				server) != 0)
+		goto fail;
+
+	pthread_mutex_lock(&metrics->server_mutex);
+	metrics->server = server;
+	pthread_mutex_unlock(&metrics->server_mutex);
+
+	blog(LOG_INFO, "Serving metrics on 127.0.0.1:%u", (unsigned)port);
+	return true;
+
+fail:
+	metrics_server_destroy(server);
+	return false;
+}
+
+void obs_metrics_server_stop(void)
+{
+	struct metrics_server *server;
+
+	if (!obs)
+		return;
+
+	pthread_mutex_lock(&obs->metrics.server_mutex);
+	server = obs->metrics.server;
+	obs->metrics.server = NULL;
+	pthread_mutex_unlock(&obs->metrics.server_mutex);
+
+	if (!server)
+		return;
+
+	os_event_signal(server->stop_event);
+	pthread_join(server->thread, NULL);
+	metrics_server_destroy(server);
+}
+
+/* ------------------------------------------------------------------------- */
+
+bool obs_init_metrics(void)
+{
+	struct obs_core_metrics *metrics = &obs->metrics;
+
+	pthread_mutex_init_value(&metrics->server_mutex);
+	if (pthread_mutex_init(&metrics->server_mutex, NULL) != 0)
+		return false;
+
+	metrics->render_time = metric_create(METRIC_HISTOGRAM,
+			"obs_render_seconds",
+			"Time spent rendering the main texture and converting "
+			"it to the output format", NULL, NULL);
+	metrics->readback_time = metric_create(METRIC_HISTOGRAM,
+			"obs_readback_seconds",
+			"Time spent staging and mapping rendered frames",
+			NULL, NULL);
+	metrics->skipped_readbacks = metric_create(METRIC_COUNTER,
+			"obs_readback_skipped_frames_total",
+			"Frames dropped because the GPU had not finished "
+			"copying them back", NULL, NULL);
+	metrics->rendered_frames = metric_create(METRIC_COUNTER,
+			"obs_rendered_frames_total",
+			"Frame intervals since video was reset", NULL, NULL);
+	metrics->lagged_frames = metric_create(METRIC_COUNTER,
+			"obs_lagged_frames_total",
+			"Frames skipped because rendering took too long",
+			NULL, NULL);
+	metrics->audio_buffering = metric_create(METRIC_GAUGE,
+			"obs_audio_buffering_frames",
+			"Audio sample frames buffered to wait for late sources",
+			NULL, NULL);
+	return true;
+}
+
+void obs_free_metrics(void)
+{
+	struct obs_core_metrics *metrics = &obs->metrics;
+
+	obs_metrics_server_stop();
+	pthread_mutex_destroy(&metrics->server_mutex);
+
+	metric_release(metrics->render_time);
+	metric_release(metrics->readback_time);
+	metric_release(metrics->skipped_readbacks);
+	metric_release(metrics->rendered_frames);
+	metric_release(metrics->lagged_frames);
+	metric_release(metrics->audio_buffering);
+	memset(metrics, 0, sizeof(*metrics));
+}
@@ -124,9 +124,7 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_free_encoder_packet(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
+	interleave_free(&output->interleaved_packets);
 }
 
 void obs_output_destroy(obs_output_t *output)
@@ -602,6 +600,45 @@ int obs_output_get_total_frames(const obs_output_t *output)
 		output->total_frames : 0;
 }
 
+static uint64_t get_delay_packet_memory(obs_output_t *output)
+{
+	uint64_t total = 0;
+	size_t   num;
+
+	pthread_mutex_lock(&output->delay_mutex);
+
+	num = output->delay_data.size / sizeof(struct delay_data);
+	for (size_t i = 0; i < num; i++) {
+		struct delay_data *dd = circlebuf_data(&output->delay_data,
+				i * sizeof(struct delay_data));
+		if (dd->msg == DELAY_MSG_PACKET)
+			total += dd->packet.size;
+	}
+
+	pthread_mutex_unlock(&output->delay_mutex);
+	return total;
+}
+
+uint64_t obs_output_get_packet_memory(const obs_output_t *output)
+{
+	obs_output_t *out = (obs_output_t*)output;
+	uint64_t     total = 0;
+
+	if (!obs_output_valid(output, "obs_output_get_packet_memory"))
+		return 0;
+
+	pthread_mutex_lock(&out->interleaved_mutex);
+	total += interleave_payload_size(&out->interleaved_packets);
+	pthread_mutex_unlock(&out->interleaved_mutex);
+
+	total += get_delay_packet_memory(out);
+
+	if (output->info.get_packet_memory && output->context.data)
+		total += output->info.get_packet_memory(output->context.data);
+
+	return total;
+}
+
 void obs_output_set_preferred_size(obs_output_t *output, uint32_t width,
 		uint32_t height)
 {
@@ -867,21 +904,24 @@ static inline bool has_higher_opposing_ts(struct obs_output *output,
 
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct interleave_entry *first =
+		interleave_peek(&output->interleaved_packets);
+	struct encoder_packet out;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timstamp in the interleave buffer.
 	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
+	if (!first || !has_higher_opposing_ts(output, &first->packet))
 		return;
 
+	interleave_pop(&output->interleaved_packets, &out);
+
 	if (out.type == OBS_ENCODER_VIDEO)
 		output->total_frames++;
 
-	da_erase(output->interleaved_packets, 0);
 	if (!output->stopped)
 		output->info.encoded_packet(output->context.data, &out);
-	obs_free_encoder_packet(&out);
+	obs_encoder_packet_release(&out);
 }
 
 static inline void set_higher_ts(struct obs_output *output,
@@ -896,189 +936,154 @@ static inline void set_higher_ts(struct obs_output *output,
 	}
 }
 
-static inline struct encoder_packet *find_first_packet_type(
+static inline size_t audio_track(size_t audio_idx)
+{
+	return INTERLEAVE_VIDEO_TRACK + 1 + audio_idx;
+}
+
+static inline struct interleave_entry *find_first_packet_type(
 		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx);
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx);
+		size_t audio_idx)
+{
+	return interleave_first(&output->interleaved_packets,
+			type == OBS_ENCODER_VIDEO ?
+			INTERLEAVE_VIDEO_TRACK : audio_track(audio_idx));
+}
+
+static inline struct interleave_entry *find_last_packet_type(
+		struct obs_output *output, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	return interleave_last(&output->interleaved_packets,
+			type == OBS_ENCODER_VIDEO ?
+			INTERLEAVE_VIDEO_TRACK : audio_track(audio_idx));
+}
 
 /* gets the point where audio and video are closest together */
-static size_t get_interleaved_start_idx(struct obs_output *output)
+static struct interleave_entry *get_interleaved_start(
+		struct obs_output *output)
 {
-	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
-	struct encoder_packet *first_video = find_first_packet_type(output,
+	struct interleave_queue *queue = &output->interleaved_packets;
+	struct interleave_entry *first_video = find_first_packet_type(output,
 			OBS_ENCODER_VIDEO, 0);
-	size_t video_idx = DARRAY_INVALID;
-	size_t idx = 0;
+	struct interleave_entry *closest = NULL;
+	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
 
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		struct interleave_entry *audio;
 		int64_t diff;
 
-		if (packet->type != OBS_ENCODER_AUDIO) {
-			if (packet == first_video)
-				video_idx = i;
+		audio = interleave_find_closest(queue, audio_track(i),
+				first_video->packet.dts_usec);
+		if (!audio)
 			continue;
-		}
 
-		diff = llabs(packet->dts_usec - first_video->dts_usec);
-		if (diff < closest_diff) {
+		diff = llabs(audio->packet.dts_usec -
+				first_video->packet.dts_usec);
+		if (diff < closest_diff || (diff == closest_diff &&
+		    interleave_before(audio, closest))) {
 			closest_diff = diff;
-			idx = i;
+			closest = audio;
 		}
 	}
 
-	return video_idx < idx ? video_idx : idx;
+	if (!closest || interleave_before(first_video, closest))
+		return first_video;
+	return closest;
 }
 
-static int prune_premature_packets(struct obs_output *output)
+/* returns the last packet to prune if the first video packet is too far
+ * away from audio */
+static struct interleave_entry *prune_premature_packets(
+		struct obs_output *output, bool *ready)
 {
 	size_t audio_mixes = num_audio_mixes(output);
-	struct encoder_packet *video;
-	int video_idx;
-	int max_idx;
+	struct interleave_entry *video;
+	struct interleave_entry *last;
 	int64_t duration_usec;
 	int64_t max_diff = 0;
-	int64_t diff;
+	int64_t diff = 0;
 
-	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
-	if (video_idx == -1) {
+	*ready = false;
+
+	video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
+	if (!video) {
 		output->received_video = false;
-		return -1;
+		return NULL;
 	}
 
-	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
-	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
+	last = video;
+	duration_usec = video->packet.timebase_num * 1000000LL /
+		video->packet.timebase_den;
 
 	for (size_t i = 0; i < audio_mixes; i++) {
-		struct encoder_packet *audio;
-		int audio_idx;
+		struct interleave_entry *audio;
 
-		audio_idx = find_first_packet_type_idx(output,
-				OBS_ENCODER_AUDIO, i);
-		if (audio_idx == -1) {
+		audio = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
+		if (!audio) {
 			output->received_audio = false;
-			return -1;
+			return NULL;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
-		if (audio_idx > max_idx)
-			max_idx = audio_idx;
+		if (interleave_before(last, audio))
+			last = audio;
 
-		diff = audio->dts_usec - video->dts_usec;
+		diff = audio->packet.dts_usec - video->packet.dts_usec;
 		if (diff > max_diff)
 			max_diff = diff;
 	}
 
-	return diff > duration_usec ? max_idx + 1 : 0;
-}
-
-static void discard_to_idx(struct obs_output *output, size_t idx)
-{
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_free_encoder_packet(packet);
-	}
-
-	da_erase_range(output->interleaved_packets, 0, idx);
+	*ready = true;
+	return diff > duration_usec ? last : NULL;
 }
 
 #define DEBUG_STARTING_PACKETS 0
 
 static bool prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
-	int prune_start = prune_premature_packets(output);
+	struct interleave_entry *prune_end;
+	bool ready;
+
+	prune_end = prune_premature_packets(output, &ready);
 
 #if DEBUG_STARTING_PACKETS == 1
-	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
-				packet->type == OBS_ENCODER_AUDIO ?
-				"audio" : "video", (int)packet->track_idx,
-				packet->dts_usec,
-				(int)i < prune_start ? "true" : "false");
+	blog(LOG_DEBUG, "--------- Pruning! %s ---------",
+			prune_end ? "true" : "false");
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		size_t size = interleave_track_size(
+				&output->interleaved_packets, i);
+
+		for (size_t j = 0; j < size; j++) {
+			struct interleave_entry *entry = interleave_get(
+					&output->interleaved_packets, i, j);
+			blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
+					entry->packet.type == OBS_ENCODER_AUDIO ?
+					"audio" : "video",
+					(int)entry->packet.track_idx,
+					entry->packet.dts_usec,
+					prune_end && !interleave_before(
+						prune_end, entry) ?
+					"true" : "false");
+		}
 	}
 #endif
 
 	/* prunes the first video packet if it's too far away from audio */
-	if (prune_start == -1)
+	if (!ready)
 		return false;
-	else if (prune_start != 0)
-		start_idx = (size_t)prune_start;
+	else if (prune_end)
+		interleave_discard_to(&output->interleaved_packets, prune_end,
+				true);
 	else
-		start_idx = get_interleaved_start_idx(output);
-
-	if (start_idx)
-		discard_to_idx(output, start_idx);
+		interleave_discard_to(&output->interleaved_packets,
+				get_interleaved_start(output), false);
 
 	return true;
 }
 
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)i;
-		}
-	}
-
-	return -1;
-}
-
-static int find_last_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)(i - 1);
-		}
-	}
-
-	return -1;
-}
-
-static inline struct encoder_packet *find_first_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
-static inline struct encoder_packet *find_last_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
 static bool get_audio_and_video_packets(struct obs_output *output,
-		struct encoder_packet **video,
-		struct encoder_packet **audio, size_t audio_mixes)
+		struct interleave_entry **video,
+		struct interleave_entry **audio, size_t audio_mixes)
 {
 	*video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
 	if (!*video)
@@ -1101,11 +1106,10 @@ static bool get_audio_and_video_packets(struct obs_output *output,
 
 static bool initialize_interleaved_packets(struct obs_output *output)
 {
-	struct encoder_packet *video;
-	struct encoder_packet *audio[MAX_AUDIO_MIXES];
-	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
+	struct interleave_entry *video;
+	struct interleave_entry *audio[MAX_AUDIO_MIXES];
+	struct interleave_entry *last_audio[MAX_AUDIO_MIXES];
 	size_t audio_mixes = num_audio_mixes(output);
-	size_t start_idx;
 
 	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
 		return false;
@@ -1116,29 +1120,26 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 
 	/* ensure that there is audio past the first video packet */
 	for (size_t i = 0; i < audio_mixes; i++) {
-		if (last_audio[i]->dts_usec < video->dts_usec) {
+		if (last_audio[i]->packet.dts_usec < video->packet.dts_usec) {
 			output->received_audio = false;
 			return false;
 		}
 	}
 
 	/* clear out excess starting audio if it hasn't been already */
-	start_idx = get_interleaved_start_idx(output);
-	if (start_idx) {
-		discard_to_idx(output, start_idx);
-		if (!get_audio_and_video_packets(output, &video, audio,
-					audio_mixes))
-			return false;
-	}
+	interleave_discard_to(&output->interleaved_packets,
+			get_interleaved_start(output), false);
+	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
+		return false;
 
 	/* get new offsets */
-	output->video_offset = video->dts;
+	output->video_offset = video->packet.dts;
 	for (size_t i = 0; i < audio_mixes; i++)
-		output->audio_offsets[i] = audio[i]->dts;
+		output->audio_offsets[i] = audio[i]->packet.dts;
 
 #if DEBUG_STARTING_PACKETS == 1
-	int64_t v = video->dts_usec;
-	int64_t a = audio[0]->dts_usec;
+	int64_t v = video->packet.dts_usec;
+	int64_t a = audio[0]->packet.dts_usec;
 	int64_t diff = v - a;
 
 	blog(LOG_DEBUG, "output '%s' offset for video: %lld, audio: %lld, "
@@ -1147,65 +1148,26 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 #endif
 
 	/* subtract offsets from highest TS offset variables */
-	output->highest_audio_ts -= audio[0]->dts_usec;
-	output->highest_video_ts -= video->dts_usec;
+	output->highest_audio_ts -= audio[0]->packet.dts_usec;
+	output->highest_video_ts -= video->packet.dts_usec;
 
 	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
+	for (size_t i = 0; i < INTERLEAVE_MAX_TRACKS; i++) {
+		size_t size = interleave_track_size(
+				&output->interleaved_packets, i);
+
+		for (size_t j = 0; j < size; j++) {
+			struct interleave_entry *entry = interleave_get(
+					&output->interleaved_packets, i, j);
+			apply_interleaved_packet_offset(output, &entry->packet);
+		}
 	}
 
+	/* the tracks were offset separately, so merge them again */
+	interleave_reorder(&output->interleaved_packets);
 	return true;
 }
 
-static inline void insert_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec < cur_packet->dts_usec)
-			break;
-	}
-
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-			sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
-}
-
-static void discard_unused_audio_packets(struct obs_output *output,
-		int64_t dts_usec)
-{
-	size_t idx = 0;
-
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
-
-		if (p->dts_usec >= dts_usec)
-			break;
-	}
-
-	if (idx)
-		discard_to_idx(output, idx);
-}
-
 static void interleave_packets(void *data, struct encoder_packet *packet)
 {
 	struct obs_output     *output = data;
@@ -1221,7 +1183,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (!output->received_video &&
 	    packet->type == OBS_ENCODER_VIDEO &&
 	    !packet->keyframe) {
-		discard_unused_audio_packets(output, packet->dts_usec);
+		interleave_discard_before_dts(&output->interleaved_packets,
+				packet->dts_usec);
 		pthread_mutex_unlock(&output->interleaved_mutex);
 		return;
 	}
@@ -1231,25 +1194,23 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_duplicate_encoder_packet(&out, packet);
+		obs_encoder_packet_ref(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
 	set_higher_ts(output, &out);
+	interleave_push(&output->interleaved_packets, &out);
 
 	/* when both video and audio have been received, we're ready
 	 * to start sending out packets (one at a time) */
 	if (output->received_audio && output->received_video) {
 		if (!was_started) {
 			if (prune_interleaved_packets(output)) {
-				if (initialize_interleaved_packets(output)) {
-					resort_interleaved_packets(output);
+				if (initialize_interleaved_packets(output))
 					send_interleaved(output);
-				}
 			}
 		} else {
 			send_interleaved(output);
@@ -1269,7 +1230,7 @@ static void default_encoded_callback(void *param, struct encoder_packet *packet)
 	if (!output->stopped)
 		output->info.encoded_packet(output->context.data, packet);
 	if (output->active_delay_ns)
-		obs_free_encoder_packet(packet);
+		obs_encoder_packet_release(packet);
 
 	if (packet->type == OBS_ENCODER_VIDEO)
 		output->total_frames++;
@@ -64,6 +64,12 @@ struct obs_output_info {
 
 	void *type_data;
 	void (*free_type_data)(void *type_data);
+
+	/**
+	 * Returns the size of the encoded packets the output is holding in
+	 * its own queue, in bytes
+	 */
+	uint64_t (*get_packet_memory)(void *data);
 };
 
 EXPORT void obs_register_output_s(const struct obs_output_info *info,
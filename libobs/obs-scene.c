@@ -155,6 +155,14 @@ static void scene_destroy(void *data)
 
 	remove_all_items(scene);
 
+	if (scene->cache_render || scene->atlas || scene->batch_vb) {
+		obs_enter_graphics();
+		gs_texrender_destroy(scene->cache_render);
+		gs_texture_destroy(scene->atlas);
+		gs_vertexbuffer_destroy(scene->batch_vb);
+		obs_leave_graphics();
+	}
+
 	pthread_mutex_destroy(&scene->video_mutex);
 	pthread_mutex_destroy(&scene->audio_mutex);
 	bfree(scene);
@@ -187,6 +195,8 @@ static void scene_enum_sources(void *data,
 
 static inline void detach_sceneitem(struct obs_scene_item *item)
 {
+	obs_source_invalidate_video(item->parent->source);
+
 	if (item->prev)
 		item->prev->next = item->next;
 	else
@@ -204,6 +214,8 @@ static inline void attach_sceneitem(struct obs_scene *parent,
 	item->prev   = prev;
 	item->parent = parent;
 
+	obs_source_invalidate_video(parent->source);
+
 	if (prev) {
 		item->next = prev->next;
 		if (prev->next)
@@ -363,6 +375,8 @@ static void update_item_transform(struct obs_scene_item *item)
 	item->last_width  = width;
 	item->last_height = height;
 
+	obs_source_invalidate_video(item->parent->source);
+
 	calldata_init_fixed(&params, stack, sizeof(stack));
 	calldata_set_ptr(&params, "scene", item->parent);
 	calldata_set_ptr(&params, "item", item);
@@ -383,38 +397,379 @@ static inline bool crop_enabled(const struct obs_sceneitem_crop *crop)
 	return crop->left || crop->right || crop->top || crop->bottom;
 }
 
-static inline void render_item(struct obs_scene_item *item)
+static inline bool crop_equal(const struct obs_sceneitem_crop *crop1,
+		const struct obs_sceneitem_crop *crop2)
 {
-	if (item->crop_render) {
-		uint32_t width  = obs_source_get_width(item->source);
-		uint32_t height = obs_source_get_height(item->source);
-		uint32_t cx = calc_cx(item, width);
-		uint32_t cy = calc_cy(item, height);
+	return crop1->left   == crop2->left  &&
+	       crop1->right  == crop2->right &&
+	       crop1->top    == crop2->top   &&
+	       crop1->bottom == crop2->bottom;
+}
 
-		if (cx && cy && gs_texrender_begin(item->crop_render, cx, cy)) {
-			float cx_scale = (float)width  / (float)cx;
-			float cy_scale = (float)height / (float)cy;
-			struct vec4 clear_color;
+static void render_item_texture(struct obs_scene_item *item,
+		gs_texrender_t *texrender, uint32_t width, uint32_t height)
+{
+	uint32_t cx = calc_cx(item, width);
+	uint32_t cy = calc_cy(item, height);
+
+	if (cx && cy && gs_texrender_begin(texrender, cx, cy)) {
+		float cx_scale = (float)width  / (float)cx;
+		float cy_scale = (float)height / (float)cy;
+		struct vec4 clear_color;
 
-			vec4_zero(&clear_color);
-			gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
-			gs_ortho(0.0f, (float)width, 0.0f, (float)height,
-					-100.0f, 100.0f);
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)width, 0.0f, (float)height,
+				-100.0f, 100.0f);
 
-			gs_matrix_scale3f(cx_scale, cy_scale, 1.0f);
-			gs_matrix_translate3f(
-					-(float)item->crop.left,
-					-(float)item->crop.top,
-					0.0f);
+		gs_matrix_scale3f(cx_scale, cy_scale, 1.0f);
+		gs_matrix_translate3f(
+				-(float)item->crop.left,
+				-(float)item->crop.top,
+				0.0f);
 
-			obs_source_video_render(item->source);
-			gs_texrender_end(item->crop_render);
+		obs_source_video_render(item->source);
+		gs_texrender_end(texrender);
+	}
+}
+
+/* returns the cached render of the item while its source is static, reset if
+ * the source has changed since it was last drawn */
+static gs_texrender_t *get_item_cache(struct obs_scene_item *item,
+		uint32_t width, uint32_t height)
+{
+	long revision;
+
+	/* nested scenes cache themselves */
+	if (!width || !height ||
+	    item->source->info.type == OBS_SOURCE_TYPE_SCENE ||
+	    !obs_source_video_static(item->source, &revision)) {
+		if (item->cache_render) {
+			gs_texrender_destroy(item->cache_render);
+			item->cache_render = NULL;
 		}
+		return NULL;
+	}
+
+	if (!item->cache_render) {
+		item->cache_render = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+		if (!item->cache_render)
+			return NULL;
+
+	} else if (item->cache_revision == revision &&
+	           item->cache_width    == width &&
+	           item->cache_height   == height &&
+	           crop_equal(&item->cache_crop, &item->crop)) {
+		return item->cache_render;
+	}
+
+	gs_texrender_reset(item->cache_render);
+	item->cache_revision = revision;
+	item->cache_width    = width;
+	item->cache_height   = height;
+	item->cache_crop     = item->crop;
+	item->atlas_dirty    = true;
+	return item->cache_render;
+}
+
+/* renders into a cache premultiply color as it's drawn and blend alpha the
+ * same way, so that the cache holds what its layers cover rather than a sum
+ * of their alpha */
+static inline void set_cache_blend_state(void)
+{
+	gs_enable_blending(true);
+	gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA,
+			GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+}
+
+/* scenes nested in a cache that aren't cached themselves blend like the cache
+ * they're drawn into.  only used on the graphics thread */
+static int cache_render_depth = 0;
+
+static inline void begin_cache_render(void)
+{
+	gs_blend_state_push();
+	set_cache_blend_state();
+	cache_render_depth++;
+}
+
+static inline void end_cache_render(void)
+{
+	cache_render_depth--;
+	gs_blend_state_pop();
+}
+
+/* cached renders are premultiplied, so they're drawn as they are */
+static inline void draw_cache(gs_texrender_t *texrender)
+{
+	gs_effect_t  *effect = obs->video.default_effect;
+	gs_texture_t *tex    = gs_texrender_get_texture(texrender);
+
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	while (gs_effect_loop(effect, "Draw"))
+		obs_source_draw(tex, 0, 0, 0, 0, 0);
+
+	gs_blend_state_pop();
+}
+
+#define ATLAS_SIZE          2048
+#define ATLAS_MAX_ITEM_SIZE 256
+#define BATCH_MAX_ITEMS     256
+
+/* each region keeps a 1 pixel border around it so that linear filtering at
+ * its edges doesn't pick up its neighbours */
+static bool atlas_alloc(struct obs_scene *scene, uint32_t cx, uint32_t cy,
+		uint32_t *x, uint32_t *y)
+{
+	uint32_t region_cx = cx + 2;
+	uint32_t region_cy = cy + 2;
+
+	if (scene->atlas_x + region_cx > ATLAS_SIZE) {
+		scene->atlas_x          = 0;
+		scene->atlas_y         += scene->atlas_row_height;
+		scene->atlas_row_height = 0;
+	}
+
+	if (scene->atlas_y + region_cy > ATLAS_SIZE) {
+		scene->atlas_full = true;
+		return false;
+	}
+
+	*x = scene->atlas_x + 1;
+	*y = scene->atlas_y + 1;
+
+	scene->atlas_x += region_cx;
+	if (region_cy > scene->atlas_row_height)
+		scene->atlas_row_height = region_cy;
+	return true;
+}
+
+/* regions aren't freed individually, instead the whole atlas is repacked on
+ * the next frame once it fills up */
+static inline void begin_atlas_frame(struct obs_scene *scene)
+{
+	if (scene->atlas_repack) {
+		scene->atlas_x          = 0;
+		scene->atlas_y          = 0;
+		scene->atlas_row_height = 0;
+		scene->atlas_repack     = false;
+		scene->atlas_generation++;
+	}
+
+	scene->atlas_full  = false;
+	scene->atlas_items = 0;
+}
+
+/* if the same items fill the atlas again after it was repacked for them,
+ * they don't all fit.  repacking again would only copy every one of them
+ * again, so the atlas is left as it is and the ones without a region are
+ * drawn by themselves until the items change */
+static inline void end_atlas_frame(struct obs_scene *scene)
+{
+	if (scene->atlas_full &&
+	    scene->atlas_items != scene->atlas_full_items) {
+		scene->atlas_full_items = scene->atlas_items;
+		scene->atlas_repack     = true;
+	}
+}
+
+static inline void add_atlas_item(struct obs_scene *scene,
+		const struct obs_scene_item *item, uint32_t cx, uint32_t cy)
+{
+	uint64_t val = (uint64_t)(uintptr_t)item ^
+		((uint64_t)cx << 32 | (uint64_t)cy);
+
+	scene->atlas_items = (scene->atlas_items ^ val) * 0x100000001B3ULL;
+}
+
+/* copies the texture along with its edges into the border around it, which
+ * makes filtering at the edges match clamped sampling of the texture */
+static void copy_to_atlas(gs_texture_t *atlas, uint32_t x, uint32_t y,
+		gs_texture_t *tex, uint32_t cx, uint32_t cy)
+{
+	uint32_t r = cx - 1;
+	uint32_t b = cy - 1;
+
+	gs_copy_texture_region(atlas, x, y, tex, 0, 0, cx, cy);
+
+	gs_copy_texture_region(atlas, x - 1,  y,      tex, 0, 0, 1,  cy);
+	gs_copy_texture_region(atlas, x + cx, y,      tex, r, 0, 1,  cy);
+	gs_copy_texture_region(atlas, x,      y - 1,  tex, 0, 0, cx, 1);
+	gs_copy_texture_region(atlas, x,      y + cy, tex, 0, b, cx, 1);
+
+	gs_copy_texture_region(atlas, x - 1,  y - 1,  tex, 0, 0, 1, 1);
+	gs_copy_texture_region(atlas, x + cx, y - 1,  tex, r, 0, 1, 1);
+	gs_copy_texture_region(atlas, x - 1,  y + cy, tex, 0, b, 1, 1);
+	gs_copy_texture_region(atlas, x + cx, y + cy, tex, r, b, 1, 1);
+}
+
+static gs_vertbuffer_t *create_batch_vb(void)
+{
+	struct gs_vb_data *vbd;
+	size_t num = BATCH_MAX_ITEMS * 6;
+
+	vbd = gs_vbdata_create();
+	vbd->num     = num;
+	vbd->points  = bzalloc(sizeof(struct vec3) * num);
+	vbd->num_tex = 1;
+	vbd->tvarray = bzalloc(sizeof(struct gs_tvertarray));
+	vbd->tvarray[0].width = 2;
+	vbd->tvarray[0].array = bzalloc(sizeof(struct vec2) * num);
+
+	return gs_vertexbuffer_create(vbd, GS_DYNAMIC);
+}
+
+/* draws all of the queued atlas quads with one draw call */
+static void flush_batch(struct obs_scene *scene)
+{
+	gs_effect_t *effect = obs->video.default_effect;
+	gs_eparam_t *image;
+
+	if (!scene->batch_count)
+		return;
+
+	gs_vertexbuffer_flush(scene->batch_vb);
+	gs_load_vertexbuffer(scene->batch_vb);
+	gs_load_indexbuffer(NULL);
+
+	image = gs_effect_get_param_by_name(effect, "image");
+	gs_effect_set_texture(image, scene->atlas);
+
+	/* the atlas is copied from the item caches, so it's premultiplied */
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw(GS_TRIS, 0, (uint32_t)scene->batch_count * 6);
+
+	gs_blend_state_pop();
+	scene->batch_count = 0;
+}
+
+/* the quad is transformed on the CPU so that items with different
+ * transforms can share a draw call */
+static void add_batch_quad(struct obs_scene *scene,
+		const struct obs_scene_item *item)
+{
+	struct gs_vb_data *data = gs_vertexbuffer_get_data(scene->batch_vb);
+	struct vec3 *points = data->points + scene->batch_count * 6;
+	struct vec2 *uvs    = data->tvarray[0].array;
+	struct vec3 corners[4];
+	struct vec2 uv[4];
+	float scale = 1.0f / (float)ATLAS_SIZE;
+	float l = (float)item->atlas_x * scale;
+	float t = (float)item->atlas_y * scale;
+	float r = (float)(item->atlas_x + item->atlas_cx) * scale;
+	float b = (float)(item->atlas_y + item->atlas_cy) * scale;
+	static const int order[6] = {0, 1, 2, 2, 1, 3};
+
+	float cx = (float)item->atlas_cx;
+	float cy = (float)item->atlas_cy;
+
+	vec3_set(&corners[0], 0.0f, 0.0f, 0.0f);
+	vec3_set(&corners[1], cx,   0.0f, 0.0f);
+	vec3_set(&corners[2], 0.0f, cy,   0.0f);
+	vec3_set(&corners[3], cx,   cy,   0.0f);
+
+	vec2_set(&uv[0], l, t);
+	vec2_set(&uv[1], r, t);
+	vec2_set(&uv[2], l, b);
+	vec2_set(&uv[3], r, b);
+
+	for (size_t i = 0; i < 4; i++)
+		vec3_transform(&corners[i], &corners[i],
+				&item->draw_transform);
+
+	uvs += scene->batch_count * 6;
+	for (size_t i = 0; i < 6; i++) {
+		points[i] = corners[order[i]];
+		uvs[i]    = uv[order[i]];
+	}
+
+	if (++scene->batch_count == BATCH_MAX_ITEMS)
+		flush_batch(scene);
+}
+
+/* queues the cached render of a small item for a batched draw, copying it
+ * into the atlas first if it changed.  returns false if the item has to be
+ * drawn by itself */
+static bool batch_cached_item(struct obs_scene *scene,
+		struct obs_scene_item *item, gs_texrender_t *cache)
+{
+	gs_texture_t *tex = gs_texrender_get_texture(cache);
+	uint32_t cx, cy;
+
+	if (!tex)
+		return false;
+
+	cx = gs_texture_get_width(tex);
+	cy = gs_texture_get_height(tex);
+	if (cx > ATLAS_MAX_ITEM_SIZE || cy > ATLAS_MAX_ITEM_SIZE)
+		return false;
+
+	if (!scene->atlas) {
+		scene->atlas = gs_texture_create(ATLAS_SIZE, ATLAS_SIZE,
+				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
+		if (!scene->atlas)
+			return false;
+	}
+
+	if (!scene->batch_vb) {
+		scene->batch_vb = create_batch_vb();
+		if (!scene->batch_vb)
+			return false;
+	}
+
+	add_atlas_item(scene, item, cx, cy);
+
+	if (item->atlas_generation != scene->atlas_generation ||
+	    item->atlas_cx != cx || item->atlas_cy != cy) {
+		if (!atlas_alloc(scene, cx, cy, &item->atlas_x, &item->atlas_y))
+			return false;
+
+		item->atlas_generation = scene->atlas_generation;
+		item->atlas_cx         = cx;
+		item->atlas_cy         = cy;
+		item->atlas_dirty      = true;
 	}
 
+	if (item->atlas_dirty) {
+		copy_to_atlas(scene->atlas, item->atlas_x, item->atlas_y,
+				tex, cx, cy);
+		item->atlas_dirty = false;
+	}
+
+	add_batch_quad(scene, item);
+	return true;
+}
+
+static inline void render_item(struct obs_scene *scene,
+		struct obs_scene_item *item)
+{
+	uint32_t width  = obs_source_get_width(item->source);
+	uint32_t height = obs_source_get_height(item->source);
+	gs_texrender_t *cache = get_item_cache(item, width, height);
+
+	if (cache) {
+		begin_cache_render();
+		render_item_texture(item, cache, width, height);
+		end_cache_render();
+	} else if (item->crop_render)
+		render_item_texture(item, item->crop_render, width, height);
+
+	if (cache && batch_cached_item(scene, item, cache))
+		return;
+
+	/* anything queued before this item has to be drawn under it */
+	flush_batch(scene);
+
 	gs_matrix_push();
 	gs_matrix_mul(&item->draw_transform);
-	if (item->crop_render) {
+	if (cache) {
+		draw_cache(cache);
+	} else if (item->crop_render) {
 		gs_texture_t *tex = gs_texrender_get_texture(item->crop_render);
 
 		while (gs_effect_loop(obs->video.default_effect, "Draw"))
@@ -442,19 +797,17 @@ static void scene_video_tick(void *data, float seconds)
 	UNUSED_PARAMETER(seconds);
 }
 
-static void scene_video_render(void *data, gs_effect_t *effect)
+static void render_items(struct obs_scene *scene, struct darray *remove_items)
 {
-	DARRAY(struct obs_scene_item*) remove_items;
-	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
-
-	da_init(remove_items);
-
-	video_lock(scene);
-	item = scene->first_item;
+	struct obs_scene_item *item = scene->first_item;
 
 	gs_blend_state_push();
-	gs_reset_blend_state();
+	if (cache_render_depth)
+		set_cache_blend_state();
+	else
+		gs_reset_blend_state();
+
+	begin_atlas_frame(scene);
 
 	while (item) {
 		if (obs_source_removed(item->source)) {
@@ -462,7 +815,8 @@ static void scene_video_render(void *data, gs_effect_t *effect)
 			item = item->next;
 
 			remove_without_release(del_item);
-			da_push_back(remove_items, &del_item);
+			darray_push_back(sizeof(struct obs_scene_item*),
+					remove_items, &del_item);
 			continue;
 		}
 
@@ -470,12 +824,117 @@ static void scene_video_render(void *data, gs_effect_t *effect)
 			update_item_transform(item);
 
 		if (item->user_visible)
-			render_item(item);
+			render_item(scene, item);
 
 		item = item->next;
 	}
 
+	flush_batch(scene);
+	end_atlas_frame(scene);
 	gs_blend_state_pop();
+}
+
+static bool item_inside_canvas(const struct obs_scene_item *item,
+		float width, float height)
+{
+	struct vec3 corner;
+
+	for (int i = 0; i < 4; i++) {
+		vec3_set(&corner, (float)(i & 1), (float)(i >> 1), 0.0f);
+		vec3_transform(&corner, &corner, &item->box_transform);
+
+		if (corner.x < 0.0f || corner.x > width ||
+		    corner.y < 0.0f || corner.y > height)
+			return false;
+	}
+
+	return true;
+}
+
+/* the cache is the size of the canvas, so a scene with items outside of it
+ * (as nested scenes often have) is drawn directly to not clip them */
+static bool items_inside_canvas(struct obs_scene *scene,
+		uint32_t width, uint32_t height)
+{
+	struct obs_scene_item *item = scene->first_item;
+
+	while (item) {
+		if (item->user_visible &&
+		    !item_inside_canvas(item, (float)width, (float)height))
+			return false;
+
+		item = item->next;
+	}
+
+	return true;
+}
+
+/* returns the cached render of the scene while all of its visible items are
+ * static, reset if any of them changed since it was last drawn */
+static gs_texrender_t *get_scene_cache(struct obs_scene *scene,
+		uint32_t width, uint32_t height)
+{
+	long revision;
+
+	if (!width || !height || !obs_scene_video_static(scene, &revision) ||
+	    !items_inside_canvas(scene, width, height)) {
+		if (scene->cache_render) {
+			gs_texrender_destroy(scene->cache_render);
+			scene->cache_render = NULL;
+		}
+		return NULL;
+	}
+
+	if (!scene->cache_render) {
+		scene->cache_render = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+		if (!scene->cache_render)
+			return NULL;
+
+	} else if (scene->cache_revision == revision &&
+	           scene->cache_width    == width &&
+	           scene->cache_height   == height) {
+		return scene->cache_render;
+	}
+
+	gs_texrender_reset(scene->cache_render);
+	scene->cache_revision = revision;
+	scene->cache_width    = width;
+	scene->cache_height   = height;
+	return scene->cache_render;
+}
+
+static void scene_video_render(void *data, gs_effect_t *effect)
+{
+	DARRAY(struct obs_scene_item*) remove_items;
+	struct obs_scene *scene = data;
+	uint32_t width  = obs->video.base_width;
+	uint32_t height = obs->video.base_height;
+	gs_texrender_t *cache;
+
+	da_init(remove_items);
+
+	video_lock(scene);
+
+	cache = get_scene_cache(scene, width, height);
+	if (!cache) {
+		render_items(scene, &remove_items.da);
+
+	} else if (gs_texrender_begin(cache, width, height)) {
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)width, 0.0f, (float)height,
+				-100.0f, 100.0f);
+
+		begin_cache_render();
+		render_items(scene, &remove_items.da);
+		end_cache_render();
+		gs_texrender_end(cache);
+	}
+
+	if (cache)
+		draw_cache(cache);
 
 	video_unlock(scene);
 
@@ -486,6 +945,42 @@ static void scene_video_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+bool obs_scene_video_static(obs_scene_t *scene, long *revision)
+{
+	struct obs_scene_item *item;
+	long cur_revision;
+	bool is_static = true;
+
+	cur_revision = os_atomic_load_long(&scene->source->video_revision);
+
+	video_lock(scene);
+
+	item = scene->first_item;
+	while (item && is_static) {
+		long item_revision;
+
+		/* removed items and size changes are handled by render_items,
+		 * which invalidates the scene */
+		if (obs_source_removed(item->source) ||
+		    source_size_changed(item)) {
+			is_static = false;
+
+		} else if (item->user_visible) {
+			is_static = obs_source_video_static(item->source,
+					&item_revision);
+			if (item_revision > cur_revision)
+				cur_revision = item_revision;
+		}
+
+		item = item->next;
+	}
+
+	video_unlock(scene);
+
+	*revision = cur_revision;
+	return is_static;
+}
+
 static void set_visibility(struct obs_scene_item *item, bool vis)
 {
 	pthread_mutex_lock(&item->actions_mutex);
@@ -504,6 +999,9 @@ static void set_visibility(struct obs_scene_item *item, bool vis)
 	item->visible = vis;
 	item->user_visible = vis;
 
+	if (item->parent)
+		obs_source_invalidate_video(item->parent->source);
+
 	pthread_mutex_unlock(&item->actions_mutex);
 }
 
@@ -1212,6 +1710,8 @@ obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source)
 
 	full_unlock(scene);
 
+	obs_source_invalidate_video(scene->source);
+
 	if (!scene->source->context.private)
 		init_hotkeys(scene, item, obs_source_get_name(source));
 
@@ -1227,9 +1727,10 @@ obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source)
 static void obs_sceneitem_destroy(obs_sceneitem_t *item)
 {
 	if (item) {
-		if (item->crop_render) {
+		if (item->crop_render || item->cache_render) {
 			obs_enter_graphics();
 			gs_texrender_destroy(item->crop_render);
+			gs_texrender_destroy(item->cache_render);
 			obs_leave_graphics();
 		}
 		obs_hotkey_pair_unregister(item->toggle_visibility);
@@ -1585,6 +2086,7 @@ bool obs_sceneitem_set_visible(obs_sceneitem_t *item, bool visible)
 	}
 
 	item->user_visible = visible;
+	obs_source_invalidate_video(item->parent->source);
 
 	calldata_init_fixed(&cd, stack, sizeof(stack));
 	calldata_set_ptr(&cd, "scene", item->parent);
@@ -1663,6 +2165,7 @@ bool obs_scene_reorder_items(obs_scene_t *scene,
 		prev = item_order[i];
 	}
 
+	obs_source_invalidate_video(scene->source);
 	signal_reorder(scene->first_item);
 
 	full_unlock(scene);
@@ -1683,15 +2186,6 @@ void obs_scene_atomic_update(obs_scene_t *scene,
 	obs_scene_release(scene);
 }
 
-static inline bool crop_equal(const struct obs_sceneitem_crop *crop1,
-		const struct obs_sceneitem_crop *crop2)
-{
-	return crop1->left   == crop2->left  &&
-	       crop1->right  == crop2->right &&
-	       crop1->top    == crop2->top   &&
-	       crop1->bottom == crop2->bottom;
-}
-
 void obs_sceneitem_set_crop(obs_sceneitem_t *item,
 		const struct obs_sceneitem_crop *crop)
 {
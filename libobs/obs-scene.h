@@ -43,6 +43,23 @@ struct obs_scene_item {
 	gs_texrender_t        *crop_render;
 	struct obs_sceneitem_crop crop;
 
+	/* render of a static source, reused until its revision, size or crop
+	 * changes */
+	gs_texrender_t        *cache_render;
+	long                  cache_revision;
+	uint32_t              cache_width;
+	uint32_t              cache_height;
+	struct obs_sceneitem_crop cache_crop;
+
+	/* where the cached render was copied to in the parent's atlas, valid
+	 * while atlas_generation matches the parent's */
+	long                  atlas_generation;
+	uint32_t              atlas_x;
+	uint32_t              atlas_y;
+	uint32_t              atlas_cx;
+	uint32_t              atlas_cy;
+	bool                  atlas_dirty;
+
 	struct vec2           pos;
 	struct vec2           scale;
 	float                 rot;
@@ -76,4 +93,28 @@ struct obs_scene {
 	pthread_mutex_t       video_mutex;
 	pthread_mutex_t       audio_mutex;
 	struct obs_scene_item *first_item;
+
+	/* render of the whole scene while all of its items are static */
+	gs_texrender_t        *cache_render;
+	long                  cache_revision;
+	uint32_t              cache_width;
+	uint32_t              cache_height;
+
+	/* cached renders of small static items, packed in rows so that runs
+	 * of them can be drawn in a single batch */
+	gs_texture_t          *atlas;
+	long                  atlas_generation;
+	uint32_t              atlas_x;
+	uint32_t              atlas_y;
+	uint32_t              atlas_row_height;
+	bool                  atlas_full;
+	bool                  atlas_repack;
+
+	/* the items that were drawn from the atlas this frame, and the ones
+	 * that last filled it up, to only repack when they changed */
+	uint64_t              atlas_items;
+	uint64_t              atlas_full_items;
+
+	gs_vertbuffer_t       *batch_vb;
+	size_t                batch_count;
 };
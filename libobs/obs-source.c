@@ -133,6 +133,8 @@ static inline bool is_composite_source(const struct obs_source *source)
 extern char *find_libobs_data_file(const char *file);
 
 /* internal initialization */
+#define DEFAULT_ASYNC_MAX_LATENCY_MS 1000
+
 bool obs_source_init(struct obs_source *source)
 {
 	pthread_mutexattr_t attr;
@@ -140,6 +142,8 @@ bool obs_source_init(struct obs_source *source)
 	source->user_volume = 1.0f;
 	source->volume = 1.0f;
 	source->sync_offset = 0;
+	source->async_queue_policy = OBS_ASYNC_QUEUE_DROP_OLDEST;
+	source->async_max_latency = DEFAULT_ASYNC_MAX_LATENCY_MS * 1000000ULL;
 	pthread_mutex_init_value(&source->filter_mutex);
 	pthread_mutex_init_value(&source->async_mutex);
 	pthread_mutex_init_value(&source->audio_mutex);
@@ -719,6 +723,7 @@ static void obs_source_deferred_update(obs_source_t *source)
 				source->context.settings);
 
 	source->defer_update = false;
+	obs_source_invalidate_video(source);
 }
 
 void obs_source_update(obs_source_t *source, obs_data_t *settings)
@@ -734,6 +739,7 @@ void obs_source_update(obs_source_t *source, obs_data_t *settings)
 	} else if (source->context.data && source->info.update) {
 		source->info.update(source->context.data,
 				source->context.settings);
+		obs_source_invalidate_video(source);
 	}
 }
 
@@ -914,12 +920,12 @@ void obs_source_deactivate(obs_source_t *source, enum view_type type)
 static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
 		uint64_t sys_time);
 
-void obs_source_video_tick(obs_source_t *source, float seconds)
+bool obs_source_video_tick(obs_source_t *source, float seconds, bool defer)
 {
 	bool now_showing, now_active;
 
 	if (!obs_source_valid(source, "obs_source_video_tick"))
-		return;
+		return false;
 
 	if (source->info.type == OBS_SOURCE_TYPE_TRANSITION)
 		obs_transition_tick(source);
@@ -977,11 +983,23 @@ void obs_source_video_tick(obs_source_t *source, float seconds)
 		source->active = now_active;
 	}
 
-	if (source->context.data && source->info.video_tick)
-		source->info.video_tick(source->context.data, seconds);
-
 	source->async_rendered = false;
 	source->deinterlace_rendered = false;
+
+	if (!source->context.data || !source->info.video_tick)
+		return false;
+
+	/* thread-safe ticks are left to the caller to run in parallel */
+	if (defer && (source->info.output_flags & OBS_SOURCE_THREADSAFE_TICK))
+		return true;
+
+	source->info.video_tick(source->context.data, seconds);
+	return false;
+}
+
+void obs_source_call_video_tick(obs_source_t *source, float seconds)
+{
+	source->info.video_tick(source->context.data, seconds);
 }
 
 /* unless the value is 3+ hours worth of frames, this won't overflow */
@@ -1592,11 +1610,17 @@ static void obs_source_draw_async_texture(struct obs_source *source)
 	}
 }
 
+static struct obs_source_frame *unlend_async_frame(obs_source_t *source,
+		struct obs_source_frame *frame);
+
 static void obs_source_update_async_video(obs_source_t *source)
 {
 	if (!source->async_rendered) {
 		struct obs_source_frame *frame = obs_source_get_frame(source);
 
+		/* a filter added while frames were lent must not keep them */
+		if (frame && frame->release && has_async_video_filters(source))
+			frame = unlend_async_frame(source, frame);
 		if (frame)
 			frame = filter_async_video(source, frame);
 
@@ -1850,6 +1874,8 @@ void obs_source_filter_add(obs_source_t *source, obs_source_t *filter)
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
+	obs_source_invalidate_video(source);
+
 	calldata_init_fixed(&cd, stack, sizeof(stack));
 	calldata_set_ptr(&cd, "source", source);
 	calldata_set_ptr(&cd, "filter", filter);
@@ -1887,6 +1913,8 @@ static bool obs_source_filter_remove_refless(obs_source_t *source,
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
+	obs_source_invalidate_video(source);
+
 	calldata_init_fixed(&cd, stack, sizeof(stack));
 	calldata_set_ptr(&cd, "source", source);
 	calldata_set_ptr(&cd, "filter", filter);
@@ -2015,8 +2043,10 @@ void obs_source_filter_set_order(obs_source_t *source, obs_source_t *filter,
 	success = move_filter_dir(source, filter, movement);
 	pthread_mutex_unlock(&source->filter_mutex);
 
-	if (success)
+	if (success) {
+		obs_source_invalidate_video(source);
 		obs_source_dosignal(source, NULL, "reorder_filters");
+	}
 }
 
 obs_data_t *obs_source_get_settings(const obs_source_t *source)
@@ -2028,6 +2058,25 @@ obs_data_t *obs_source_get_settings(const obs_source_t *source)
 	return source->context.settings;
 }
 
+bool has_async_video_filters(obs_source_t *source)
+{
+	bool has_filters = false;
+
+	pthread_mutex_lock(&source->filter_mutex);
+
+	for (size_t i = 0; i < source->filters.num; i++) {
+		struct obs_source *filter = source->filters.array[i];
+
+		if (filter->enabled && filter->info.filter_video) {
+			has_filters = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&source->filter_mutex);
+	return has_filters;
+}
+
 struct obs_source_frame *filter_async_video(obs_source_t *source,
 		struct obs_source_frame *in)
 {
@@ -2162,20 +2211,52 @@ static void clean_cache(obs_source_t *source)
 
 #define MAX_ASYNC_FRAMES 30
 
-static inline struct obs_source_frame *cache_video(struct obs_source *source,
-		const struct obs_source_frame *frame)
+static inline void drop_oldest_async_frame(struct obs_source *source)
 {
-	struct obs_source_frame *new_frame = NULL;
+	struct obs_source_frame *frame = source->async_frames.array[0];
 
-	pthread_mutex_lock(&source->async_mutex);
+	da_erase(source->async_frames, 0);
+	remove_async_frame(source, frame);
+	os_atomic_inc_long(&source->async_frames_dropped);
+}
 
-	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
-		free_async_cache(source);
-		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
-		return NULL;
+/* applies the source's queue policy, returns false if the new frame should be
+ * dropped */
+static bool make_room_for_async_frame(struct obs_source *source,
+		const struct obs_source_frame *frame)
+{
+	switch (source->async_queue_policy) {
+	case OBS_ASYNC_QUEUE_DROP_NEWEST:
+		if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
+			os_atomic_inc_long(&source->async_frames_dropped);
+			return false;
+		}
+		break;
+
+	case OBS_ASYNC_QUEUE_MAX_LATENCY:
+		while (source->async_frames.num &&
+		       frame->timestamp > source->async_frames.array[0]->
+		               timestamp + source->async_max_latency)
+			drop_oldest_async_frame(source);
+		/* fall through */
+
+	/* the policy is clamped when it's set, but never leave the queue
+	 * unbounded */
+	case OBS_ASYNC_QUEUE_DROP_OLDEST:
+	default:
+		while (source->async_frames.num >= MAX_ASYNC_FRAMES)
+			drop_oldest_async_frame(source);
+		break;
 	}
 
+	return true;
+}
+
+/* flushes the cache if the frame format changed and makes room in the queue,
+ * returns false if the new frame should be dropped */
+static inline bool prepare_async_cache(struct obs_source *source,
+		const struct obs_source_frame *frame)
+{
 	if (async_texture_changed(source, frame)) {
 		free_async_cache(source);
 		source->async_cache_width  = frame->width;
@@ -2183,6 +2264,16 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 		source->async_cache_format = frame->format;
 	}
 
+	return make_room_for_async_frame(source, frame);
+}
+
+/* returns an unused frame of the cache, or adds a new one, with a reference
+ * for the caller.  the async mutex must be locked. */
+static struct obs_source_frame *get_cache_frame(struct obs_source *source,
+		const struct obs_source_frame *frame)
+{
+	struct obs_source_frame *new_frame = NULL;
+
 	for (size_t i = 0; i < source->async_cache.num; i++) {
 		struct async_frame *af = &source->async_cache.array[i];
 		if (!af->used) {
@@ -2209,6 +2300,22 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	}
 
 	os_atomic_inc_long(&new_frame->refs);
+	return new_frame;
+}
+
+static inline struct obs_source_frame *cache_video(struct obs_source *source,
+		const struct obs_source_frame *frame)
+{
+	struct obs_source_frame *new_frame;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		return NULL;
+	}
+
+	new_frame = get_cache_frame(source, frame);
 
 	pthread_mutex_unlock(&source->async_mutex);
 
@@ -2222,6 +2329,56 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	return new_frame;
 }
 
+/* replaces a lent frame taken with obs_source_get_frame by a copy in the
+ * cache, and gives the lent planes back to the source */
+static struct obs_source_frame *unlend_async_frame(obs_source_t *source,
+		struct obs_source_frame *frame)
+{
+	struct obs_source_frame *copy;
+
+	pthread_mutex_lock(&source->async_mutex);
+	copy = get_cache_frame(source, frame);
+	pthread_mutex_unlock(&source->async_mutex);
+
+	copy_frame_data(copy, frame);
+	obs_source_release_frame(source, frame);
+	return copy;
+}
+
+static inline bool release_lent_frame(obs_source_t *source,
+		struct obs_source_frame *frame)
+{
+	if (!frame || !frame->release)
+		return false;
+
+	remove_async_frame(source, frame);
+	return true;
+}
+
+/* hands every queued lent frame back to the source; frames that are being
+ * uploaded are released by obs_source_release_frame once that finishes */
+static void release_lent_frames(obs_source_t *source)
+{
+	pthread_mutex_lock(&source->async_mutex);
+
+	for (size_t i = source->async_frames.num; i > 0; i--) {
+		struct obs_source_frame *frame =
+			source->async_frames.array[i - 1];
+
+		if (frame->release) {
+			da_erase(source->async_frames, i - 1);
+			release_lent_frame(source, frame);
+		}
+	}
+
+	if (release_lent_frame(source, source->cur_async_frame))
+		source->cur_async_frame = NULL;
+	if (release_lent_frame(source, source->prev_async_frame))
+		source->prev_async_frame = NULL;
+
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
 void obs_source_output_video(obs_source_t *source,
 		const struct obs_source_frame *frame)
 {
@@ -2230,6 +2387,7 @@ void obs_source_output_video(obs_source_t *source,
 
 	if (!frame) {
 		source->async_active = false;
+		release_lent_frames(source);
 		return;
 	}
 
@@ -2246,6 +2404,57 @@ void obs_source_output_video(obs_source_t *source,
 	}
 }
 
+/* lent frames wrap the source's own planes rather than a copy of them, and
+ * their cache entry only lives as long as the frame is queued or in use */
+void obs_source_output_video_lent(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		obs_source_frame_release_t release, void *param)
+{
+	struct obs_source_frame *output;
+	struct async_frame new_af;
+
+	if (!obs_source_valid(source, "obs_source_output_video_lent"))
+		return;
+	if (!obs_ptr_valid(frame, "obs_source_output_video_lent") ||
+	    !obs_ptr_valid(release, "obs_source_output_video_lent"))
+		return;
+
+	/* async filters may hold on to frames for as long as they like (a
+	 * delay filter keeps seconds of them), so don't lend to them */
+	if (has_async_video_filters(source)) {
+		obs_source_output_video(source, frame);
+		release(param);
+		return;
+	}
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		release(param);
+		return;
+	}
+
+	clean_cache(source);
+
+	output = bmemdup(frame, sizeof(*frame));
+	output->refs          = 1;
+	output->prev_frame    = false;
+	output->release       = release;
+	output->release_param = param;
+
+	new_af.frame        = output;
+	new_af.used         = true;
+	new_af.unused_count = 0;
+
+	da_push_back(source->async_cache, &new_af);
+	da_push_back(source->async_frames, &output);
+
+	pthread_mutex_unlock(&source->async_mutex);
+
+	source->async_active = true;
+}
+
 static inline struct obs_audio_data *filter_async_audio(obs_source_t *source,
 		struct obs_audio_data *in)
 {
@@ -2426,7 +2635,12 @@ void remove_async_frame(obs_source_t *source, struct obs_source_frame *frame)
 		struct async_frame *f = &source->async_cache.array[i];
 
 		if (f->frame == frame) {
-			f->used = false;
+			if (frame->release) {
+				da_erase(source->async_cache, i);
+				obs_source_frame_decref(frame);
+			} else {
+				f->used = false;
+			}
 			break;
 		}
 	}
@@ -2446,6 +2660,7 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 		while (source->async_frames.num > 1) {
 			da_erase(source->async_frames, 0);
 			remove_async_frame(source, next_frame);
+			os_atomic_inc_long(&source->async_frames_late);
 			next_frame = source->async_frames.array[0];
 		}
 
@@ -2482,8 +2697,10 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 		if ((source->last_frame_ts - next_frame->timestamp) < 2000000)
 			break;
 
-		if (frame)
+		if (frame) {
 			da_erase(source->async_frames, 0);
+			os_atomic_inc_long(&source->async_frames_late);
+		}
 
 #if DEBUG_ASYNC_FRAMES
 		blog(LOG_DEBUG, "new frame, "
@@ -3197,6 +3414,54 @@ void obs_source_draw(gs_texture_t *texture, int x, int y, uint32_t cx,
 		gs_matrix_pop();
 }
 
+void obs_source_invalidate_video(obs_source_t *source)
+{
+	long revision;
+
+	if (!obs_source_valid(source, "obs_source_invalidate_video"))
+		return;
+
+	revision = os_atomic_inc_long(&obs->data.video_revision);
+	os_atomic_set_long(&source->video_revision, revision);
+}
+
+bool obs_source_video_static(obs_source_t *source, long *revision)
+{
+	uint32_t flags = source->info.output_flags;
+	long cur_revision = os_atomic_load_long(&source->video_revision);
+	bool is_static;
+
+	if (source->info.type == OBS_SOURCE_TYPE_SCENE)
+		is_static = obs_scene_video_static(source->context.data,
+				&cur_revision);
+	else
+		is_static = (flags & OBS_SOURCE_STATIC_VIDEO) != 0 &&
+		            (flags & OBS_SOURCE_ASYNC) == 0;
+
+	if (is_static && source->filters.num) {
+		pthread_mutex_lock(&source->filter_mutex);
+
+		for (size_t i = 0; is_static && i < source->filters.num; i++) {
+			obs_source_t *filter = source->filters.array[i];
+			long filter_revision;
+
+			if (!filter->enabled ||
+			    (filter->info.output_flags & OBS_SOURCE_VIDEO) == 0)
+				continue;
+
+			is_static = obs_source_video_static(filter,
+					&filter_revision);
+			if (filter_revision > cur_revision)
+				cur_revision = filter_revision;
+		}
+
+		pthread_mutex_unlock(&source->filter_mutex);
+	}
+
+	*revision = cur_revision;
+	return is_static;
+}
+
 void obs_source_inc_showing(obs_source_t *source)
 {
 	if (obs_source_valid(source, "obs_source_inc_showing"))
@@ -3269,6 +3534,11 @@ void obs_source_set_enabled(obs_source_t *source, bool enabled)
 
 	source->enabled = enabled;
 
+	/* disabled filters are skipped when checking the parent's revision */
+	obs_source_invalidate_video(source);
+	if (source->filter_parent)
+		obs_source_invalidate_video(source->filter_parent);
+
 	calldata_init_fixed(&data, stack, sizeof(stack));
 	calldata_set_ptr(&data, "source", source);
 	calldata_set_bool(&data, "enabled", enabled);
@@ -3768,3 +4038,60 @@ void obs_source_remove_audio_capture_callback(obs_source_t *source,
 	da_erase_item(source->audio_cb_list, &info);
 	pthread_mutex_unlock(&source->audio_cb_mutex);
 }
+
+void obs_source_set_async_queue_policy(obs_source_t *source,
+		enum obs_async_queue_policy policy)
+{
+	if (!obs_source_valid(source, "obs_source_set_async_queue_policy"))
+		return;
+
+	/* also comes from saved scene data, which can be anything */
+	if ((int)policy < (int)OBS_ASYNC_QUEUE_DROP_OLDEST ||
+	    (int)policy > (int)OBS_ASYNC_QUEUE_MAX_LATENCY) {
+		blog(LOG_WARNING, "obs_source_set_async_queue_policy: "
+				"invalid policy %d for source '%s', using "
+				"drop oldest", (int)policy,
+				obs_source_get_name(source));
+		policy = OBS_ASYNC_QUEUE_DROP_OLDEST;
+	}
+
+	pthread_mutex_lock(&source->async_mutex);
+	source->async_queue_policy = policy;
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
+enum obs_async_queue_policy obs_source_get_async_queue_policy(
+		const obs_source_t *source)
+{
+	return obs_source_valid(source, "obs_source_get_async_queue_policy") ?
+		source->async_queue_policy : OBS_ASYNC_QUEUE_DROP_OLDEST;
+}
+
+void obs_source_set_async_max_latency(obs_source_t *source, uint32_t ms)
+{
+	if (!obs_source_valid(source, "obs_source_set_async_max_latency"))
+		return;
+
+	pthread_mutex_lock(&source->async_mutex);
+	source->async_max_latency = (uint64_t)ms * 1000000ULL;
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
+uint32_t obs_source_get_async_max_latency(const obs_source_t *source)
+{
+	return obs_source_valid(source, "obs_source_get_async_max_latency") ?
+		(uint32_t)(source->async_max_latency / 1000000ULL) : 0;
+}
+
+uint32_t obs_source_get_async_frames_dropped(const obs_source_t *source)
+{
+	return obs_source_valid(source, "obs_source_get_async_frames_dropped") ?
+		(uint32_t)os_atomic_load_long(&source->async_frames_dropped) :
+		0;
+}
+
+uint32_t obs_source_get_async_frames_late(const obs_source_t *source)
+{
+	return obs_source_valid(source, "obs_source_get_async_frames_late") ?
+		(uint32_t)os_atomic_load_long(&source->async_frames_late) : 0;
+}
@@ -115,6 +115,34 @@ enum obs_source_type {
  */
 #define OBS_SOURCE_DO_NOT_DUPLICATE (1<<7)
 
+/**
+ * Source video_tick callback is thread-safe
+ *
+ * When used specifies that the video_tick callback only touches the source's
+ * own data and does not need to be called on the graphics thread.  Ticks of
+ * sources with this flag may then be called from worker threads, in parallel
+ * with each other and with the ticks of other sources.
+ *
+ * The tick must not call functions that lock the source list (such as
+ * obs_get_source_by_name), as the graphics thread holds it while waiting on
+ * the ticks.  obs_enter_graphics may be used, but serializes the tick against
+ * any other thread using the graphics subsystem, so uploads should
+ * preferably be left to video_render.
+ */
+#define OBS_SOURCE_THREADSAFE_TICK (1<<8)
+
+/**
+ * Source video is static
+ *
+ * When used specifies that the source's video only changes when its settings
+ * are updated or when it calls obs_source_invalidate_video, so scenes can
+ * render it once and reuse the result until then.  Filters may use this flag
+ * when their output only depends on their input and settings.
+ *
+ * This capability flag is ignored for asynchronous video sources.
+ */
+#define OBS_SOURCE_STATIC_VIDEO (1<<9)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
@@ -21,9 +21,129 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 
+static const char *tick_worker_name = "tick_worker";
+
+static void run_ticks(struct obs_tick_pool *pool)
+{
+	for (;;) {
+		size_t idx = (size_t)os_atomic_inc_long(&pool->next) - 1;
+		if (idx >= pool->queue.num)
+			break;
+
+		obs_source_call_video_tick(pool->queue.array[idx],
+				pool->seconds);
+	}
+}
+
+static void *tick_worker(void *param)
+{
+	struct obs_tick_pool *pool = param;
+
+	os_set_thread_name("libobs: tick worker");
+
+	for (;;) {
+		os_sem_wait(pool->start);
+		if (pool->stop)
+			break;
+
+		profile_start(tick_worker_name);
+		run_ticks(pool);
+		profile_end(tick_worker_name);
+
+		profile_reenable_thread();
+
+		os_sem_post(pool->done);
+	}
+
+	return NULL;
+}
+
+static bool ensure_tick_workers(struct obs_tick_pool *pool)
+{
+	size_t count;
+
+	if (pool->num_workers || pool->stop)
+		return pool->num_workers > 0;
+
+	count = (size_t)os_get_logical_cores() / 2;
+	if (count > AUTO_TICK_THREADS)
+		count = AUTO_TICK_THREADS;
+	if (count < 2) {
+		pool->stop = true;
+		return false;
+	}
+
+	/* the graphics thread runs ticks as well */
+	count--;
+
+	if (os_sem_init(&pool->start, 0) != 0 ||
+	    os_sem_init(&pool->done, 0) != 0) {
+		pool->stop = true;
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (pthread_create(&pool->workers[i], NULL, tick_worker,
+					pool) != 0)
+			break;
+		pool->num_workers++;
+	}
+
+	if (pool->num_workers < count)
+		blog(LOG_WARNING, "tick_sources: only started %d of %d "
+		                  "worker threads",
+		                  (int)pool->num_workers, (int)count);
+
+	/* don't retry every frame if no thread could be started */
+	if (!pool->num_workers)
+		pool->stop = true;
+
+	return pool->num_workers > 0;
+}
+
+static void free_tick_workers(struct obs_tick_pool *pool)
+{
+	pool->stop = true;
+
+	for (size_t i = 0; i < pool->num_workers; i++)
+		os_sem_post(pool->start);
+	for (size_t i = 0; i < pool->num_workers; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	os_sem_destroy(pool->start);
+	os_sem_destroy(pool->done);
+	da_free(pool->queue);
+	memset(pool, 0, sizeof(*pool));
+}
+
+/* the graphics thread only waits for the slowest of the queued ticks: workers
+ * and the graphics thread all pull from the same queue until it's empty */
+static void run_parallel_ticks(struct obs_tick_pool *pool, float seconds)
+{
+	size_t wake = 0;
+
+	pool->seconds = seconds;
+	os_atomic_set_long(&pool->next, 0);
+
+	if (pool->queue.num > 1 && ensure_tick_workers(pool)) {
+		wake = pool->queue.num - 1;
+		if (wake > pool->num_workers)
+			wake = pool->num_workers;
+	}
+
+	for (size_t i = 0; i < wake; i++)
+		os_sem_post(pool->start);
+
+	run_ticks(pool);
+
+	for (size_t i = 0; i < wake; i++)
+		os_sem_wait(pool->done);
+}
+
 static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 {
 	struct obs_core_data *data = &obs->data;
+	struct obs_tick_pool *pool = &obs->video.tick_pool;
 	struct obs_source    *source;
 	uint64_t             delta_time;
 	float                seconds;
@@ -37,13 +157,20 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 
 	pthread_mutex_lock(&data->sources_mutex);
 
-	/* call the tick function of each source */
+	/* call the tick function of each source, queueing up thread-safe
+	 * ticks to run in parallel once the rest are done */
+	da_resize(pool->queue, 0);
+
 	source = data->first_source;
 	while (source) {
-		obs_source_video_tick(source, seconds);
+		if (obs_source_video_tick(source, seconds, true))
+			da_push_back(pool->queue, &source);
 		source = (struct obs_source*)source->context.next;
 	}
 
+	if (pool->queue.num)
+		run_parallel_ticks(pool, seconds);
+
 	pthread_mutex_unlock(&data->sources_mutex);
 
 	return cur_time;
@@ -84,11 +211,13 @@ static inline void set_render_size(uint32_t width, uint32_t height)
 	gs_set_viewport(0, 0, width, height);
 }
 
-static inline void unmap_last_surface(struct obs_core_video *video)
+static inline void unmap_last_surfaces(struct obs_core_video *video)
 {
-	if (video->mapped_surface) {
-		gs_stagesurface_unmap(video->mapped_surface);
-		video->mapped_surface = NULL;
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (video->mapped_surfaces[c]) {
+			gs_stagesurface_unmap(video->mapped_surfaces[c]);
+			video->mapped_surfaces[c] = NULL;
+		}
 	}
 }
 
@@ -217,52 +346,56 @@ static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
 	gs_effect_set_float(param, val);
 }
 
-static const char *render_convert_texture_name = "render_convert_texture";
-static void render_convert_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+static void render_convert_plane(struct obs_core_video *video,
+		gs_texture_t *texture, int cur_texture, size_t plane)
 {
-	profile_start(render_convert_texture_name);
-
-	gs_texture_t *texture = video->output_textures[prev_texture];
-	gs_texture_t *target  = video->convert_textures[cur_texture];
-	float        fwidth  = (float)video->output_width;
-	float        fheight = (float)video->output_height;
+	gs_texture_t *target = video->convert_textures[cur_texture][plane];
+	uint32_t     width   = video->plane_widths[plane];
+	uint32_t     height  = video->plane_heights[plane];
 	size_t       passes, i;
 
 	gs_effect_t    *effect  = video->conversion_effect;
 	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
 	gs_technique_t *tech    = gs_effect_get_technique(effect,
-			video->conversion_tech);
+			video->conversion_techs[plane]);
 
-	if (!video->textures_output[prev_texture])
-		goto end;
-
-	set_eparam(effect, "u_plane_offset", (float)video->plane_offsets[1]);
-	set_eparam(effect, "v_plane_offset", (float)video->plane_offsets[2]);
-	set_eparam(effect, "width",  fwidth);
-	set_eparam(effect, "height", fheight);
-	set_eparam(effect, "width_i",  1.0f / fwidth);
-	set_eparam(effect, "height_i", 1.0f / fheight);
-	set_eparam(effect, "width_d2",  fwidth  * 0.5f);
-	set_eparam(effect, "height_d2", fheight * 0.5f);
-	set_eparam(effect, "width_d2_i",  1.0f / (fwidth  * 0.5f));
-	set_eparam(effect, "height_d2_i", 1.0f / (fheight * 0.5f));
-	set_eparam(effect, "input_height", (float)video->conversion_height);
+	set_eparam(effect, "width",   (float)width);
+	set_eparam(effect, "width_i", 1.0f / (float)width);
 
 	gs_effect_set_texture(image, texture);
 
 	gs_set_render_target(target, NULL);
-	set_render_size(video->output_width, video->conversion_height);
+	set_render_size(width, height);
 
-	gs_enable_blending(false);
 	passes = gs_technique_begin(tech);
 	for (i = 0; i < passes; i++) {
 		gs_technique_begin_pass(tech, i);
-		gs_draw_sprite(texture, 0, video->output_width,
-				video->conversion_height);
+		gs_draw_sprite(texture, 0, width, height);
 		gs_technique_end_pass(tech);
 	}
 	gs_technique_end(tech);
+}
+
+static const char *render_convert_texture_name = "render_convert_texture";
+static void render_convert_texture(struct obs_core_video *video,
+		int cur_texture, int prev_texture)
+{
+	profile_start(render_convert_texture_name);
+
+	gs_texture_t *texture = video->output_textures[prev_texture];
+
+	if (!video->textures_output[prev_texture])
+		goto end;
+
+	/* one pass per plane, each into its own target, so the staged planes
+	 * can be handed to the encoder without any CPU-side fix-up */
+	gs_enable_blending(false);
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (!video->plane_widths[c])
+			break;
+
+		render_convert_plane(video, texture, cur_texture, c);
+	}
 	gs_enable_blending(true);
 
 	video->textures_converted[cur_texture] = true;
@@ -273,30 +406,43 @@ end:
 
 static const char *stage_output_texture_name = "stage_output_texture";
 static inline void stage_output_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+		int prev_texture)
 {
 	profile_start(stage_output_texture_name);
 
-	gs_texture_t   *texture;
+	gs_stagesurf_t **copies;
 	bool        texture_ready;
-	gs_stagesurf_t *copy = video->copy_surfaces[cur_texture];
+	int         cur_copy = video->cur_copy;
 
-	if (video->gpu_conversion) {
-		texture = video->convert_textures[prev_texture];
+	copies = video->copy_surfaces[cur_copy];
+
+	if (video->gpu_conversion)
 		texture_ready = video->textures_converted[prev_texture];
-	} else {
-		texture = video->output_textures[prev_texture];
-		texture_ready = video->output_textures[prev_texture];
-	}
+	else
+		texture_ready = video->textures_output[prev_texture];
+
+	/* the surfaces mapped last frame are the ones about to be reused */
+	unmap_last_surfaces(video);
 
-	unmap_last_surface(video);
+	video->textures_copied[cur_copy] = false;
 
 	if (!texture_ready)
 		goto end;
 
-	gs_stage_texture(copy, texture);
+	if (video->gpu_conversion) {
+		for (size_t c = 0; c < NUM_CHANNELS; c++) {
+			if (!copies[c])
+				break;
 
-	video->textures_copied[cur_texture] = true;
+			gs_stage_texture(copies[c],
+					video->convert_textures[prev_texture][c]);
+		}
+	} else {
+		gs_stage_texture(copies[0],
+				video->output_textures[prev_texture]);
+	}
+
+	video->textures_copied[cur_copy] = true;
 
 end:
 	profile_end(stage_output_texture_name);
@@ -315,7 +461,7 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	if (video->gpu_conversion)
 		render_convert_texture(video, cur_texture, prev_texture);
 
-	stage_output_texture(video, cur_texture, prev_texture);
+	stage_output_texture(video, prev_texture);
 
 	gs_set_render_target(NULL, NULL);
 	gs_enable_blending(true);
@@ -323,98 +469,90 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	gs_end_scene();
 }
 
-static inline bool download_frame(struct obs_core_video *video,
-		int prev_texture, struct video_data *frame)
-{
-	gs_stagesurf_t *surface = video->copy_surfaces[prev_texture];
-
-	if (!video->textures_copied[prev_texture])
-		return false;
-
-	if (!gs_stagesurface_map(surface, &frame->data[0], &frame->linesize[0]))
-		return false;
-
-	video->mapped_surface = surface;
-	return true;
-}
-
-static inline uint32_t calc_linesize(uint32_t pos, uint32_t linesize)
+/* the oldest staged surface in the readback ring is mapped, which gives the
+ * GPU (readback_depth - 1) frames to finish the copy before we touch it */
+static inline int oldest_copy_slot(const struct obs_core_video *video)
 {
-	uint32_t size = pos % linesize;
-	return size ? size : linesize;
+	return (video->cur_copy + 1) % video->readback_depth;
 }
 
-static void copy_dealign(
-		uint8_t *dst, uint32_t dst_pos, uint32_t dst_linesize,
-		const uint8_t *src, uint32_t src_pos, uint32_t src_linesize,
-		uint32_t remaining)
+static inline bool copies_ready(gs_stagesurf_t **copies)
 {
-	while (remaining) {
-		uint32_t src_remainder = src_pos % src_linesize;
-		uint32_t dst_offset = dst_linesize - src_remainder;
-		uint32_t src_offset = src_linesize - src_remainder;
-
-		if (remaining < dst_offset) {
-			memcpy(dst + dst_pos, src + src_pos, remaining);
-			src_pos += remaining;
-			dst_pos += remaining;
-			remaining = 0;
-		} else {
-			memcpy(dst + dst_pos, src + src_pos, dst_offset);
-			src_pos += src_offset;
-			dst_pos += dst_offset;
-			remaining -= dst_offset;
-		}
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (copies[c] && !gs_stagesurface_ready(copies[c]))
+			return false;
 	}
-}
 
-static inline uint32_t make_aligned_linesize_offset(uint32_t offset,
-		uint32_t dst_linesize, uint32_t src_linesize)
-{
-	uint32_t remainder = offset % dst_linesize;
-	return (offset / dst_linesize) * src_linesize + remainder;
+	return true;
 }
 
-static void fix_gpu_converted_alignment(struct obs_core_video *video,
-		struct video_frame *output, const struct video_data *input)
+static inline bool download_frame(struct obs_core_video *video,
+		struct video_data *frame)
 {
-	uint32_t src_linesize = input->linesize[0];
-	uint32_t dst_linesize = output->linesize[0] * 4;
-	uint32_t src_pos      = 0;
+	int            slot     = oldest_copy_slot(video);
+	gs_stagesurf_t **copies = video->copy_surfaces[slot];
+	const char     *name    = video->copy_map_names[slot];
+	bool           success  = true;
+
+	if (!video->textures_copied[slot])
+		return false;
 
-	for (size_t i = 0; i < 3; i++) {
-		if (video->plane_linewidth[i] == 0)
+	/* rather than stall on a copy the GPU hasn't finished yet, drop the
+	 * frame and let the next one cover its time.  only done once in a row
+	 * so that a GPU that's always behind still gets frames out */
+	if (video->readback_depth > 1 && !video->skipped_readbacks &&
+	    !copies_ready(copies)) {
+		video->skipped_readbacks++;
+		metric_add(obs->metrics.skipped_readbacks, 1);
+		return false;
+	}
+
+	profile_start(name);
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (!copies[c])
 			break;
 
-		src_pos = make_aligned_linesize_offset(video->plane_offsets[i],
-				dst_linesize, src_linesize);
+		if (!gs_stagesurface_map(copies[c], &frame->data[c],
+					&frame->linesize[c])) {
+			success = false;
+			break;
+		}
 
-		copy_dealign(output->data[i], 0, dst_linesize,
-				input->data[0], src_pos, src_linesize,
-				video->plane_sizes[i]);
+		video->mapped_surfaces[c] = copies[c];
 	}
+	profile_end(name);
+
+	if (!success)
+		unmap_last_surfaces(video);
+	return success;
 }
 
-static void set_gpu_converted_data(struct obs_core_video *video,
-		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+static inline void copy_plane(uint8_t *dst, uint32_t dst_linesize,
+		const uint8_t *src, uint32_t src_linesize,
+		uint32_t width, uint32_t height)
 {
-	if (input->linesize[0] == video->output_width*4) {
-		struct video_frame frame;
-
-		for (size_t i = 0; i < 3; i++) {
-			if (video->plane_linewidth[i] == 0)
-				break;
-
-			frame.linesize[i] = video->plane_linewidth[i];
-			frame.data[i] =
-				input->data[0] + video->plane_offsets[i];
+	/* if the line sizes match, do a single copy */
+	if (src_linesize == dst_linesize) {
+		memcpy(dst, src, src_linesize * height);
+	} else {
+		for (uint32_t y = 0; y < height; y++) {
+			memcpy(dst, src, width);
+			src += src_linesize;
+			dst += dst_linesize;
 		}
+	}
+}
 
-		video_frame_copy(output, &frame, info->format, info->height);
+static void set_gpu_converted_data(struct obs_core_video *video,
+		struct video_frame *output, const struct video_data *input)
+{
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (!video->plane_widths[c])
+			break;
 
-	} else {
-		fix_gpu_converted_alignment(video, output, input);
+		copy_plane(output->data[c], output->linesize[c],
+				input->data[c], input->linesize[c],
+				video->plane_widths[c], video->plane_heights[c]);
 	}
 }
 
@@ -449,19 +587,9 @@ static inline void copy_rgbx_frame(
 		struct video_frame *output, const struct video_data *input,
 		const struct video_output_info *info)
 {
-	uint8_t *in_ptr = input->data[0];
-	uint8_t *out_ptr = output->data[0];
-
-	/* if the line sizes match, do a single copy */
-	if (input->linesize[0] == output->linesize[0]) {
-		memcpy(out_ptr, in_ptr, input->linesize[0] * info->height);
-	} else {
-		for (size_t y = 0; y < info->height; y++) {
-			memcpy(out_ptr, in_ptr, info->width * 4);
-			in_ptr += input->linesize[0];
-			out_ptr += output->linesize[0];
-		}
-	}
+	copy_plane(output->data[0], output->linesize[0],
+			input->data[0], input->linesize[0],
+			info->width * 4, info->height);
 }
 
 static inline void output_video_data(struct obs_core_video *video,
@@ -478,7 +606,7 @@ static inline void output_video_data(struct obs_core_video *video,
 	if (locked) {
 		if (video->gpu_conversion) {
 			set_gpu_converted_data(video, &output_frame,
-					input_frame, info);
+					input_frame);
 
 		} else if (format_is_yuv(info->format)) {
 			convert_frame(&output_frame, input_frame, info);
@@ -509,6 +637,10 @@ static inline void video_sleep(struct obs_core_video *video,
 	video->total_frames += count;
 	video->lagged_frames += count - 1;
 
+	metric_add(obs->metrics.rendered_frames, count);
+	if (count > 1)
+		metric_add(obs->metrics.lagged_frames, count - 1);
+
 	vframe_info.timestamp = cur_time;
 	vframe_info.count = count;
 	circlebuf_push_back(&video->vframe_info_buffer, &vframe_info,
@@ -527,6 +659,7 @@ static inline void output_frame(void)
 	int prev_texture = cur_texture == 0 ? NUM_TEXTURES-1 : cur_texture-1;
 	struct video_data frame;
 	bool frame_ready;
+	uint64_t start_time;
 
 	memset(&frame, 0, sizeof(struct video_data));
 
@@ -534,11 +667,15 @@ static inline void output_frame(void)
 	gs_enter_context(video->graphics);
 
 	profile_start(output_frame_render_video_name);
+	start_time = os_gettime_ns();
 	render_video(video, cur_texture, prev_texture);
+	metric_record(obs->metrics.render_time, os_gettime_ns() - start_time);
 	profile_end(output_frame_render_video_name);
 
 	profile_start(output_frame_download_frame_name);
-	frame_ready = download_frame(video, prev_texture, &frame);
+	start_time = os_gettime_ns();
+	frame_ready = download_frame(video, &frame);
+	metric_record(obs->metrics.readback_time, os_gettime_ns() - start_time);
 	profile_end(output_frame_download_frame_name);
 
 	profile_start(output_frame_gs_flush_name);
@@ -553,6 +690,14 @@ static inline void output_frame(void)
 		circlebuf_pop_front(&video->vframe_info_buffer, &vframe_info,
 				sizeof(vframe_info));
 
+		/* frames whose readback was skipped are filled with this one */
+		for (; video->skipped_readbacks; video->skipped_readbacks--) {
+			struct obs_vframe_info skipped_info;
+			circlebuf_pop_front(&video->vframe_info_buffer,
+					&skipped_info, sizeof(skipped_info));
+			vframe_info.count += skipped_info.count;
+		}
+
 		frame.timestamp = vframe_info.timestamp;
 		profile_start(output_frame_output_video_data_name);
 		output_video_data(video, &frame, vframe_info.count);
@@ -561,6 +706,8 @@ static inline void output_frame(void)
 
 	if (++video->cur_texture == NUM_TEXTURES)
 		video->cur_texture = 0;
+	if (++video->cur_copy == video->readback_depth)
+		video->cur_copy = 0;
 }
 
 #define NBSP "\xC2\xA0"
@@ -604,6 +751,8 @@ void *obs_video_thread(void *param)
 		video_sleep(&obs->video, &obs->video.video_time, interval);
 	}
 
+	free_tick_workers(&obs->video.tick_pool);
+
 	UNUSED_PARAMETER(param);
 	return NULL;
 }
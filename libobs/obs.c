@@ -19,6 +19,7 @@
 
 #include "graphics/matrix4.h"
 #include "callback/calldata.h"
+#include "media-io/format-conversion.h"
 
 #include "obs.h"
 #include "obs-internal.h"
@@ -42,108 +43,52 @@ static inline void make_video_info(struct video_output_info *vi,
 	vi->cache_size = 6;
 }
 
-#define PIXEL_SIZE 4
-
-#define GET_ALIGN(val, align) \
-	(((val) + (align-1)) & ~(align-1))
-
-static inline void set_420p_sizes(const struct obs_video_info *ovi)
+static inline void set_plane(uint32_t plane, const char *tech,
+		uint32_t width, uint32_t height)
 {
 	struct obs_core_video *video = &obs->video;
-	uint32_t chroma_pixels;
-	uint32_t total_bytes;
-
-	chroma_pixels = (ovi->output_width * ovi->output_height / 4);
-	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
 
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = ovi->output_width * ovi->output_height;
-	video->plane_offsets[2] = video->plane_offsets[1] + chroma_pixels;
-
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width/2;
-	video->plane_linewidth[2] = ovi->output_width/2;
-
-	video->plane_sizes[0] = video->plane_offsets[1];
-	video->plane_sizes[1] = video->plane_sizes[0]/4;
-	video->plane_sizes[2] = video->plane_sizes[1];
-
-	total_bytes = video->plane_offsets[2] + chroma_pixels;
+	video->conversion_techs[plane] = tech;
+	video->plane_widths[plane]     = width;
+	video->plane_heights[plane]    = height;
+}
 
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
+static inline void set_420p_sizes(const struct obs_video_info *ovi)
+{
+	uint32_t width  = ovi->output_width;
+	uint32_t height = ovi->output_height;
 
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "Planar420";
+	set_plane(0, "Plane_Y", width, height);
+	set_plane(1, "Plane_U", (width + 1) / 2, (height + 1) / 2);
+	set_plane(2, "Plane_V", (width + 1) / 2, (height + 1) / 2);
 }
 
 static inline void set_nv12_sizes(const struct obs_video_info *ovi)
 {
-	struct obs_core_video *video = &obs->video;
-	uint32_t chroma_pixels;
-	uint32_t total_bytes;
-
-	chroma_pixels = (ovi->output_width * ovi->output_height / 2);
-	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
-
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = ovi->output_width * ovi->output_height;
-
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width;
-
-	video->plane_sizes[0] = video->plane_offsets[1];
-	video->plane_sizes[1] = video->plane_sizes[0]/2;
-
-	total_bytes = video->plane_offsets[1] + chroma_pixels;
+	uint32_t width  = ovi->output_width;
+	uint32_t height = ovi->output_height;
 
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
-
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "NV12";
+	set_plane(0, "Plane_Y", width, height);
+	set_plane(1, "Plane_NV12_UV", (width + 1) & ~1, (height + 1) / 2);
 }
 
 static inline void set_444p_sizes(const struct obs_video_info *ovi)
 {
-	struct obs_core_video *video = &obs->video;
-	uint32_t chroma_pixels;
-	uint32_t total_bytes;
-
-	chroma_pixels = (ovi->output_width * ovi->output_height);
-	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
-
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = chroma_pixels;
-	video->plane_offsets[2] = chroma_pixels + chroma_pixels;
-
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width;
-	video->plane_linewidth[2] = ovi->output_width;
-
-	video->plane_sizes[0] = chroma_pixels;
-	video->plane_sizes[1] = chroma_pixels;
-	video->plane_sizes[2] = chroma_pixels;
-
-	total_bytes = video->plane_offsets[2] + chroma_pixels;
-
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
+	uint32_t width  = ovi->output_width;
+	uint32_t height = ovi->output_height;
 
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "Planar444";
+	set_plane(0, "Plane_Y", width, height);
+	set_plane(1, "Plane_U", width, height);
+	set_plane(2, "Plane_V", width, height);
 }
 
 static inline void calc_gpu_conversion_sizes(const struct obs_video_info *ovi)
 {
-	obs->video.conversion_height = 0;
-	memset(obs->video.plane_offsets, 0, sizeof(obs->video.plane_offsets));
-	memset(obs->video.plane_sizes, 0, sizeof(obs->video.plane_sizes));
-	memset(obs->video.plane_linewidth, 0,
-		sizeof(obs->video.plane_linewidth));
+	struct obs_core_video *video = &obs->video;
+
+	memset(video->conversion_techs, 0, sizeof(video->conversion_techs));
+	memset(video->plane_widths, 0, sizeof(video->plane_widths));
+	memset(video->plane_heights, 0, sizeof(video->plane_heights));
 
 	switch ((uint32_t)ovi->output_format) {
 	case VIDEO_FORMAT_I420:
@@ -164,20 +109,28 @@ static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 
 	calc_gpu_conversion_sizes(ovi);
 
-	if (!video->conversion_height) {
+	if (!video->plane_widths[0]) {
 		blog(LOG_INFO, "GPU conversion not available for format: %u",
 				(unsigned int)ovi->output_format);
 		video->gpu_conversion = false;
 		return true;
 	}
 
+	/* each plane gets its own single channel target, so the planes come
+	 * out of the GPU already laid out the way the encoder wants them */
 	for (size_t i = 0; i < NUM_TEXTURES; i++) {
-		video->convert_textures[i] = gs_texture_create(
-				ovi->output_width, video->conversion_height,
-				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
+		for (size_t c = 0; c < NUM_CHANNELS; c++) {
+			if (!video->plane_widths[c])
+				break;
 
-		if (!video->convert_textures[i])
-			return false;
+			video->convert_textures[i][c] = gs_texture_create(
+					video->plane_widths[c],
+					video->plane_heights[c],
+					GS_R8, 1, NULL, GS_RENDER_TARGET);
+
+			if (!video->convert_textures[i][c])
+				return false;
+		}
 	}
 
 	return true;
@@ -186,17 +139,39 @@ static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 static bool obs_init_textures(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
-	uint32_t output_height = video->gpu_conversion ?
-		video->conversion_height : ovi->output_height;
 	size_t i;
 
-	for (i = 0; i < NUM_TEXTURES; i++) {
-		video->copy_surfaces[i] = gs_stagesurface_create(
-				ovi->output_width, output_height, GS_RGBA);
+	for (i = 0; i < (size_t)video->readback_depth; i++) {
+		if (video->gpu_conversion) {
+			for (size_t c = 0; c < NUM_CHANNELS; c++) {
+				if (!video->plane_widths[c])
+					break;
 
-		if (!video->copy_surfaces[i])
-			return false;
+				video->copy_surfaces[i][c] =
+					gs_stagesurface_create(
+						video->plane_widths[c],
+						video->plane_heights[c],
+						GS_R8);
 
+				if (!video->copy_surfaces[i][c])
+					return false;
+			}
+		} else {
+			video->copy_surfaces[i][0] = gs_stagesurface_create(
+					ovi->output_width, ovi->output_height,
+					GS_RGBA);
+
+			if (!video->copy_surfaces[i][0])
+				return false;
+		}
+
+		video->copy_map_names[i] = profile_store_name(
+				obs_get_profiler_name_store(),
+				"gs_stagesurface_map(slot %d/%d)",
+				(int)i + 1, video->readback_depth);
+	}
+
+	for (i = 0; i < NUM_TEXTURES; i++) {
 		video->render_textures[i] = gs_texture_create(
 				ovi->base_width, ovi->base_height,
 				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
@@ -249,6 +224,17 @@ static int obs_init_graphics(struct obs_video_info *ovi)
 
 	gs_enter_context(video->graphics);
 
+	if (obs->module_config_path) {
+		struct dstr path = {0};
+
+		dstr_copy(&path, obs->module_config_path);
+		if (!dstr_is_empty(&path) && dstr_end(&path) != '/')
+			dstr_cat_ch(&path, '/');
+		dstr_cat(&path, "libobs/shader_cache");
+		gs_set_shader_cache_path(path.array);
+		dstr_free(&path);
+	}
+
 	char *filename = find_libobs_data_file("default.effect");
 	video->default_effect = gs_effect_create_from_file(filename,
 			NULL);
@@ -355,6 +341,7 @@ static int obs_init_video(struct obs_video_info *ovi)
 	video->output_height  = ovi->output_height;
 	video->gpu_conversion = ovi->gpu_conversion;
 	video->scale_type     = ovi->scale_type;
+	video->readback_depth = (int)ovi->readback_depth;
 
 	set_video_matrix(video, ovi);
 
@@ -416,20 +403,34 @@ static void obs_free_video(void)
 
 		gs_enter_context(video->graphics);
 
-		if (video->mapped_surface) {
-			gs_stagesurface_unmap(video->mapped_surface);
-			video->mapped_surface = NULL;
+		for (size_t c = 0; c < NUM_CHANNELS; c++) {
+			if (video->mapped_surfaces[c]) {
+				gs_stagesurface_unmap(video->mapped_surfaces[c]);
+				video->mapped_surfaces[c] = NULL;
+			}
+		}
+
+		for (size_t i = 0; i < MAX_READBACK_DEPTH; i++) {
+			for (size_t c = 0; c < NUM_CHANNELS; c++) {
+				gs_stagesurface_destroy(
+						video->copy_surfaces[i][c]);
+				video->copy_surfaces[i][c] = NULL;
+			}
+
+			video->copy_map_names[i] = NULL;
 		}
 
 		for (size_t i = 0; i < NUM_TEXTURES; i++) {
-			gs_stagesurface_destroy(video->copy_surfaces[i]);
 			gs_texture_destroy(video->render_textures[i]);
-			gs_texture_destroy(video->convert_textures[i]);
 			gs_texture_destroy(video->output_textures[i]);
 
-			video->copy_surfaces[i]    = NULL;
+			for (size_t c = 0; c < NUM_CHANNELS; c++) {
+				gs_texture_destroy(
+						video->convert_textures[i][c]);
+				video->convert_textures[i][c] = NULL;
+			}
+
 			video->render_textures[i]  = NULL;
-			video->convert_textures[i] = NULL;
 			video->output_textures[i]  = NULL;
 		}
 
@@ -447,6 +448,8 @@ static void obs_free_video(void)
 				sizeof(video->textures_converted));
 
 		video->cur_texture = 0;
+		video->cur_copy = 0;
+		video->skipped_readbacks = 0;
 	}
 }
 
@@ -507,6 +510,7 @@ static void obs_free_audio(void)
 	da_free(audio->root_nodes);
 
 	memset(audio, 0, sizeof(struct obs_core_audio));
+	metric_set(obs->metrics.audio_buffering, 0);
 }
 
 static bool obs_init_data(void)
@@ -731,6 +735,8 @@ static bool obs_init(const char *locale, const char *module_config_path,
 		return false;
 	if (!obs_init_handlers())
 		return false;
+	if (!obs_init_metrics())
+		return false;
 	if (!obs_init_hotkeys())
 		return false;
 
@@ -811,6 +817,11 @@ void obs_shutdown(void)
 	obs_free_video();
 	obs_free_hotkeys();
 	obs_free_graphics();
+
+	/* joins the row-sliced conversion workers, they're recreated on
+	 * demand if libobs is started again */
+	format_conversion_set_threads(0);
+
 	proc_handler_destroy(obs->procs);
 	signal_handler_destroy(obs->signals);
 
@@ -826,6 +837,12 @@ void obs_shutdown(void)
 		free_module_path(obs->module_paths.array+i);
 	da_free(obs->module_paths);
 
+	obs_free_metrics();
+
+	/* modules are unloaded by now, so anything left in the registry
+	 * belongs to no one */
+	metrics_free();
+
 	if (obs->name_store_owned)
 		profiler_name_store_free(obs->name_store);
 
@@ -908,6 +925,13 @@ int obs_reset_video(struct obs_video_info *ovi)
 	ovi->output_width  &= 0xFFFFFFFC;
 	ovi->output_height &= 0xFFFFFFFE;
 
+	if (!ovi->readback_depth)
+		ovi->readback_depth = DEFAULT_READBACK_DEPTH;
+	else if (ovi->readback_depth < 2)
+		ovi->readback_depth = 2;
+	else if (ovi->readback_depth > MAX_READBACK_DEPTH)
+		ovi->readback_depth = MAX_READBACK_DEPTH;
+
 	if (!video->graphics) {
 		int errorcode = obs_init_graphics(ovi);
 		if (errorcode != OBS_VIDEO_SUCCESS) {
@@ -921,11 +945,13 @@ int obs_reset_video(struct obs_video_info *ovi)
 	               "\tbase resolution:   %dx%d\n"
 	               "\toutput resolution: %dx%d\n"
 	               "\tfps:               %d/%d\n"
-	               "\tformat:            %s",
+	               "\tformat:            %s\n"
+	               "\treadback depth:    %d",
 	               ovi->base_width, ovi->base_height,
 	               ovi->output_width, ovi->output_height,
 	               ovi->fps_num, ovi->fps_den,
-		       get_video_format_name(ovi->output_format));
+		       get_video_format_name(ovi->output_format),
+		       (int)ovi->readback_depth);
 
 	return obs_init_video(ovi);
 }
@@ -984,6 +1010,7 @@ bool obs_get_video_info(struct obs_video_info *ovi)
 	ovi->output_format = info->format;
 	ovi->fps_num       = info->fps_num;
 	ovi->fps_den       = info->fps_den;
+	ovi->readback_depth= (uint32_t)video->readback_depth;
 
 	return true;
 }
@@ -1423,6 +1450,7 @@ static obs_source_t *obs_load_source_type(obs_data_t *source_data)
 	uint32_t     mixers;
 	int          di_order;
 	int          di_mode;
+	int          queue_policy;
 
 	source = obs_source_create(id, name, settings, hotkeys);
 
@@ -1474,6 +1502,16 @@ static obs_source_t *obs_load_source_type(obs_data_t *source_data)
 	obs_source_set_deinterlace_field_order(source,
 			(enum obs_deinterlace_field_order)di_order);
 
+	queue_policy = (int)obs_data_get_int(source_data, "async_queue_policy");
+	obs_source_set_async_queue_policy(source,
+			(enum obs_async_queue_policy)queue_policy);
+
+	obs_data_set_default_int(source_data, "async_max_latency",
+			obs_source_get_async_max_latency(source));
+	obs_source_set_async_max_latency(source,
+			(uint32_t)obs_data_get_int(source_data,
+				"async_max_latency"));
+
 	if (filters) {
 		size_t count = obs_data_array_count(filters);
 
@@ -1573,6 +1611,9 @@ obs_data_t *obs_save_source(obs_source_t *source)
 	int        di_mode     = (int)obs_source_get_deinterlace_mode(source);
 	int        di_order    =
 		(int)obs_source_get_deinterlace_field_order(source);
+	int        queue_policy=
+		(int)obs_source_get_async_queue_policy(source);
+	uint32_t   max_latency = obs_source_get_async_max_latency(source);
 
 	obs_source_save(source);
 	hotkeys = obs_hotkeys_save_source(source);
@@ -1599,6 +1640,8 @@ obs_data_t *obs_save_source(obs_source_t *source)
 	obs_data_set_obj   (source_data, "hotkeys",  hotkey_data);
 	obs_data_set_int   (source_data, "deinterlace_mode", di_mode);
 	obs_data_set_int   (source_data, "deinterlace_field_order", di_order);
+	obs_data_set_int   (source_data, "async_queue_policy", queue_policy);
+	obs_data_set_int   (source_data, "async_max_latency", max_latency);
 
 	if (source->info.type == OBS_SOURCE_TYPE_TRANSITION)
 		obs_transition_save(source, source_data);
@@ -1809,6 +1852,16 @@ uint64_t obs_get_video_frame_time(void)
 	return obs ? obs->video.video_time : 0;
 }
 
+uint32_t obs_get_total_frames(void)
+{
+	return obs ? obs->video.total_frames : 0;
+}
+
+uint32_t obs_get_lagged_frames(void)
+{
+	return obs ? obs->video.lagged_frames : 0;
+}
+
 enum obs_obj_type obs_obj_get_type(void *obj)
 {
 	struct obs_context_data *context = obj;
@@ -20,6 +20,7 @@
 #include "util/c99defs.h"
 #include "util/bmem.h"
 #include "util/profiler.h"
+#include "util/metrics.h"
 #include "util/text-lookup.h"
 #include "graphics/graphics.h"
 #include "graphics/vec2.h"
@@ -172,6 +173,14 @@ struct obs_video_info {
 	enum video_range_type range;       /**< YUV range (if YUV) */
 
 	enum obs_scale_type scale_type;    /**< How to scale if scaling */
+
+	/**
+	 * Number of staging surfaces used to read frames back from the GPU.
+	 * Higher values give the driver more frames to complete the copy
+	 * before it is mapped, at the cost of one frame of latency each.
+	 * 0 uses the default.
+	 */
+	uint32_t            readback_depth;
 };
 
 /**
@@ -207,6 +216,12 @@ struct obs_source_audio {
 	uint64_t            timestamp;
 };
 
+/**
+ * Called when libobs no longer needs the planes of a frame that was lent with
+ * obs_source_output_video_lent.
+ */
+typedef void (*obs_source_frame_release_t)(void *param);
+
 /**
  * Source asynchronous video output structure.  Used with
  * obs_source_output_video to output asynchronous video.  Video is buffered as
@@ -233,6 +248,8 @@ struct obs_source_frame {
 	/* used internally by libobs */
 	volatile long       refs;
 	bool                prev_frame;
+	obs_source_frame_release_t release;
+	void                *release_param;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -605,6 +622,19 @@ EXPORT void obs_view_render(obs_view_t *view);
 
 EXPORT uint64_t obs_get_video_frame_time(void);
 
+/** Gets the number of frame intervals since video was reset */
+EXPORT uint32_t obs_get_total_frames(void);
+
+/** Gets the number of those frames that were skipped due to rendering lag */
+EXPORT uint32_t obs_get_lagged_frames(void);
+
+/**
+ * Serves the metrics registry (see util/metrics.h) in the Prometheus text
+ * format over HTTP on 127.0.0.1:port, replacing a previously started server
+ */
+EXPORT bool obs_metrics_server_start(uint16_t port);
+EXPORT void obs_metrics_server_stop(void);
+
 
 /* ------------------------------------------------------------------------- */
 /* Display context */
@@ -907,6 +937,35 @@ EXPORT void obs_source_set_deinterlace_field_order(obs_source_t *source,
 EXPORT enum obs_deinterlace_field_order obs_source_get_deinterlace_field_order(
 		const obs_source_t *source);
 
+/**
+ * What to do when an async source outputs frames faster than they are
+ * rendered.  Frames that are dropped go back to the source's frame pool.
+ */
+enum obs_async_queue_policy {
+	/** Drop the oldest queued frame once the queue is full (default) */
+	OBS_ASYNC_QUEUE_DROP_OLDEST,
+	/** Drop the incoming frame while the queue is full */
+	OBS_ASYNC_QUEUE_DROP_NEWEST,
+	/** Drop queued frames that are older than the maximum latency */
+	OBS_ASYNC_QUEUE_MAX_LATENCY
+};
+
+EXPORT void obs_source_set_async_queue_policy(obs_source_t *source,
+		enum obs_async_queue_policy policy);
+EXPORT enum obs_async_queue_policy obs_source_get_async_queue_policy(
+		const obs_source_t *source);
+
+/** Sets the maximum queued latency for OBS_ASYNC_QUEUE_MAX_LATENCY */
+EXPORT void obs_source_set_async_max_latency(obs_source_t *source,
+		uint32_t ms);
+EXPORT uint32_t obs_source_get_async_max_latency(const obs_source_t *source);
+
+/** Returns the number of async frames dropped because the queue was full */
+EXPORT uint32_t obs_source_get_async_frames_dropped(const obs_source_t *source);
+
+/** Returns the number of async frames skipped because they were too late */
+EXPORT uint32_t obs_source_get_async_frames_late(const obs_source_t *source);
+
 /* ------------------------------------------------------------------------- */
 /* Functions used by sources */
 
@@ -943,10 +1002,40 @@ EXPORT void obs_source_draw_set_color_matrix(
 EXPORT void obs_source_draw(gs_texture_t *image, int x, int y,
 		uint32_t cx, uint32_t cy, bool flip);
 
-/** Outputs asynchronous video data.  Set to NULL to deactivate the texture */
+/**
+ * Notifies libobs that the video of a source with OBS_SOURCE_STATIC_VIDEO has
+ * changed, and that any cached render of it must be redrawn.  Not needed
+ * after settings updates, which invalidate the source automatically.
+ */
+EXPORT void obs_source_invalidate_video(obs_source_t *source);
+
+/**
+ * Outputs asynchronous video data.  Set to NULL to deactivate the texture and
+ * release any frames that were lent with obs_source_output_video_lent and are
+ * still queued.
+ */
 EXPORT void obs_source_output_video(obs_source_t *source,
 		const struct obs_source_frame *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  The planes of the frame
+ * are queued and uploaded directly, so they must stay valid and unmodified
+ * until libobs calls release(param), which happens exactly once per call.
+ *
+ *   release can be called from any thread (usually the graphics thread) while
+ * the source's frame queue is locked, so it must only hand the buffer back to
+ * its owner and must not call back into the source.  A frame that is being
+ * uploaded when the source calls obs_source_output_video(source, NULL) is
+ * released as soon as the upload finishes.
+ *
+ *   Frames are never lent to async video filters, which may keep frames for
+ * as long as they like.  While the source has any, the frame is copied and
+ * released right away.
+ */
+EXPORT void obs_source_output_video_lent(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		obs_source_frame_release_t release, void *param);
+
 /** Outputs audio data (always asynchronous) */
 EXPORT void obs_source_output_audio(obs_source_t *source,
 		const struct obs_source_audio *audio);
@@ -1429,6 +1518,14 @@ EXPORT uint64_t obs_output_get_total_bytes(const obs_output_t *output);
 EXPORT int obs_output_get_frames_dropped(const obs_output_t *output);
 EXPORT int obs_output_get_total_frames(const obs_output_t *output);
 
+/**
+ * Returns the size of the encoded packet payloads the output currently
+ * holds, in the interleave and delay buffers and in the output's own send
+ * queue if it reports one.  Payloads shared with other outputs are counted
+ * for each output that references them.
+ */
+EXPORT uint64_t obs_output_get_packet_memory(const obs_output_t *output);
+
 /**
  * Sets the preferred scaled resolution for this output.  Set width and height
  * to 0 to disable scaling.
@@ -1564,6 +1661,18 @@ EXPORT enum obs_encoder_type obs_encoder_get_type(const obs_encoder_t *encoder);
 EXPORT void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 		uint32_t height);
 
+/**
+ * Sets the maximum number of frames that may be queued for a video encoder
+ * before frames are dropped, and how they are dropped.  Set max_frames to 0 to
+ * use the default.  If the encoder is active, this function will trigger a
+ * warning, and do nothing.
+ *
+ * With VIDEO_DROP_OLDEST, dropped frames leave gaps in the encoder's
+ * timestamps instead of being replaced by repeated frames.
+ */
+EXPORT void obs_encoder_set_frame_queue(obs_encoder_t *encoder,
+		uint32_t max_frames, enum video_drop_policy drop_policy);
+
 /** For video encoders, returns the width of the encoded image */
 EXPORT uint32_t obs_encoder_get_width(const obs_encoder_t *encoder);
 
@@ -1600,7 +1709,9 @@ EXPORT obs_properties_t *obs_encoder_properties(const obs_encoder_t *encoder);
 
 /**
  * Updates the settings of the encoder context.  Usually used for changing
- * bitrate while active
+ * bitrate while active.  While the encoder is active, the new settings are
+ * applied by the encoder's thread before it encodes its next frame, so this
+ * can be called from any thread.
  */
 EXPORT void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings);
 
@@ -1638,10 +1749,33 @@ EXPORT const char *obs_encoder_get_id(const obs_encoder_t *encoder);
 
 EXPORT uint32_t obs_get_encoder_caps(const char *encoder_id);
 
-/** Duplicates an encoder packet */
+/**
+ * Adds a reference to a packet received from an encoder.  The payload is
+ * shared read-only by every output the encoder feeds; an output that needs
+ * to modify the data must make its own copy with
+ * obs_duplicate_encoder_packet.
+ */
+EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src);
+
+/** Releases a reference added with obs_encoder_packet_ref */
+EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
+
+/**
+ * Creates a shared packet with its own copy of the payload, with a single
+ * reference.  Release it with obs_encoder_packet_release.
+ */
+EXPORT void obs_encoder_packet_create_instance(struct encoder_packet *dst,
+		const struct encoder_packet *src);
+
+/**
+ * Duplicates an encoder packet into a plain allocation that the caller may
+ * modify.  Free it with obs_free_encoder_packet.
+ */
 EXPORT void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 
+/** Frees a packet created with obs_duplicate_encoder_packet */
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 
 
@@ -1749,7 +1883,10 @@ static inline struct obs_source_frame *obs_source_frame_create(
 static inline void obs_source_frame_destroy(struct obs_source_frame *frame)
 {
 	if (frame) {
-		bfree(frame->data[0]);
+		if (frame->release)
+			frame->release(frame->release_param);
+		else
+			bfree(frame->data[0]);
 		bfree(frame);
 	}
 }
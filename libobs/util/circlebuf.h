@@ -231,6 +231,20 @@ static inline void circlebuf_peek_back(struct circlebuf *cb, void *data,
 	}
 }
 
+/* returns a pointer to the byte at 'idx' from the front.  only use this when
+ * every item pushed has the same size, so no item wraps around the end */
+static inline void *circlebuf_data(struct circlebuf *cb, size_t idx)
+{
+	size_t offset = cb->start_pos + idx;
+
+	if (idx >= cb->size)
+		return NULL;
+	if (offset >= cb->capacity)
+		offset -= cb->capacity;
+
+	return (uint8_t*)cb->data + offset;
+}
+
 static inline void circlebuf_pop_front(struct circlebuf *cb, void *data,
 		size_t size)
 {
@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2016 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+
+#include "metrics.h"
+#include "base.h"
+#include "bmem.h"
+#include "darray.h"
+#include "platform.h"
+#include "threading.h"
+
+/* values below LINEAR_BUCKETS get a bucket each, every power of two above
+ * that is split into SUB_BUCKETS */
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS     (1 << SUB_BUCKET_BITS)
+#define LINEAR_BUCKETS  (SUB_BUCKETS * 2)
+#define LINEAR_BITS     (SUB_BUCKET_BITS + 1)
+#define NUM_BUCKETS     (LINEAR_BUCKETS + (64 - LINEAR_BITS) * SUB_BUCKETS)
+
+/* exported buckets, each power of two from ~1 µs to ~17 s */
+#define EXPORT_MIN_BIT 10
+#define EXPORT_MAX_BIT 34
+
+struct metric {
+	enum metric_type type;
+	char             *name;
+	char             *help;
+	char             *label;
+	char             *label_value;
+	long             refs;
+
+	pthread_mutex_t  mutex;
+	int64_t          value;
+	uint64_t         count;
+	uint64_t         sum;
+	uint64_t         *buckets;
+};
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DARRAY(metric_t*) metrics;
+
+static inline int highest_bit(uint64_t val)
+{
+	int bit = 0;
+
+	if (val >> 32) { val >>= 32; bit += 32; }
+	if (val >> 16) { val >>= 16; bit += 16; }
+	if (val >> 8)  { val >>= 8;  bit += 8; }
+	if (val >> 4)  { val >>= 4;  bit += 4; }
+	if (val >> 2)  { val >>= 2;  bit += 2; }
+	if (val >> 1)  { bit += 1; }
+
+	return bit;
+}
+
+/* buckets hold (lower, upper], so a value equal to a power of two ends up in
+ * the bucket that the exported 'le' of that power of two includes */
+static inline size_t bucket_index(uint64_t ns)
+{
+	int bit;
+
+	if (ns)
+		ns--;
+	if (ns < LINEAR_BUCKETS)
+		return (size_t)ns;
+
+	bit = highest_bit(ns);
+	return LINEAR_BUCKETS + (size_t)(bit - LINEAR_BITS) * SUB_BUCKETS +
+		(size_t)((ns >> (bit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* largest value that falls into the bucket */
+static inline uint64_t bucket_max(size_t idx)
+{
+	size_t bit, sub;
+	uint64_t width;
+
+	if (idx < LINEAR_BUCKETS)
+		return idx + 1;
+
+	bit   = (idx - LINEAR_BUCKETS) / SUB_BUCKETS + LINEAR_BITS;
+	sub   = (idx - LINEAR_BUCKETS) % SUB_BUCKETS;
+	width = (uint64_t)1 << (bit - SUB_BUCKET_BITS);
+	return (SUB_BUCKETS + sub) * width + width;
+}
+
+static inline bool str_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static inline int compare_metric(const metric_t *metric, const char *name,
+		const char *label_value)
+{
+	int cmp = strcmp(metric->name, name);
+	if (cmp != 0)
+		return cmp;
+
+	return strcmp(metric->label_value ? metric->label_value : "",
+			label_value ? label_value : "");
+}
+
+static void metric_destroy(metric_t *metric)
+{
+	pthread_mutex_destroy(&metric->mutex);
+	bfree(metric->buckets);
+	bfree(metric->name);
+	bfree(metric->help);
+	bfree(metric->label);
+	bfree(metric->label_value);
+	bfree(metric);
+}
+
+metric_t *metric_create(enum metric_type type, const char *name,
+		const char *help, const char *label, const char *label_value)
+{
+	metric_t *metric = NULL;
+	size_t idx;
+
+	if (!name)
+		return NULL;
+	if (!label)
+		label_value = NULL;
+	else if (!label_value)
+		label_value = "";
+
+	pthread_mutex_lock(&metrics_mutex);
+
+	/* kept sorted so that all labels of a name are written together */
+	for (idx = 0; idx < metrics.num; idx++) {
+		int cmp = compare_metric(metrics.array[idx], name, label_value);
+		if (cmp == 0)
+			metric = metrics.array[idx];
+		if (cmp >= 0)
+			break;
+	}
+
+	/* every label value of a name is written out under a single # TYPE
+	 * line, so they all have to share the type and label name */
+	for (size_t i = 0; i < metrics.num; i++) {
+		metric_t *other = metrics.array[i];
+
+		if (strcmp(other->name, name) != 0)
+			continue;
+
+		if (other->type != type || !str_equal(other->label, label)) {
+			blog(LOG_WARNING, "metric_create: metric '%s' already "
+					"exists with a different type or "
+					"label", name);
+			pthread_mutex_unlock(&metrics_mutex);
+			return NULL;
+		}
+	}
+
+	if (metric) {
+		metric->refs++;
+		pthread_mutex_unlock(&metrics_mutex);
+		return metric;
+	}
+
+	metric = bzalloc(sizeof(metric_t));
+	metric->type        = type;
+	metric->name        = bstrdup(name);
+	metric->help        = help ? bstrdup(help) : NULL;
+	metric->label       = label ? bstrdup(label) : NULL;
+	metric->label_value = label_value ? bstrdup(label_value) : NULL;
+	metric->refs        = 1;
+	pthread_mutex_init(&metric->mutex, NULL);
+
+	if (type == METRIC_HISTOGRAM)
+		metric->buckets = bzalloc(sizeof(uint64_t) * NUM_BUCKETS);
+
+	da_insert(metrics, idx, &metric);
+
+	pthread_mutex_unlock(&metrics_mutex);
+	return metric;
+}
+
+void metric_release(metric_t *metric)
+{
+	if (!metric)
+		return;
+
+	pthread_mutex_lock(&metrics_mutex);
+	if (--metric->refs == 0) {
+		da_erase_item(metrics, &metric);
+		metric_destroy(metric);
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+void metric_add(metric_t *metric, int64_t val)
+{
+	if (!metric || metric->type == METRIC_HISTOGRAM)
+		return;
+
+	pthread_mutex_lock(&metric->mutex);
+	metric->value += val;
+	pthread_mutex_unlock(&metric->mutex);
+}
+
+void metric_set(metric_t *metric, int64_t val)
+{
+	if (!metric || metric->type != METRIC_GAUGE)
+		return;
+
+	pthread_mutex_lock(&metric->mutex);
+	metric->value = val;
+	pthread_mutex_unlock(&metric->mutex);
+}
+
+void metric_record(metric_t *metric, uint64_t ns)
+{
+	size_t idx;
+
+	if (!metric || metric->type != METRIC_HISTOGRAM)
+		return;
+
+	idx = bucket_index(ns);
+
+	pthread_mutex_lock(&metric->mutex);
+	metric->buckets[idx]++;
+	metric->count++;
+	metric->sum += ns;
+	pthread_mutex_unlock(&metric->mutex);
+}
+
+enum metric_type metric_get_type(const metric_t *metric)
+{
+	return metric ? metric->type : METRIC_COUNTER;
+}
+
+const char *metric_get_name(const metric_t *metric)
+{
+	return metric ? metric->name : NULL;
+}
+
+const char *metric_get_label_value(const metric_t *metric)
+{
+	return metric ? metric->label_value : NULL;
+}
+
+int64_t metric_get_value(metric_t *metric)
+{
+	int64_t val;
+
+	if (!metric)
+		return 0;
+
+	pthread_mutex_lock(&metric->mutex);
+	val = metric->value;
+	pthread_mutex_unlock(&metric->mutex);
+	return val;
+}
+
+uint64_t metric_get_count(metric_t *metric)
+{
+	uint64_t count;
+
+	if (!metric)
+		return 0;
+
+	pthread_mutex_lock(&metric->mutex);
+	count = metric->count;
+	pthread_mutex_unlock(&metric->mutex);
+	return count;
+}
+
+uint64_t metric_get_sum(metric_t *metric)
+{
+	uint64_t sum;
+
+	if (!metric)
+		return 0;
+
+	pthread_mutex_lock(&metric->mutex);
+	sum = metric->sum;
+	pthread_mutex_unlock(&metric->mutex);
+	return sum;
+}
+
+uint64_t metric_get_quantile(metric_t *metric, double quantile)
+{
+	uint64_t target, accum = 0;
+	uint64_t result = 0;
+
+	if (!metric || metric->type != METRIC_HISTOGRAM)
+		return 0;
+
+	if (quantile < 0.0)
+		quantile = 0.0;
+	else if (quantile > 1.0)
+		quantile = 1.0;
+
+	pthread_mutex_lock(&metric->mutex);
+
+	target = (uint64_t)(quantile * (double)metric->count + 0.5);
+	if (target == 0)
+		target = 1;
+
+	if (metric->count) {
+		for (size_t i = 0; i < NUM_BUCKETS; i++) {
+			accum += metric->buckets[i];
+			if (accum >= target) {
+				result = bucket_max(i);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&metric->mutex);
+	return result;
+}
+
+void metrics_enum(metrics_enum_proc enum_proc, void *param)
+{
+	pthread_mutex_lock(&metrics_mutex);
+
+	for (size_t i = 0; i < metrics.num; i++) {
+		if (!enum_proc(param, metrics.array[i]))
+			break;
+	}
+
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Prometheus text format */
+
+static void cat_escaped(struct dstr *output, const char *str, bool quotes)
+{
+	for (; *str; str++) {
+		if (*str == '\\')
+			dstr_cat(output, "\\\\");
+		else if (*str == '\n')
+			dstr_cat(output, "\\n");
+		else if (*str == '"' && quotes)
+			dstr_cat(output, "\\\"");
+		else
+			dstr_cat_ch(output, *str);
+	}
+}
+
+static void cat_labels(struct dstr *output, const metric_t *metric,
+		const char *le)
+{
+	if (!metric->label && !le)
+		return;
+
+	dstr_cat_ch(output, '{');
+
+	if (metric->label) {
+		dstr_catf(output, "%s=\"", metric->label);
+		cat_escaped(output, metric->label_value, true);
+		dstr_cat_ch(output, '"');
+	}
+
+	if (le)
+		dstr_catf(output, "%sle=\"%s\"", metric->label ? "," : "", le);
+
+	dstr_cat_ch(output, '}');
+}
+
+/* nanoseconds as exact decimal seconds */
+static inline void seconds_str(char *str, size_t size, uint64_t ns)
+{
+	snprintf(str, size, "%"PRIu64".%09"PRIu64,
+			ns / 1000000000, ns % 1000000000);
+}
+
+static void dump_histogram(struct dstr *output, metric_t *metric,
+		const uint64_t *buckets, uint64_t count, uint64_t sum)
+{
+	uint64_t accum = 0;
+	size_t idx = 0;
+	char str[32];
+
+	for (int bit = EXPORT_MIN_BIT; bit <= EXPORT_MAX_BIT; bit++) {
+		uint64_t le = (uint64_t)1 << bit;
+		size_t end = bucket_index(le);
+
+		for (; idx <= end; idx++)
+			accum += buckets[idx];
+
+		seconds_str(str, sizeof(str), le);
+
+		dstr_catf(output, "%s_bucket", metric->name);
+		cat_labels(output, metric, str);
+		dstr_catf(output, " %"PRIu64"\n", accum);
+	}
+
+	dstr_catf(output, "%s_bucket", metric->name);
+	cat_labels(output, metric, "+Inf");
+	dstr_catf(output, " %"PRIu64"\n", count);
+
+	seconds_str(str, sizeof(str), sum);
+
+	dstr_catf(output, "%s_sum", metric->name);
+	cat_labels(output, metric, NULL);
+	dstr_catf(output, " %s\n", str);
+
+	dstr_catf(output, "%s_count", metric->name);
+	cat_labels(output, metric, NULL);
+	dstr_catf(output, " %"PRIu64"\n", count);
+}
+
+static const char *type_names[] = {
+	[METRIC_COUNTER]   = "counter",
+	[METRIC_GAUGE]     = "gauge",
+	[METRIC_HISTOGRAM] = "histogram"
+};
+
+void metrics_dump_prometheus(struct dstr *output)
+{
+	uint64_t *buckets = bmalloc(sizeof(uint64_t) * NUM_BUCKETS);
+	const char *prev_name = NULL;
+
+	pthread_mutex_lock(&metrics_mutex);
+
+	for (size_t i = 0; i < metrics.num; i++) {
+		metric_t *metric = metrics.array[i];
+		uint64_t count, sum;
+		int64_t value;
+
+		if (!prev_name || strcmp(prev_name, metric->name) != 0) {
+			if (metric->help) {
+				dstr_catf(output, "# HELP %s ", metric->name);
+				cat_escaped(output, metric->help, false);
+				dstr_cat_ch(output, '\n');
+			}
+
+			dstr_catf(output, "# TYPE %s %s\n", metric->name,
+					type_names[metric->type]);
+			prev_name = metric->name;
+		}
+
+		pthread_mutex_lock(&metric->mutex);
+		value = metric->value;
+		count = metric->count;
+		sum   = metric->sum;
+		if (metric->buckets)
+			memcpy(buckets, metric->buckets,
+					sizeof(uint64_t) * NUM_BUCKETS);
+		pthread_mutex_unlock(&metric->mutex);
+
+		if (metric->type == METRIC_HISTOGRAM) {
+			dump_histogram(output, metric, buckets, count, sum);
+		} else {
+			dstr_cat(output, metric->name);
+			cat_labels(output, metric, NULL);
+			dstr_catf(output, " %"PRId64"\n", value);
+		}
+	}
+
+	pthread_mutex_unlock(&metrics_mutex);
+	bfree(buckets);
+}
+
+void metrics_free(void)
+{
+	pthread_mutex_lock(&metrics_mutex);
+
+	for (size_t i = 0; i < metrics.num; i++)
+		metric_destroy(metrics.array[i]);
+	da_free(metrics);
+
+	pthread_mutex_unlock(&metrics_mutex);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+#include "dstr.h"
+
+/*
+ * Metrics registry
+ *
+ *   Counters, gauges and histograms that can be read at any time, or written
+ *   out all at once in the Prometheus text format.  A metric is identified by
+ *   its name and optional label, and creating a metric that already exists
+ *   returns the existing one with an added reference.
+ *
+ *   Histograms take nanoseconds and keep eight buckets per power of two, so
+ *   quantiles are within 12.5% of the recorded values.  A bucket includes its
+ *   upper bound, like the 'le' buckets they are written out as, in seconds.
+ *
+ *   All functions accept NULL metrics, so callers don't have to check whether
+ *   creating one succeeded.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+};
+
+typedef struct metric metric_t;
+
+/**
+ * Creates a metric, or adds a reference to it if it already exists
+ *
+ * @param  name         Prometheus metric name, such as obs_render_seconds
+ * @param  help         Description of the metric
+ * @param  label        Optional label name, such as "encoder"
+ * @param  label_value  Value of the label, any string
+ * @return              The metric, or NULL if a metric with that name
+ *                      exists with a different type or label name
+ */
+EXPORT metric_t *metric_create(enum metric_type type, const char *name,
+		const char *help, const char *label, const char *label_value);
+EXPORT void metric_release(metric_t *metric);
+
+/** Adds to a counter or gauge */
+EXPORT void metric_add(metric_t *metric, int64_t val);
+/** Sets a gauge */
+EXPORT void metric_set(metric_t *metric, int64_t val);
+/** Adds a value in nanoseconds to a histogram */
+EXPORT void metric_record(metric_t *metric, uint64_t ns);
+
+EXPORT enum metric_type metric_get_type(const metric_t *metric);
+EXPORT const char *metric_get_name(const metric_t *metric);
+EXPORT const char *metric_get_label_value(const metric_t *metric);
+
+/** Returns the value of a counter or gauge */
+EXPORT int64_t metric_get_value(metric_t *metric);
+/** Returns the number of values recorded in a histogram */
+EXPORT uint64_t metric_get_count(metric_t *metric);
+/** Returns the sum of the values recorded in a histogram, in nanoseconds */
+EXPORT uint64_t metric_get_sum(metric_t *metric);
+/**
+ * Returns the upper bound of the histogram bucket holding the given quantile
+ * (0.0-1.0), in nanoseconds
+ */
+EXPORT uint64_t metric_get_quantile(metric_t *metric, double quantile);
+
+typedef bool (*metrics_enum_proc)(void *param, metric_t *metric);
+
+/**
+ * Enumerates all metrics, sorted by name.  Metrics must not be created or
+ * released from within the callback.
+ */
+EXPORT void metrics_enum(metrics_enum_proc enum_proc, void *param);
+
+/** Appends every metric to 'output' in the Prometheus text format */
+EXPORT void metrics_dump_prometheus(struct dstr *output);
+
+/** Frees every metric, even the ones that are still referenced */
+EXPORT void metrics_free(void);
+
+#ifdef __cplusplus
+}
+#endif
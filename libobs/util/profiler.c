@@ -1,6 +1,7 @@
 #include <inttypes.h>
 #include "profiler.h"
 
+#include "circlebuf.h"
 #include "darray.h"
 #include "dstr.h"
 #include "platform.h"
@@ -256,29 +257,155 @@ static void merge_call(profile_entry *entry, profile_call *call,
 #endif
 }
 
-static bool enabled = false;
+/*
+ * Per-thread event buffers
+ *
+ *   profile_start/profile_end only append a timestamped event to a
+ *   single-producer, single-consumer ring owned by the calling thread.  The
+ *   aggregator thread drains the rings, rebuilds the call trees from the
+ *   events and merges them into the root entries, so none of the allocation,
+ *   locking or hashing happens on the profiled threads.  A thread that fills
+ *   its ring before the aggregator gets to it drains the ring itself.
+ */
+
+#define EVENT_BUFFER_SIZE     4096 /* must be a power of two */
+#define AGGREGATE_INTERVAL_MS 50
+
+typedef struct profile_event profile_event;
+struct profile_event {
+	const char *name;
+	uint64_t time;
+#ifdef TRACK_OVERHEAD
+	uint64_t overhead;
+#endif
+	bool end;
+};
+
+typedef struct profile_thread_buffer profile_thread_buffer;
+struct profile_thread_buffer {
+	profile_event events[EVENT_BUFFER_SIZE];
+	volatile long head;
+	volatile long tail;
+
+	/* names of the open calls, only used by the owning thread */
+	DARRAY(const char*) stack;
+
+	/* call tree being rebuilt, only used while holding mutex */
+	pthread_mutex_t mutex;
+	profile_call *context;
+
+	/* protected by buffers_mutex */
+	uint32_t id;
+	bool exited;
+	volatile bool detached;
+
+	/* protected by trace_mutex */
+	bool trace_named;
+};
+
+/*
+ * Trace
+ *
+ *   While a trace is active every completed call is also kept with the id of
+ *   its thread for 'trace_window' ns, so the timeline of the last few seconds
+ *   can be written out after a stall.  Threads are named after their first
+ *   root call.
+ */
+
+typedef struct profile_trace_call profile_trace_call;
+struct profile_trace_call {
+	const char *name;
+	uint64_t start_time;
+	uint64_t end_time;
+	uint32_t thread_id;
+};
+
+typedef struct profile_trace_thread profile_trace_thread;
+struct profile_trace_thread {
+	uint32_t id;
+	const char *name;
+};
+
+static volatile bool enabled = false;
 static pthread_mutex_t root_mutex = PTHREAD_MUTEX_INITIALIZER;
 static DARRAY(profile_root_entry) root_entries;
 
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DARRAY(profile_thread_buffer*) thread_buffers;
+static pthread_key_t buffer_key;
+static bool buffer_key_created = false;
+
+static uint32_t next_buffer_id = 1;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool trace_active = false;
+static uint64_t trace_window = 0;
+static uint64_t trace_latest = 0;
+static struct circlebuf trace_calls;
+static DARRAY(profile_trace_thread) trace_threads;
+
+static bool aggregator_active = false;
+static pthread_t aggregator_thread;
+static os_event_t *aggregator_stop = NULL;
+
 #ifdef _MSC_VER
-static __declspec(thread) profile_call *thread_context = NULL;
+static __declspec(thread) profile_thread_buffer *thread_buffer = NULL;
 static __declspec(thread) bool thread_enabled = true;
 #else
-static __thread profile_call *thread_context = NULL;
+static __thread profile_thread_buffer *thread_buffer = NULL;
 static __thread bool thread_enabled = true;
 #endif
 
+static void drain_thread_buffers(void);
+
+static void *aggregator_thread_func(void *unused)
+{
+	os_set_thread_name("profiler: aggregator");
+
+	while (os_event_timedwait(aggregator_stop, AGGREGATE_INTERVAL_MS) ==
+			ETIMEDOUT)
+		drain_thread_buffers();
+
+	UNUSED_PARAMETER(unused);
+	return NULL;
+}
+
+static void start_aggregator(void)
+{
+	if (os_event_init(&aggregator_stop, OS_EVENT_TYPE_MANUAL) != 0)
+		return;
+
+	if (pthread_create(&aggregator_thread, NULL, aggregator_thread_func,
+				NULL) != 0) {
+		os_event_destroy(aggregator_stop);
+		aggregator_stop = NULL;
+		return;
+	}
+
+	aggregator_active = true;
+}
+
+static void stop_aggregator(void)
+{
+	os_event_signal(aggregator_stop);
+	pthread_join(aggregator_thread, NULL);
+	os_event_destroy(aggregator_stop);
+	aggregator_stop = NULL;
+}
+
 void profiler_start(void)
 {
 	pthread_mutex_lock(&root_mutex);
-	enabled = true;
+	os_atomic_set_bool(&enabled, true);
+	if (!aggregator_active)
+		start_aggregator();
 	pthread_mutex_unlock(&root_mutex);
 }
 
 void profiler_stop(void)
 {
 	pthread_mutex_lock(&root_mutex);
-	enabled = false;
+	os_atomic_set_bool(&enabled, false);
 	pthread_mutex_unlock(&root_mutex);
 }
 
@@ -347,7 +474,11 @@ static void merge_context(profile_call *context)
 	profile_entry *entry = NULL;
 	profile_call *prev_call = NULL;
 
-	if (!lock_root()) {
+	/* called from whichever thread drains the buffer, so this can't use
+	 * lock_root, which would disable profiling for that thread */
+	pthread_mutex_lock(&root_mutex);
+	if (!enabled) {
+		pthread_mutex_unlock(&root_mutex);
 		free_call_context(context);
 		return;
 	}
@@ -370,31 +501,287 @@ static void merge_context(profile_call *context)
 	free_call_context(prev_call);
 }
 
-void profile_start(const char *name)
+static void free_pending_calls(profile_thread_buffer *buf)
 {
-	if (!thread_enabled)
+	profile_call *root = buf->context;
+	if (!root)
 		return;
 
-	profile_call new_call = {
-		.name = name,
-#ifdef TRACK_OVERHEAD
-		.overhead_start = os_gettime_ns(),
-#endif
-		.parent = thread_context,
+	while (root->parent)
+		root = root->parent;
+
+	free_call_context(root);
+	buf->context = NULL;
+}
+
+static void free_thread_buffer(profile_thread_buffer *buf)
+{
+	free_pending_calls(buf);
+	da_free(buf->stack);
+	pthread_mutex_destroy(&buf->mutex);
+	bfree(buf);
+}
+
+static void thread_buffer_exit(void *data)
+{
+	profile_thread_buffer *buf = data;
+
+	pthread_mutex_lock(&buffers_mutex);
+	if (buf->detached)
+		free_thread_buffer(buf);
+	else
+		buf->exited = true;
+	pthread_mutex_unlock(&buffers_mutex);
+}
+
+static profile_thread_buffer *create_thread_buffer(void)
+{
+	profile_thread_buffer *buf = bzalloc(sizeof(profile_thread_buffer));
+	pthread_mutex_init(&buf->mutex, NULL);
+
+	pthread_mutex_lock(&buffers_mutex);
+	if (!buffer_key_created)
+		buffer_key_created = pthread_key_create(&buffer_key,
+				thread_buffer_exit) == 0;
+	if (buffer_key_created)
+		pthread_setspecific(buffer_key, buf);
+	buf->id = next_buffer_id++;
+	da_push_back(thread_buffers, &buf);
+	pthread_mutex_unlock(&buffers_mutex);
+
+	return buf;
+}
+
+/* must be called with trace_mutex held */
+static void add_trace_call(profile_thread_buffer *buf, profile_call *call)
+{
+	profile_trace_call trace_call = {
+		.name = call->name,
+		.start_time = call->start_time,
+		.end_time = call->end_time,
+		.thread_id = buf->id,
 	};
 
+	if (!call->parent && !buf->trace_named) {
+		profile_trace_thread *thread = da_push_back_new(trace_threads);
+		thread->id = buf->id;
+		thread->name = call->name;
+		buf->trace_named = true;
+	}
+
+	circlebuf_push_back(&trace_calls, &trace_call, sizeof(trace_call));
+	if (call->end_time > trace_latest)
+		trace_latest = call->end_time;
+
+	/* calls arrive in order per thread only, so this is approximate */
+	while (trace_calls.size) {
+		profile_trace_call *first = circlebuf_data(&trace_calls, 0);
+		if (trace_latest - first->end_time <= trace_window)
+			break;
+
+		circlebuf_pop_front(&trace_calls, NULL, sizeof(*first));
+	}
+}
+
+static void process_event(profile_thread_buffer *buf,
+		const profile_event *event, bool trace)
+{
 	profile_call *call = NULL;
 
-	if (new_call.parent) {
-		size_t idx = da_push_back(new_call.parent->children, &new_call);
-		call = &new_call.parent->children.array[idx];
-	} else {
-		call = bmalloc(sizeof(profile_call));
-		memcpy(call, &new_call, sizeof(profile_call));
+	if (!event->end) {
+		profile_call new_call = {
+			.name = event->name,
+#ifdef TRACK_OVERHEAD
+			.overhead_start = event->overhead,
+#endif
+			.start_time = event->time,
+			.parent = buf->context,
+		};
+
+		if (new_call.parent) {
+			size_t idx = da_push_back(new_call.parent->children,
+					&new_call);
+			call = &new_call.parent->children.array[idx];
+		} else {
+			call = bmalloc(sizeof(profile_call));
+			memcpy(call, &new_call, sizeof(profile_call));
+		}
+
+		buf->context = call;
+		return;
+	}
+
+	/* the start was discarded by profiler_free */
+	call = buf->context;
+	if (!call)
+		return;
+
+	if (!call->name)
+		call->name = event->name;
+
+	call->end_time = event->time;
+#ifdef TRACK_OVERHEAD
+	call->overhead_end = event->overhead;
+#endif
+
+	if (trace)
+		add_trace_call(buf, call);
+
+	buf->context = call->parent;
+	if (!call->parent)
+		merge_context(call);
+}
+
+/* must be called with buf->mutex held */
+static void drain_thread_buffer(profile_thread_buffer *buf)
+{
+	unsigned long tail = (unsigned long)buf->tail;
+	unsigned long head = (unsigned long)os_atomic_load_long(&buf->head);
+	unsigned long pos;
+	bool trace = os_atomic_load_bool(&trace_active);
+
+	if (trace)
+		pthread_mutex_lock(&trace_mutex);
+
+	for (pos = tail; pos != head; pos++)
+		process_event(buf, &buf->events[pos & (EVENT_BUFFER_SIZE - 1)],
+				trace);
+
+	if (trace)
+		pthread_mutex_unlock(&trace_mutex);
+
+	/* full barrier, the events must have been read before the owning
+	 * thread can reuse them */
+	os_atomic_compare_swap_long(&buf->tail, (long)tail, (long)pos);
+}
+
+static void drain_thread_buffers(void)
+{
+	pthread_mutex_lock(&buffers_mutex);
+
+	for (size_t i = 0; i < thread_buffers.num;) {
+		profile_thread_buffer *buf = thread_buffers.array[i];
+
+		pthread_mutex_lock(&buf->mutex);
+		drain_thread_buffer(buf);
+		pthread_mutex_unlock(&buf->mutex);
+
+		if (buf->exited) {
+			free_thread_buffer(buf);
+			da_erase(thread_buffers, i);
+		} else {
+			i++;
+		}
+	}
+
+	pthread_mutex_unlock(&buffers_mutex);
+}
+
+static void detach_thread_buffers(void)
+{
+	pthread_mutex_lock(&buffers_mutex);
+
+	for (size_t i = 0; i < thread_buffers.num; i++) {
+		profile_thread_buffer *buf = thread_buffers.array[i];
+
+		pthread_mutex_lock(&buf->mutex);
+		free_pending_calls(buf);
+		pthread_mutex_unlock(&buf->mutex);
+
+		/* buffers of running threads are freed by their owner, either
+		 * on the next root call or when the thread exits */
+		if (buf->exited)
+			free_thread_buffer(buf);
+		else
+			os_atomic_set_bool(&buf->detached, true);
+	}
+
+	da_free(thread_buffers);
+	pthread_mutex_unlock(&buffers_mutex);
+}
+
+static inline profile_event *reserve_event(profile_thread_buffer *buf)
+{
+	unsigned long head = (unsigned long)buf->head;
+	unsigned long tail = (unsigned long)os_atomic_load_long(&buf->tail);
+
+	if (head - tail == EVENT_BUFFER_SIZE) {
+		pthread_mutex_lock(&buf->mutex);
+		drain_thread_buffer(buf);
+		pthread_mutex_unlock(&buf->mutex);
+	}
+
+	return &buf->events[head & (EVENT_BUFFER_SIZE - 1)];
+}
+
+static inline void publish_event(profile_thread_buffer *buf)
+{
+	os_atomic_inc_long(&buf->head);
+}
+
+static profile_thread_buffer *get_root_buffer(void)
+{
+	profile_thread_buffer *buf = thread_buffer;
+
+	if (!os_atomic_load_bool(&enabled)) {
+		thread_enabled = false;
+		return NULL;
 	}
 
-	thread_context = call;
-	call->start_time = os_gettime_ns();
+	if (buf && os_atomic_load_bool(&buf->detached)) {
+		free_thread_buffer(buf);
+		buf = NULL;
+	}
+
+	if (!buf)
+		buf = thread_buffer = create_thread_buffer();
+
+	return buf;
+}
+
+void profile_start(const char *name)
+{
+#ifdef TRACK_OVERHEAD
+	uint64_t overhead_start = os_gettime_ns();
+#endif
+	if (!thread_enabled)
+		return;
+
+	profile_thread_buffer *buf = thread_buffer;
+	if (!buf || !buf->stack.num) {
+		buf = get_root_buffer();
+		if (!buf)
+			return;
+	}
+
+	if (buf->stack.num < buf->stack.capacity)
+		buf->stack.array[buf->stack.num++] = name;
+	else
+		da_push_back(buf->stack, &name);
+
+	profile_event *event = reserve_event(buf);
+	event->name = name;
+	event->end  = false;
+#ifdef TRACK_OVERHEAD
+	event->overhead = overhead_start;
+#endif
+	event->time = os_gettime_ns();
+	publish_event(buf);
+}
+
+static void end_call(profile_thread_buffer *buf, const char *name,
+		uint64_t end)
+{
+	profile_event *event = reserve_event(buf);
+	event->name = name;
+	event->time = end;
+	event->end  = true;
+#ifdef TRACK_OVERHEAD
+	event->overhead = os_gettime_ns();
+#endif
+	publish_event(buf);
+
+	da_pop_back(buf->stack);
 }
 
 void profile_end(const char *name)
@@ -403,44 +790,33 @@ void profile_end(const char *name)
 	if (!thread_enabled)
 		return;
 
-	profile_call *call = thread_context;
-	if (!call) {
+	profile_thread_buffer *buf = thread_buffer;
+	if (!buf || !buf->stack.num) {
 		blog(LOG_ERROR, "Called profile end with no active profile");
 		return;
 	}
 
-	if (!call->name)
-		call->name = name;
+	const char **call_name = da_end(buf->stack);
+	if (!*call_name)
+		*call_name = name;
 
-	if (call->name != name) {
+	if (*call_name != name) {
 		blog(LOG_ERROR, "Called profile end with mismatching name: "
 				"start(\"%s\"[%p]) <-> end(\"%s\"[%p])",
-				call->name, call->name, name, name);
+				*call_name, *call_name, name, name);
 
-		profile_call *parent = call->parent;
-		while (parent && parent->parent &&  parent->name != name)
-			parent = parent->parent;
+		size_t idx = buf->stack.num - 1;
+		while (idx > 0 && buf->stack.array[idx] != name)
+			idx--;
 
-		if (!parent || parent->name != name)
+		if (buf->stack.array[idx] != name)
 			return;
 
-		while (call->name != name) {
-			profile_end(call->name);
-			call = call->parent;
-		}
+		while (buf->stack.num > idx + 1)
+			end_call(buf, *(const char**)da_end(buf->stack), end);
 	}
 
-	thread_context = call->parent;
-
-	call->end_time = end;
-#ifdef TRACK_OVERHEAD
-	call->overhead_end = os_gettime_ns();
-#endif
-
-	if (call->parent)
-		return;
-
-	merge_context(call);
+	end_call(buf, name, end);
 }
 
 static int profiler_time_entry_compare(const void *first, const void *second)
@@ -805,12 +1181,26 @@ static void free_profile_entry(profile_entry *entry)
 void profiler_free(void)
 {
 	DARRAY(profile_root_entry) old_root_entries = {0};
+	bool was_aggregating;
 
 	pthread_mutex_lock(&root_mutex);
-	enabled = false;
+	os_atomic_set_bool(&enabled, false);
+	was_aggregating = aggregator_active;
+	aggregator_active = false;
 	da_move(old_root_entries, root_entries);
 	pthread_mutex_unlock(&root_mutex);
 
+	if (was_aggregating)
+		stop_aggregator();
+
+	detach_thread_buffers();
+
+	pthread_mutex_lock(&trace_mutex);
+	os_atomic_set_bool(&trace_active, false);
+	circlebuf_free(&trace_calls);
+	da_free(trace_threads);
+	pthread_mutex_unlock(&trace_mutex);
+
 	for (size_t i = 0; i < old_root_entries.num; i++) {
 		profile_root_entry *entry = &old_root_entries.array[i];
 
@@ -933,6 +1323,8 @@ profiler_snapshot_t *profile_snapshot_create(void)
 {
 	profiler_snapshot_t *snap = bzalloc(sizeof(profiler_snapshot_t));
 
+	drain_thread_buffers();
+
 	pthread_mutex_lock(&root_mutex);
 	da_reserve(snap->roots, root_entries.num);
 	for (size_t i = 0; i < root_entries.num; i++) {
@@ -1067,6 +1459,119 @@ bool profiler_snapshot_dump_csv_gz(const profiler_snapshot_t *snap,
 	return true;
 }
 
+
+/* ------------------------------------------------------------------------- */
+/* Profiler trace */
+
+void profiler_trace_start(uint64_t window_ns)
+{
+	pthread_mutex_lock(&trace_mutex);
+	circlebuf_free(&trace_calls);
+	trace_window = window_ns;
+	trace_latest = 0;
+	os_atomic_set_bool(&trace_active, true);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void profiler_trace_stop(void)
+{
+	drain_thread_buffers();
+
+	pthread_mutex_lock(&trace_mutex);
+	os_atomic_set_bool(&trace_active, false);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static void dump_json_string(struct dstr *buffer, const char *str)
+{
+	dstr_cat_ch(buffer, '"');
+
+	for (; str && *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			dstr_cat_ch(buffer, '\\');
+			dstr_cat_ch(buffer, *str);
+		} else if ((unsigned char)*str < 0x20) {
+			dstr_catf(buffer, "\\u%04x", (unsigned)*str);
+		} else {
+			dstr_cat_ch(buffer, *str);
+		}
+	}
+
+	dstr_cat_ch(buffer, '"');
+}
+
+bool profiler_trace_dump_json(const char *filename)
+{
+	DARRAY(profile_trace_thread) threads = {0};
+	profile_trace_call *calls = NULL;
+	size_t num_calls = 0;
+	uint64_t first_start = ~(uint64_t)0;
+	struct dstr buffer = {0};
+	FILE *f;
+
+	drain_thread_buffers();
+
+	/* copy everything out, writing the file under trace_mutex would
+	 * block any thread that drains its own buffer meanwhile */
+	pthread_mutex_lock(&trace_mutex);
+	num_calls = trace_calls.size / sizeof(profile_trace_call);
+	if (num_calls) {
+		calls = bmalloc(trace_calls.size);
+		circlebuf_peek_front(&trace_calls, calls, trace_calls.size);
+	}
+	da_copy(threads, trace_threads);
+	pthread_mutex_unlock(&trace_mutex);
+
+	f = os_fopen(filename, "wb+");
+	if (!f) {
+		bfree(calls);
+		da_free(threads);
+		return false;
+	}
+
+	for (size_t i = 0; i < num_calls; i++)
+		if (calls[i].start_time < first_start)
+			first_start = calls[i].start_time;
+
+	dstr_copy(&buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	fwrite(buffer.array, 1, buffer.len, f);
+
+	for (size_t i = 0; i < threads.num; i++) {
+		dstr_printf(&buffer, "%s\n{\"ph\":\"M\",\"pid\":1,"
+				"\"tid\":%"PRIu32",\"name\":\"thread_name\","
+				"\"args\":{\"name\":", i ? "," : "",
+				threads.array[i].id);
+		dump_json_string(&buffer, threads.array[i].name);
+		dstr_cat(&buffer, "}}");
+		fwrite(buffer.array, 1, buffer.len, f);
+	}
+
+	for (size_t i = 0; i < num_calls; i++) {
+		profile_trace_call *call = &calls[i];
+		uint64_t ts  = call->start_time - first_start;
+		uint64_t dur = call->end_time - call->start_time;
+
+		dstr_printf(&buffer, "%s\n{\"ph\":\"X\",\"pid\":1,"
+				"\"tid\":%"PRIu32",\"ts\":%"PRIu64".%03u,"
+				"\"dur\":%"PRIu64".%03u,\"name\":",
+				(i || threads.num) ? "," : "",
+				call->thread_id,
+				ts / 1000, (unsigned)(ts % 1000),
+				dur / 1000, (unsigned)(dur % 1000));
+		dump_json_string(&buffer, call->name);
+		dstr_cat_ch(&buffer, '}');
+		fwrite(buffer.array, 1, buffer.len, f);
+	}
+
+	fwrite("\n]}\n", 1, 4, f);
+	fclose(f);
+
+	dstr_free(&buffer);
+	bfree(calls);
+	da_free(threads);
+	return true;
+}
+
 size_t profiler_snapshot_num_roots(profiler_snapshot_t *snap)
 {
 	return snap ? snap->roots.num : 0;
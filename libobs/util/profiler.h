@@ -33,6 +33,22 @@ EXPORT void profiler_print_time_between_calls(profiler_snapshot_t *snap);
 
 EXPORT void profiler_free(void);
 
+/* ------------------------------------------------------------------------- */
+/* Profiler trace */
+
+/**
+ * Starts keeping every completed call of the last window_ns nanoseconds along
+ * with the thread it was made on, replacing the previous trace
+ */
+EXPORT void profiler_trace_start(uint64_t window_ns);
+EXPORT void profiler_trace_stop(void);
+
+/**
+ * Writes the calls of the current (or last) trace as Chrome trace event JSON,
+ * which can be loaded in chrome://tracing or the Perfetto UI
+ */
+EXPORT bool profiler_trace_dump_json(const char *filename);
+
 /* ------------------------------------------------------------------------- */
 /* Profiler name storage */
 
@@ -131,6 +131,19 @@ static bool CreateAACEncoder(OBSEncoder &res, string &id, int bitrate,
 	return false;
 }
 
+static bool CreateOpusEncoder(OBSEncoder &res, const char *name, size_t idx)
+{
+	res = obs_audio_encoder_create("ffmpeg_opus", name, nullptr, idx,
+			nullptr);
+
+	if (res) {
+		obs_encoder_release(res);
+		return true;
+	}
+
+	return false;
+}
+
 /* ------------------------------------------------------------------------ */
 
 struct SimpleOutput : BasicOutputHandler {
@@ -642,6 +655,12 @@ struct AdvancedOutput : BasicOutputHandler {
 	OBSEncoder             h264Streaming;
 	OBSEncoder             h264Recording;
 
+	/* FTL streams through fileOutput, as H.264 and Opus */
+	OBSEncoder             h264FTL;
+	OBSEncoder             opusFTL;
+	OBSService             ftlService;
+	size_t                 opusFTLMixer = 0;
+
 	bool                   ffmpegOutput;
 	bool                   ffmpegRecording;
 	bool                   useStreamEncoder;
@@ -657,7 +676,7 @@ struct AdvancedOutput : BasicOutputHandler {
 
 	inline void SetupStreaming();
 	inline void SetupRecording();
-	inline void SetupFFmpeg();
+	inline void SetupFTL();
 	void SetupOutputs();
 	int GetAudioBitrate(size_t i) const;
 
@@ -712,12 +731,28 @@ AdvancedOutput::AdvancedOutput(OBSBasic *main_) : BasicOutputHandler(main_)
 	obs_output_release(streamOutput);
 
 	if (ffmpegOutput) {
-		fileOutput = obs_output_create("ffmpeg_output",
-				"adv_ffmpeg_output", nullptr, nullptr);
+		fileOutput = obs_output_create("ftl_output",
+				"adv_ftl_output", nullptr, nullptr);
 		if (!fileOutput)
-			throw "Failed to create recording FFmpeg output "
-			      "(advanced output)";
+			throw "Failed to create FTL output (advanced output)";
 		obs_output_release(fileOutput);
+
+		h264FTL = obs_video_encoder_create(streamEncoder, "ftl_h264",
+				streamEncSettings, nullptr);
+		if (!h264FTL)
+			throw "Failed to create FTL h264 encoder "
+			      "(advanced output)";
+		obs_encoder_release(h264FTL);
+
+		if (!CreateOpusEncoder(opusFTL, "ftl_opus", opusFTLMixer))
+			throw "Failed to create FTL opus encoder "
+			      "(advanced output)";
+
+		ftlService = obs_service_create("rtmp_custom", "ftl_service",
+				nullptr, nullptr);
+		if (!ftlService)
+			throw "Failed to create FTL service (advanced output)";
+		obs_service_release(ftlService);
 	} else {
 		fileOutput = obs_output_create("ffmpeg_muxer",
 				"adv_file_output", nullptr, nullptr);
@@ -890,7 +925,7 @@ inline void AdvancedOutput::SetupRecording()
 	obs_data_release(settings);
 }
 
-inline void AdvancedOutput::SetupFFmpeg()
+inline void AdvancedOutput::SetupFTL()
 {
 	const char *url = config_get_string(main->Config(), "AdvOut", "FFURL");
 	int vBitrate = config_get_int(main->Config(), "AdvOut",
@@ -899,76 +934,65 @@ inline void AdvancedOutput::SetupFFmpeg()
 			"FFRescale");
 	const char *rescaleRes = config_get_string(main->Config(), "AdvOut",
 			"FFRescaleRes");
-	const char *formatName = config_get_string(main->Config(), "AdvOut",
-			"FFFormat");
-	const char *mimeType = config_get_string(main->Config(), "AdvOut",
-			"FFFormatMimeType");
-	const char *muxCustom = config_get_string(main->Config(), "AdvOut",
-			"FFMCustom");
-	const char *vEncoder = config_get_string(main->Config(), "AdvOut",
-			"FFVEncoder");
-	int vEncoderId = config_get_int(main->Config(), "AdvOut",
-			"FFVEncoderId");
-	const char *vEncCustom = config_get_string(main->Config(), "AdvOut",
-			"FFVCustom");
 	int aBitrate = config_get_int(main->Config(), "AdvOut",
 			"FFABitrate");
 	int aTrack = config_get_int(main->Config(), "AdvOut",
 			"FFAudioTrack");
-	const char *aEncoder = config_get_string(main->Config(), "AdvOut",
-			"FFAEncoder");
-	int aEncoderId = config_get_int(main->Config(), "AdvOut",
-			"FFAEncoderId");
-	const char *aEncCustom = config_get_string(main->Config(), "AdvOut",
-			"FFACustom");
-	const char *aMuxCustom = config_get_string(main->Config(), "AdvOut",
-			"FFAMuxer");
-
-	int ftlChannelId = config_get_int(main->Config(), "AdvOut",
-			"FTLChannelID");
 	const char *ftlStreamKey = config_get_string(main->Config(), "AdvOut",
 			"FTLStreamKey");
-	int ftlAudioSSRC = config_get_int(main->Config(), "AdvOut",
-			"FTLAudioSSRC");
-	int ftlVideoSSRC = config_get_int(main->Config(), "AdvOut",
-			"FTLVideoSSRC");
+	size_t mixer = aTrack > 0 ? (size_t)(aTrack - 1) : 0;
+	unsigned int cx = 0;
+	unsigned int cy = 0;
 
-	obs_data_t *settings = obs_data_create();
+	/* the mixer of an audio encoder is fixed when it's created */
+	if (mixer != opusFTLMixer && !obs_encoder_active(opusFTL)) {
+		if (!CreateOpusEncoder(opusFTL, "ftl_opus", mixer))
+			throw "Failed to create FTL opus encoder "
+			      "(advanced output)";
+		opusFTLMixer = mixer;
+	}
 
-	obs_data_set_string(settings, "url", url);
-	obs_data_set_string(settings, "format_name", formatName);
-	obs_data_set_string(settings, "format_mime_type", mimeType);
-	obs_data_set_string(settings, "muxer_settings", muxCustom);
-	obs_data_set_int(settings, "video_bitrate", vBitrate);
-	obs_data_set_string(settings, "video_encoder", vEncoder);
-	obs_data_set_int(settings, "video_encoder_id", vEncoderId);
-	obs_data_set_string(settings, "video_settings", vEncCustom);
-	obs_data_set_string(settings, "audio_muxer_settings", aMuxCustom);
-	obs_data_set_int(settings, "audio_bitrate", aBitrate);
-	obs_data_set_string(settings, "audio_encoder", aEncoder);
-	obs_data_set_int(settings, "audio_encoder_id", aEncoderId);
-	obs_data_set_string(settings, "audio_settings", aEncCustom);
-	obs_data_set_int(settings, "ftl_channel_id", ftlChannelId);
-	obs_data_set_string(settings, "ftl_stream_key", ftlStreamKey);
-	obs_data_set_int(settings, "ftl_audio_ssrc", ftlAudioSSRC);
-	obs_data_set_int(settings, "ftl_video_ssrc", ftlVideoSSRC);
-	
 	if (rescale && rescaleRes && *rescaleRes) {
-		int width;
-		int height;
-		int val = sscanf(rescaleRes, "%dx%d", &width, &height);
-
-		if (val == 2 && width && height) {
-			obs_data_set_int(settings, "scale_width", width);
-			obs_data_set_int(settings, "scale_height", height);
+		if (sscanf(rescaleRes, "%ux%u", &cx, &cy) != 2) {
+			cx = 0;
+			cy = 0;
 		}
 	}
 
-	obs_output_set_mixer(fileOutput, aTrack - 1);
-	obs_output_set_media(fileOutput, obs_get_video(), obs_get_audio());
-	obs_output_update(fileOutput, settings);
+	OBSData h264Settings = GetDataFromJsonFile("streamEncoder.json");
+	if (!h264Settings) {
+		h264Settings = obs_data_create();
+		obs_data_release(h264Settings);
+	}
+	obs_data_set_int(h264Settings, "bitrate", vBitrate);
 
-	obs_data_release(settings);
+	obs_data_t *opusSettings = obs_data_create();
+	obs_data_set_int(opusSettings, "bitrate", aBitrate);
+
+	video_t *video = obs_get_video();
+	enum video_format format = video_output_get_format(video);
+
+	if (format != VIDEO_FORMAT_NV12 && format != VIDEO_FORMAT_I420)
+		obs_encoder_set_preferred_video_format(h264FTL,
+				VIDEO_FORMAT_NV12);
+
+	obs_encoder_set_scaled_size(h264FTL, cx, cy);
+	obs_encoder_set_video(h264FTL, obs_get_video());
+	obs_encoder_update(h264FTL, h264Settings);
+
+	obs_encoder_set_audio(opusFTL, obs_get_audio());
+	obs_encoder_update(opusFTL, opusSettings);
+	obs_data_release(opusSettings);
+
+	obs_data_t *serviceSettings = obs_data_create();
+	obs_data_set_string(serviceSettings, "server", url);
+	obs_data_set_string(serviceSettings, "key", ftlStreamKey);
+	obs_service_update(ftlService, serviceSettings);
+	obs_data_release(serviceSettings);
+
+	obs_output_set_video_encoder(fileOutput, h264FTL);
+	obs_output_set_audio_encoder(fileOutput, opusFTL, 0);
+	obs_output_set_service(fileOutput, ftlService);
 }
 
 static inline void SetEncoderName(obs_encoder_t *encoder, const char *name,
@@ -1026,7 +1050,7 @@ void AdvancedOutput::SetupOutputs()
 	SetupStreaming();
 
 	if (ffmpegOutput)
-		SetupFFmpeg();
+		SetupFTL();
 	else
 		SetupRecording();
 }
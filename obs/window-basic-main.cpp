@@ -2343,6 +2343,8 @@ int OBSBasic::ResetVideo()
 	ovi.adapter        = 0;
 	ovi.gpu_conversion = true;
 	ovi.scale_type     = GetScaleType(basicConfig);
+	ovi.readback_depth = (uint32_t)config_get_uint(basicConfig,
+			"Video", "ReadbackDepth");
 
 	if (ovi.base_width == 0 || ovi.base_height == 0) {
 		ovi.base_width = 1920;
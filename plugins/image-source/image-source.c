@@ -23,6 +23,7 @@ struct image_source {
 	time_t       file_timestamp;
 	float        update_time_elapsed;
 	uint64_t     last_time;
+	bool         texture_dirty;
 
 	gs_image_file_t image;
 };
@@ -50,6 +51,8 @@ static void image_source_load(struct image_source *context)
 	gs_image_file_free(&context->image);
 	obs_leave_graphics();
 
+	context->texture_dirty = false;
+
 	if (file && *file) {
 		debug("loading texture '%s'", file);
 		context->file_timestamp = get_modified_timestamp(file);
@@ -63,6 +66,8 @@ static void image_source_load(struct image_source *context)
 		if (!context->image.loaded)
 			warn("failed to load texture '%s'", file);
 	}
+
+	obs_source_invalidate_video(context->source);
 }
 
 static void image_source_unload(struct image_source *context)
@@ -70,6 +75,8 @@ static void image_source_unload(struct image_source *context)
 	obs_enter_graphics();
 	gs_image_file_free(&context->image);
 	obs_leave_graphics();
+
+	obs_source_invalidate_video(context->source);
 }
 
 static void image_source_update(void *data, obs_data_t *settings)
@@ -150,6 +157,11 @@ static void image_source_render(void *data, gs_effect_t *effect)
 	if (!context->image.texture)
 		return;
 
+	if (context->texture_dirty) {
+		gs_image_file_update_texture(&context->image);
+		context->texture_dirty = false;
+	}
+
 	gs_reset_blend_state();
 	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"),
 			context->image.texture);
@@ -166,10 +178,11 @@ static void image_source_tick(void *data, float seconds)
 		uint64_t elapsed = frame_time - context->last_time;
 		bool updated = gs_image_file_tick(&context->image, elapsed);
 
+		/* the texture is updated on render so that the tick doesn't
+		 * need the graphics context */
 		if (updated) {
-			obs_enter_graphics();
-			gs_image_file_update_texture(&context->image);
-			obs_leave_graphics();
+			context->texture_dirty = true;
+			obs_source_invalidate_video(context->source);
 		}
 	}
 
@@ -228,7 +241,8 @@ static obs_properties_t *image_source_properties(void *data)
 static struct obs_source_info image_source_info = {
 	.id             = "image_source",
 	.type           = OBS_SOURCE_TYPE_INPUT,
-	.output_flags   = OBS_SOURCE_VIDEO,
+	.output_flags   = OBS_SOURCE_VIDEO | OBS_SOURCE_THREADSAFE_TICK |
+	                  OBS_SOURCE_STATIC_VIDEO,
 	.get_name       = image_source_get_name,
 	.create         = image_source_create,
 	.destroy        = image_source_destroy,
@@ -63,6 +63,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define blog(level, msg, ...) blog(level, "v4l2-input: " msg, ##__VA_ARGS__)
 
+struct v4l2_data;
+
+/**
+ * Data structure for a mapped buffer that is lent to obs
+ */
+struct v4l2_lent_buffer {
+	struct v4l2_data *data;
+	struct v4l2_buffer buf;
+};
+
 /**
  * Data structure for the v4l2 source
  */
@@ -86,6 +96,9 @@ struct v4l2_data {
 	int height;
 	int linesize;
 	struct v4l2_buffer_data buffers;
+
+	struct v4l2_lent_buffer *lent;
+	volatile long lent_count;
 };
 
 /* forward declarations */
@@ -142,6 +155,65 @@ static void v4l2_prep_obs_frame(struct v4l2_data *data,
 	}
 }
 
+/**
+ * Give a buffer that was lent to obs back to the driver
+ *
+ * This is called by obs once the frame has been uploaded or dropped, which
+ * usually happens on the graphics thread.
+ */
+static void v4l2_release_buffer(void *param)
+{
+	struct v4l2_lent_buffer *lent = param;
+	struct v4l2_data *data = lent->data;
+
+	if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &lent->buf) < 0)
+		blog(LOG_DEBUG, "failed to enqueue lent buffer");
+
+	os_atomic_dec_long(&data->lent_count);
+}
+
+/**
+ * Output a dequeued buffer to obs
+ *
+ * The mapped buffer is handed to obs directly as long as that still leaves
+ * the driver a buffer to capture into, otherwise the frame is copied and the
+ * buffer is enqueued again right away.
+ *
+ * @return negative on failure
+ */
+static int_fast32_t v4l2_output_buffer(struct v4l2_data *data,
+		struct obs_source_frame *out, struct v4l2_buffer *buf)
+{
+	if (os_atomic_load_long(&data->lent_count) + 1 <
+			(long)data->buffers.count) {
+		struct v4l2_lent_buffer *lent = &data->lent[buf->index];
+
+		lent->buf = *buf;
+		os_atomic_inc_long(&data->lent_count);
+		obs_source_output_video_lent(data->source, out,
+				v4l2_release_buffer, lent);
+		return 0;
+	}
+
+	obs_source_output_video(data->source, out);
+	return v4l2_ioctl(data->dev, VIDIOC_QBUF, buf);
+}
+
+/**
+ * Wait for obs to give back all lent buffers
+ *
+ * Queued frames are released right away, a frame that is currently being
+ * uploaded is released as soon as the upload is done.  Async filters, which
+ * could keep frames indefinitely, only ever get copies.
+ */
+static void v4l2_reclaim_buffers(struct v4l2_data *data)
+{
+	obs_source_output_video(data->source, NULL);
+
+	while (os_atomic_load_long(&data->lent_count) > 0)
+		os_sleep_ms(1);
+}
+
 /*
  * Worker thread to get video data
  */
@@ -158,6 +230,10 @@ static void *v4l2_thread(void *vptr)
 	struct obs_source_frame out;
 	size_t plane_offsets[MAX_AV_PLANES];
 
+	data->lent = bzalloc(data->buffers.count * sizeof(*data->lent));
+	for (uint_fast32_t i = 0; i < data->buffers.count; ++i)
+		data->lent[i].data = data;
+
 	if (v4l2_start_capture(data->dev, &data->buffers) < 0)
 		goto exit;
 
@@ -200,9 +276,8 @@ static void *v4l2_thread(void *vptr)
 		start = (uint8_t *) data->buffers.info[buf.index].start;
 		for (uint_fast32_t i = 0; i < MAX_AV_PLANES; ++i)
 			out.data[i] = start + plane_offsets[i];
-		obs_source_output_video(data->source, &out);
 
-		if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
+		if (v4l2_output_buffer(data, &out, &buf) < 0) {
 			blog(LOG_DEBUG, "failed to enqueue buffer");
 			break;
 		}
@@ -213,7 +288,11 @@ static void *v4l2_thread(void *vptr)
 	blog(LOG_INFO, "Stopped capture after %"PRIu64" frames", frames);
 
 exit:
+	v4l2_reclaim_buffers(data);
 	v4l2_stop_capture(data->dev);
+
+	bfree(data->lent);
+	data->lent = NULL;
 	return NULL;
 }
 
@@ -17,8 +17,13 @@
 
 #include <obs-module.h>
 #include <obs-avc.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
 #include <util/dstr.h>
 #include <util/pipe.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <time.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
 
 #include <libavformat/avformat.h>
@@ -35,8 +40,22 @@ struct ffmpeg_muxer {
 	os_process_pipe_t *pipe;
 	struct dstr       path;
 	bool              sent_headers;
-	bool              active;
+	volatile bool     active;
 	bool              capturing;
+
+	/* replay buffer */
+	pthread_mutex_t   packets_mutex;
+	struct circlebuf  packets;
+	int64_t           cur_size;
+	int64_t           max_size;
+	int64_t           max_time;
+	obs_hotkey_id     hotkey;
+
+	DARRAY(struct encoder_packet) save_packets;
+	struct dstr       save_path;
+	pthread_t         save_thread;
+	bool              save_thread_active;
+	volatile bool     saving;
 };
 
 static const char *ffmpeg_mux_getname(void *unused)
@@ -159,7 +178,8 @@ static void add_muxer_params(struct dstr *cmd, struct ffmpeg_muxer *stream)
 	dstr_free(&mux);
 }
 
-static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd)
+static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
+		const char *path)
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 	obs_encoder_t *aencoders[MAX_AUDIO_MIXES];
@@ -178,7 +198,7 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd)
 	dstr_init_move_array(cmd, obs_module_file(FFMPEG_MUX));
 	dstr_insert_ch(cmd, 0, '\"');
 	dstr_cat(cmd, "\" \"");
-	dstr_cat_dstr(cmd, &stream->path);
+	dstr_cat(cmd, path);
 	dstr_catf(cmd, "\" %d %d ", vencoder ? 1 : 0, num_tracks);
 
 	if (vencoder)
@@ -213,7 +233,7 @@ static bool ffmpeg_mux_start(void *data)
 	dstr_replace(&stream->path, "\"", "\"\"");
 	obs_data_release(settings);
 
-	build_command_line(stream, &cmd);
+	build_command_line(stream, &cmd, stream->path.array);
 	stream->pipe = os_process_pipe_create(cmd.array, "w");
 	dstr_free(&cmd);
 
@@ -223,7 +243,7 @@ static bool ffmpeg_mux_start(void *data)
 	}
 
 	/* write headers and start capture */
-	stream->active = true;
+	os_atomic_set_bool(&stream->active, true);
 	stream->capturing = true;
 	obs_output_begin_data_capture(stream->output, 0);
 
@@ -235,11 +255,11 @@ static int deactivate(struct ffmpeg_muxer *stream)
 {
 	int ret = -1;
 
-	if (stream->active) {
+	if (os_atomic_load_bool(&stream->active)) {
 		ret = os_process_pipe_destroy(stream->pipe);
 		stream->pipe = NULL;
 
-		stream->active = false;
+		os_atomic_set_bool(&stream->active, false);
 		stream->sent_headers = false;
 
 		info("Output of file '%s' stopped", stream->path.array);
@@ -274,8 +294,8 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 	stream->capturing = false;
 }
 
-static bool write_packet(struct ffmpeg_muxer *stream,
-		struct encoder_packet *packet)
+static bool write_packet_to(struct ffmpeg_muxer *stream,
+		os_process_pipe_t *pipe, struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
 	size_t ret;
@@ -289,17 +309,26 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 		.keyframe = packet->keyframe
 	};
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)&info,
+	ret = os_process_pipe_write(pipe, (const uint8_t*)&info,
 			sizeof(info));
 	if (ret != sizeof(info)) {
 		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
 		return false;
 	}
 
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
+	ret = os_process_pipe_write(pipe, packet->data, packet->size);
 	if (ret != packet->size) {
 		warn("os_process_pipe_write for packet data failed");
+		return false;
+	}
+
+	return true;
+}
+
+static bool write_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	if (!write_packet_to(stream, stream->pipe, packet)) {
 		signal_failure(stream);
 		return false;
 	}
@@ -308,7 +337,7 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 }
 
 static bool send_audio_headers(struct ffmpeg_muxer *stream,
-		obs_encoder_t *aencoder, size_t idx)
+		os_process_pipe_t *pipe, obs_encoder_t *aencoder, size_t idx)
 {
 	struct encoder_packet packet = {
 		.type         = OBS_ENCODER_AUDIO,
@@ -317,10 +346,11 @@ static bool send_audio_headers(struct ffmpeg_muxer *stream,
 	};
 
 	obs_encoder_get_extra_data(aencoder, &packet.data, &packet.size);
-	return write_packet(stream, &packet);
+	return write_packet_to(stream, pipe, &packet);
 }
 
-static bool send_video_headers(struct ffmpeg_muxer *stream)
+static bool send_video_headers(struct ffmpeg_muxer *stream,
+		os_process_pipe_t *pipe)
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 
@@ -330,21 +360,21 @@ static bool send_video_headers(struct ffmpeg_muxer *stream)
 	};
 
 	obs_encoder_get_extra_data(vencoder, &packet.data, &packet.size);
-	return write_packet(stream, &packet);
+	return write_packet_to(stream, pipe, &packet);
 }
 
-static bool send_headers(struct ffmpeg_muxer *stream)
+static bool send_headers(struct ffmpeg_muxer *stream, os_process_pipe_t *pipe)
 {
 	obs_encoder_t *aencoder;
 	size_t idx = 0;
 
-	if (!send_video_headers(stream))
+	if (!send_video_headers(stream, pipe))
 		return false;
 
 	do {
 		aencoder = obs_output_get_audio_encoder(stream->output, idx);
 		if (aencoder) {
-			if (!send_audio_headers(stream, aencoder, idx)) {
+			if (!send_audio_headers(stream, pipe, aencoder, idx)) {
 				return false;
 			}
 			idx++;
@@ -358,12 +388,14 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
 
-	if (!stream->active)
+	if (!os_atomic_load_bool(&stream->active))
 		return;
 
 	if (!stream->sent_headers) {
-		if (!send_headers(stream))
+		if (!send_headers(stream, stream->pipe)) {
+			signal_failure(stream);
 			return;
+		}
 
 		stream->sent_headers = true;
 	}
@@ -396,3 +428,459 @@ struct obs_output_info ffmpeg_muxer = {
 	.encoded_packet = ffmpeg_mux_data,
 	.get_properties = ffmpeg_mux_properties
 };
+
+/* ------------------------------------------------------------------------ */
+
+static const char *replay_buffer_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("ReplayBuffer");
+}
+
+static void replay_buffer_save(struct ffmpeg_muxer *stream);
+
+static void replay_buffer_hotkey(void *data, obs_hotkey_id id,
+		obs_hotkey_t *hotkey, bool pressed)
+{
+	UNUSED_PARAMETER(id);
+	UNUSED_PARAMETER(hotkey);
+
+	if (pressed)
+		replay_buffer_save(data);
+}
+
+static void save_replay_proc(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(cd);
+	replay_buffer_save(data);
+}
+
+static void replay_buffer_update(void *data, obs_data_t *settings)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	stream->max_time = obs_data_get_int(settings, "max_time_sec") *
+		1000000LL;
+	stream->max_size = obs_data_get_int(settings, "max_size_mb") *
+		(1024 * 1024);
+	pthread_mutex_unlock(&stream->packets_mutex);
+}
+
+static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+
+	stream->output = output;
+	pthread_mutex_init_value(&stream->packets_mutex);
+
+	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0) {
+		bfree(stream);
+		return NULL;
+	}
+
+	stream->hotkey = obs_hotkey_register_output(output,
+			"ReplayBuffer.Save",
+			obs_module_text("ReplayBuffer.Save"),
+			replay_buffer_hotkey, stream);
+
+	proc_handler_add(ph, "void save()", save_replay_proc, stream);
+	signal_handler_add(obs_output_get_signal_handler(output),
+			"void replay_saved(ptr output, string path)");
+
+	replay_buffer_update(stream, settings);
+	return stream;
+}
+
+static void free_replay_packets(struct ffmpeg_muxer *stream)
+{
+	while (stream->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+	}
+
+	stream->cur_size = 0;
+}
+
+static void replay_buffer_destroy(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	if (stream->save_thread_active)
+		pthread_join(stream->save_thread, NULL);
+
+	obs_hotkey_unregister(stream->hotkey);
+
+	free_replay_packets(stream);
+	circlebuf_free(&stream->packets);
+	pthread_mutex_destroy(&stream->packets_mutex);
+	dstr_free(&stream->save_path);
+	dstr_free(&stream->path);
+	bfree(stream);
+}
+
+static bool replay_buffer_start(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	os_atomic_set_bool(&stream->active, true);
+	stream->capturing = true;
+	obs_output_begin_data_capture(stream->output, 0);
+
+	info("Replay buffer started, keeping %d seconds / %d MB",
+			(int)(stream->max_time / 1000000LL),
+			(int)(stream->max_size / (1024 * 1024)));
+	return true;
+}
+
+static void replay_buffer_stop(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	if (stream->capturing) {
+		obs_output_end_data_capture(stream->output);
+		stream->capturing = false;
+	}
+
+	/* a save in progress works on its own references, so the buffer
+	 * can be freed right away */
+	pthread_mutex_lock(&stream->packets_mutex);
+	os_atomic_set_bool(&stream->active, false);
+	free_replay_packets(stream);
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	info("Replay buffer stopped");
+}
+
+static inline struct encoder_packet *replay_packet(struct ffmpeg_muxer *stream,
+		size_t idx)
+{
+	return circlebuf_data(&stream->packets, idx * sizeof(struct encoder_packet));
+}
+
+static inline size_t num_replay_packets(struct ffmpeg_muxer *stream)
+{
+	return stream->packets.size / sizeof(struct encoder_packet);
+}
+
+/* drops the oldest group of pictures, so the buffer always starts at a
+ * keyframe.  the last group of pictures is never dropped. */
+static bool drop_oldest_gop(struct ffmpeg_muxer *stream)
+{
+	size_t num = num_replay_packets(stream);
+	size_t next_keyframe = 0;
+
+	for (size_t i = 1; i < num; i++) {
+		struct encoder_packet *packet = replay_packet(stream, i);
+		if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe) {
+			next_keyframe = i;
+			break;
+		}
+	}
+
+	if (!next_keyframe)
+		return false;
+
+	for (size_t i = 0; i < next_keyframe; i++) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+		stream->cur_size -= (int64_t)packet.size;
+		obs_encoder_packet_release(&packet);
+	}
+
+	return true;
+}
+
+static inline bool replay_buffer_full(struct ffmpeg_muxer *stream)
+{
+	struct encoder_packet *first = replay_packet(stream, 0);
+	struct encoder_packet *last =
+		replay_packet(stream, num_replay_packets(stream) - 1);
+
+	if (stream->max_size && stream->cur_size > stream->max_size)
+		return true;
+	return stream->max_time &&
+		last->dts_usec - first->dts_usec > stream->max_time;
+}
+
+static void replay_buffer_data(void *data, struct encoder_packet *packet)
+{
+	struct ffmpeg_muxer   *stream = data;
+	struct encoder_packet ref;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+
+	if (!os_atomic_load_bool(&stream->active)) {
+		pthread_mutex_unlock(&stream->packets_mutex);
+		return;
+	}
+
+	/* the payload is shared with the encoder and every other output, so
+	 * buffering it only costs a reference */
+	obs_encoder_packet_ref(&ref, packet);
+
+	circlebuf_push_back(&stream->packets, &ref, sizeof(ref));
+	stream->cur_size += (int64_t)ref.size;
+
+	while (replay_buffer_full(stream)) {
+		if (!drop_oldest_gop(stream))
+			break;
+	}
+
+	pthread_mutex_unlock(&stream->packets_mutex);
+}
+
+static uint64_t replay_buffer_packet_memory(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	uint64_t size;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	size = (uint64_t)stream->cur_size;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return size;
+}
+
+static inline int64_t usec_to_timebase(int64_t usec,
+		const struct encoder_packet *packet)
+{
+	int64_t val = usec * packet->timebase_den;
+	int64_t div = (int64_t)packet->timebase_num * 1000000;
+
+	return val >= 0 ? (val + div / 2) / div : -((div / 2 - val) / div);
+}
+
+/* makes the saved file start at timestamp 0.  the timestamps of each track
+ * start wherever its encoder started, so every track is rebased on the
+ * shared clock of dts_usec to the first video keyframe, which keeps them in
+ * sync.  audio from before that keyframe is left out. */
+static void rebase_save_packets(struct ffmpeg_muxer *stream)
+{
+	int64_t start_usec = 0;
+	bool found_keyframe = false;
+	size_t num = 0;
+
+	for (size_t i = 0; i < stream->save_packets.num; i++) {
+		struct encoder_packet *packet = &stream->save_packets.array[i];
+
+		if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe) {
+			start_usec = packet->dts_usec;
+			found_keyframe = true;
+			break;
+		}
+	}
+
+	if (!found_keyframe)
+		return;
+
+	for (size_t i = 0; i < stream->save_packets.num; i++) {
+		struct encoder_packet *packet = &stream->save_packets.array[i];
+		int64_t offset = packet->pts - packet->dts;
+
+		if (packet->dts_usec < start_usec) {
+			obs_encoder_packet_release(packet);
+			continue;
+		}
+
+		packet->dts = usec_to_timebase(packet->dts_usec - start_usec,
+				packet);
+		packet->pts = packet->dts + offset;
+		stream->save_packets.array[num++] = *packet;
+	}
+
+	stream->save_packets.num = num;
+}
+
+static void generate_replay_path(struct ffmpeg_muxer *stream)
+{
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+	const char *dir = obs_data_get_string(settings, "directory");
+	const char *format = obs_data_get_string(settings, "format");
+	const char *ext = obs_data_get_string(settings, "extension");
+	char file[256];
+	time_t now = time(NULL);
+
+	if (!*format ||
+	    !strftime(file, sizeof(file), format, localtime(&now)))
+		snprintf(file, sizeof(file), "Replay %lld", (long long)now);
+
+	dstr_copy(&stream->save_path, dir);
+	dstr_replace(&stream->save_path, "\\", "/");
+	if (stream->save_path.len &&
+	    dstr_end(&stream->save_path) != '/')
+		dstr_cat_ch(&stream->save_path, '/');
+	dstr_catf(&stream->save_path, "%s.%s", file, *ext ? ext : "mp4");
+
+	obs_data_release(settings);
+}
+
+static bool write_replay(struct ffmpeg_muxer *stream)
+{
+	os_process_pipe_t *pipe;
+	struct dstr path = {0};
+	struct dstr cmd;
+	bool success;
+	int ret;
+
+	dstr_copy_dstr(&path, &stream->save_path);
+	dstr_replace(&path, "\"", "\"\"");
+
+	build_command_line(stream, &cmd, path.array);
+	pipe = os_process_pipe_create(cmd.array, "w");
+	dstr_free(&cmd);
+	dstr_free(&path);
+
+	if (!pipe) {
+		warn("Failed to create process pipe");
+		return false;
+	}
+
+	success = send_headers(stream, pipe);
+
+	for (size_t i = 0; success && i < stream->save_packets.num; i++)
+		success = write_packet_to(stream, pipe,
+				&stream->save_packets.array[i]);
+
+	ret = os_process_pipe_destroy(pipe);
+	return success && ret == 0;
+}
+
+static void *replay_save_thread(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	uint64_t start = os_gettime_ns();
+	bool success;
+
+	rebase_save_packets(stream);
+	success = write_replay(stream);
+
+	for (size_t i = 0; i < stream->save_packets.num; i++)
+		obs_encoder_packet_release(&stream->save_packets.array[i]);
+	da_free(stream->save_packets);
+
+	if (success) {
+		struct calldata cd;
+		uint8_t stack[128];
+
+		info("Saved replay '%s' in %d ms", stream->save_path.array,
+				(int)((os_gettime_ns() - start) / 1000000));
+
+		calldata_init_fixed(&cd, stack, sizeof(stack));
+		calldata_set_ptr(&cd, "output", stream->output);
+		calldata_set_string(&cd, "path", stream->save_path.array);
+		signal_handler_signal(
+				obs_output_get_signal_handler(stream->output),
+				"replay_saved", &cd);
+	} else {
+		warn("Failed to save replay '%s'", stream->save_path.array);
+	}
+
+	os_atomic_set_bool(&stream->saving, false);
+	return NULL;
+}
+
+static void replay_buffer_save(struct ffmpeg_muxer *stream)
+{
+	size_t num;
+
+	if (!os_atomic_load_bool(&stream->active))
+		return;
+
+	/* the hotkey and the proc can both trigger a save */
+	if (os_atomic_set_bool(&stream->saving, true)) {
+		warn("Replay save already in progress");
+		return;
+	}
+
+	if (stream->save_thread_active) {
+		pthread_join(stream->save_thread, NULL);
+		stream->save_thread_active = false;
+	}
+
+	/* take references to the buffered packets, the encoders keep
+	 * running and the buffer keeps filling while the file is written */
+	pthread_mutex_lock(&stream->packets_mutex);
+	num = num_replay_packets(stream);
+	da_resize(stream->save_packets, num);
+	for (size_t i = 0; i < num; i++)
+		obs_encoder_packet_ref(&stream->save_packets.array[i],
+				replay_packet(stream, i));
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	if (!num) {
+		da_free(stream->save_packets);
+		os_atomic_set_bool(&stream->saving, false);
+		return;
+	}
+
+	generate_replay_path(stream);
+
+	if (pthread_create(&stream->save_thread, NULL, replay_save_thread,
+				stream) != 0) {
+		warn("Failed to create replay save thread");
+		for (size_t i = 0; i < num; i++)
+			obs_encoder_packet_release(
+					&stream->save_packets.array[i]);
+		da_free(stream->save_packets);
+		os_atomic_set_bool(&stream->saving, false);
+		return;
+	}
+
+	stream->save_thread_active = true;
+}
+
+static void replay_buffer_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "max_time_sec", 20);
+	obs_data_set_default_int(settings, "max_size_mb", 512);
+	obs_data_set_default_string(settings, "format",
+			"Replay %Y-%m-%d %H-%M-%S");
+	obs_data_set_default_string(settings, "extension", "mp4");
+}
+
+static obs_properties_t *replay_buffer_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_path(props, "directory",
+			obs_module_text("ReplayBuffer.Directory"),
+			OBS_PATH_DIRECTORY, NULL, NULL);
+	obs_properties_add_text(props, "format",
+			obs_module_text("ReplayBuffer.Format"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_text(props, "extension",
+			obs_module_text("ReplayBuffer.Extension"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "max_time_sec",
+			obs_module_text("ReplayBuffer.MaxTime"), 1, 21600, 1);
+	obs_properties_add_int(props, "max_size_mb",
+			obs_module_text("ReplayBuffer.MaxSize"), 0, 65536, 1);
+	return props;
+}
+
+struct obs_output_info replay_buffer = {
+	.id                = "replay_buffer",
+	.flags             = OBS_OUTPUT_AV |
+	                     OBS_OUTPUT_ENCODED |
+	                     OBS_OUTPUT_MULTI_TRACK,
+	.get_name          = replay_buffer_getname,
+	.create            = replay_buffer_create,
+	.destroy           = replay_buffer_destroy,
+	.start             = replay_buffer_start,
+	.stop              = replay_buffer_stop,
+	.update            = replay_buffer_update,
+	.encoded_packet    = replay_buffer_data,
+	.get_defaults      = replay_buffer_defaults,
+	.get_properties    = replay_buffer_properties,
+	.get_packet_memory = replay_buffer_packet_memory
+};
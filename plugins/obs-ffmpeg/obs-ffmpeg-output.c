@@ -15,8 +15,6 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
-//#define _FTL_USE_H264
-
 #include <obs-module.h>
 #include <util/circlebuf.h>
 #include <util/threading.h>
@@ -28,36 +26,15 @@
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 
-#ifdef _WIN32
-#include <ftl.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#include <windows.h>
-#include <process.h>
-#include <Shellapi.h>
-#else
-#include <ftl.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <signal.h>
-#include <wchar.h>
-#include <netdb.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#endif
-
 #include "obs-ffmpeg-formats.h"
 #include "closest-pixel-format.h"
 #include "obs-ffmpeg-compat.h"
 
 struct ffmpeg_cfg {
-	char         			 url[2048];
+	const char         *url;
 	const char         *format_name;
 	const char         *format_mime_type;
-	char				 			 audio_muxer_settings[2048];
-	char         			 muxer_settings[2048];
+	const char         *muxer_settings;
 	int                video_bitrate;
 	int                audio_bitrate;
 	const char         *video_encoder;
@@ -73,15 +50,6 @@ struct ffmpeg_cfg {
 	int                scale_height;
 	int                width;
 	int                height;
-
-	/* FTL specific fields */
-	const char			   *ingest_location;
-	char         ingest_ip[20];
-	uint32_t					channel_id;
-	char						stream_key[2048];
-	uint32_t					audio_ssrc;
-	uint32_t					video_ssrc;
-
 };
 
 struct ffmpeg_data {
@@ -89,8 +57,7 @@ struct ffmpeg_data {
 	AVStream           *audio;
 	AVCodec            *acodec;
 	AVCodec            *vcodec;
-	AVFormatContext    *output_video;
-	AVFormatContext    *output_audio;
+	AVFormatContext    *output;
 	struct SwsContext  *swscale;
 
 	int64_t            total_frames;
@@ -114,6 +81,19 @@ struct ffmpeg_data {
 	bool               initialized;
 };
 
+struct queued_packet {
+	AVPacket           packet;
+	uint64_t           queued_ns;
+};
+
+struct write_stats {
+	long               max_queue_depth;
+	uint64_t           last_latency_ns;
+	uint64_t           max_latency_ns;
+	uint64_t           total_latency_ns;
+	uint64_t           packets_written;
+};
+
 struct ffmpeg_output {
 	obs_output_t       *output;
 	volatile bool      active;
@@ -128,166 +108,37 @@ struct ffmpeg_output {
 	os_sem_t           *write_sem;
 	os_event_t         *stop_event;
 
-	DARRAY(AVPacket)   packets_video;
-	DARRAY(AVPacket)   packets_audio;
-
-	ftl_stream_configuration_t* stream_config;
-	ftl_stream_video_component_t* video_component;
-	ftl_stream_audio_component_t* audio_component;
+	/* filled by the encode callbacks, the write thread swaps them with
+	 * its own (empty) batch buffers and drains a whole batch per wake */
+	struct circlebuf   packets_video;
+	struct circlebuf   packets_audio;
+	struct circlebuf   batch_video;
+	struct circlebuf   batch_audio;
 
-#ifdef _WIN32
-	STARTUPINFO si;
-	PROCESS_INFORMATION pi;
-  SHELLEXECUTEINFO ShExecInfo;
-#else
-	pid_t ftl_express_pid;
-#endif
+	volatile long      queued_packets;
+	struct write_stats stats;
 };
 
 /* ------------------------------------------------------------------------- */
 
-void log_libftl_messages(ftl_log_severity_t log_level, const char * message)
-{
-	UNUSED_PARAMETER(log_level);
-  blog(LOG_WARNING, "[libftl] %s", message);
-}
-
-// Returns 0 on success
-int map_ftl_error_to_obs_error(int status) {
-	/* Map FTL errors to OBS errors */
-	int ftl_to_obs_error_code = 0;
-	switch (status) {
-		case FTL_SUCCESS:
-			break;
-		case FTL_DNS_FAILURE:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_DNS_FAILURE;
-			break;
-		case FTL_CONNECT_ERROR:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_CONNECT_FAILURE;
-			break;
-		case FTL_OLD_VERSION:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_OLD_VERSION;
-			break;
-		case FTL_STREAM_REJECTED:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_STREAM_REJECTED;
-			break;
-		case FTL_UNAUTHORIZED:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_UNAUTHORIZED;
-			break;
-		case FTL_AUDIO_SSRC_COLLISION:
-			/* SSRC collision, let's back up and try with a new audio SSRC */
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_AUDIO_SSRC_COLLISION;
-			break;
-		case FTL_VIDEO_SSRC_COLLISION:
-			ftl_to_obs_error_code = OBS_OUTPUT_FTL_VIDEO_SSRC_COLLISION;
-			break;
-		/* Non-specific failures, or internal Tachyon bug */
-		default:
-			/* Unknown FTL error */
-			blog (LOG_ERROR, "tachyon error mapping needs to be updated!");
-			ftl_to_obs_error_code = OBS_OUTPUT_ERROR;
-	}
-
-	return ftl_to_obs_error_code;
-}
-
-static int lookup_ingest_ip(const char *ingest_location, char *ingest_ip){
-  struct hostent *remoteHost;
-	struct in_addr addr;
-	int retval = -1;
-	ingest_ip[0] = '\0';
-
-  remoteHost = gethostbyname(ingest_location);
-
-	if(remoteHost) {
-			int i = 0;
-			if (remoteHost->h_addrtype == AF_INET)
-			{
-					while (remoteHost->h_addr_list[i] != 0) {
-							addr.s_addr = *(u_long *) remoteHost->h_addr_list[i++];
-							blog(LOG_INFO, "IP Address #%d of ingest is: %s\n", i, inet_ntoa(addr));
-
-							/*only use the first ip found*/
-							if(strlen(ingest_ip) == 0){
-								strcpy(ingest_ip, inet_ntoa(addr));
-								retval = 0;
-							}
-					}
-			}
-	}
-
-	return retval;
-}
-
-ftl_status_t attempt_ftl_connection(struct ffmpeg_output *output, struct ffmpeg_cfg config)
-{
-	ftl_status_t status_code;
-
-
-	/* Use Charon to autheticate and configure muxer settings */
-	ftl_init();
-	ftl_register_log_handler(log_libftl_messages);
-
-	status_code = ftl_create_stream_configuration(&(output->stream_config));
-	if (status_code != FTL_SUCCESS) {
-	 blog(LOG_WARNING, "Failed to initialize stream configuration: errno %d\n", status_code);
-	 return OBS_OUTPUT_ERROR;
-  }
-
-	ftl_set_ingest_location(output->stream_config, config.ingest_ip);
-	ftl_set_authetication_key(output->stream_config, config.channel_id, config.stream_key);
-
-#ifdef _FTL_USE_H264
-	output->video_component = ftl_create_video_component(FTL_VIDEO_H264, 96, config.video_ssrc, config.scale_width, config.scale_height);
-#else
-	output->video_component = ftl_create_video_component(FTL_VIDEO_VP8, 96, config.video_ssrc, config.scale_width, config.scale_height);
-#endif
-	ftl_attach_video_component_to_stream(output->stream_config, output->video_component);
-
-	output->audio_component = ftl_create_audio_component(FTL_AUDIO_OPUS, 97, config.audio_ssrc);
-	blog(LOG_WARNING, "test %d %d", config.audio_ssrc, config.video_ssrc);
-	ftl_attach_audio_component_to_stream(output->stream_config, output->audio_component);
-
-	status_code = ftl_activate_stream(output->stream_config);
-
-	int obs_status = map_ftl_error_to_obs_error(status_code);
-
-	if (status_code != FTL_SUCCESS) {
-		blog(LOG_ERROR, "Failed to initialize FTL Stream");
-		ftl_destory_stream(&(output->stream_config));
-		output->stream_config = 0;
-		return obs_status;
-	}
-
-	return obs_status;
-}
-
 static bool new_stream(struct ffmpeg_data *data, AVStream **stream,
-		AVCodec **codec, enum AVCodecID id, int audio)
+		AVCodec **codec, enum AVCodecID id)
 {
-	*stream = NULL;
-
-	if ((*codec = avcodec_find_encoder(id)) != NULL) {
-		if (audio) {
-			*stream = avformat_new_stream(data->output_audio, *codec);
-		}
-		else {
-			*stream = avformat_new_stream(data->output_video, *codec);
-		}
+	*codec = avcodec_find_encoder(id);
+	if (!*codec) {
+		blog(LOG_WARNING, "Couldn't find encoder '%s'",
+				avcodec_get_name(id));
+		return false;
 	}
 
+	*stream = avformat_new_stream(data->output, *codec);
 	if (!*stream) {
 		blog(LOG_WARNING, "Couldn't create stream for encoder '%s'",
 				avcodec_get_name(id));
 		return false;
 	}
 
-	if (audio == 1) {
-		(*stream)->id = 0;
-	} else {
-		(*stream)->id = 1;
-	}
-
+	(*stream)->id = data->output->nb_streams-1;
 	return true;
 }
 
@@ -307,7 +158,6 @@ static void parse_params(AVCodecContext *context, char **opts)
 			*assign = 0;
 			value = assign+1;
 
-			blog(LOG_WARNING, "Setting options %s = %s\n", name, value);
 			av_opt_set(context->priv_data, name, value, 0);
 		}
 
@@ -318,17 +168,12 @@ static void parse_params(AVCodecContext *context, char **opts)
 static bool open_video_codec(struct ffmpeg_data *data)
 {
 	AVCodecContext *context = data->video->codec;
-
-	/* Hardcode in quality=realtime */
-#ifdef _FTL_USE_H264
-	//char **opts = strlist_split(data->config.video_settings, ' ', false);
-	char **opts = strlist_split("quality=realtime profile=baseline bframes=0 preset=superfast tune=zerolatency", ' ', false);
-#else
-	char **opts = strlist_split("quality=realtime", ' ', false);
-#endif
-
+	char **opts = strlist_split(data->config.video_settings, ' ', false);
 	int ret;
 
+	if (strcmp(data->vcodec->name, "libx264") == 0)
+		av_opt_set(context->priv_data, "preset", "veryfast", 0);
+
 	if (opts) {
 		parse_params(context, opts);
 		strlist_free(opts);
@@ -394,22 +239,12 @@ static bool create_video_stream(struct ffmpeg_data *data)
 	}
 
 	if (!new_stream(data, &data->video, &data->vcodec,
-				data->output_video->oformat->video_codec,
-				0)) {
-		blog(LOG_ERROR, "new_stream() failed to make video codec");
+				data->output->oformat->video_codec))
 		return false;
-	}
-
-	//closest_format = get_closest_format(data->config.format,
-	//		data->vcodec->pix_fmts);
 
-	/**
-	 * closest_format hardcoded for VP8 as removing encoder boxes from the UI
-	 * broke this. Annoying but managable. Acceptable PIX_FMTS gotten from FFmpeg
-	 * source codec
-	 */
+	closest_format = get_closest_format(data->config.format,
+			data->vcodec->pix_fmts);
 
-	closest_format 			= AV_PIX_FMT_YUV420P;
 	context                 = data->video->codec;
 	context->bit_rate       = data->config.video_bitrate * 1000;
 	context->width          = data->config.scale_width;
@@ -422,23 +257,19 @@ static bool create_video_stream(struct ffmpeg_data *data)
 
 	data->video->time_base = context->time_base;
 
-	if (data->output_video->oformat->flags & AVFMT_GLOBALHEADER)
+	if (data->output->oformat->flags & AVFMT_GLOBALHEADER)
 		context->flags |= CODEC_FLAG_GLOBAL_HEADER;
 
-	if (!open_video_codec(data)) {
-		blog(LOG_ERROR, "Failed to open video codec");
+	if (!open_video_codec(data))
 		return false;
-	}
 
 	if (context->pix_fmt    != data->config.format ||
 	    data->config.width  != data->config.scale_width ||
 	    data->config.height != data->config.scale_height) {
 
-		if (!init_swscale(data, context)) {
-				blog(LOG_ERROR, "Failed to init scale stuff");
-				return false;
-			}
-		}
+		if (!init_swscale(data, context))
+			return false;
+	}
 
 	return true;
 }
@@ -446,7 +277,6 @@ static bool create_video_stream(struct ffmpeg_data *data)
 static bool open_audio_codec(struct ffmpeg_data *data)
 {
 	AVCodecContext *context = data->audio->codec;
-	//char **opts = strlist_split(data->config.video_settings, ' ', false);
 	char **opts = strlist_split(data->config.audio_settings, ' ', false);
 	int ret;
 
@@ -494,8 +324,7 @@ static bool create_audio_stream(struct ffmpeg_data *data)
 	}
 
 	if (!new_stream(data, &data->audio, &data->acodec,
-				data->output_audio->oformat->audio_codec,
-				1))
+				data->output->oformat->audio_codec))
 		return false;
 
 	context              = data->audio->codec;
@@ -515,7 +344,7 @@ static bool create_audio_stream(struct ffmpeg_data *data)
 	data->audio_planes = get_audio_planes(data->audio_format, aoi.speakers);
 	data->audio_size = get_audio_size(data->audio_format, aoi.speakers, 1);
 
-	if (data->output_audio->oformat->flags & AVFMT_GLOBALHEADER)
+	if (data->output->oformat->flags & AVFMT_GLOBALHEADER)
 		context->flags |= CODEC_FLAG_GLOBAL_HEADER;
 
 	return open_audio_codec(data);
@@ -523,11 +352,13 @@ static bool create_audio_stream(struct ffmpeg_data *data)
 
 static inline bool init_streams(struct ffmpeg_data *data)
 {
-	if (data->output_video->oformat->video_codec != AV_CODEC_ID_NONE)
+	AVOutputFormat *format = data->output->oformat;
+
+	if (format->video_codec != AV_CODEC_ID_NONE)
 		if (!create_video_stream(data))
 			return false;
 
-	if (data->output_audio->oformat->audio_codec != AV_CODEC_ID_NONE)
+	if (format->audio_codec != AV_CODEC_ID_NONE)
 		if (!create_audio_stream(data))
 			return false;
 
@@ -536,39 +367,22 @@ static inline bool init_streams(struct ffmpeg_data *data)
 
 static inline bool open_output_file(struct ffmpeg_data *data)
 {
-	AVOutputFormat *format_video = data->output_video->oformat;
-	AVOutputFormat *format_audio = data->output_audio->oformat;
-
+	AVOutputFormat *format = data->output->oformat;
 	int ret;
 
-	/* Do video */
-	if ((format_video->flags & AVFMT_NOFILE) == 0) {
-		ret = avio_open(&data->output_video->pb, data->config.url,
+	if ((format->flags & AVFMT_NOFILE) == 0) {
+		ret = avio_open(&data->output->pb, data->config.url,
 				AVIO_FLAG_WRITE);
 		if (ret < 0) {
-			blog(LOG_WARNING, "Couldn't open video '%s', %s",
+			blog(LOG_WARNING, "Couldn't open '%s', %s",
 					data->config.url, av_err2str(ret));
 			return false;
 		}
 	}
 
-	if ((format_audio->flags & AVFMT_NOFILE) == 0) {
-		ret = avio_open(&data->output_audio->pb, data->config.url,
-				AVIO_FLAG_WRITE);
-		if (ret < 0) {
-			blog(LOG_WARNING, "Couldn't open video '%s', %s",
-					data->config.url, av_err2str(ret));
-			return false;
-		}
-	}
-
-	strncpy(data->output_audio->filename, data->config.url,
-			sizeof(data->output_audio->filename));
-	data->output_audio->filename[sizeof(data->output_audio->filename) - 1] = 0;
-
-	strncpy(data->output_video->filename, data->config.url,
-			sizeof(data->output_video->filename));
-	data->output_video->filename[sizeof(data->output_video->filename) - 1] = 0;
+	strncpy(data->output->filename, data->config.url,
+			sizeof(data->output->filename));
+	data->output->filename[sizeof(data->output->filename) - 1] = 0;
 
 	AVDictionary *dict = NULL;
 	if ((ret = av_dict_parse_string(&dict, data->config.muxer_settings,
@@ -592,44 +406,13 @@ static inline bool open_output_file(struct ffmpeg_data *data)
 		dstr_free(&str);
 	}
 
-
-	AVDictionary *audio_dict = NULL;
-	if ((ret = av_dict_parse_string(&audio_dict, data->config.audio_muxer_settings,
-				"=", " ", 0))) {
-		blog(LOG_WARNING, "Failed to parse audio muxer settings: %s\n%s",
-				av_err2str(ret), data->config.audio_muxer_settings);
-
-		av_dict_free(&audio_dict);
-		return false;
-	}
-
-	if (av_dict_count(dict) > 0) {
-		struct dstr str = {0};
-
-		AVDictionaryEntry *entry = NULL;
-		while ((entry = av_dict_get(audio_dict, "", entry, AV_DICT_IGNORE_SUFFIX))) {
-			dstr_catf(&str, "\n\t%s=%s", entry->key, entry->value);
-		}
-
-		blog(LOG_INFO, "Using audio muxer settings:%s", str.array);
-		dstr_free(&str);
-	}
-
-	ret = avformat_write_header(data->output_audio, &audio_dict);
+	ret = avformat_write_header(data->output, &dict);
 	if (ret < 0) {
-		blog(LOG_WARNING, "Error opening audio '%s': %s",
+		blog(LOG_WARNING, "Error opening '%s': %s",
 				data->config.url, av_err2str(ret));
 		return false;
 	}
 
-	ret = avformat_write_header(data->output_video, &dict);
-	if (ret < 0) {
-		blog(LOG_WARNING, "Error opening video '%s': %s",
-				data->config.url, av_err2str(ret));
-		return false;
-	}
-
-	av_dict_free(&audio_dict);
 	av_dict_free(&dict);
 
 	return true;
@@ -663,29 +446,23 @@ static void close_audio(struct ffmpeg_data *data)
 
 static void ffmpeg_data_free(struct ffmpeg_data *data)
 {
-	if (data->initialized) {
-		av_write_trailer(data->output_video);
-		av_write_trailer(data->output_audio);
-	}
+	if (data->initialized)
+		av_write_trailer(data->output);
 
 	if (data->video)
 		close_video(data);
 	if (data->audio)
 		close_audio(data);
 
-	if (data->output_video) {
-		if ((data->output_video->oformat->flags & AVFMT_NOFILE) == 0)
-			avio_close(data->output_video->pb);
+	if (data->output) {
+		if ((data->output->oformat->flags & AVFMT_NOFILE) == 0)
+			avio_close(data->output->pb);
 
-		avformat_free_context(data->output_video);
+		avformat_free_context(data->output);
 	}
 
-	if (data->output_audio) {
-		if ((data->output_audio->oformat->flags & AVFMT_NOFILE) == 0)
-			avio_close(data->output_audio->pb);
-
-		avformat_free_context(data->output_audio);
-	}
+	if (data->swscale)
+		sws_freeContext(data->swscale);
 
 	memset(data, 0, sizeof(struct ffmpeg_data));
 }
@@ -717,28 +494,13 @@ static enum AVCodecID get_codec_id(const char *name, int id)
 
 static void set_encoder_ids(struct ffmpeg_data *data)
 {
-	data->output_video->oformat->audio_codec = AV_CODEC_ID_OPUS;
-#ifdef _FTL_USE_H264
-	data->output_video->oformat->video_codec = AV_CODEC_ID_H264;
-#else
-	data->output_video->oformat->video_codec = AV_CODEC_ID_VP8;
-#endif
-	data->output_audio->oformat->audio_codec = AV_CODEC_ID_OPUS;
-#ifdef _FTL_USE_H264
-	data->output_audio->oformat->video_codec = AV_CODEC_ID_H264;
-#else
-		data->output_audio->oformat->video_codec = AV_CODEC_ID_VP8;
-#endif
-
-/*	data->output_video->oformat->video_codec = get_codec_id(
+	data->output->oformat->video_codec = get_codec_id(
 			data->config.video_encoder,
 			data->config.video_encoder_id);
-	//data->output_video->oformat->audio_codec = AV_CODEC_ID_NONE;
 
-	data->output_audio->oformat->audio_codec = get_codec_id(
+	data->output->oformat->audio_codec = get_codec_id(
 			data->config.audio_encoder,
 			data->config.audio_encoder_id);
-	//data->output_audio->oformat->video_codec = AV_CODEC_ID_NONE;*/
 }
 
 static bool ffmpeg_data_init(struct ffmpeg_data *data,
@@ -753,24 +515,14 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data,
 		return false;
 
 	av_register_all();
-
-	int version = avcodec_version();
-
-	blog(LOG_WARNING, "FFMPEG Version: %d.%d.%d\n", (0xFF0000 & version) >> 16, (0xFF00 & version) >> 8, version & 0xFF);
-
-	char *s = avcodec_configuration();
-
-	blog(LOG_WARNING, "AV Codec configurations %s\n", s);
-
 	avformat_network_init();
 
 	is_rtmp = (astrcmpi_n(config->url, "rtmp://", 7) == 0);
 
-	AVOutputFormat *output_format = av_guess_format("rtp", NULL, NULL);
-
-	/* Do it twice because avformat_alloc requires it */
-	AVOutputFormat *output_format2 = av_guess_format("rtp", NULL, NULL);
-
+	AVOutputFormat *output_format = av_guess_format(
+			is_rtmp ? "flv" : data->config.format_name,
+			data->config.url,
+			is_rtmp ? NULL : data->config.format_mime_type);
 
 	if (output_format == NULL) {
 		blog(LOG_WARNING, "Couldn't find matching output format with "
@@ -783,23 +535,19 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data,
 		goto fail;
 	}
 
-	avformat_alloc_output_context2(&data->output_audio, output_format,
+	avformat_alloc_output_context2(&data->output, output_format,
 			NULL, NULL);
-	avformat_alloc_output_context2(&data->output_video, output_format2,
-			NULL, NULL);
-
-	//if (data->config.format_name) {
-		set_encoder_ids(data);
-	//}
 
-	if (!data->output_audio) {
-		blog(LOG_WARNING, "Couldn't create audio avformat context");
+	if (!data->output) {
+		blog(LOG_WARNING, "Couldn't create avformat context");
 		goto fail;
 	}
 
-	if (!data->output_video) {
-		blog(LOG_WARNING, "Couldn't create video avformat context");
-		goto fail;
+	if (is_rtmp) {
+		data->output->oformat->video_codec = AV_CODEC_ID_H264;
+		data->output->oformat->audio_codec = AV_CODEC_ID_AAC;
+	} else if (data->config.format_name) {
+		set_encoder_ids(data);
 	}
 
 	if (!init_streams(data))
@@ -807,8 +555,7 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data,
 	if (!open_output_file(data))
 		goto fail;
 
-	av_dump_format(data->output_audio, 0, NULL, 1);
-	av_dump_format(data->output_video, 0, NULL, 1);
+	av_dump_format(data->output, 0, NULL, 1);
 
 	data->initialized = true;
 	return true;
@@ -836,6 +583,28 @@ static void ffmpeg_log_callback(void *param, int level, const char *format,
 	UNUSED_PARAMETER(param);
 }
 
+static void get_write_stats_proc(void *data, calldata_t *cd)
+{
+	struct ffmpeg_output *output = data;
+	struct write_stats stats;
+	long depth;
+
+	pthread_mutex_lock(&output->write_mutex);
+	stats = output->stats;
+	depth = os_atomic_load_long(&output->queued_packets);
+	pthread_mutex_unlock(&output->write_mutex);
+
+	calldata_set_int(cd, "queue_depth", depth);
+	calldata_set_int(cd, "max_queue_depth", stats.max_queue_depth);
+	calldata_set_int(cd, "latency_ms",
+			(long long)(stats.last_latency_ns / 1000000));
+	calldata_set_int(cd, "avg_latency_ms", stats.packets_written ?
+			(long long)(stats.total_latency_ns /
+				stats.packets_written / 1000000) : 0);
+	calldata_set_int(cd, "max_latency_ms",
+			(long long)(stats.max_latency_ns / 1000000));
+}
+
 static void *ffmpeg_output_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct ffmpeg_output *data = bzalloc(sizeof(struct ffmpeg_output));
@@ -851,6 +620,12 @@ static void *ffmpeg_output_create(obs_data_t *settings, obs_output_t *output)
 
 	av_log_set_callback(ffmpeg_log_callback);
 
+	proc_handler_add(obs_output_get_proc_handler(output),
+			"void get_write_stats(out int queue_depth, "
+			"out int max_queue_depth, out int latency_ms, "
+			"out int avg_latency_ms, out int max_latency_ms)",
+			get_write_stats_proc, data);
+
 	UNUSED_PARAMETER(settings);
 	return data;
 
@@ -881,6 +656,22 @@ static void ffmpeg_output_destroy(void *data)
 	}
 }
 
+static void push_packet(struct ffmpeg_output *output, struct circlebuf *queue,
+		AVPacket *packet)
+{
+	struct queued_packet qp = {*packet, os_gettime_ns()};
+	long depth;
+
+	pthread_mutex_lock(&output->write_mutex);
+	circlebuf_push_back(queue, &qp, sizeof(qp));
+	depth = os_atomic_inc_long(&output->queued_packets);
+	if (depth > output->stats.max_queue_depth)
+		output->stats.max_queue_depth = depth;
+	pthread_mutex_unlock(&output->write_mutex);
+
+	os_sem_post(output->write_sem);
+}
+
 static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 		int height)
 {
@@ -931,16 +722,13 @@ static void receive_video(void *param, struct video_data *frame)
 	else
 		copy_data(&data->dst_picture, frame, context->height);
 
-	if (data->output_video->flags & AVFMT_RAWPICTURE) {
+	if (data->output->flags & AVFMT_RAWPICTURE) {
 		packet.flags        |= AV_PKT_FLAG_KEY;
 		packet.stream_index  = data->video->index;
 		packet.data          = data->dst_picture.data[0];
 		packet.size          = sizeof(AVPicture);
 
-		pthread_mutex_lock(&output->write_mutex);
-		da_push_back(output->packets_video, &packet);
-		pthread_mutex_unlock(&output->write_mutex);
-		os_sem_post(output->write_sem);
+		push_packet(output, &output->packets_video, &packet);
 
 	} else {
 		data->vframe->pts = data->total_frames;
@@ -961,10 +749,7 @@ static void receive_video(void *param, struct video_data *frame)
 					context->time_base,
 					data->video->time_base);
 
-			pthread_mutex_lock(&output->write_mutex);
-			da_push_back(output->packets_video, &packet);
-			pthread_mutex_unlock(&output->write_mutex);
-			os_sem_post(output->write_sem);
+			push_packet(output, &output->packets_video, &packet);
 		} else {
 			ret = 0;
 		}
@@ -1020,10 +805,7 @@ static void encode_audio(struct ffmpeg_output *output,
 			data->audio->time_base);
 	packet.stream_index = data->audio->index;
 
-	pthread_mutex_lock(&output->write_mutex);
-	da_push_back(output->packets_audio, &packet);
-	pthread_mutex_unlock(&output->write_mutex);
-	os_sem_post(output->write_sem);
+	push_packet(output, &output->packets_audio, &packet);
 }
 
 static bool prepare_audio(struct ffmpeg_data *data,
@@ -1085,70 +867,101 @@ static void receive_audio(void *param, struct audio_data *frame)
 	}
 }
 
-static int process_packet_video(struct ffmpeg_output *output)
+static inline void swap_queue(struct circlebuf *a, struct circlebuf *b)
 {
-	AVPacket packet;
-	bool new_packet = false;
-	int ret;
+	struct circlebuf temp = *a;
+	*a = *b;
+	*b = temp;
+}
 
-	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets_video.num) {
-		packet = output->packets_video.array[0];
-		da_erase(output->packets_video, 0);
-		new_packet = true;
+static void free_packet_queue(struct circlebuf *queue)
+{
+	while (queue->size) {
+		struct queued_packet qp;
+		circlebuf_pop_front(queue, &qp, sizeof(qp));
+		av_free_packet(&qp.packet);
 	}
-	pthread_mutex_unlock(&output->write_mutex);
+	circlebuf_free(queue);
+}
+
+/* picks the packet with the lowest dts so the two outputs are fed in
+ * timestamp order across the whole batch */
+static struct circlebuf *next_batch_queue(struct ffmpeg_output *output)
+{
+	struct ffmpeg_data *data = &output->ff_data;
+	struct queued_packet video, audio;
+
+	if (!output->batch_video.size)
+		return output->batch_audio.size ? &output->batch_audio : NULL;
+	if (!output->batch_audio.size)
+		return &output->batch_video;
+
+	circlebuf_peek_front(&output->batch_video, &video, sizeof(video));
+	circlebuf_peek_front(&output->batch_audio, &audio, sizeof(audio));
 
-	if (!new_packet)
-		return 0;
+	return av_compare_ts(video.packet.dts, data->video->time_base,
+			audio.packet.dts, data->audio->time_base) <= 0 ?
+		&output->batch_video : &output->batch_audio;
+}
+
+static int write_packet(struct ffmpeg_output *output, struct circlebuf *queue,
+		uint64_t *latency_ns)
+{
+	struct queued_packet qp;
+	int ret;
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
-			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+	circlebuf_pop_front(queue, &qp, sizeof(qp));
 
-	ret = av_interleaved_write_frame(output->ff_data.output_video, &packet);
+	ret = av_interleaved_write_frame(output->ff_data.output, &qp.packet);
 	if (ret < 0) {
-		av_free_packet(&packet);
-		blog(LOG_WARNING, "receive_audio: Error writing packet: %s",
+		av_free_packet(&qp.packet);
+		blog(LOG_WARNING, "write_packet: Error writing packet: %s",
 				av_err2str(ret));
-		return ret;
 	}
 
-	return 0;
+	os_atomic_dec_long(&output->queued_packets);
+	*latency_ns = os_gettime_ns() - qp.queued_ns;
+	return ret;
 }
 
-static int process_packet_audio(struct ffmpeg_output *output)
+/* takes everything queued so far in one lock and writes it out, latency is
+ * measured from when the packet was queued to when the write returned */
+static int write_packets(struct ffmpeg_output *output)
 {
-	AVPacket packet;
-	bool new_packet = false;
-	int ret;
+	struct circlebuf *queue;
+	uint64_t max_latency_ns = 0;
+	uint64_t total_latency_ns = 0;
+	uint64_t latency_ns = 0;
+	uint64_t count = 0;
+	int ret = 0;
 
 	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets_audio.num) {
-		packet = output->packets_audio.array[0];
-		da_erase(output->packets_audio, 0);
-		new_packet = true;
-	}
+	swap_queue(&output->packets_video, &output->batch_video);
+	swap_queue(&output->packets_audio, &output->batch_audio);
 	pthread_mutex_unlock(&output->write_mutex);
 
-	if (!new_packet)
-		return 0;
+	while ((queue = next_batch_queue(output)) != NULL) {
+		ret = write_packet(output, queue, &latency_ns);
+		if (ret < 0)
+			break;
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
-			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+		if (latency_ns > max_latency_ns)
+			max_latency_ns = latency_ns;
+		total_latency_ns += latency_ns;
+		count++;
+	}
 
-	ret = av_interleaved_write_frame(output->ff_data.output_audio, &packet);
-	if (ret < 0) {
-		av_free_packet(&packet);
-		blog(LOG_WARNING, "receive_audio: Error writing packet: %s",
-				av_err2str(ret));
-		return ret;
+	if (count) {
+		pthread_mutex_lock(&output->write_mutex);
+		output->stats.last_latency_ns   = latency_ns;
+		output->stats.total_latency_ns += total_latency_ns;
+		output->stats.packets_written  += count;
+		if (max_latency_ns > output->stats.max_latency_ns)
+			output->stats.max_latency_ns = max_latency_ns;
+		pthread_mutex_unlock(&output->write_mutex);
 	}
 
-	return 0;
+	return ret;
 }
 
 static void *write_thread(void *data)
@@ -1160,12 +973,7 @@ static void *write_thread(void *data)
 		if (os_event_try(output->stop_event) == 0)
 			break;
 
-		int ret = process_packet_video(output);
-
-		/* HACKY HAC HACK HACK */
-		if (ret == 0) {
-			ret = process_packet_audio(output);
-		}
+		int ret = write_packets(output);
 
 		if (ret != 0) {
 			int code = OBS_OUTPUT_ERROR;
@@ -1203,50 +1011,30 @@ static int try_connect(struct ffmpeg_output *output)
 	obs_data_t *settings;
 	bool success;
 	int ret;
-#ifdef _WIN32
-	wchar_t ftl_ingest_arg[200];
-#else
-	char ftl_ingest_arg[200];
-#endif
-
-	int len;
-	int got_streamkey = 0;
-	const char *full_streamkey;
 
 	settings = obs_output_get_settings(output->output);
-	memset(&config, 0, sizeof(config));
-	config.ingest_location = get_string_or_null(settings, "url");
-	lookup_ingest_ip(config.ingest_location, config.ingest_ip);
+	config.url = obs_data_get_string(settings, "url");
 	config.format_name = get_string_or_null(settings, "format_name");
 	config.format_mime_type = get_string_or_null(settings,
 			"format_mime_type");
+	config.muxer_settings = obs_data_get_string(settings,
+			"muxer_settings");
 	config.video_bitrate = (int)obs_data_get_int(settings, "video_bitrate");
 	config.audio_bitrate = (int)obs_data_get_int(settings, "audio_bitrate");
+	config.video_encoder = get_string_or_null(settings, "video_encoder");
+	config.video_encoder_id = (int)obs_data_get_int(settings,
+			"video_encoder_id");
+	config.audio_encoder = get_string_or_null(settings, "audio_encoder");
+	config.audio_encoder_id = (int)obs_data_get_int(settings,
+			"audio_encoder_id");
+	config.video_settings = obs_data_get_string(settings, "video_settings");
+	config.audio_settings = obs_data_get_string(settings, "audio_settings");
 	config.scale_width = (int)obs_data_get_int(settings, "scale_width");
 	config.scale_height = (int)obs_data_get_int(settings, "scale_height");
 	config.width  = (int)obs_output_get_width(output->output);
 	config.height = (int)obs_output_get_height(output->output);
-	config.format = AV_PIX_FMT_YUV420P;
-	full_streamkey = get_string_or_null(settings, "ftl_stream_key");
-
-	/* Build the RTP command line */
-	if (config.ingest_location == NULL || strlen(config.ingest_ip) == 0) {
-		blog(LOG_WARNING, "ingest location blank");
-		return OBS_OUTPUT_ERROR;
-	}
-
-	if (full_streamkey == NULL) {
-		blog(LOG_WARNING, "stream key incorrect");
-		return OBS_OUTPUT_ERROR;
-	}
-
-	int size = 0;
-	//size = snprintf(config.url, 2048, "rtp://%s:8082?pkt_size=1350", config.ingest_location);
-	size = snprintf(config.url, 2048, "rtp://%s:8082?pkt_size=1350&buffer_size=200000", "127.0.0.1");
-	if (size == 2048) {
-		blog(LOG_WARNING, "snprintf failed on URL");
-		return OBS_OUTPUT_ERROR;
-	}
+	config.format = obs_to_ffmpeg_video_format(
+			video_output_get_format(video));
 
 	if (format_is_yuv(voi->format)) {
 		config.color_range = voi->range == VIDEO_RANGE_FULL ?
@@ -1259,7 +1047,8 @@ static int try_connect(struct ffmpeg_output *output)
 	}
 
 	if (config.format == AV_PIX_FMT_NONE) {
-		blog(LOG_WARNING, "invalid pixel format used for FFmpeg output");
+		blog(LOG_DEBUG, "invalid pixel format used for FFmpeg output");
+		obs_data_release(settings);
 		return OBS_OUTPUT_ERROR;
 	}
 
@@ -1268,58 +1057,6 @@ static int try_connect(struct ffmpeg_output *output)
 	if (!config.scale_height)
 		config.scale_height = config.height;
 
-	/* post-process the streamkey */
-	len = strlen(full_streamkey);
-	for (int i = 0; i != len; i++) {
-		/* find the comma that divides the stream key */
-		if (full_streamkey[i] == '-' || full_streamkey[i] == ',') {
-			/* stream key gets copied */
-			strcpy(config.stream_key, full_streamkey+i+1);
-
-			/* Now get the channel id */
-			char * copy_of_key = strdup(full_streamkey);
-			copy_of_key[i] = '\0';
-			config.channel_id = atol(copy_of_key);
-			free(copy_of_key);
-
-			got_streamkey = 1;
-			break;
-		}
-	}
-
-	if (got_streamkey) {
-		blog(LOG_WARNING, "got stream key: %s", config.stream_key);
-		blog(LOG_WARNING, "got channel id: %d", config.channel_id);
-	} else {
-		blog(LOG_WARNING, "unable to parse streamkey: %s", full_streamkey);
-		return OBS_OUTPUT_FTL_BAD_STREAM_KEY;
-	}
-
-
-	/* With the power of MAGIC, let's generate a set of SSRCs using the channel id as a base */
-	/* If we collide, we will try a few more times (see attempt_ftl_connection) */
-	config.audio_ssrc = config.channel_id;
-	config.video_ssrc = config.channel_id+1;
-
-	/* snprintf out the muxer settings */
-	size = snprintf(config.muxer_settings, 2048, "ssrc=%d", config.video_ssrc);
-	if (size == 2048) {
-		blog(LOG_WARNING, "snprintf failed on muxer settings!");
-		return OBS_OUTPUT_ERROR;
-	}
-
-	size = snprintf(config.audio_muxer_settings, 2048, "ssrc=%d payload_type=97", config.audio_ssrc);
-	if (size == 2048) {
-		blog(LOG_WARNING, "snprintf failed on muxer settings!");
-		return OBS_OUTPUT_ERROR;
-	}
-
-	ftl_status_t activation_status;
-	int ftl_to_obs_error_code = 0;
-
-	activation_status = attempt_ftl_connection(output, config);
-	if (activation_status != 0) { return activation_status; }
-
 	success = ffmpeg_data_init(&output->ff_data, &config);
 	obs_data_release(settings);
 
@@ -1343,46 +1080,6 @@ static int try_connect(struct ffmpeg_output *output)
 		return OBS_OUTPUT_ERROR;
 	}
 
-	/* Glue together the ingest URL */
-	int remote_port = ftl_get_remote_port(output->stream_config);
-
-#ifdef _WIN32
-	swprintf(ftl_ingest_arg, sizeof(ftl_ingest_arg)/sizeof(wchar_t), L"-rtpingestaddr=%hs:%d", config.ingest_ip, remote_port);
-
-	blog(LOG_WARNING, "FTL ingest args are: %S\n", ftl_ingest_arg);
-  	ZeroMemory( &output->ShExecInfo, sizeof(output->ShExecInfo) );
-	output->ShExecInfo.cbSize = sizeof(SHELLEXECUTEINFO);
-	output->ShExecInfo.fMask = SEE_MASK_NOCLOSEPROCESS; //SEE_MASK_WAITFORINPUTIDLE
-	output->ShExecInfo.hwnd = NULL;
-	output->ShExecInfo.lpVerb = L"open";
-	output->ShExecInfo.lpFile = L"ftl-express.exe";
-	output->ShExecInfo.lpParameters = ftl_ingest_arg;
-	output->ShExecInfo.lpDirectory = NULL;
-	output->ShExecInfo.nShow = /*SW_SHOW;*/SW_HIDE;
-	output->ShExecInfo.hInstApp = NULL;
-	ShellExecuteEx(&output->ShExecInfo);
-	SetPriorityClass(output->ShExecInfo.hProcess, HIGH_PRIORITY_CLASS);
-#else
-	snprintf(ftl_ingest_arg, sizeof(ftl_ingest_arg), "-rtpingestaddr=%s:%d", config.ingest_ip, remote_port);
-	blog(LOG_WARNING, "FTL ingest args are: %s\n", ftl_ingest_arg);
-	/* print error message if fork() fails */
-	blog(LOG_WARNING, "Forking Process\n");
-
-	if ((output->ftl_express_pid = fork()) < 0)
-	{
-		blog(LOG_ERROR, "call to fork failed\n");
-		return OBS_OUTPUT_ERROR;
-	}
-
-	if (output->ftl_express_pid == 0)
-	{
-		execlp("./ftl-express", "ftl-express", ftl_ingest_arg, NULL);
-
-		blog(LOG_ERROR, "failed to start ftl-express\n");
-		exit(1);
-	}
-#endif
-
 	obs_output_set_video_conversion(output->output, NULL);
 	obs_output_set_audio_conversion(output->output, &aci);
 	obs_output_begin_data_capture(output->output, 0);
@@ -1424,44 +1121,6 @@ static void ffmpeg_output_stop(void *data)
 		obs_output_end_data_capture(output->output);
 		ffmpeg_deactivate(output);
 	}
-
-	if (output->stream_config) {
-		ftl_deactivate_stream(output->stream_config);
-		ftl_destory_stream(&(output->stream_config));
-		output->stream_config = 0; /* FTL requires the pointer be 0ed out */
-		blog(LOG_WARNING, "Closing FTL express\n");
-#ifdef _WIN32
-		unsigned int pid = GetProcessId(output->ShExecInfo.hProcess);
-		if (!AttachConsole(pid)) {
-			  DWORD error = GetLastError();
-			  blog(LOG_WARNING, "Failed to attach to console of pid %d -- error was %d\n", pid, error);
-				TerminateProcess(output->ShExecInfo.hProcess, 0);
-		} else {
-			SetConsoleCtrlHandler(NULL, true);
-			// Sent Ctrl-C to the attached console
-			GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0);
-
-			DWORD state;
-
-			if( (state = WaitForSingleObject(output->ShExecInfo.hProcess, 5000)) == WAIT_TIMEOUT) {
-				blog(LOG_WARNING, "Gave up waiting for process to exit...forcible terminating\n");
-				TerminateProcess(output->ShExecInfo.hProcess, 0);
-			}
-			// Re-enable Ctrl-C handling or any subsequently started programs will inherit the disabled state.
-			SetConsoleCtrlHandler(NULL, false);
-			FreeConsole();
-		}
-
-    CloseHandle( output->pi.hProcess );
-    CloseHandle( output->pi.hThread );
-#else
-/* print error message if fork() fails */
-	/*send Ctrl+C to ftl express*/
-	blog(LOG_WARNING, "Sending Ctrl+C to Ftl-express pid %d\n", output->ftl_express_pid );
-	kill(output->ftl_express_pid, SIGINT);
-#endif
-
-	}
 }
 
 static void ffmpeg_deactivate(struct ffmpeg_output *output)
@@ -1475,13 +1134,23 @@ static void ffmpeg_deactivate(struct ffmpeg_output *output)
 
 	pthread_mutex_lock(&output->write_mutex);
 
-	for (size_t i = 0; i < output->packets_video.num; i++)
-		av_free_packet(output->packets_video.array+i);
-	da_free(output->packets_video);
-
-	for (size_t i = 0; i < output->packets_audio.num; i++)
-		av_free_packet(output->packets_audio.array+i);
-	da_free(output->packets_audio);
+	free_packet_queue(&output->packets_video);
+	free_packet_queue(&output->packets_audio);
+	free_packet_queue(&output->batch_video);
+	free_packet_queue(&output->batch_audio);
+	output->queued_packets = 0;
+
+	if (output->stats.packets_written)
+		blog(LOG_INFO, "ffmpeg_output: wrote %llu packets, max queue "
+				"depth: %ld, average latency: %llu ms, max "
+				"latency: %llu ms",
+				(unsigned long long)output->stats.packets_written,
+				output->stats.max_queue_depth,
+				(unsigned long long)(output->stats.total_latency_ns /
+					output->stats.packets_written / 1000000),
+				(unsigned long long)(output->stats.max_latency_ns /
+					1000000));
+	memset(&output->stats, 0, sizeof(output->stats));
 
 	pthread_mutex_unlock(&output->write_mutex);
 
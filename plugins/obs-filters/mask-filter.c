@@ -157,7 +157,10 @@ static void mask_filter_tick(void *data, float t)
 		if (!filter->last_time)
 			filter->last_time = cur_time;
 
-		gs_image_file_tick(&filter->image, cur_time - filter->last_time);
+		if (gs_image_file_tick(&filter->image,
+					cur_time - filter->last_time))
+			obs_source_invalidate_video(filter->context);
+
 		obs_enter_graphics();
 		gs_image_file_update_texture(&filter->image);
 		obs_leave_graphics();
@@ -234,7 +237,8 @@ static void mask_filter_render(void *data, gs_effect_t *effect)
 struct obs_source_info mask_filter = {
 	.id                            = "mask_filter",
 	.type                          = OBS_SOURCE_TYPE_FILTER,
-	.output_flags                  = OBS_SOURCE_VIDEO,
+	.output_flags                  = OBS_SOURCE_VIDEO |
+	                                 OBS_SOURCE_STATIC_VIDEO,
 	.get_name                      = mask_filter_get_name,
 	.create                        = mask_filter_create,
 	.destroy                       = mask_filter_destroy,
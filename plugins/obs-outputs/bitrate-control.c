@@ -0,0 +1,147 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <string.h>
+#include "bitrate-control.h"
+
+/* weight of the newest interval in the smoothed estimates */
+#define SMOOTHING            0.4
+
+/* after a decrease, wait this many intervals for the encoder to pick up the
+ * new bitrate and the buffer to drain before deciding again */
+#define HOLD_INTERVALS       2
+
+/* intervals the buffer must stay drained before the bitrate is raised */
+#define RECOVER_INTERVALS    4
+
+/* fraction of the measured throughput to use when lowering the bitrate, the
+ * headroom is what drains the buffer that built up */
+#define DECREASE_FACTOR      0.85
+#define MAX_DECREASE_FACTOR  0.5
+#define INCREASE_FACTOR      1.15
+#define MIN_INCREASE_KBPS    50
+
+/* a send thread that is blocked in the socket for most of the interval is
+ * running at link capacity */
+#define BUSY_CONGESTED       0.9
+#define BUSY_IDLE            0.5
+
+static inline int clamp_kbps(const struct bitrate_control *bc, double kbps)
+{
+	if (kbps < (double)bc->min_kbps)
+		return bc->min_kbps;
+	if (kbps > (double)bc->max_kbps)
+		return bc->max_kbps;
+	return (int)kbps;
+}
+
+static inline double smooth(double prev, double cur, bool first)
+{
+	return first ? cur : prev + (cur - prev) * SMOOTHING;
+}
+
+void bitrate_control_init(struct bitrate_control *bc, int start_kbps,
+		int min_kbps, int64_t high_buffer_usec, uint64_t now_ns)
+{
+	memset(bc, 0, sizeof(*bc));
+
+	bc->max_kbps          = start_kbps;
+	bc->min_kbps          = min_kbps < start_kbps ? min_kbps : start_kbps;
+	bc->cur_kbps          = start_kbps;
+	bc->high_buffer_usec  = high_buffer_usec;
+	bc->low_buffer_usec   = high_buffer_usec / 3;
+	bc->interval_start_ns = now_ns;
+}
+
+static int lower_bitrate(struct bitrate_control *bc)
+{
+	double target = bc->throughput_kbps * DECREASE_FACTOR;
+
+	/* the throughput can briefly be above the bitrate while the socket
+	 * catches up, still back off in that case */
+	if (target >= (double)bc->cur_kbps)
+		target = (double)bc->cur_kbps * DECREASE_FACTOR;
+	if (target < (double)bc->cur_kbps * MAX_DECREASE_FACTOR)
+		target = (double)bc->cur_kbps * MAX_DECREASE_FACTOR;
+
+	bc->hold_intervals   = HOLD_INTERVALS;
+	bc->stable_intervals = 0;
+	return clamp_kbps(bc, target);
+}
+
+static int raise_bitrate(struct bitrate_control *bc)
+{
+	double target = (double)bc->cur_kbps * INCREASE_FACTOR;
+
+	if (target < (double)(bc->cur_kbps + MIN_INCREASE_KBPS))
+		target = (double)(bc->cur_kbps + MIN_INCREASE_KBPS);
+
+	bc->stable_intervals = 0;
+	return clamp_kbps(bc, target);
+}
+
+int bitrate_control_update(struct bitrate_control *bc, int64_t buffer_usec,
+		uint64_t now_ns)
+{
+	uint64_t elapsed_ns = now_ns - bc->interval_start_ns;
+	bool     first      = bc->throughput_kbps == 0.0;
+	bool     growing;
+	bool     congested;
+	int      new_kbps   = bc->cur_kbps;
+
+	if (elapsed_ns < BITRATE_CONTROL_INTERVAL_NS)
+		return 0;
+
+	bc->throughput_kbps = smooth(bc->throughput_kbps,
+			(double)bc->interval_bytes * 8000000.0 /
+			(double)elapsed_ns, first);
+	bc->send_busy = smooth(bc->send_busy,
+			(double)bc->interval_send_ns / (double)elapsed_ns,
+			first);
+
+	growing   = buffer_usec > bc->last_buffer_usec;
+	congested = buffer_usec > bc->high_buffer_usec ||
+		(buffer_usec > bc->low_buffer_usec && growing &&
+		 bc->send_busy > BUSY_CONGESTED);
+
+	if (bc->hold_intervals) {
+		bc->hold_intervals--;
+
+	} else if (congested) {
+		new_kbps = lower_bitrate(bc);
+
+	} else if (buffer_usec <= bc->low_buffer_usec &&
+	           bc->send_busy < BUSY_IDLE) {
+		if (++bc->stable_intervals >= RECOVER_INTERVALS &&
+		    bc->cur_kbps < bc->max_kbps)
+			new_kbps = raise_bitrate(bc);
+
+	} else {
+		bc->stable_intervals = 0;
+	}
+
+	bc->last_buffer_usec  = buffer_usec;
+	bc->interval_start_ns = now_ns;
+	bc->interval_bytes    = 0;
+	bc->interval_send_ns  = 0;
+
+	if (new_kbps == bc->cur_kbps)
+		return 0;
+
+	bc->cur_kbps = new_kbps;
+	return new_kbps;
+}
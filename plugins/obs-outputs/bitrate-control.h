@@ -0,0 +1,79 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Closed-loop bitrate controller for network outputs.
+ *
+ *   The send thread reports every write with bitrate_control_sent(), and
+ *   calls bitrate_control_update() with the duration of the packets still
+ *   waiting to be sent.  Once per interval the controller compares the
+ *   throughput the link actually carried with the time spent blocked in the
+ *   socket and the send buffer trend: if the buffer is building up it lowers
+ *   the bitrate to what the link carried, and after the buffer has stayed
+ *   drained for a while it raises the bitrate again in steps, up to the
+ *   bitrate the stream was started with.
+ *
+ *   The controller does no I/O and takes its clock as a parameter, so it can
+ *   be driven from a test.
+ */
+
+#define BITRATE_CONTROL_INTERVAL_NS 500000000ULL
+
+struct bitrate_control {
+	int      min_kbps;
+	int      max_kbps;
+	int      cur_kbps;
+
+	/* buffered duration below which the link is considered to be keeping
+	 * up, and above which the bitrate is lowered */
+	int64_t  low_buffer_usec;
+	int64_t  high_buffer_usec;
+
+	uint64_t interval_start_ns;
+	uint64_t interval_bytes;
+	uint64_t interval_send_ns;
+
+	double   throughput_kbps;
+	double   send_busy;
+	int64_t  last_buffer_usec;
+
+	int      hold_intervals;
+	int      stable_intervals;
+};
+
+/* high_buffer_usec should be below the frame drop threshold so the bitrate
+ * is lowered before frames have to be dropped */
+extern void bitrate_control_init(struct bitrate_control *bc, int start_kbps,
+		int min_kbps, int64_t high_buffer_usec, uint64_t now_ns);
+
+/* records a write of 'bytes' that blocked for 'send_ns' */
+static inline void bitrate_control_sent(struct bitrate_control *bc,
+		size_t bytes, uint64_t send_ns)
+{
+	bc->interval_bytes   += bytes;
+	bc->interval_send_ns += send_ns;
+}
+
+/* returns the new bitrate in kbps if it should change, otherwise 0 */
+extern int bitrate_control_update(struct bitrate_control *bc,
+		int64_t buffer_usec, uint64_t now_ns);
@@ -261,3 +261,56 @@ void flv_packet_mux(struct encoder_packet *packet,
 	*output = data.bytes.array;
 	*size   = data.bytes.num;
 }
+
+static inline uint8_t *w8(uint8_t *out, uint8_t val)
+{
+	*out = val;
+	return out + 1;
+}
+
+static inline uint8_t *wb24(uint8_t *out, uint32_t val)
+{
+	out[0] = (uint8_t)(val >> 16);
+	out[1] = (uint8_t)(val >> 8);
+	out[2] = (uint8_t)val;
+	return out + 3;
+}
+
+/* same layout as flv_video/flv_audio, minus the data and tag size */
+size_t flv_packet_header(struct encoder_packet *packet, bool is_header,
+		uint8_t header[FLV_TAG_HEADER_MAX_SIZE])
+{
+	bool     video   = packet->type == OBS_ENCODER_VIDEO;
+	int32_t  time_ms = get_ms_time(packet, packet->dts);
+	uint8_t  *out    = header;
+
+	if (!packet->data || !packet->size)
+		return 0;
+
+	out = w8(out, video ? RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO);
+	out = wb24(out, (uint32_t)packet->size + (video ? 5 : 2));
+	out = wb24(out, time_ms);
+	out = w8(out, (time_ms >> 24) & 0x7F);
+	out = wb24(out, 0);
+
+	if (video) {
+		out = w8(out, packet->keyframe ? 0x17 : 0x27);
+		out = w8(out, is_header ? 0 : 1);
+		out = wb24(out, get_ms_time(packet, packet->pts - packet->dts));
+	} else {
+		out = w8(out, 0xaf);
+		out = w8(out, is_header ? 0 : 1);
+	}
+
+	return out - header;
+}
+
+void flv_packet_footer(size_t header_size, size_t data_size,
+		uint8_t footer[FLV_TAG_FOOTER_SIZE])
+{
+	/* tag size (starting byte doesnt count) */
+	uint32_t size = (uint32_t)(header_size + data_size) + 4 - 1;
+
+	footer[0] = (uint8_t)(size >> 24);
+	wb24(footer + 1, size);
+}
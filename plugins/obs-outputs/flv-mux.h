@@ -21,6 +21,10 @@
 
 #define MILLISECOND_DEN   1000
 
+/* tag header plus the 5 extra bytes of a video tag */
+#define FLV_TAG_HEADER_MAX_SIZE 16
+#define FLV_TAG_FOOTER_SIZE     4
+
 static uint32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 {
 	return (uint32_t)(val * MILLISECOND_DEN / packet->timebase_den);
@@ -32,3 +36,13 @@ extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header, size_t audio_idx);
 extern void flv_packet_mux(struct encoder_packet *packet,
 		uint8_t **output, size_t *size, bool is_header);
+
+/*
+ * Writes the tag header of a packet without copying its data, so the tag can
+ * be written as header + packet->data + footer.  Returns the size of the
+ * header, or 0 if the packet is empty and nothing should be written.
+ */
+extern size_t flv_packet_header(struct encoder_packet *packet, bool is_header,
+		uint8_t header[FLV_TAG_HEADER_MAX_SIZE]);
+extern void flv_packet_footer(size_t header_size, size_t data_size,
+		uint8_t footer[FLV_TAG_FOOTER_SIZE]);
@@ -89,16 +89,24 @@ static void flv_output_stop(void *data)
 static int write_packet(struct flv_output *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
+	uint8_t header[FLV_TAG_HEADER_MAX_SIZE];
+	uint8_t footer[FLV_TAG_FOOTER_SIZE];
+	size_t  header_size;
 	int     ret = 0;
 
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
-	flv_packet_mux(packet, &data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
-	obs_free_encoder_packet(packet);
+	header_size = flv_packet_header(packet, is_header, header);
+	if (header_size) {
+		flv_packet_footer(header_size, packet->size, footer);
+		fwrite(header, 1, header_size, stream->file);
+		fwrite(packet->data, 1, packet->size, stream->file);
+		fwrite(footer, 1, sizeof(footer), stream->file);
+	}
+
+	/* headers are built here, packets are shared with libobs */
+	if (is_header)
+		obs_free_encoder_packet(packet);
 
 	return ret;
 }
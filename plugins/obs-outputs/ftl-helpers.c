@@ -0,0 +1,109 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs-module.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "ftl-helpers.h"
+
+void log_libftl_messages(ftl_log_severity_t log_level, const char *message)
+{
+	UNUSED_PARAMETER(log_level);
+	blog(LOG_WARNING, "[libftl] %s", message);
+}
+
+int map_ftl_error_to_obs_error(int status)
+{
+	switch (status) {
+	case FTL_SUCCESS:
+		return 0;
+	case FTL_DNS_FAILURE:
+		return OBS_OUTPUT_FTL_DNS_FAILURE;
+	case FTL_CONNECT_ERROR:
+		return OBS_OUTPUT_FTL_CONNECT_FAILURE;
+	case FTL_OLD_VERSION:
+		return OBS_OUTPUT_FTL_OLD_VERSION;
+	case FTL_STREAM_REJECTED:
+		return OBS_OUTPUT_FTL_STREAM_REJECTED;
+	case FTL_UNAUTHORIZED:
+		return OBS_OUTPUT_FTL_UNAUTHORIZED;
+	case FTL_AUDIO_SSRC_COLLISION:
+		return OBS_OUTPUT_FTL_AUDIO_SSRC_COLLISION;
+	case FTL_VIDEO_SSRC_COLLISION:
+		return OBS_OUTPUT_FTL_VIDEO_SSRC_COLLISION;
+	}
+
+	/* non-specific failures, or internal Tachyon bug */
+	blog(LOG_ERROR, "tachyon error mapping needs to be updated!");
+	return OBS_OUTPUT_ERROR;
+}
+
+int lookup_ingest_ip(const char *ingest_location, char *ingest_ip)
+{
+	struct hostent *remote_host;
+	struct in_addr addr;
+	int retval = -1;
+
+	ingest_ip[0] = '\0';
+
+	remote_host = gethostbyname(ingest_location);
+	if (!remote_host || remote_host->h_addrtype != AF_INET)
+		return retval;
+
+	for (int i = 0; remote_host->h_addr_list[i] != 0; i++) {
+		addr.s_addr = *(u_long*)remote_host->h_addr_list[i];
+		blog(LOG_INFO, "IP Address #%d of ingest is: %s", i + 1,
+				inet_ntoa(addr));
+
+		/* only use the first ip found */
+		if (retval != 0) {
+			strncpy(ingest_ip, inet_ntoa(addr),
+					FTL_INGEST_IP_SIZE - 1);
+			ingest_ip[FTL_INGEST_IP_SIZE - 1] = '\0';
+			retval = 0;
+		}
+	}
+
+	return retval;
+}
+
+bool parse_ftl_stream_key(const char *full_key, uint32_t *channel_id,
+		char *stream_key, size_t stream_key_size)
+{
+	const char *separator = full_key;
+
+	while (*separator && *separator != '-' && *separator != ',')
+		separator++;
+
+	if (!*separator)
+		return false;
+
+	strncpy(stream_key, separator + 1, stream_key_size - 1);
+	stream_key[stream_key_size - 1] = '\0';
+	*channel_id = (uint32_t)strtoul(full_key, NULL, 10);
+	return true;
+}
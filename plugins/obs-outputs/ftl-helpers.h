@@ -0,0 +1,40 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ftl.h>
+
+/* large enough for a dotted IPv4 address */
+#define FTL_INGEST_IP_SIZE 20
+
+extern void log_libftl_messages(ftl_log_severity_t log_level,
+		const char *message);
+
+/* returns 0 on success */
+extern int map_ftl_error_to_obs_error(int status);
+
+/* resolves the ingest host name to the first IPv4 address found, returns 0
+ * on success */
+extern int lookup_ingest_ip(const char *ingest_location, char *ingest_ip);
+
+/* splits a "<channel id>-<key>" (or comma separated) stream key */
+extern bool parse_ftl_stream_key(const char *full_key, uint32_t *channel_id,
+		char *stream_key, size_t stream_key_size);
@@ -0,0 +1,643 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/*
+ * FTL output for already encoded H.264 video and Opus audio.  Packets from
+ * the output's encoders are packetized into RTP (see rtp-packetizer.h) and
+ * sent straight to the ingest port that libftl negotiated, so the encoders
+ * can be shared with other outputs and nothing goes through a local relay.
+ */
+
+#include <errno.h>
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "ftl-helpers.h"
+#include "send-queue.h"
+#include "rtp-packetizer.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[ftl stream: '%s'] " format, \
+			obs_output_get_name(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+
+#ifdef _WIN32
+#define socklen_t int
+#define close_socket closesocket
+#else
+#define SOCKET int
+#define INVALID_SOCKET -1
+#define close_socket close
+#endif
+
+#define OPT_MAX_SHUTDOWN_TIME_SEC "max_shutdown_time_sec"
+#define OPT_DROP_THRESHOLD "drop_threshold_ms"
+
+#define RTP_VIDEO_PAYLOAD_TYPE   96
+#define RTP_AUDIO_PAYLOAD_TYPE   97
+#define RTP_VIDEO_CLOCK_RATE     90000
+#define RTP_AUDIO_CLOCK_RATE     48000
+
+#define MAX_SSRC_ATTEMPTS        3
+#define MIN_SENDBUF_SIZE         (1024 * 1024)
+
+struct ftl_stream {
+	obs_output_t     *output;
+
+	struct send_queue queue;
+
+	volatile bool    connecting;
+	pthread_t        connect_thread;
+
+	struct dstr      ingest_location;
+	char             ingest_ip[FTL_INGEST_IP_SIZE];
+	uint32_t         channel_id;
+	char             stream_key[2048];
+
+	ftl_stream_configuration_t   *stream_config;
+	ftl_stream_video_component_t *video_component;
+	ftl_stream_audio_component_t *audio_component;
+
+	SOCKET           sock;
+	struct sockaddr_in ingest_addr;
+
+	struct rtp_packetizer video_rtp;
+	struct rtp_packetizer audio_rtp;
+
+	uint64_t         total_bytes_sent;
+};
+
+static const char *ftl_stream_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return obs_module_text("FTLStream");
+}
+
+static inline bool stopping(struct ftl_stream *stream)
+{
+	return send_queue_stopping(&stream->queue);
+}
+
+static inline bool connecting(struct ftl_stream *stream)
+{
+	return os_atomic_load_bool(&stream->connecting);
+}
+
+static inline bool active(struct ftl_stream *stream)
+{
+	return send_queue_active(&stream->queue);
+}
+
+static inline bool disconnected(struct ftl_stream *stream)
+{
+	return send_queue_disconnected(&stream->queue);
+}
+
+static void close_connection(struct ftl_stream *stream)
+{
+	if (stream->sock != INVALID_SOCKET) {
+		close_socket(stream->sock);
+		stream->sock = INVALID_SOCKET;
+	}
+
+	if (stream->stream_config) {
+		ftl_deactivate_stream(stream->stream_config);
+		ftl_destory_stream(&stream->stream_config);
+
+		/* FTL requires the pointer be 0ed out */
+		stream->stream_config = NULL;
+	}
+}
+
+static void ftl_stream_destroy(void *data)
+{
+	struct ftl_stream *stream = data;
+
+	if (!stream)
+		return;
+
+	if (stopping(stream) && !connecting(stream)) {
+		pthread_join(stream->queue.send_thread, NULL);
+
+	} else if (connecting(stream) || active(stream)) {
+		if (stream->connecting)
+			pthread_join(stream->connect_thread, NULL);
+
+		if (active(stream)) {
+			send_queue_stop(&stream->queue);
+			pthread_join(stream->queue.send_thread, NULL);
+		} else {
+			os_event_signal(stream->queue.stop_event);
+		}
+	}
+
+	send_queue_free(&stream->queue);
+	close_connection(stream);
+	dstr_free(&stream->ingest_location);
+	bfree(stream);
+}
+
+static const struct send_queue_info ftl_send_queue_info;
+
+static void *ftl_stream_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct ftl_stream *stream = bzalloc(sizeof(struct ftl_stream));
+	stream->output = output;
+	stream->sock   = INVALID_SOCKET;
+
+	if (!send_queue_init(&stream->queue, output, &ftl_send_queue_info,
+				stream))
+		goto fail;
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+
+fail:
+	ftl_stream_destroy(stream);
+	return NULL;
+}
+
+static void ftl_stream_stop(void *data)
+{
+	struct ftl_stream *stream = data;
+
+	if (stopping(stream))
+		return;
+
+	if (connecting(stream))
+		pthread_join(stream->connect_thread, NULL);
+
+	send_queue_stop(&stream->queue);
+}
+
+/* ------------------------------------------------------------------------- */
+/* RTP                                                                       */
+
+static bool send_rtp(void *data, const uint8_t *packet, size_t size)
+{
+	struct ftl_stream *stream = data;
+	int ret;
+
+	ret = (int)sendto(stream->sock, (const char*)packet, (int)size, 0,
+			(const struct sockaddr*)&stream->ingest_addr,
+			sizeof(stream->ingest_addr));
+	if (ret < 0) {
+#ifdef _WIN32
+		int error = WSAGetLastError();
+#else
+		int error = errno;
+#endif
+		warn("sendto failed: %d", error);
+		return false;
+	}
+
+	stream->total_bytes_sent += size;
+	return true;
+}
+
+static inline uint32_t packet_timestamp(const struct rtp_packetizer *rtp,
+		const struct encoder_packet *packet)
+{
+	return rtp_packetizer_timestamp(rtp, packet->pts,
+			packet->timebase_num, packet->timebase_den);
+}
+
+static bool send_video_packet(struct ftl_stream *stream,
+		struct encoder_packet *packet)
+{
+	struct rtp_packetizer *rtp = &stream->video_rtp;
+	uint32_t timestamp = packet_timestamp(rtp, packet);
+
+	/* repeat SPS/PPS in front of every keyframe so the ingest can start
+	 * decoding at any keyframe */
+	if (packet->keyframe) {
+		obs_encoder_t *vencoder =
+			obs_output_get_video_encoder(stream->output);
+		uint8_t *header;
+		size_t  size;
+
+		if (obs_encoder_get_extra_data(vencoder, &header, &size) &&
+		    !rtp_packetize_h264(rtp, header, size, timestamp, false))
+			return false;
+	}
+
+	return rtp_packetize_h264(rtp, packet->data, packet->size, timestamp,
+			true);
+}
+
+static bool send_audio_packet(struct ftl_stream *stream,
+		struct encoder_packet *packet)
+{
+	struct rtp_packetizer *rtp = &stream->audio_rtp;
+
+	if (packet->size > RTP_MAX_PAYLOAD_SIZE) {
+		warn("Opus packet too large for RTP: %d bytes",
+				(int)packet->size);
+		return true;
+	}
+
+	return rtp_packetize_opus(rtp, packet->data, packet->size,
+			packet_timestamp(rtp, packet));
+}
+
+static bool send_packet(void *data, struct encoder_packet *packet)
+{
+	struct ftl_stream *stream = data;
+	bool success = packet->type == OBS_ENCODER_VIDEO ?
+		send_video_packet(stream, packet) :
+		send_audio_packet(stream, packet);
+
+	obs_encoder_packet_release(packet);
+	return success;
+}
+
+static void close_stream(void *data, bool disconnected)
+{
+	struct ftl_stream *stream = data;
+
+	if (disconnected)
+		info("Disconnected from %s", stream->ingest_location.array);
+	else
+		info("User stopped the stream");
+
+	close_connection(stream);
+}
+
+static const struct send_queue_info ftl_send_queue_info = {
+	.log_name    = "ftl stream",
+	.thread_name = "ftl-stream: send_thread",
+	.send_packet = send_packet,
+	.close       = close_stream
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void adjust_sndbuf_size(struct ftl_stream *stream, int new_size)
+{
+	int cur_sendbuf_size = new_size;
+	socklen_t int_size = sizeof(int);
+
+	getsockopt(stream->sock, SOL_SOCKET, SO_SNDBUF,
+			(char*)&cur_sendbuf_size, &int_size);
+
+	if (cur_sendbuf_size < new_size) {
+		cur_sendbuf_size = new_size;
+		setsockopt(stream->sock, SOL_SOCKET, SO_SNDBUF,
+				(const char*)&cur_sendbuf_size, int_size);
+	}
+}
+
+static int init_send(struct ftl_stream *stream)
+{
+	if (!send_queue_start(&stream->queue)) {
+		close_connection(stream);
+		warn("Failed to create send thread");
+		return OBS_OUTPUT_ERROR;
+	}
+
+	obs_output_begin_data_capture(stream->output, 0);
+
+	return OBS_OUTPUT_SUCCESS;
+}
+
+/* registers the stream with the ingest, picking new SSRCs if the ones based
+ * on the channel id are already taken */
+static int activate_ftl_stream(struct ftl_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	uint32_t width  = obs_encoder_get_width(vencoder);
+	uint32_t height = obs_encoder_get_height(vencoder);
+	ftl_status_t status = FTL_SUCCESS;
+
+	ftl_init();
+	ftl_register_log_handler(log_libftl_messages);
+
+	stream->audio_rtp.ssrc = stream->channel_id;
+	stream->video_rtp.ssrc = stream->channel_id + 1;
+
+	for (int i = 0; i < MAX_SSRC_ATTEMPTS; i++) {
+		status = ftl_create_stream_configuration(
+				&stream->stream_config);
+		if (status != FTL_SUCCESS) {
+			warn("Failed to initialize stream configuration: "
+			     "%d", status);
+			return OBS_OUTPUT_ERROR;
+		}
+
+		ftl_set_ingest_location(stream->stream_config,
+				stream->ingest_ip);
+		ftl_set_authetication_key(stream->stream_config,
+				stream->channel_id, stream->stream_key);
+
+		stream->video_component = ftl_create_video_component(
+				FTL_VIDEO_H264, RTP_VIDEO_PAYLOAD_TYPE,
+				stream->video_rtp.ssrc, width, height);
+		ftl_attach_video_component_to_stream(stream->stream_config,
+				stream->video_component);
+
+		stream->audio_component = ftl_create_audio_component(
+				FTL_AUDIO_OPUS, RTP_AUDIO_PAYLOAD_TYPE,
+				stream->audio_rtp.ssrc);
+		ftl_attach_audio_component_to_stream(stream->stream_config,
+				stream->audio_component);
+
+		status = ftl_activate_stream(stream->stream_config);
+		if (status == FTL_SUCCESS)
+			return OBS_OUTPUT_SUCCESS;
+
+		ftl_destory_stream(&stream->stream_config);
+		stream->stream_config = NULL;
+
+		if (status == FTL_AUDIO_SSRC_COLLISION)
+			stream->audio_rtp.ssrc += 2;
+		else if (status == FTL_VIDEO_SSRC_COLLISION)
+			stream->video_rtp.ssrc += 2;
+		else
+			break;
+	}
+
+	warn("Failed to activate FTL stream: %d", status);
+	return map_ftl_error_to_obs_error(status);
+}
+
+static int open_socket(struct ftl_stream *stream)
+{
+	int port = ftl_get_remote_port(stream->stream_config);
+
+	stream->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (stream->sock == INVALID_SOCKET) {
+		warn("Failed to create socket");
+		return OBS_OUTPUT_ERROR;
+	}
+
+	adjust_sndbuf_size(stream, MIN_SENDBUF_SIZE);
+
+	memset(&stream->ingest_addr, 0, sizeof(stream->ingest_addr));
+	stream->ingest_addr.sin_family      = AF_INET;
+	stream->ingest_addr.sin_port        = htons((uint16_t)port);
+	stream->ingest_addr.sin_addr.s_addr = inet_addr(stream->ingest_ip);
+
+	info("Sending RTP to %s:%d", stream->ingest_ip, port);
+	return OBS_OUTPUT_SUCCESS;
+}
+
+static int try_connect(struct ftl_stream *stream)
+{
+	int ret;
+
+	if (dstr_is_empty(&stream->ingest_location)) {
+		warn("URL is empty");
+		return OBS_OUTPUT_BAD_PATH;
+	}
+
+	info("Connecting to FTL ingest %s...", stream->ingest_location.array);
+
+	if (lookup_ingest_ip(stream->ingest_location.array,
+				stream->ingest_ip) != 0) {
+		warn("Failed to resolve ingest %s",
+				stream->ingest_location.array);
+		return OBS_OUTPUT_FTL_DNS_FAILURE;
+	}
+
+	ret = activate_ftl_stream(stream);
+	if (ret != OBS_OUTPUT_SUCCESS)
+		return ret;
+
+	ret = open_socket(stream);
+	if (ret != OBS_OUTPUT_SUCCESS) {
+		close_connection(stream);
+		return ret;
+	}
+
+	info("Connection to %s successful", stream->ingest_location.array);
+
+	return init_send(stream);
+}
+
+static int init_connect(struct ftl_stream *stream)
+{
+	obs_service_t *service;
+	obs_data_t *settings;
+	const char *full_key;
+	bool       valid_key;
+
+	if (stopping(stream))
+		pthread_join(stream->queue.send_thread, NULL);
+
+	service = obs_output_get_service(stream->output);
+	if (!service)
+		return OBS_OUTPUT_BAD_PATH;
+
+	send_queue_reset(&stream->queue);
+	stream->total_bytes_sent = 0;
+
+	rtp_packetizer_init(&stream->video_rtp, RTP_VIDEO_PAYLOAD_TYPE,
+			RTP_VIDEO_CLOCK_RATE, 0, send_rtp, stream);
+	rtp_packetizer_init(&stream->audio_rtp, RTP_AUDIO_PAYLOAD_TYPE,
+			RTP_AUDIO_CLOCK_RATE, 0, send_rtp, stream);
+
+	settings = obs_output_get_settings(stream->output);
+	dstr_copy(&stream->ingest_location, obs_service_get_url(service));
+	dstr_depad(&stream->ingest_location);
+
+	full_key  = obs_service_get_key(service);
+	valid_key = full_key && parse_ftl_stream_key(full_key,
+			&stream->channel_id, stream->stream_key,
+			sizeof(stream->stream_key));
+
+	stream->queue.max_shutdown_time_sec =
+		(int)obs_data_get_int(settings, OPT_MAX_SHUTDOWN_TIME_SEC);
+	stream->queue.drop_threshold_usec =
+		(int64_t)obs_data_get_int(settings, OPT_DROP_THRESHOLD) * 1000;
+	obs_data_release(settings);
+
+	if (!valid_key) {
+		warn("Unable to parse stream key");
+		return OBS_OUTPUT_FTL_BAD_STREAM_KEY;
+	}
+
+	return OBS_OUTPUT_SUCCESS;
+}
+
+static void *connect_thread(void *data)
+{
+	struct ftl_stream *stream = data;
+	int ret;
+
+	os_set_thread_name("ftl-stream: connect_thread");
+
+	ret = init_connect(stream);
+	if (ret == OBS_OUTPUT_SUCCESS)
+		ret = try_connect(stream);
+
+	if (ret != OBS_OUTPUT_SUCCESS) {
+		obs_output_signal_stop(stream->output, ret);
+		info("Connection to %s failed: %d",
+				stream->ingest_location.array, ret);
+	}
+
+	if (!stopping(stream))
+		pthread_detach(stream->connect_thread);
+
+	os_atomic_set_bool(&stream->connecting, false);
+	return NULL;
+}
+
+static inline bool encoder_codec_is(obs_encoder_t *encoder, const char *codec)
+{
+	const char *name = encoder ? obs_encoder_get_codec(encoder) : NULL;
+	return name && astrcmpi(name, codec) == 0;
+}
+
+/* the stream is announced to the ingest as H.264 and Opus, and packets are
+ * sent with those RTP payload types as they are */
+static bool check_codecs(struct ftl_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(stream->output,
+			0);
+
+	if (!encoder_codec_is(vencoder, "h264")) {
+		warn("FTL requires an H.264 video encoder");
+		return false;
+	}
+	if (!encoder_codec_is(aencoder, "opus")) {
+		warn("FTL requires an Opus audio encoder");
+		return false;
+	}
+
+	return true;
+}
+
+static bool ftl_stream_start(void *data)
+{
+	struct ftl_stream *stream = data;
+
+	if (!check_codecs(stream))
+		return false;
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	os_atomic_set_bool(&stream->connecting, true);
+	return pthread_create(&stream->connect_thread, NULL, connect_thread,
+			stream) == 0;
+}
+
+/* packets stay annex b for RTP, so only the priorities are taken from the
+ * slice NAL units rather than using obs_parse_avc_packet */
+static void set_video_priority(struct encoder_packet *packet)
+{
+	const uint8_t *end = packet->data + packet->size;
+	const uint8_t *nal_start;
+
+	nal_start = obs_avc_find_startcode(packet->data, end);
+	while (true) {
+		int type;
+
+		while (nal_start < end && !*(nal_start++));
+
+		if (nal_start == end)
+			break;
+
+		type = nal_start[0] & 0x1F;
+		if (type == OBS_NAL_SLICE_IDR || type == OBS_NAL_SLICE)
+			packet->priority = nal_start[0] >> 5;
+
+		nal_start = obs_avc_find_startcode(nal_start, end);
+	}
+
+	if (packet->keyframe)
+		packet->drop_priority = OBS_NAL_PRIORITY_HIGHEST;
+	else if (packet->priority == OBS_NAL_PRIORITY_DISPOSABLE ||
+	         packet->priority == OBS_NAL_PRIORITY_LOW)
+		packet->drop_priority = packet->priority;
+	else
+		packet->drop_priority = OBS_NAL_PRIORITY_HIGHEST;
+}
+
+static void ftl_stream_data(void *data, struct encoder_packet *packet)
+{
+	struct ftl_stream     *stream = data;
+	struct encoder_packet new_packet;
+
+	if (disconnected(stream))
+		return;
+
+	obs_encoder_packet_ref(&new_packet, packet);
+	if (new_packet.type == OBS_ENCODER_VIDEO)
+		set_video_priority(&new_packet);
+
+	send_queue_add(&stream->queue, &new_packet);
+}
+
+static void ftl_stream_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_MAX_SHUTDOWN_TIME_SEC, 5);
+	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+}
+
+static uint64_t ftl_stream_total_bytes_sent(void *data)
+{
+	struct ftl_stream *stream = data;
+	return stream->total_bytes_sent;
+}
+
+static int ftl_stream_dropped_frames(void *data)
+{
+	struct ftl_stream *stream = data;
+	return stream->queue.dropped_frames;
+}
+
+static uint64_t ftl_stream_packet_memory(void *data)
+{
+	struct ftl_stream *stream = data;
+	return send_queue_memory(&stream->queue);
+}
+
+struct obs_output_info ftl_output_info = {
+	.id                 = "ftl_output",
+	.flags              = OBS_OUTPUT_AV |
+	                      OBS_OUTPUT_ENCODED |
+	                      OBS_OUTPUT_SERVICE,
+	.get_name           = ftl_stream_getname,
+	.create             = ftl_stream_create,
+	.destroy            = ftl_stream_destroy,
+	.start              = ftl_stream_start,
+	.stop               = ftl_stream_stop,
+	.encoded_packet     = ftl_stream_data,
+	.get_defaults       = ftl_stream_defaults,
+	.get_total_bytes    = ftl_stream_total_bytes_sent,
+	.get_dropped_frames = ftl_stream_dropped_frames,
+	.get_packet_memory  = ftl_stream_packet_memory
+};
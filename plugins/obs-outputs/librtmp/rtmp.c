@@ -4212,6 +4212,12 @@ RTMP_Close(RTMP *r)
     free(r->m_vecChannelsOut);
     r->m_vecChannelsOut = NULL;
     r->m_channelsAllocatedOut = 0;
+    free(r->m_writeIov);
+    r->m_writeIov = NULL;
+    r->m_writeIovSize = 0;
+    free(r->m_writeBuf);
+    r->m_writeBuf = NULL;
+    r->m_writeBufSize = 0;
     AV_clear(r->m_methodCalls, r->m_numCalls);
     r->m_methodCalls = NULL;
     r->m_numCalls = 0;
@@ -5229,3 +5235,293 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
     }
     return size+s2;
 }
+
+#ifdef _WIN32
+typedef WSABUF RTMPIOVec;
+#define IOV_BASE(v)	((v)->buf)
+#define IOV_LEN(v)	((v)->len)
+#define IOV_MAX_WRITE	1024
+#else
+typedef struct iovec RTMPIOVec;
+#define IOV_BASE(v)	((v)->iov_base)
+#define IOV_LEN(v)	((v)->iov_len)
+#ifdef IOV_MAX
+#define IOV_MAX_WRITE	IOV_MAX
+#else
+#define IOV_MAX_WRITE	1024
+#endif
+#endif
+
+static void
+SetIOVec(RTMPIOVec *v, const char *buf, int len)
+{
+    IOV_BASE(v) = (char *)buf;
+    IOV_LEN(v) = len;
+}
+
+static int
+WriteV(RTMP *r, RTMPIOVec *iov, int count)
+{
+    while (count > 0)
+    {
+        int num = count > IOV_MAX_WRITE ? IOV_MAX_WRITE : count;
+        long nBytes;
+
+#ifdef _WIN32
+        DWORD sent;
+        if (WSASend(r->m_sb.sb_socket, iov, num, &sent, 0, NULL, NULL) == 0)
+            nBytes = (long)sent;
+        else
+            nBytes = -1;
+#else
+        nBytes = (long)writev(r->m_sb.sb_socket, iov, num);
+#endif
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        /* skip what was sent, the last buffer may be partially sent */
+        while (count > 0 && nBytes >= (long)IOV_LEN(iov))
+        {
+            nBytes -= (long)IOV_LEN(iov);
+            iov++;
+            count--;
+        }
+        if (nBytes > 0)
+        {
+            IOV_BASE(iov) = (char *)IOV_BASE(iov) + nBytes;
+            IOV_LEN(iov) -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
+/* sends through WriteN for the transports that can't take the buffers
+ * directly */
+static int
+WriteVCopy(RTMP *r, const RTMPIOVec *iov, int count)
+{
+    int size = 0;
+    char *ptr;
+    int i;
+
+    for (i = 0; i < count; i++)
+        size += (int)IOV_LEN(&iov[i]);
+
+    if (size > r->m_writeBufSize)
+    {
+        char *buf = realloc(r->m_writeBuf, size);
+        if (!buf)
+            return FALSE;
+        r->m_writeBuf = buf;
+        r->m_writeBufSize = size;
+    }
+
+    ptr = r->m_writeBuf;
+    for (i = 0; i < count; i++)
+    {
+        memcpy(ptr, IOV_BASE(&iov[i]), IOV_LEN(&iov[i]));
+        ptr += IOV_LEN(&iov[i]);
+    }
+
+    return WriteN(r, r->m_writeBuf, size);
+}
+
+static int
+CanWriteV(RTMP *r)
+{
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+        return FALSE;
+    if (r->m_bCustomSend && r->m_customSendFunc)
+        return FALSE;
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        return FALSE;
+#if !defined(NO_SSL)
+    if (r->m_sb.sb_ssl)
+        return FALSE;
+#endif
+#endif
+    return TRUE;
+}
+
+/* adds the body bytes [offset, offset + size) to the write list, the body
+ * is split between the end of the tag buffer and the data buffer */
+static RTMPIOVec *
+AddBodyIOVec(RTMPIOVec *iov, const char *tagBody, int tagBodySize,
+             const char *data, int offset, int size)
+{
+    if (offset < tagBodySize)
+    {
+        int num = tagBodySize - offset;
+        if (num > size)
+            num = size;
+        SetIOVec(iov++, tagBody + offset, num);
+        offset += num;
+        size -= num;
+    }
+    if (size > 0)
+        SetIOVec(iov++, data + offset - tagBodySize, size);
+    return iov;
+}
+
+/* Same packet as RTMP_Write followed by RTMP_SendPacket would produce, but
+ * the chunk headers are sent from a small header buffer and the body straight
+ * from the caller's buffers, instead of copying the tag into a packet and
+ * writing the chunk headers over the body. */
+int
+RTMP_WriteTag(RTMP *r, const char *tag, int tagSize, const char *data,
+              int dataSize, int streamIdx)
+{
+    RTMPPacket packet;
+    const RTMPPacket *prevPacket;
+    const char *tagBody = tag + 11;
+    int tagBodySize = tagSize - 11;
+    uint32_t last = 0;
+    uint32_t t;
+    int nSize, hSize, bodySize, chunkSize, numChunks, maxIov;
+    char *hptr, *hend, c;
+    RTMPIOVec *iov, *cur;
+    int offset, ret;
+
+    if (tagSize < 11)
+        return FALSE;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.m_nChannel = 0x04;	/* source channel */
+    packet.m_nInfoField2 = r->Link.streams[streamIdx].id;
+    packet.m_packetType = tag[0];
+    packet.m_nBodySize = AMF_DecodeInt24(tag + 1);
+    packet.m_nTimeStamp = AMF_DecodeInt24(tag + 4);
+    packet.m_nTimeStamp |= (uint32_t)(uint8_t)tag[7] << 24;
+
+    /* metadata gets @setDataFrame prepended, use RTMP_Write for it */
+    if (packet.m_packetType != RTMP_PACKET_TYPE_AUDIO &&
+            packet.m_packetType != RTMP_PACKET_TYPE_VIDEO)
+        return FALSE;
+    if ((int)packet.m_nBodySize != tagBodySize + dataSize)
+        return FALSE;
+
+    packet.m_headerType = packet.m_nTimeStamp ?
+        RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+
+    if (packet.m_nChannel >= r->m_channelsAllocatedOut)
+    {
+        int n = packet.m_nChannel + 10;
+        RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
+        if (!packets)
+        {
+            free(r->m_vecChannelsOut);
+            r->m_vecChannelsOut = NULL;
+            r->m_channelsAllocatedOut = 0;
+            return FALSE;
+        }
+        r->m_vecChannelsOut = packets;
+        memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
+        r->m_channelsAllocatedOut = n;
+    }
+
+    prevPacket = r->m_vecChannelsOut[packet.m_nChannel];
+    if (prevPacket && packet.m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        /* compress a bit by using the prev packet's attributes */
+        if (prevPacket->m_nBodySize == packet.m_nBodySize
+                && prevPacket->m_packetType == packet.m_packetType
+                && packet.m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet.m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet.m_nTimeStamp
+                && packet.m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet.m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    /* the source channel always fits in the basic header, so every chunk
+     * after the first starts with the same single byte, stored right after
+     * the full header */
+    nSize = packetSize[packet.m_headerType];
+    t = packet.m_nTimeStamp - last;
+    hptr = r->m_writeHeader;
+    hend = r->m_writeHeader + RTMP_MAX_HEADER_SIZE;
+
+    c = packet.m_headerType << 6;
+    c |= packet.m_nChannel;
+    *hptr++ = c;
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet.m_nBodySize);
+        *hptr++ = packet.m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet.m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    hSize = (int)(hptr - r->m_writeHeader);
+    r->m_writeHeader[RTMP_MAX_HEADER_SIZE] = (char)(0xc0 | c);
+
+    /* each chunk is a header plus at most two body pieces */
+    bodySize = packet.m_nBodySize;
+    chunkSize = r->m_outChunkSize;
+    numChunks = bodySize ? (bodySize + chunkSize - 1) / chunkSize : 1;
+    maxIov = numChunks * 3;
+
+    if (maxIov > r->m_writeIovSize)
+    {
+        void *newIov = realloc(r->m_writeIov, sizeof(RTMPIOVec) * maxIov);
+        if (!newIov)
+            return FALSE;
+        r->m_writeIov = newIov;
+        r->m_writeIovSize = maxIov;
+    }
+
+    iov = r->m_writeIov;
+    cur = iov;
+    SetIOVec(cur++, r->m_writeHeader, hSize);
+
+    for (offset = 0; offset < bodySize; offset += chunkSize)
+    {
+        int num = bodySize - offset;
+        if (num > chunkSize)
+            num = chunkSize;
+
+        if (offset)
+            SetIOVec(cur++, r->m_writeHeader + RTMP_MAX_HEADER_SIZE, 1);
+        cur = AddBodyIOVec(cur, tagBody, tagBodySize, data, offset, num);
+    }
+
+    RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, (int)r->m_sb.sb_socket,
+             bodySize);
+
+    if (CanWriteV(r))
+        ret = WriteV(r, iov, (int)(cur - iov));
+    else
+        ret = WriteVCopy(r, iov, (int)(cur - iov));
+    if (!ret)
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet.m_nChannel])
+        r->m_vecChannelsOut[packet.m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet.m_nChannel], &packet, sizeof(RTMPPacket));
+    return TRUE;
+}
@@ -323,6 +323,13 @@ extern "C"
         RTMP_READ m_read;
         RTMPPacket m_write;
         RTMPSockBuf m_sb;
+
+        /* reused by RTMP_WriteTag between writes */
+        void *m_writeIov;
+        int m_writeIovSize;
+        char *m_writeBuf;
+        int m_writeBufSize;
+        char m_writeHeader[RTMP_MAX_HEADER_SIZE + 1];
         RTMP_LNK Link;
     } RTMP;
 
@@ -412,6 +419,13 @@ extern "C"
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx);
 
+    /* Sends an FLV audio or video tag as a single RTMP packet without
+     * copying it.  'tag' holds the 11 byte FLV tag header followed by the
+     * start of the tag body, 'data' the rest of the body.  The trailing tag
+     * size is not included.  Returns FALSE on failure. */
+    int RTMP_WriteTag(RTMP *r, const char *tag, int tagSize,
+                      const char *data, int dataSize, int streamIdx);
+
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
                      int age);
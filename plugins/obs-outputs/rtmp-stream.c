@@ -18,13 +18,13 @@
 #include <obs-module.h>
 #include <obs-avc.h>
 #include <util/platform.h>
-#include <util/circlebuf.h>
 #include <util/dstr.h>
 #include <util/threading.h>
-#include <inttypes.h>
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
+#include "bitrate-control.h"
+#include "send-queue.h"
 
 #ifdef _WIN32
 #include <Iphlpapi.h>
@@ -42,41 +42,38 @@
 
 #define OPT_DROP_THRESHOLD "drop_threshold_ms"
 #define OPT_MAX_SHUTDOWN_TIME_SEC "max_shutdown_time_sec"
+#define OPT_DYN_BITRATE "dynamic_bitrate"
+
+/* lowest bitrate the dynamic bitrate may go to, relative to the bitrate the
+ * stream was started with */
+#define DYN_BITRATE_MIN_DIVISOR 5
 
 //#define TEST_FRAMEDROPS
 
 struct rtmp_stream {
 	obs_output_t     *output;
 
-	pthread_mutex_t  packets_mutex;
-	struct circlebuf packets;
+	struct send_queue queue;
 	bool             sent_headers;
 
 	volatile bool    connecting;
 	pthread_t        connect_thread;
 
-	volatile bool    active;
-	volatile bool    disconnected;
-	pthread_t        send_thread;
-
-	int              max_shutdown_time_sec;
-
-	os_sem_t         *send_sem;
-	os_event_t       *stop_event;
-
 	struct dstr      path, key;
 	struct dstr      username, password;
 	struct dstr      encoder_name;
 
-	/* frame drop variables */
-	int64_t          drop_threshold_usec;
-	int64_t          min_drop_dts_usec;
-	int              min_priority;
-
-	int64_t          last_dts_usec;
+	/* dynamic bitrate variables, only used by the send thread */
+	bool             dynamic_bitrate;
+	int              start_bitrate;
+	struct bitrate_control bitrate_control;
 
 	uint64_t         total_bytes_sent;
-	int              dropped_frames;
+
+	metric_t         *queue_metric;
+	metric_t         *sent_bytes_metric;
+	metric_t         *send_time_metric;
+	metric_t         *dropped_frames_metric;
 
 	RTMP             rtmp;
 };
@@ -95,29 +92,9 @@ static void log_rtmp(int level, const char *format, va_list args)
 	blogva(LOG_INFO, format, args);
 }
 
-static inline size_t num_buffered_packets(struct rtmp_stream *stream);
-
-static inline void free_packets(struct rtmp_stream *stream)
-{
-	size_t num_packets;
-
-	pthread_mutex_lock(&stream->packets_mutex);
-
-	num_packets = num_buffered_packets(stream);
-	if (num_packets)
-		info("Freeing %d remaining packets", (int)num_packets);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-		obs_free_encoder_packet(&packet);
-	}
-	pthread_mutex_unlock(&stream->packets_mutex);
-}
-
 static inline bool stopping(struct rtmp_stream *stream)
 {
-	return os_event_try(stream->stop_event) != EAGAIN;
+	return send_queue_stopping(&stream->queue);
 }
 
 static inline bool connecting(struct rtmp_stream *stream)
@@ -127,12 +104,12 @@ static inline bool connecting(struct rtmp_stream *stream)
 
 static inline bool active(struct rtmp_stream *stream)
 {
-	return os_atomic_load_bool(&stream->active);
+	return send_queue_active(&stream->queue);
 }
 
 static inline bool disconnected(struct rtmp_stream *stream)
 {
-	return os_atomic_load_bool(&stream->disconnected);
+	return send_queue_disconnected(&stream->queue);
 }
 
 static void rtmp_stream_destroy(void *data)
@@ -140,51 +117,78 @@ static void rtmp_stream_destroy(void *data)
 	struct rtmp_stream *stream = data;
 
 	if (stopping(stream) && !connecting(stream)) {
-		pthread_join(stream->send_thread, NULL);
+		pthread_join(stream->queue.send_thread, NULL);
 
 	} else if (connecting(stream) || active(stream)) {
 		if (stream->connecting)
 			pthread_join(stream->connect_thread, NULL);
 
-		os_event_signal(stream->stop_event);
-
 		if (active(stream)) {
-			os_sem_post(stream->send_sem);
-			obs_output_end_data_capture(stream->output);
-			pthread_join(stream->send_thread, NULL);
+			send_queue_stop(&stream->queue);
+			pthread_join(stream->queue.send_thread, NULL);
+		} else {
+			os_event_signal(stream->queue.stop_event);
 		}
 	}
 
 	if (stream) {
-		free_packets(stream);
+		send_queue_free(&stream->queue);
 		dstr_free(&stream->path);
 		dstr_free(&stream->key);
 		dstr_free(&stream->username);
 		dstr_free(&stream->password);
 		dstr_free(&stream->encoder_name);
-		os_event_destroy(stream->stop_event);
-		os_sem_destroy(stream->send_sem);
-		pthread_mutex_destroy(&stream->packets_mutex);
-		circlebuf_free(&stream->packets);
+		metric_release(stream->queue_metric);
+		metric_release(stream->sent_bytes_metric);
+		metric_release(stream->send_time_metric);
+		metric_release(stream->dropped_frames_metric);
 		bfree(stream);
 	}
 }
 
+static void create_metrics(struct rtmp_stream *stream)
+{
+	const char *name = obs_output_get_name(stream->output);
+
+	stream->queue_metric = metric_create(METRIC_GAUGE,
+			"obs_rtmp_send_queue_packets",
+			"Packets waiting to be sent", "output", name);
+	stream->sent_bytes_metric = metric_create(METRIC_COUNTER,
+			"obs_rtmp_sent_bytes_total",
+			"Bytes of FLV tags sent", "output", name);
+	stream->send_time_metric = metric_create(METRIC_HISTOGRAM,
+			"obs_rtmp_send_seconds",
+			"Time spent writing a packet to the socket",
+			"output", name);
+	stream->dropped_frames_metric = metric_create(METRIC_COUNTER,
+			"obs_rtmp_dropped_frames_total",
+			"Video frames dropped because of congestion",
+			"output", name);
+}
+
+static const struct send_queue_info rtmp_send_queue_info;
+
 static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
-	pthread_mutex_init_value(&stream->packets_mutex);
+	create_metrics(stream);
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
-	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
-		goto fail;
-	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+	if (!send_queue_init(&stream->queue, output, &rtmp_send_queue_info,
+				stream))
 		goto fail;
 
+	stream->queue.queue_metric          = stream->queue_metric;
+	stream->queue.dropped_frames_metric = stream->dropped_frames_metric;
+
+	signal_handler_add(obs_output_get_signal_handler(output),
+			"void bitrate_changed(ptr output, int bitrate, "
+			"int previous_bitrate, int throughput, int buffer_ms)");
+
 	UNUSED_PARAMETER(settings);
 	return stream;
 
@@ -203,12 +207,7 @@ static void rtmp_stream_stop(void *data)
 	if (connecting(stream))
 		pthread_join(stream->connect_thread, NULL);
 
-	os_event_signal(stream->stop_event);
-
-	if (active(stream)) {
-		os_sem_post(stream->send_sem);
-		obs_output_end_data_capture(stream->output);
-	}
+	send_queue_stop(&stream->queue);
 }
 
 static inline void set_rtmp_str(AVal *val, const char *str)
@@ -225,22 +224,6 @@ static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
 	val->av_len = valid ? (int)str->len : 0;
 }
 
-static inline bool get_next_packet(struct rtmp_stream *stream,
-		struct encoder_packet *packet)
-{
-	bool new_packet = false;
-
-	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
-		circlebuf_pop_front(&stream->packets, packet,
-				sizeof(struct encoder_packet));
-		new_packet = true;
-	}
-	pthread_mutex_unlock(&stream->packets_mutex);
-
-	return new_packet;
-}
-
 static bool discard_recv_data(struct rtmp_stream *stream, size_t size)
 {
 	RTMP *rtmp = &stream->rtmp;
@@ -281,10 +264,13 @@ static bool discard_recv_data(struct rtmp_stream *stream, size_t size)
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header, size_t idx)
 {
-	uint8_t *data;
-	size_t  size;
+	uint8_t header[FLV_TAG_HEADER_MAX_SIZE];
+	size_t  header_size;
+	size_t  size = 0;
 	int     recv_size = 0;
 	int     ret = 0;
+	uint64_t send_start_ns;
+	uint64_t send_time_ns;
 
 #ifdef _WIN32
 	ret = ioctlsocket(stream->rtmp.m_sb.sb_socket, FIONREAD,
@@ -298,98 +284,175 @@ static int send_packet(struct rtmp_stream *stream,
 			return -1;
 	}
 
-	flv_packet_mux(packet, &data, &size, is_header);
+	/* the tag is sent from a stack header and the packet data directly,
+	 * without muxing it into a separate buffer first */
+	header_size = flv_packet_header(packet, is_header, header);
+	send_start_ns = os_gettime_ns();
 #ifdef TEST_FRAMEDROPS
 	os_sleep_ms(rand() % 40);
 #endif
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size, (int)idx);
-	bfree(data);
+	if (header_size) {
+		size = header_size + packet->size + FLV_TAG_FOOTER_SIZE;
+		if (!RTMP_WriteTag(&stream->rtmp, (char*)header,
+					(int)header_size, (char*)packet->data,
+					(int)packet->size, (int)idx))
+			ret = -1;
+	}
+
+	send_time_ns = os_gettime_ns() - send_start_ns;
+	bitrate_control_sent(&stream->bitrate_control, size, send_time_ns);
+	if (size)
+		metric_record(stream->send_time_metric, send_time_ns);
 
-	obs_free_encoder_packet(packet);
+	/* headers are built by the stream, packets are shared */
+	if (is_header)
+		obs_free_encoder_packet(packet);
+	else
+		obs_encoder_packet_release(packet);
 
 	stream->total_bytes_sent += size;
+	metric_add(stream->sent_bytes_metric, (int64_t)size);
 	return ret;
 }
 
 static inline bool send_headers(struct rtmp_stream *stream);
 
-static bool send_remaining_packets(struct rtmp_stream *stream)
+/* called from the send thread, obs_encoder_update leaves the change to the
+ * encoder thread, which applies it before encoding its next frame */
+static void set_video_bitrate(struct rtmp_stream *stream, int bitrate)
 {
-	struct encoder_packet packet;
-	uint64_t max_ns = (uint64_t)stream->max_shutdown_time_sec * 1000000000;
-	uint64_t begin_time_ns = os_gettime_ns();
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t    *settings = obs_data_create();
 
-	if (!stream->sent_headers) {
-		if (!send_headers(stream))
-			return false;
-	}
+	obs_data_set_int(settings, "bitrate", bitrate);
+	obs_encoder_update(vencoder, settings);
+	obs_data_release(settings);
+}
 
-	while (get_next_packet(stream, &packet)) {
-		if (send_packet(stream, &packet, false, packet.track_idx) < 0)
-			return false;
+static void signal_bitrate_changed(struct rtmp_stream *stream, int bitrate,
+		int previous_bitrate, int64_t buffer_usec)
+{
+	signal_handler_t *handler =
+		obs_output_get_signal_handler(stream->output);
+	struct calldata params;
+	uint8_t stack[256];
 
-		/* Just disconnect if it takes too long to shut down */
-		if ((os_gettime_ns() - begin_time_ns) > max_ns) {
-			info("Took longer than %d second(s) to shut down, "
-			     "automatically stopping connection",
-			     stream->max_shutdown_time_sec);
-			return false;
-		}
+	calldata_init_fixed(&params, stack, sizeof(stack));
+	calldata_set_ptr(&params, "output", stream->output);
+	calldata_set_int(&params, "bitrate", bitrate);
+	calldata_set_int(&params, "previous_bitrate", previous_bitrate);
+	calldata_set_int(&params, "throughput",
+			(long long)stream->bitrate_control.throughput_kbps);
+	calldata_set_int(&params, "buffer_ms", buffer_usec / 1000);
+	signal_handler_signal(handler, "bitrate_changed", &params);
+}
+
+static void init_dynamic_bitrate(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t    *settings = obs_encoder_get_settings(vencoder);
+
+	stream->start_bitrate = (int)obs_data_get_int(settings, "bitrate");
+	obs_data_release(settings);
+
+	bitrate_control_init(&stream->bitrate_control, stream->start_bitrate,
+			stream->start_bitrate / DYN_BITRATE_MIN_DIVISOR,
+			stream->queue.drop_threshold_usec / 2, os_gettime_ns());
+
+	if (stream->dynamic_bitrate && !stream->start_bitrate) {
+		warn("Video encoder has no bitrate setting, dynamic bitrate "
+		     "disabled");
+		stream->dynamic_bitrate = false;
 	}
+}
 
-	return true;
+static void update_dynamic_bitrate(struct rtmp_stream *stream)
+{
+	struct bitrate_control *bc = &stream->bitrate_control;
+	uint64_t now_ns = os_gettime_ns();
+	int      prev_bitrate = bc->cur_kbps;
+	int64_t  buffer_usec;
+	int      bitrate;
+
+	if (now_ns - bc->interval_start_ns < BITRATE_CONTROL_INTERVAL_NS)
+		return;
+
+	buffer_usec = send_queue_duration_usec(&stream->queue);
+	bitrate = bitrate_control_update(bc, buffer_usec, now_ns);
+	if (!bitrate)
+		return;
+
+	info("Changing bitrate from %d to %d kbps (throughput %d kbps, "
+	     "buffered %d ms)", prev_bitrate, bitrate,
+	     (int)bc->throughput_kbps, (int)(buffer_usec / 1000));
+
+	set_video_bitrate(stream, bitrate);
+	signal_bitrate_changed(stream, bitrate, prev_bitrate, buffer_usec);
 }
 
-static void *send_thread(void *data)
+/* the encoder settings are shared with the user's configuration, so do not
+ * leave a lowered bitrate behind */
+static void reset_dynamic_bitrate(struct rtmp_stream *stream)
 {
-	struct rtmp_stream *stream = data;
+	if (!stream->dynamic_bitrate ||
+	    stream->bitrate_control.cur_kbps == stream->start_bitrate)
+		return;
 
-	os_set_thread_name("rtmp-stream: send_thread");
+	set_video_bitrate(stream, stream->start_bitrate);
+	stream->bitrate_control.cur_kbps = stream->start_bitrate;
+}
 
-	while (os_sem_wait(stream->send_sem) == 0) {
-		struct encoder_packet packet;
+static const char *send_thread_name = "send_thread(rtmp-stream)";
+static const char *send_packet_name = "send_packet";
 
-		if (stopping(stream))
-			break;
-		if (!get_next_packet(stream, &packet))
-			continue;
+static bool send_queued_packet(void *data, struct encoder_packet *packet)
+{
+	struct rtmp_stream *stream = data;
+	bool success = true;
 
-		if (!stream->sent_headers) {
-			if (!send_headers(stream)) {
-				os_atomic_set_bool(&stream->disconnected, true);
-				break;
-			}
-		}
+	profile_start(send_thread_name);
 
-		if (send_packet(stream, &packet, false, packet.track_idx) < 0) {
-			os_atomic_set_bool(&stream->disconnected, true);
-			break;
-		}
+	if (!stream->sent_headers)
+		success = send_headers(stream);
+
+	if (success) {
+		profile_start(send_packet_name);
+		success = send_packet(stream, packet, false,
+				packet->track_idx) >= 0;
+		profile_end(send_packet_name);
+	} else {
+		obs_encoder_packet_release(packet);
 	}
 
-	if (!disconnected(stream) && !send_remaining_packets(stream))
-		os_atomic_set_bool(&stream->disconnected, true);
+	if (success && stream->dynamic_bitrate)
+		update_dynamic_bitrate(stream);
 
-	if (disconnected(stream)) {
+	profile_end(send_thread_name);
+	profile_reenable_thread();
+	return success;
+}
+
+static void close_connection(void *data, bool disconnected)
+{
+	struct rtmp_stream *stream = data;
+
+	if (disconnected)
 		info("Disconnected from %s", stream->path.array);
-		free_packets(stream);
-	} else {
+	else
 		info("User stopped the stream");
-	}
 
 	RTMP_Close(&stream->rtmp);
-
-	if (!stopping(stream)) {
-		pthread_detach(stream->send_thread);
-		obs_output_signal_stop(stream->output, OBS_OUTPUT_DISCONNECTED);
-	}
-
-	os_event_reset(stream->stop_event);
-	os_atomic_set_bool(&stream->active, false);
+	reset_dynamic_bitrate(stream);
 	stream->sent_headers = false;
-	return NULL;
 }
 
+static const struct send_queue_info rtmp_send_queue_info = {
+	.log_name    = "rtmp stream",
+	.thread_name = "rtmp-stream: send_thread",
+	.send_packet = send_queued_packet,
+	.close       = close_connection
+};
+
 static bool send_meta_data(struct rtmp_stream *stream, size_t idx, bool *next)
 {
 	uint8_t *meta_data;
@@ -468,12 +531,6 @@ static inline bool send_headers(struct rtmp_stream *stream)
 	return true;
 }
 
-static inline bool reset_semaphore(struct rtmp_stream *stream)
-{
-	os_sem_destroy(stream->send_sem);
-	return os_sem_init(&stream->send_sem, 0) == 0;
-}
-
 #ifdef _WIN32
 #define socklen_t int
 #endif
@@ -497,7 +554,6 @@ static void adjust_sndbuf_size(struct rtmp_stream *stream, int new_size)
 
 static int init_send(struct rtmp_stream *stream)
 {
-	int ret;
 	size_t idx = 0;
 	bool next = true;
 
@@ -505,16 +561,14 @@ static int init_send(struct rtmp_stream *stream)
 	adjust_sndbuf_size(stream, MIN_SENDBUF_SIZE);
 #endif
 
-	reset_semaphore(stream);
+	init_dynamic_bitrate(stream);
 
-	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
-	if (ret != 0) {
+	if (!send_queue_start(&stream->queue)) {
 		RTMP_Close(&stream->rtmp);
 		warn("Failed to create send thread");
 		return OBS_OUTPUT_ERROR;
 	}
 
-	os_atomic_set_bool(&stream->active, true);
 	while (next) {
 		if (!send_meta_data(stream, idx++, &next)) {
 			warn("Disconnected while attempting to connect to "
@@ -655,19 +709,14 @@ static bool init_connect(struct rtmp_stream *stream)
 	obs_data_t *settings;
 
 	if (stopping(stream))
-		pthread_join(stream->send_thread, NULL);
-
-	free_packets(stream);
+		pthread_join(stream->queue.send_thread, NULL);
 
 	service = obs_output_get_service(stream->output);
 	if (!service)
 		return false;
 
-	os_atomic_set_bool(&stream->disconnected, false);
+	send_queue_reset(&stream->queue);
 	stream->total_bytes_sent = 0;
-	stream->dropped_frames   = 0;
-	stream->min_drop_dts_usec= 0;
-	stream->min_priority     = 0;
 
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,     obs_service_get_url(service));
@@ -676,10 +725,11 @@ static bool init_connect(struct rtmp_stream *stream)
 	dstr_copy(&stream->password, obs_service_get_password(service));
 	dstr_depad(&stream->path);
 	dstr_depad(&stream->key);
-	stream->drop_threshold_usec =
+	stream->queue.drop_threshold_usec =
 		(int64_t)obs_data_get_int(settings, OPT_DROP_THRESHOLD) * 1000;
-	stream->max_shutdown_time_sec =
+	stream->queue.max_shutdown_time_sec =
 		(int)obs_data_get_int(settings, OPT_MAX_SHUTDOWN_TIME_SEC);
+	stream->dynamic_bitrate = obs_data_get_bool(settings, OPT_DYN_BITRATE);
 	obs_data_release(settings);
 	return true;
 }
@@ -724,136 +774,27 @@ static bool rtmp_stream_start(void *data)
 			stream) == 0;
 }
 
-static inline bool add_packet(struct rtmp_stream *stream,
-		struct encoder_packet *packet)
-{
-	circlebuf_push_back(&stream->packets, packet,
-			sizeof(struct encoder_packet));
-	stream->last_dts_usec = packet->dts_usec;
-	return true;
-}
-
-static inline size_t num_buffered_packets(struct rtmp_stream *stream)
-{
-	return stream->packets.size / sizeof(struct encoder_packet);
-}
-
-static void drop_frames(struct rtmp_stream *stream)
-{
-	struct circlebuf new_buf            = {0};
-	int              drop_priority      = 0;
-	uint64_t         last_drop_dts_usec = 0;
-	int              num_frames_dropped = 0;
-
-	debug("Previous packet count: %d", (int)num_buffered_packets(stream));
-
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-
-		last_drop_dts_usec = packet.dts_usec;
-
-		/* do not drop audio data or video keyframes */
-		if (packet.type          == OBS_ENCODER_AUDIO ||
-		    packet.drop_priority == OBS_NAL_PRIORITY_HIGHEST) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
-			if (drop_priority < packet.drop_priority)
-				drop_priority = packet.drop_priority;
-
-			num_frames_dropped++;
-			obs_free_encoder_packet(&packet);
-		}
-	}
-
-	circlebuf_free(&stream->packets);
-	stream->packets           = new_buf;
-	stream->min_priority      = drop_priority;
-	stream->min_drop_dts_usec = last_drop_dts_usec;
-
-	stream->dropped_frames += num_frames_dropped;
-	debug("New packet count: %d", (int)num_buffered_packets(stream));
-}
-
-static void check_to_drop_frames(struct rtmp_stream *stream)
-{
-	struct encoder_packet first;
-	int64_t buffer_duration_usec;
-
-	if (num_buffered_packets(stream) < 5)
-		return;
-
-	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
-
-	/* do not drop frames if frames were just dropped within this time */
-	if (first.dts_usec < stream->min_drop_dts_usec)
-		return;
-
-	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
-
-	if (buffer_duration_usec > stream->drop_threshold_usec) {
-		drop_frames(stream);
-		debug("dropping %" PRId64 " worth of frames",
-				buffer_duration_usec);
-	}
-}
-
-static bool add_video_packet(struct rtmp_stream *stream,
-		struct encoder_packet *packet)
-{
-	check_to_drop_frames(stream);
-
-	/* if currently dropping frames, drop packets until it reaches the
-	 * desired priority */
-	if (packet->priority < stream->min_priority) {
-		stream->dropped_frames++;
-		return false;
-	} else {
-		stream->min_priority = 0;
-	}
-
-	return add_packet(stream, packet);
-}
-
 static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 {
 	struct rtmp_stream    *stream = data;
 	struct encoder_packet new_packet;
-	bool                  added_packet = false;
 
 	if (disconnected(stream))
 		return;
 
 	if (packet->type == OBS_ENCODER_VIDEO)
-		obs_parse_avc_packet(&new_packet, packet);
+		obs_parse_avc_packet_shared(&new_packet, packet);
 	else
-		obs_duplicate_encoder_packet(&new_packet, packet);
-
-	pthread_mutex_lock(&stream->packets_mutex);
+		obs_encoder_packet_ref(&new_packet, packet);
 
-	if (!disconnected(stream)) {
-		added_packet = (packet->type == OBS_ENCODER_VIDEO) ?
-			add_video_packet(stream, &new_packet) :
-			add_packet(stream, &new_packet);
-	}
-
-	pthread_mutex_unlock(&stream->packets_mutex);
-
-	if (added_packet)
-		os_sem_post(stream->send_sem);
-	else
-		obs_free_encoder_packet(&new_packet);
+	send_queue_add(&stream->queue, &new_packet);
 }
 
 static void rtmp_stream_defaults(obs_data_t *defaults)
 {
 	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
 	obs_data_set_default_int(defaults, OPT_MAX_SHUTDOWN_TIME_SEC, 5);
+	obs_data_set_default_bool(defaults, OPT_DYN_BITRATE, false);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -865,6 +806,8 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
 			obs_module_text("RTMPStream.DropThreshold"),
 			200, 10000, 100);
+	obs_properties_add_bool(props, OPT_DYN_BITRATE,
+			obs_module_text("RTMPStream.DynamicBitrate"));
 
 	return props;
 }
@@ -878,7 +821,13 @@ static uint64_t rtmp_stream_total_bytes_sent(void *data)
 static int rtmp_stream_dropped_frames(void *data)
 {
 	struct rtmp_stream *stream = data;
-	return stream->dropped_frames;
+	return stream->queue.dropped_frames;
+}
+
+static uint64_t rtmp_stream_packet_memory(void *data)
+{
+	struct rtmp_stream *stream = data;
+	return send_queue_memory(&stream->queue);
 }
 
 struct obs_output_info rtmp_output_info = {
@@ -896,5 +845,6 @@ struct obs_output_info rtmp_output_info = {
 	.get_defaults       = rtmp_stream_defaults,
 	.get_properties     = rtmp_stream_properties,
 	.get_total_bytes    = rtmp_stream_total_bytes_sent,
-	.get_dropped_frames = rtmp_stream_dropped_frames
+	.get_dropped_frames = rtmp_stream_dropped_frames,
+	.get_packet_memory  = rtmp_stream_packet_memory
 };
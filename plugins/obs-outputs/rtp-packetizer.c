@@ -0,0 +1,149 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <string.h>
+#include <obs-avc.h>
+#include "rtp-packetizer.h"
+
+#define NAL_TYPE_FU_A            28
+#define FU_A_HEADER_SIZE         2
+
+void rtp_packetizer_init(struct rtp_packetizer *rtp, uint8_t payload_type,
+		uint32_t clock_rate, uint32_t ssrc, rtp_send_t send,
+		void *param)
+{
+	memset(rtp, 0, sizeof(*rtp));
+	rtp->payload_type = payload_type;
+	rtp->clock_rate   = clock_rate;
+	rtp->ssrc         = ssrc;
+	rtp->send         = send;
+	rtp->param        = param;
+}
+
+static inline void write_be16(uint8_t *p, uint16_t val)
+{
+	p[0] = (uint8_t)(val >> 8);
+	p[1] = (uint8_t)val;
+}
+
+static inline void write_be32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val >> 24);
+	p[1] = (uint8_t)(val >> 16);
+	p[2] = (uint8_t)(val >> 8);
+	p[3] = (uint8_t)val;
+}
+
+/* sends one RTP packet made of an optional payload header (used for FU-A)
+ * and a chunk of payload */
+static bool send_rtp(struct rtp_packetizer *rtp, uint32_t timestamp,
+		bool marker, const uint8_t *header, size_t header_size,
+		const uint8_t *payload, size_t payload_size)
+{
+	uint8_t *p = rtp->packet;
+
+	p[0] = 0x80; /* version 2, no padding, extensions or csrcs */
+	p[1] = (uint8_t)((marker ? 0x80 : 0) | rtp->payload_type);
+	write_be16(p + 2, rtp->seq++);
+	write_be32(p + 4, timestamp);
+	write_be32(p + 8, rtp->ssrc);
+
+	if (header_size)
+		memcpy(p + RTP_HEADER_SIZE, header, header_size);
+	memcpy(p + RTP_HEADER_SIZE + header_size, payload, payload_size);
+
+	return rtp->send(rtp->param, p,
+			RTP_HEADER_SIZE + header_size + payload_size);
+}
+
+static bool send_nal(struct rtp_packetizer *rtp, const uint8_t *nal,
+		size_t size, uint32_t timestamp, bool last_nal)
+{
+	uint8_t fu_header[FU_A_HEADER_SIZE];
+	uint8_t nal_type;
+	bool    first = true;
+
+	if (size <= RTP_MAX_PAYLOAD_SIZE)
+		return send_rtp(rtp, timestamp, last_nal, NULL, 0, nal, size);
+
+	fu_header[0] = (uint8_t)((nal[0] & 0xE0) | NAL_TYPE_FU_A);
+	nal_type     = nal[0] & 0x1F;
+
+	/* the NAL header is replaced by the FU indicator and header */
+	nal++;
+	size--;
+
+	while (size) {
+		size_t chunk = RTP_MAX_PAYLOAD_SIZE - FU_A_HEADER_SIZE;
+		bool   last;
+
+		if (chunk > size)
+			chunk = size;
+		last = chunk == size;
+
+		fu_header[1] = nal_type;
+		if (first)
+			fu_header[1] |= 0x80;
+		if (last)
+			fu_header[1] |= 0x40;
+
+		if (!send_rtp(rtp, timestamp, last && last_nal,
+					fu_header, FU_A_HEADER_SIZE,
+					nal, chunk))
+			return false;
+
+		first = false;
+		nal  += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+bool rtp_packetize_h264(struct rtp_packetizer *rtp, const uint8_t *data,
+		size_t size, uint32_t timestamp, bool end_of_frame)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *nal_start, *nal_end;
+
+	nal_start = obs_avc_find_startcode(data, end);
+	while (true) {
+		while (nal_start < end && !*(nal_start++));
+
+		if (nal_start == end)
+			break;
+
+		nal_end = obs_avc_find_startcode(nal_start, end);
+
+		if (!send_nal(rtp, nal_start, nal_end - nal_start, timestamp,
+					end_of_frame && nal_end == end))
+			return false;
+
+		nal_start = nal_end;
+	}
+
+	return true;
+}
+
+bool rtp_packetize_opus(struct rtp_packetizer *rtp, const uint8_t *data,
+		size_t size, uint32_t timestamp)
+{
+	if (size > RTP_MAX_PAYLOAD_SIZE)
+		return false;
+
+	return send_rtp(rtp, timestamp, true, NULL, 0, data, size);
+}
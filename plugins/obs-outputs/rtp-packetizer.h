@@ -0,0 +1,73 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * RTP packetizer for H.264 (RFC 6184) and Opus (RFC 7587).
+ *
+ *   Each finished RTP packet is handed to the send callback, which returns
+ *   false if it couldn't be sent.  H.264 NAL units that fit are sent as
+ *   single NAL unit packets and larger ones as FU-A fragments, and the
+ *   marker bit is set on the last packet of an access unit.  The packetizer
+ *   does no I/O itself, so it can be driven from a test.
+ */
+
+#define RTP_MAX_PACKET_SIZE      1350
+#define RTP_HEADER_SIZE          12
+#define RTP_MAX_PAYLOAD_SIZE     (RTP_MAX_PACKET_SIZE - RTP_HEADER_SIZE)
+
+typedef bool (*rtp_send_t)(void *param, const uint8_t *packet, size_t size);
+
+struct rtp_packetizer {
+	uint32_t   ssrc;
+	uint16_t   seq;
+	uint8_t    payload_type;
+	uint32_t   clock_rate;
+
+	rtp_send_t send;
+	void       *param;
+
+	uint8_t    packet[RTP_MAX_PACKET_SIZE];
+};
+
+extern void rtp_packetizer_init(struct rtp_packetizer *rtp,
+		uint8_t payload_type, uint32_t clock_rate, uint32_t ssrc,
+		rtp_send_t send, void *param);
+
+/* converts a pts in the given timebase to the RTP clock */
+static inline uint32_t rtp_packetizer_timestamp(
+		const struct rtp_packetizer *rtp, int64_t pts,
+		int32_t timebase_num, int32_t timebase_den)
+{
+	return (uint32_t)(pts * (int64_t)rtp->clock_rate * timebase_num /
+			timebase_den);
+}
+
+/* sends every NAL unit of an annex b buffer, the marker bit is only set on
+ * the last packet if the buffer ends the access unit */
+extern bool rtp_packetize_h264(struct rtp_packetizer *rtp,
+		const uint8_t *data, size_t size, uint32_t timestamp,
+		bool end_of_frame);
+
+/* sends one Opus packet as one RTP packet */
+extern bool rtp_packetize_opus(struct rtp_packetizer *rtp,
+		const uint8_t *data, size_t size, uint32_t timestamp);
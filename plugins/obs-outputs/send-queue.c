@@ -0,0 +1,345 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include "send-queue.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[%s: '%s'] " format, sq->info->log_name, \
+			obs_output_get_name(sq->output), ##__VA_ARGS__)
+
+#define info(format, ...)  do_log(LOG_INFO,  format, ##__VA_ARGS__)
+#define debug(format, ...) do_log(LOG_DEBUG, format, ##__VA_ARGS__)
+
+bool send_queue_init(struct send_queue *sq, obs_output_t *output,
+		const struct send_queue_info *info, void *param)
+{
+	sq->output = output;
+	sq->info   = info;
+	sq->param  = param;
+	pthread_mutex_init_value(&sq->packets_mutex);
+
+	if (pthread_mutex_init(&sq->packets_mutex, NULL) != 0)
+		return false;
+	if (os_event_init(&sq->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		return false;
+
+	return true;
+}
+
+void send_queue_free(struct send_queue *sq)
+{
+	send_queue_free_packets(sq);
+	os_event_destroy(sq->stop_event);
+	os_sem_destroy(sq->send_sem);
+	pthread_mutex_destroy(&sq->packets_mutex);
+	circlebuf_free(&sq->packets);
+}
+
+static inline size_t num_buffered_packets(struct send_queue *sq)
+{
+	return sq->packets.size / sizeof(struct encoder_packet);
+}
+
+void send_queue_free_packets(struct send_queue *sq)
+{
+	size_t num_packets;
+
+	pthread_mutex_lock(&sq->packets_mutex);
+
+	num_packets = num_buffered_packets(sq);
+	if (num_packets)
+		info("Freeing %d remaining packets", (int)num_packets);
+
+	while (sq->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&sq->packets, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+	}
+	metric_set(sq->queue_metric, 0);
+	pthread_mutex_unlock(&sq->packets_mutex);
+}
+
+void send_queue_reset(struct send_queue *sq)
+{
+	send_queue_free_packets(sq);
+
+	os_atomic_set_bool(&sq->disconnected, false);
+	sq->dropped_frames    = 0;
+	sq->min_drop_dts_usec = 0;
+	sq->min_priority      = 0;
+	sq->last_dts_usec     = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool get_next_packet(struct send_queue *sq,
+		struct encoder_packet *packet)
+{
+	bool new_packet = false;
+
+	pthread_mutex_lock(&sq->packets_mutex);
+	if (sq->packets.size) {
+		circlebuf_pop_front(&sq->packets, packet,
+				sizeof(struct encoder_packet));
+		new_packet = true;
+	}
+	metric_set(sq->queue_metric, (int64_t)num_buffered_packets(sq));
+	pthread_mutex_unlock(&sq->packets_mutex);
+
+	return new_packet;
+}
+
+static bool send_remaining_packets(struct send_queue *sq)
+{
+	struct encoder_packet packet;
+	uint64_t max_ns = (uint64_t)sq->max_shutdown_time_sec * 1000000000;
+	uint64_t begin_time_ns = os_gettime_ns();
+
+	while (get_next_packet(sq, &packet)) {
+		if (!sq->info->send_packet(sq->param, &packet))
+			return false;
+
+		/* Just disconnect if it takes too long to shut down */
+		if ((os_gettime_ns() - begin_time_ns) > max_ns) {
+			info("Took longer than %d second(s) to shut down, "
+			     "automatically stopping connection",
+			     sq->max_shutdown_time_sec);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void *send_thread(void *data)
+{
+	struct send_queue *sq = data;
+
+	os_set_thread_name(sq->info->thread_name);
+
+	while (os_sem_wait(sq->send_sem) == 0) {
+		struct encoder_packet packet;
+
+		if (send_queue_stopping(sq))
+			break;
+		if (!get_next_packet(sq, &packet))
+			continue;
+
+		if (!sq->info->send_packet(sq->param, &packet)) {
+			os_atomic_set_bool(&sq->disconnected, true);
+			break;
+		}
+	}
+
+	if (!send_queue_disconnected(sq) && !send_remaining_packets(sq))
+		os_atomic_set_bool(&sq->disconnected, true);
+
+	if (send_queue_disconnected(sq))
+		send_queue_free_packets(sq);
+
+	sq->info->close(sq->param, send_queue_disconnected(sq));
+
+	if (!send_queue_stopping(sq)) {
+		pthread_detach(sq->send_thread);
+		obs_output_signal_stop(sq->output, OBS_OUTPUT_DISCONNECTED);
+	}
+
+	os_event_reset(sq->stop_event);
+	os_atomic_set_bool(&sq->active, false);
+	return NULL;
+}
+
+static inline bool reset_semaphore(struct send_queue *sq)
+{
+	os_sem_destroy(sq->send_sem);
+	return os_sem_init(&sq->send_sem, 0) == 0;
+}
+
+bool send_queue_start(struct send_queue *sq)
+{
+	reset_semaphore(sq);
+
+	if (pthread_create(&sq->send_thread, NULL, send_thread, sq) != 0)
+		return false;
+
+	os_atomic_set_bool(&sq->active, true);
+	return true;
+}
+
+void send_queue_stop(struct send_queue *sq)
+{
+	os_event_signal(sq->stop_event);
+
+	if (send_queue_active(sq)) {
+		os_sem_post(sq->send_sem);
+		obs_output_end_data_capture(sq->output);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline void add_packet(struct send_queue *sq,
+		struct encoder_packet *packet)
+{
+	circlebuf_push_back(&sq->packets, packet,
+			sizeof(struct encoder_packet));
+	sq->last_dts_usec = packet->dts_usec;
+}
+
+static void drop_frames(struct send_queue *sq)
+{
+	struct circlebuf new_buf            = {0};
+	int              drop_priority      = 0;
+	int64_t          last_drop_dts_usec = 0;
+	int              num_frames_dropped = 0;
+
+	debug("Previous packet count: %d", (int)num_buffered_packets(sq));
+
+	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+
+	while (sq->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&sq->packets, &packet, sizeof(packet));
+
+		last_drop_dts_usec = packet.dts_usec;
+
+		/* do not drop audio data or video keyframes */
+		if (packet.type          == OBS_ENCODER_AUDIO ||
+		    packet.drop_priority == OBS_NAL_PRIORITY_HIGHEST) {
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+
+		} else {
+			if (drop_priority < packet.drop_priority)
+				drop_priority = packet.drop_priority;
+
+			num_frames_dropped++;
+			obs_encoder_packet_release(&packet);
+		}
+	}
+
+	circlebuf_free(&sq->packets);
+	sq->packets           = new_buf;
+	sq->min_priority      = drop_priority;
+	sq->min_drop_dts_usec = last_drop_dts_usec;
+
+	sq->dropped_frames += num_frames_dropped;
+	metric_add(sq->dropped_frames_metric, num_frames_dropped);
+	debug("New packet count: %d", (int)num_buffered_packets(sq));
+}
+
+static void check_to_drop_frames(struct send_queue *sq)
+{
+	struct encoder_packet first;
+	int64_t buffer_duration_usec;
+
+	if (num_buffered_packets(sq) < 5)
+		return;
+
+	circlebuf_peek_front(&sq->packets, &first, sizeof(first));
+
+	/* do not drop frames if frames were just dropped within this time */
+	if (first.dts_usec < sq->min_drop_dts_usec)
+		return;
+
+	/* if the amount of time stored in the buffered packets waiting to be
+	 * sent is higher than threshold, drop frames */
+	buffer_duration_usec = sq->last_dts_usec - first.dts_usec;
+
+	if (buffer_duration_usec > sq->drop_threshold_usec) {
+		drop_frames(sq);
+		debug("dropping %" PRId64 " worth of frames",
+				buffer_duration_usec);
+	}
+}
+
+static bool add_video_packet(struct send_queue *sq,
+		struct encoder_packet *packet)
+{
+	check_to_drop_frames(sq);
+
+	/* if currently dropping frames, drop packets until it reaches the
+	 * desired priority */
+	if (packet->priority < sq->min_priority) {
+		sq->dropped_frames++;
+		metric_add(sq->dropped_frames_metric, 1);
+		return false;
+	} else {
+		sq->min_priority = 0;
+	}
+
+	add_packet(sq, packet);
+	return true;
+}
+
+void send_queue_add(struct send_queue *sq, struct encoder_packet *packet)
+{
+	bool added_packet = false;
+
+	pthread_mutex_lock(&sq->packets_mutex);
+
+	if (!send_queue_disconnected(sq)) {
+		if (packet->type == OBS_ENCODER_VIDEO) {
+			added_packet = add_video_packet(sq, packet);
+		} else {
+			add_packet(sq, packet);
+			added_packet = true;
+		}
+		metric_set(sq->queue_metric, (int64_t)num_buffered_packets(sq));
+	}
+
+	pthread_mutex_unlock(&sq->packets_mutex);
+
+	if (added_packet)
+		os_sem_post(sq->send_sem);
+	else
+		obs_encoder_packet_release(packet);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int64_t send_queue_duration_usec(struct send_queue *sq)
+{
+	struct encoder_packet first;
+	int64_t duration = 0;
+
+	pthread_mutex_lock(&sq->packets_mutex);
+	if (sq->packets.size) {
+		circlebuf_peek_front(&sq->packets, &first, sizeof(first));
+		duration = sq->last_dts_usec - first.dts_usec;
+	}
+	pthread_mutex_unlock(&sq->packets_mutex);
+
+	return duration;
+}
+
+uint64_t send_queue_memory(struct send_queue *sq)
+{
+	uint64_t total = 0;
+
+	pthread_mutex_lock(&sq->packets_mutex);
+	for (size_t i = 0; i < num_buffered_packets(sq); i++) {
+		struct encoder_packet *packet = circlebuf_data(&sq->packets,
+				i * sizeof(struct encoder_packet));
+		total += packet->size;
+	}
+	pthread_mutex_unlock(&sq->packets_mutex);
+
+	return total;
+}
@@ -0,0 +1,113 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <obs-module.h>
+#include <util/circlebuf.h>
+#include <util/metrics.h>
+#include <util/threading.h>
+
+/*
+ * Packet queue and send thread shared by the stream outputs.
+ *
+ *   Encoded packets are queued with send_queue_add() from the output's
+ *   encoded_packet callback, and sent in order from the send thread through
+ *   the output's send_packet callback.  When the queued packets span more
+ *   than the drop threshold, video that isn't a keyframe is dropped by
+ *   priority, and new video is dropped until a frame of that priority
+ *   arrives.
+ */
+
+struct send_queue_info {
+	/* used to prefix log messages and to name the send thread */
+	const char *log_name;
+	const char *thread_name;
+
+	/* sends a packet from the send thread and releases it, returns false
+	 * if the connection was lost */
+	bool (*send_packet)(void *param, struct encoder_packet *packet);
+
+	/* closes the connection once the send thread is done sending */
+	void (*close)(void *param, bool disconnected);
+};
+
+struct send_queue {
+	obs_output_t     *output;
+	const struct send_queue_info *info;
+	void             *param;
+
+	pthread_mutex_t  packets_mutex;
+	struct circlebuf packets;
+
+	volatile bool    active;
+	volatile bool    disconnected;
+	pthread_t        send_thread;
+
+	int              max_shutdown_time_sec;
+
+	os_sem_t         *send_sem;
+	os_event_t       *stop_event;
+
+	/* frame drop variables */
+	int64_t          drop_threshold_usec;
+	int64_t          min_drop_dts_usec;
+	int              min_priority;
+
+	int64_t          last_dts_usec;
+	int              dropped_frames;
+
+	/* optional, owned by the output */
+	metric_t         *queue_metric;
+	metric_t         *dropped_frames_metric;
+};
+
+extern bool send_queue_init(struct send_queue *sq, obs_output_t *output,
+		const struct send_queue_info *info, void *param);
+extern void send_queue_free(struct send_queue *sq);
+
+/* clears the queue and the drop state before connecting */
+extern void send_queue_reset(struct send_queue *sq);
+extern void send_queue_free_packets(struct send_queue *sq);
+
+/* starts the send thread once connected */
+extern bool send_queue_start(struct send_queue *sq);
+
+/* signals the send thread to send what's left and stop */
+extern void send_queue_stop(struct send_queue *sq);
+
+/* queues a referenced packet, or releases it if it was dropped */
+extern void send_queue_add(struct send_queue *sq,
+		struct encoder_packet *packet);
+
+extern int64_t send_queue_duration_usec(struct send_queue *sq);
+extern uint64_t send_queue_memory(struct send_queue *sq);
+
+static inline bool send_queue_stopping(struct send_queue *sq)
+{
+	return os_event_try(sq->stop_event) != EAGAIN;
+}
+
+static inline bool send_queue_active(struct send_queue *sq)
+{
+	return os_atomic_load_bool(&sq->active);
+}
+
+static inline bool send_queue_disconnected(struct send_queue *sq)
+{
+	return os_atomic_load_bool(&sq->disconnected);
+}
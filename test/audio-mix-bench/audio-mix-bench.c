@@ -0,0 +1,176 @@
+/*
+ * Compares the old scalar audio mixing loop against mix_audio_floats() with
+ * unrouted mixes skipped, using the same buffer layout as obs-audio.c.
+ *
+ *   audio-mix-bench [sources] [iterations]
+ *
+ * Returns non-zero if the two mixes differ.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+#include <media-io/audio-math.h>
+
+#define CHANNELS 2
+
+struct bench_source {
+	float    *buf;
+	float    *data[MAX_AUDIO_MIXES][MAX_AUDIO_CHANNELS];
+	uint32_t mixers;
+	size_t   start_point;
+};
+
+static void init_source(struct bench_source *src, size_t idx)
+{
+	uint32_t seed = (uint32_t)idx * 7919 + 1;
+
+	src->buf = bzalloc(sizeof(float) * AUDIO_OUTPUT_FRAMES *
+			MAX_AUDIO_CHANNELS * MAX_AUDIO_MIXES);
+
+	/* most sources only go to one or two tracks, like a typical
+	 * multi-track recording setup */
+	src->mixers = 1 | (1 << (idx % MAX_AUDIO_MIXES));
+	src->start_point = (idx % 5 == 0) ? idx % AUDIO_OUTPUT_FRAMES : 0;
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++) {
+			float *data = src->buf + (mix * MAX_AUDIO_CHANNELS +
+					ch) * AUDIO_OUTPUT_FRAMES;
+			src->data[mix][ch] = data;
+
+			/* unrouted mixes are silent, as obs-source.c leaves
+			 * them */
+			if ((src->mixers & (1 << mix)) == 0)
+				continue;
+
+			for (size_t i = 0; i < AUDIO_OUTPUT_FRAMES; i++) {
+				seed = seed * 1664525 + 1013904223;
+				data[i] = (float)(int32_t)seed / 2147483648.0f;
+			}
+		}
+	}
+}
+
+static void mix_scalar(float *out[MAX_AUDIO_MIXES][CHANNELS],
+		const struct bench_source *src)
+{
+	size_t total_floats = AUDIO_OUTPUT_FRAMES - src->start_point;
+
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			register float *mix = out[mix_idx][ch];
+			register float *aud = src->data[mix_idx][ch];
+			register float *end;
+
+			mix += src->start_point;
+			end = aud + total_floats;
+
+			while (aud < end)
+				*(mix++) += *(aud++);
+		}
+	}
+}
+
+static void mix_simd(float *out[MAX_AUDIO_MIXES][CHANNELS],
+		const struct bench_source *src, uint32_t mixers)
+{
+	size_t total_floats = AUDIO_OUTPUT_FRAMES - src->start_point;
+
+	mixers &= src->mixers;
+
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		if ((mixers & (1 << mix_idx)) == 0)
+			continue;
+
+		for (size_t ch = 0; ch < CHANNELS; ch++)
+			mix_audio_floats(out[mix_idx][ch] + src->start_point,
+					src->data[mix_idx][ch], total_floats);
+	}
+}
+
+static void clear_output(float *out[MAX_AUDIO_MIXES][CHANNELS])
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < CHANNELS; ch++)
+			memset(out[mix][ch], 0,
+					sizeof(float) * AUDIO_OUTPUT_FRAMES);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_sources = argc > 1 ? (size_t)atoi(argv[1]) : 40;
+	int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+	uint32_t mixers = (1 << MAX_AUDIO_MIXES) - 1;
+	float *ref[MAX_AUDIO_MIXES][CHANNELS];
+	float *out[MAX_AUDIO_MIXES][CHANNELS];
+	struct bench_source *sources;
+	uint64_t scalar_ns = 0, simd_ns = 0;
+	bool match = true;
+
+	if (!num_sources)
+		num_sources = 1;
+	if (iterations < 1)
+		iterations = 1;
+
+	sources = bzalloc(sizeof(*sources) * num_sources);
+	for (size_t i = 0; i < num_sources; i++)
+		init_source(&sources[i], i);
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			ref[mix][ch] = bmalloc(sizeof(float) *
+					AUDIO_OUTPUT_FRAMES);
+			out[mix][ch] = bmalloc(sizeof(float) *
+					AUDIO_OUTPUT_FRAMES);
+		}
+	}
+
+	for (int it = 0; it < iterations; it++) {
+		uint64_t t;
+
+		clear_output(ref);
+		t = os_gettime_ns();
+		for (size_t i = 0; i < num_sources; i++)
+			mix_scalar(ref, &sources[i]);
+		scalar_ns += os_gettime_ns() - t;
+
+		clear_output(out);
+		t = os_gettime_ns();
+		for (size_t i = 0; i < num_sources; i++)
+			mix_simd(out, &sources[i], mixers);
+		simd_ns += os_gettime_ns() - t;
+	}
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < CHANNELS; ch++)
+			if (memcmp(ref[mix][ch], out[mix][ch],
+					sizeof(float) * AUDIO_OUTPUT_FRAMES))
+				match = false;
+
+	printf("%d sources, %d mixes, %d channels, %d frames per tick\n",
+			(int)num_sources, MAX_AUDIO_MIXES, CHANNELS,
+			AUDIO_OUTPUT_FRAMES);
+	printf("scalar loop:      %8.2f us per tick\n",
+			(double)scalar_ns / iterations / 1000.0);
+	printf("mix_audio_floats: %8.2f us per tick (%.2fx)\n",
+			(double)simd_ns / iterations / 1000.0,
+			(double)scalar_ns / (double)simd_ns);
+	printf("%s\n", match ? "output matches" : "output MISMATCH");
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			bfree(ref[mix][ch]);
+			bfree(out[mix][ch]);
+		}
+	}
+	for (size_t i = 0; i < num_sources; i++)
+		bfree(sources[i].buf);
+	bfree(sources);
+
+	return match ? 0 : 1;
+}
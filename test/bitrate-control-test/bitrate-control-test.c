@@ -0,0 +1,233 @@
+/*
+ * Runs the rtmp-stream bitrate controller against a simulated link.  Time is
+ * simulated in 1 ms steps, so the test is deterministic and runs instantly:
+ * a producer queues 30 fps "frames" at the controller's current bitrate, a
+ * sender writes them into a socket buffer the way rtmp-stream does, blocking
+ * while it is full, and the link drains the socket buffer at a rate that
+ * changes during the test:
+ *
+ *   1. link above the start bitrate, the bitrate must not drop
+ *   2. link throttled below the start bitrate, the bitrate must average
+ *      below the link rate once it has settled, and the send buffer must
+ *      stay under the drop threshold
+ *   3. link restored, the bitrate must climb back up
+ *
+ * Returns non-zero if any phase fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+
+#include "test-check.h"
+#include "bitrate-control.h"
+
+#define FPS                  30
+#define START_KBPS           4000
+#define FAST_LINK_KBPS       8000
+#define SLOW_LINK_KBPS       1500
+#define DROP_THRESHOLD_USEC  600000
+#define SOCKET_BUF_SIZE      16384
+#define STEP_NS              1000000ULL
+
+struct frame {
+	size_t  size;
+	int64_t dts_usec;
+};
+
+struct test {
+	uint64_t               now_ns;
+
+	int                    link_kbps;
+	int                    bitrate_kbps;
+	double                 socket_bytes;
+
+	/* producer */
+	struct circlebuf       frames;
+	int64_t                last_dts_usec;
+	uint64_t               next_frame_ns;
+
+	/* sender, blocked in a write until send_end_ns */
+	bool                   sending;
+	size_t                 send_size;
+	uint64_t               send_start_ns;
+	uint64_t               send_end_ns;
+
+	struct bitrate_control bc;
+	int64_t                max_buffer_usec;
+	int                    changes;
+
+	/* for the average bitrate of a phase */
+	double                 kbps_sum;
+	uint64_t               steps;
+};
+
+static inline double elapsed_sec(const struct test *test)
+{
+	return (double)test->now_ns / 1000000000.0;
+}
+
+static inline double link_bytes_per_ns(const struct test *test)
+{
+	return (double)test->link_kbps * 1000.0 / 8.0 / 1000000000.0;
+}
+
+static void produce_frame(struct test *test)
+{
+	struct frame frame;
+
+	frame.size     = (size_t)test->bitrate_kbps * 1000 / 8 / FPS;
+	frame.dts_usec = (int64_t)(test->next_frame_ns / 1000);
+
+	circlebuf_push_back(&test->frames, &frame, sizeof(frame));
+	test->last_dts_usec = frame.dts_usec;
+
+	/* same last resort as rtmp-stream's frame dropping */
+	if (test->frames.size > sizeof(frame)) {
+		struct frame first;
+		circlebuf_peek_front(&test->frames, &first, sizeof(first));
+		if (frame.dts_usec - first.dts_usec > DROP_THRESHOLD_USEC * 2)
+			circlebuf_pop_front(&test->frames, NULL,
+					test->frames.size - sizeof(frame));
+	}
+
+	test->next_frame_ns += 1000000000ULL / FPS;
+}
+
+static int64_t buffer_duration_usec(struct test *test)
+{
+	struct frame first;
+
+	if (!test->frames.size)
+		return 0;
+
+	circlebuf_peek_front(&test->frames, &first, sizeof(first));
+	return test->last_dts_usec - first.dts_usec;
+}
+
+/* a write that doesn't fit in the socket buffer blocks until the link has
+ * drained enough of it */
+static void start_send(struct test *test)
+{
+	struct frame frame;
+	double overflow;
+
+	circlebuf_pop_front(&test->frames, &frame, sizeof(frame));
+
+	overflow = test->socket_bytes + (double)frame.size - SOCKET_BUF_SIZE;
+
+	test->sending       = true;
+	test->send_size     = frame.size;
+	test->send_start_ns = test->now_ns;
+	test->send_end_ns   = test->now_ns;
+	if (overflow > 0.0)
+		test->send_end_ns += (uint64_t)(overflow /
+				link_bytes_per_ns(test));
+
+	test->socket_bytes += (double)frame.size;
+}
+
+static void finish_send(struct test *test)
+{
+	int64_t buffer_usec;
+	int kbps;
+
+	test->sending = false;
+	bitrate_control_sent(&test->bc, test->send_size,
+			test->now_ns - test->send_start_ns);
+
+	buffer_usec = buffer_duration_usec(test);
+	if (buffer_usec > test->max_buffer_usec)
+		test->max_buffer_usec = buffer_usec;
+
+	kbps = bitrate_control_update(&test->bc, buffer_usec, test->now_ns);
+	if (kbps) {
+		printf("%6.2fs  link %5d kbps  bitrate %5d kbps  "
+		       "throughput %5d kbps  buffered %4d ms\n",
+		       elapsed_sec(test), test->link_kbps, kbps,
+		       (int)test->bc.throughput_kbps,
+		       (int)(buffer_usec / 1000));
+		test->bitrate_kbps = kbps;
+		test->changes++;
+	}
+}
+
+static void step(struct test *test)
+{
+	test->now_ns += STEP_NS;
+	test->kbps_sum += (double)test->bitrate_kbps;
+	test->steps++;
+
+	test->socket_bytes -= link_bytes_per_ns(test) * (double)STEP_NS;
+	if (test->socket_bytes < 0.0)
+		test->socket_bytes = 0.0;
+
+	while (test->now_ns >= test->next_frame_ns)
+		produce_frame(test);
+
+	if (test->sending && test->now_ns >= test->send_end_ns)
+		finish_send(test);
+	if (!test->sending && test->frames.size)
+		start_send(test);
+}
+
+static inline int average_kbps(const struct test *test)
+{
+	return test->steps ? (int)(test->kbps_sum / (double)test->steps) : 0;
+}
+
+static void run_phase(struct test *test, const char *name, int link_kbps,
+		int seconds)
+{
+	uint64_t end_ns = test->now_ns + (uint64_t)seconds * 1000000000ULL;
+
+	printf("%6.2fs  -- %s: link %d kbps for %d s\n", elapsed_sec(test),
+			name, link_kbps, seconds);
+
+	test->link_kbps = link_kbps;
+	test->kbps_sum  = 0.0;
+	test->steps     = 0;
+	while (test->now_ns < end_ns)
+		step(test);
+}
+
+int main(int argc, char *argv[])
+{
+	struct test test;
+	bool success = true;
+
+	UNUSED_PARAMETER(argc);
+	UNUSED_PARAMETER(argv);
+
+	memset(&test, 0, sizeof(test));
+	test.link_kbps    = FAST_LINK_KBPS;
+	test.bitrate_kbps = START_KBPS;
+
+	bitrate_control_init(&test.bc, START_KBPS, START_KBPS / 5,
+			DROP_THRESHOLD_USEC / 2, test.now_ns);
+
+	run_phase(&test, "fast link", FAST_LINK_KBPS, 5);
+	success &= test_check(test.changes == 0,
+			"bitrate unchanged while the link keeps up");
+
+	run_phase(&test, "throttled link", SLOW_LINK_KBPS, 7);
+	test.max_buffer_usec = 0;
+	run_phase(&test, "throttled link (settled)", SLOW_LINK_KBPS, 5);
+	printf("        average bitrate %d kbps, max buffered %d ms\n",
+			average_kbps(&test),
+			(int)(test.max_buffer_usec / 1000));
+	success &= test_check(average_kbps(&test) < SLOW_LINK_KBPS,
+			"bitrate lowered below the throttled link rate");
+	success &= test_check(test.max_buffer_usec < DROP_THRESHOLD_USEC,
+			"buffer stays under the drop threshold once settled");
+
+	run_phase(&test, "restored link", FAST_LINK_KBPS, 20);
+	printf("        bitrate %d kbps\n", test.bitrate_kbps);
+	success &= test_check(test.bitrate_kbps >= SLOW_LINK_KBPS * 2,
+			"bitrate raised again after the link recovered");
+
+	circlebuf_free(&test.frames);
+	return test_result(success);
+}
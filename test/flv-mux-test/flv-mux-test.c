@@ -0,0 +1,259 @@
+/*
+ * Checks that the allocation-free FLV tag writers produce the same bytes as
+ * the serializer based muxer:
+ *
+ *   1. flv_packet_header + data + flv_packet_footer against flv_packet_mux,
+ *      as written by flv-output
+ *   2. RTMP_WriteTag against flv_packet_mux + RTMP_Write, as sent by
+ *      rtmp-stream, captured from a socket pair for several chunk sizes
+ *
+ * Returns non-zero if any output differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/threading.h>
+
+#include "test-check.h"
+#include "flv-mux.h"
+#include "librtmp/rtmp.h"
+
+#define NUM_PACKETS 600
+
+struct test_packet {
+	struct encoder_packet packet;
+	bool                  is_header;
+};
+
+struct capture {
+	int                   sock;
+	pthread_t             thread;
+	DARRAY(uint8_t)       bytes;
+};
+
+static uint32_t seed = 1;
+
+static inline uint32_t rand_u32(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+static void fill_packet(struct test_packet *tp, size_t idx)
+{
+	struct encoder_packet *packet = &tp->packet;
+	bool video = idx % 3 == 0;
+	int64_t ms = (int64_t)idx * 11;
+
+	memset(tp, 0, sizeof(*tp));
+
+	/* the last packets go past 0xffffff ms to cover the extended
+	 * timestamp fields */
+	if (idx >= NUM_PACKETS - 20)
+		ms += 0x1000000LL;
+
+	packet->type         = video ? OBS_ENCODER_VIDEO : OBS_ENCODER_AUDIO;
+	packet->timebase_num = 1;
+	packet->timebase_den = 1000;
+	packet->dts          = idx < 3 ? 0 : ms;
+	packet->pts          = packet->dts + (video ? (idx % 2) * 33 : 0);
+	packet->keyframe     = video && idx % 120 == 0;
+	tp->is_header        = idx < 2;
+
+	/* an empty packet is skipped by both muxers */
+	if (idx == 50)
+		return;
+
+	if (!video)
+		packet->size = 300 + rand_u32() % 200;
+	else if (packet->keyframe)
+		packet->size = 150000 + rand_u32() % 50000;
+	else
+		packet->size = 1 + rand_u32() % 30000;
+
+	/* same size as the previous audio packet to hit the header
+	 * compression paths */
+	if (!video && idx % 7 == 0)
+		packet->size = 400;
+
+	packet->data = bmalloc(packet->size);
+	for (size_t i = 0; i < packet->size; i++)
+		packet->data[i] = (uint8_t)rand_u32();
+}
+
+static bool compare(const char *name, const uint8_t *a, size_t a_size,
+		const uint8_t *b, size_t b_size)
+{
+	size_t size = a_size < b_size ? a_size : b_size;
+
+	for (size_t i = 0; i < size; i++) {
+		if (a[i] != b[i])
+			return test_check(false, "%s: byte %u differs", name,
+					(unsigned)i);
+	}
+
+	if (a_size != b_size)
+		return test_check(false, "%s: %u bytes vs %u bytes", name,
+				(unsigned)a_size, (unsigned)b_size);
+
+	return test_check(true, "%s (%u bytes)", name, (unsigned)a_size);
+}
+
+static bool test_file_tags(struct test_packet *packets)
+{
+	DARRAY(uint8_t) old_bytes = {0};
+	DARRAY(uint8_t) new_bytes = {0};
+	bool success;
+
+	for (size_t i = 0; i < NUM_PACKETS; i++) {
+		struct encoder_packet *packet = &packets[i].packet;
+		uint8_t header[FLV_TAG_HEADER_MAX_SIZE];
+		uint8_t footer[FLV_TAG_FOOTER_SIZE];
+		size_t header_size;
+		uint8_t *data;
+		size_t size;
+
+		flv_packet_mux(packet, &data, &size, packets[i].is_header);
+		if (size)
+			da_push_back_array(old_bytes, data, size);
+		bfree(data);
+
+		header_size = flv_packet_header(packet, packets[i].is_header,
+				header);
+		if (header_size) {
+			flv_packet_footer(header_size, packet->size, footer);
+			da_push_back_array(new_bytes, header, header_size);
+			da_push_back_array(new_bytes, packet->data,
+					packet->size);
+			da_push_back_array(new_bytes, footer, sizeof(footer));
+		}
+	}
+
+	success = compare("flv file tags", old_bytes.array, old_bytes.num,
+			new_bytes.array, new_bytes.num);
+
+	da_free(old_bytes);
+	da_free(new_bytes);
+	return success;
+}
+
+static void *capture_thread(void *data)
+{
+	struct capture *capture = data;
+	uint8_t buf[65536];
+	ssize_t ret;
+
+	while ((ret = recv(capture->sock, buf, sizeof(buf), 0)) > 0)
+		da_push_back_array(capture->bytes, buf, (size_t)ret);
+
+	return NULL;
+}
+
+static bool open_capture(RTMP *rtmp, struct capture *capture, int chunk_size)
+{
+	int socks[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) != 0)
+		return false;
+
+	RTMP_Init(rtmp);
+	rtmp->m_sb.sb_socket      = socks[0];
+	rtmp->m_outChunkSize      = chunk_size;
+	rtmp->Link.nStreams       = 1;
+	rtmp->Link.streams[0].id  = 1;
+
+	memset(capture, 0, sizeof(*capture));
+	capture->sock = socks[1];
+	pthread_create(&capture->thread, NULL, capture_thread, capture);
+	return true;
+}
+
+static void close_capture(RTMP *rtmp, struct capture *capture)
+{
+	/* no stream ids, so closing doesn't send anything */
+	rtmp->Link.streams[0].id = 0;
+	RTMP_Close(rtmp);
+
+	pthread_join(capture->thread, NULL);
+	close(capture->sock);
+}
+
+static bool test_rtmp_chunks(struct test_packet *packets, int chunk_size)
+{
+	struct capture old_capture, new_capture;
+	RTMP old_rtmp, new_rtmp;
+	char name[64];
+	bool success = true;
+
+	if (!open_capture(&old_rtmp, &old_capture, chunk_size) ||
+	    !open_capture(&new_rtmp, &new_capture, chunk_size)) {
+		return test_check(false, "could not open socket pairs");
+	}
+
+	for (size_t i = 0; i < NUM_PACKETS; i++) {
+		struct encoder_packet *packet = &packets[i].packet;
+		uint8_t header[FLV_TAG_HEADER_MAX_SIZE];
+		size_t header_size;
+		uint8_t *data;
+		size_t size;
+
+		flv_packet_mux(packet, &data, &size, packets[i].is_header);
+		if (RTMP_Write(&old_rtmp, (char*)data, (int)size, 0) < 0)
+			success = false;
+		bfree(data);
+
+		header_size = flv_packet_header(packet, packets[i].is_header,
+				header);
+		if (header_size && !RTMP_WriteTag(&new_rtmp, (char*)header,
+					(int)header_size, (char*)packet->data,
+					(int)packet->size, 0))
+			success = false;
+	}
+
+	close_capture(&old_rtmp, &old_capture);
+	close_capture(&new_rtmp, &new_capture);
+
+	snprintf(name, sizeof(name), "rtmp chunks, chunk size %d", chunk_size);
+	if (!success)
+		test_check(false, "%s: write failed", name);
+	else
+		success = compare(name, old_capture.bytes.array,
+				old_capture.bytes.num,
+				new_capture.bytes.array,
+				new_capture.bytes.num);
+
+	da_free(old_capture.bytes);
+	da_free(new_capture.bytes);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_packet *packets;
+	bool success = true;
+
+	UNUSED_PARAMETER(argc);
+	UNUSED_PARAMETER(argv);
+
+	packets = bmalloc(sizeof(*packets) * NUM_PACKETS);
+	for (size_t i = 0; i < NUM_PACKETS; i++)
+		fill_packet(&packets[i], i);
+
+	success &= test_file_tags(packets);
+	success &= test_rtmp_chunks(packets, RTMP_DEFAULT_CHUNKSIZE);
+	success &= test_rtmp_chunks(packets, 4096);
+	success &= test_rtmp_chunks(packets, 1000);
+
+	for (size_t i = 0; i < NUM_PACKETS; i++)
+		bfree(packets[i].packet.data);
+	bfree(packets);
+
+	return test_result(success);
+}
@@ -0,0 +1,265 @@
+/*
+ * Benchmarks the CPU format conversion kernels, and checks that every
+ * instruction set (and the threaded mode) matches the scalar reference.
+ *
+ *   format-conversion-bench [iterations]
+ *
+ * Returns non-zero if any kernel produced different output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/format-conversion.h>
+
+enum kernel {
+	KERNEL_I420,
+	KERNEL_NV12,
+	KERNEL_I444,
+	KERNEL_DECOMPRESS_420,
+	KERNEL_DECOMPRESS_NV12,
+	KERNEL_DECOMPRESS_422,
+	KERNEL_COUNT
+};
+
+static const char *kernel_names[KERNEL_COUNT] = {
+	"uyvx_to_i420",
+	"uyvx_to_nv12",
+	"uyvx_to_i444",
+	"decompress_420",
+	"decompress_nv12",
+	"decompress_422"
+};
+
+struct frame {
+	uint32_t width, height;
+
+	/* packed 444 input/output */
+	uint8_t  *packed;
+	uint32_t packed_linesize;
+
+	/* planar input/output, sized for 444 */
+	uint8_t  *planes[3];
+	uint32_t linesizes[3];
+
+	size_t   packed_size;
+	size_t   plane_size;
+};
+
+static void frame_init(struct frame *f, uint32_t width, uint32_t height)
+{
+	f->width           = width;
+	f->height          = height;
+	f->packed_linesize = width * 4;
+	f->packed_size     = (size_t)f->packed_linesize * height;
+	f->plane_size      = (size_t)width * height;
+	f->packed          = bzalloc(f->packed_size);
+
+	for (size_t i = 0; i < 3; i++) {
+		f->planes[i]    = bzalloc(f->plane_size);
+		f->linesizes[i] = width;
+	}
+}
+
+static void frame_free(struct frame *f)
+{
+	bfree(f->packed);
+	for (size_t i = 0; i < 3; i++)
+		bfree(f->planes[i]);
+}
+
+static void frame_clear(struct frame *f)
+{
+	memset(f->packed, 0, f->packed_size);
+	for (size_t i = 0; i < 3; i++)
+		memset(f->planes[i], 0, f->plane_size);
+}
+
+static void fill_random(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1664525 + 1013904223;
+		data[i] = (uint8_t)(seed >> 24);
+	}
+}
+
+static void fill_input(struct frame *in)
+{
+	fill_random(in->packed, in->packed_size, 1);
+	for (size_t i = 0; i < 3; i++)
+		fill_random(in->planes[i], in->plane_size, 2 + (uint32_t)i);
+}
+
+/* the planar sources are laid out per kernel: 420 has half size chroma
+ * planes, nv12 has a single interleaved chroma plane */
+static void run_kernel(enum kernel k, struct frame *in, struct frame *out)
+{
+	uint32_t in_ls[3];
+	uint32_t out_ls[3];
+	uint32_t h = in->height;
+
+	switch (k) {
+	case KERNEL_I420:
+		out_ls[0] = out->width;
+		out_ls[1] = out_ls[2] = out->width / 2;
+		compress_uyvx_to_i420(in->packed, in->packed_linesize, 0, h,
+				out->planes, out_ls);
+		break;
+	case KERNEL_NV12:
+		out_ls[0] = out_ls[1] = out->width;
+		compress_uyvx_to_nv12(in->packed, in->packed_linesize, 0, h,
+				out->planes, out_ls);
+		break;
+	case KERNEL_I444:
+		out_ls[0] = out_ls[1] = out_ls[2] = out->width;
+		convert_uyvx_to_i444(in->packed, in->packed_linesize, 0, h,
+				out->planes, out_ls);
+		break;
+	case KERNEL_DECOMPRESS_420:
+		in_ls[0] = in->width;
+		in_ls[1] = in_ls[2] = in->width / 2;
+		decompress_420((const uint8_t *const *)in->planes, in_ls, 0, h,
+				out->packed, out->packed_linesize);
+		break;
+	case KERNEL_DECOMPRESS_NV12:
+		in_ls[0] = in_ls[1] = in->width;
+		decompress_nv12((const uint8_t *const *)in->planes, in_ls,
+				0, h, out->packed, out->packed_linesize);
+		break;
+	case KERNEL_DECOMPRESS_422:
+		decompress_422(in->packed, in->width * 2, 0, h,
+				out->packed, out->packed_linesize,
+				(h & 2) != 0);
+		break;
+	case KERNEL_COUNT:
+		break;
+	}
+}
+
+/* bytes read plus bytes written for one frame, used for the MB/s figure */
+static size_t kernel_bytes(enum kernel k, const struct frame *f)
+{
+	size_t px = (size_t)f->width * f->height;
+
+	switch (k) {
+	case KERNEL_I420:
+	case KERNEL_NV12:            return px * 4 + px * 3 / 2;
+	case KERNEL_I444:            return px * 4 + px * 3;
+	case KERNEL_DECOMPRESS_420:
+	case KERNEL_DECOMPRESS_NV12: return px * 3 / 2 + px * 4;
+	case KERNEL_DECOMPRESS_422:  return px * 2 + px * 4;
+	case KERNEL_COUNT:           break;
+	}
+
+	return 0;
+}
+
+static bool frames_equal(const struct frame *a, const struct frame *b)
+{
+	if (memcmp(a->packed, b->packed, a->packed_size) != 0)
+		return false;
+	for (size_t i = 0; i < 3; i++)
+		if (memcmp(a->planes[i], b->planes[i], a->plane_size) != 0)
+			return false;
+	return true;
+}
+
+/* runs one kernel with the current settings, checks it against the reference
+ * and prints its throughput */
+static bool bench_kernel(enum kernel k, struct frame *in,
+		const struct frame *ref, struct frame *out,
+		int iterations)
+{
+	enum format_conversion_isa isa = format_conversion_get_isa();
+	uint32_t threads = format_conversion_get_threads();
+	uint64_t start, elapsed;
+	double mbps;
+	bool match;
+
+	frame_clear(out);
+	run_kernel(k, in, out);
+	match = frames_equal(ref, out);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < iterations; i++)
+		run_kernel(k, in, out);
+	elapsed = os_gettime_ns() - start;
+
+	mbps = (double)kernel_bytes(k, in) * iterations /
+		((double)elapsed / 1000000000.0) / 1000000.0;
+
+	printf("%-16s %-8s %7u %10.1f %s\n", kernel_names[k],
+			format_conversion_isa_name(isa), threads, mbps,
+			match ? "ok" : "MISMATCH");
+	return match;
+}
+
+static bool bench_size(uint32_t width, uint32_t height, int iterations)
+{
+	struct frame in, ref, out;
+	enum format_conversion_isa best;
+	bool success = true;
+
+	frame_init(&in,  width, height);
+	frame_init(&ref, width, height);
+	frame_init(&out, width, height);
+	fill_input(&in);
+
+	best = format_conversion_set_isa(FORMAT_CONVERSION_ISA_AUTO);
+
+	printf("\n%ux%u\n", width, height);
+	printf("%-16s %-8s %7s %10s %s\n",
+			"kernel", "isa", "threads", "MB/s", "result");
+
+	for (int k = 0; k < KERNEL_COUNT; k++) {
+		format_conversion_set_threads(1);
+		format_conversion_set_isa(FORMAT_CONVERSION_ISA_C);
+		frame_clear(&ref);
+		run_kernel(k, &in, &ref);
+
+		for (int isa = FORMAT_CONVERSION_ISA_C; isa <= (int)best;
+				isa++) {
+			format_conversion_set_isa(isa);
+			success &= bench_kernel(k, &in, &ref, &out, iterations);
+		}
+
+		/* frames below the slicing threshold are always converted on
+		 * the calling thread, so only the larger sizes show a gain.
+		 * always use at least two threads so slicing gets checked
+		 * even on single core machines */
+		format_conversion_set_threads(0);
+		if (format_conversion_get_threads() < 2)
+			format_conversion_set_threads(2);
+		success &= bench_kernel(k, &in, &ref, &out, iterations);
+	}
+
+	format_conversion_set_isa(FORMAT_CONVERSION_ISA_AUTO);
+	format_conversion_set_threads(0);
+
+	frame_free(&in);
+	frame_free(&ref);
+	frame_free(&out);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 20;
+	bool success = true;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	/* 1284 is not a multiple of the vector block sizes, so the scalar
+	 * tails are checked too */
+	success &= bench_size(1284, 720,  iterations);
+	success &= bench_size(1920, 1080, iterations);
+	success &= bench_size(3840, 2160, iterations);
+
+	printf("\n%s\n", success ? "all kernels match the reference" :
+			"kernel output MISMATCH");
+	return success ? 0 : 1;
+}
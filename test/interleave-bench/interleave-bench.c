@@ -0,0 +1,209 @@
+/*
+ * Compares the old sorted-array interleaver of obs-output.c against the
+ * per-track heap merge in obs-interleave.c.  A synthetic stream of 60 fps
+ * video and one packet stream per audio mix is fed to both in arrival order,
+ * with the video arriving late the way it does from an encoder with
+ * lookahead, while the output holds 'backlog' packets before sending, like a
+ * stalled or delayed output does.
+ *
+ *   interleave-bench [seconds] [backlog]
+ *
+ * Returns non-zero if the two interleavers send packets in different orders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <obs-interleave.h>
+
+#define VIDEO_FPS           60
+#define AUDIO_FRAMES        1024
+#define SAMPLE_RATE         48000
+#define VIDEO_LATENCY_USEC  100000
+#define AUDIO_LATENCY_USEC  20000
+
+struct arrival {
+	struct encoder_packet packet;
+	int64_t               arrival_usec;
+};
+
+static int compare_arrivals(const void *a, const void *b)
+{
+	const struct arrival *aa = a;
+	const struct arrival *ab = b;
+
+	if (aa->arrival_usec != ab->arrival_usec)
+		return aa->arrival_usec < ab->arrival_usec ? -1 : 1;
+	if (aa->packet.type != ab->packet.type)
+		return aa->packet.type == OBS_ENCODER_VIDEO ? -1 : 1;
+	return (int)aa->packet.track_idx - (int)ab->packet.track_idx;
+}
+
+static void add_packet(struct arrival *arrival, enum obs_encoder_type type,
+		size_t track, int64_t dts, int32_t num, int32_t den,
+		int64_t latency_usec)
+{
+	struct encoder_packet *packet = &arrival->packet;
+
+	memset(arrival, 0, sizeof(*arrival));
+	packet->type         = type;
+	packet->track_idx    = track;
+	packet->dts          = dts;
+	packet->pts          = dts;
+	packet->timebase_num = num;
+	packet->timebase_den = den;
+	packet->size         = type == OBS_ENCODER_VIDEO ? 20000 : 400;
+	packet->keyframe     = type == OBS_ENCODER_VIDEO && dts % 120 == 0;
+	packet->dts_usec     = dts * num * 1000000LL / den;
+
+	arrival->arrival_usec = packet->dts_usec + latency_usec;
+}
+
+static struct arrival *generate_stream(int seconds, size_t *count)
+{
+	size_t video_count = (size_t)seconds * VIDEO_FPS;
+	size_t audio_count = (size_t)seconds * SAMPLE_RATE / AUDIO_FRAMES;
+	size_t total = video_count + audio_count * MAX_AUDIO_MIXES;
+	struct arrival *stream = bmalloc(sizeof(*stream) * total);
+	size_t idx = 0;
+
+	for (size_t i = 0; i < video_count; i++)
+		add_packet(&stream[idx++], OBS_ENCODER_VIDEO, 0, (int64_t)i,
+				1, VIDEO_FPS, VIDEO_LATENCY_USEC);
+
+	/* each mix comes from its own encoder, offset slightly so the tracks
+	 * don't all land on the same timestamps */
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t i = 0; i < audio_count; i++)
+			add_packet(&stream[idx++], OBS_ENCODER_AUDIO, mix,
+					(int64_t)(i * AUDIO_FRAMES + mix * 37),
+					1, SAMPLE_RATE,
+					AUDIO_LATENCY_USEC + (int64_t)mix * 500);
+	}
+
+	qsort(stream, total, sizeof(*stream), compare_arrivals);
+	*count = total;
+	return stream;
+}
+
+/* ------------------------------------------------------------------------- */
+/* the interleaver as obs-output.c used to implement it                      */
+
+static uint64_t run_old(const struct arrival *stream, size_t count,
+		size_t backlog, struct encoder_packet *sent)
+{
+	DARRAY(struct encoder_packet) packets = {0};
+	uint64_t start = os_gettime_ns();
+	size_t num_sent = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct encoder_packet packet = stream[i].packet;
+		size_t idx;
+
+		for (idx = 0; idx < packets.num; idx++) {
+			if (packet.dts_usec < packets.array[idx].dts_usec)
+				break;
+		}
+
+		da_insert(packets, idx, &packet);
+
+		if (packets.num > backlog) {
+			sent[num_sent++] = packets.array[0];
+			da_erase(packets, 0);
+		}
+	}
+
+	while (packets.num) {
+		sent[num_sent++] = packets.array[0];
+		da_erase(packets, 0);
+	}
+
+	start = os_gettime_ns() - start;
+	da_free(packets);
+	return start;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t run_heap(const struct arrival *stream, size_t count,
+		size_t backlog, struct encoder_packet *sent)
+{
+	struct interleave_queue queue = {0};
+	uint64_t start = os_gettime_ns();
+	size_t num_sent = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct encoder_packet packet = stream[i].packet;
+		interleave_push(&queue, &packet);
+
+		if (queue.num_packets > backlog)
+			interleave_pop(&queue, &sent[num_sent++]);
+	}
+
+	while (interleave_pop(&queue, &sent[num_sent]))
+		num_sent++;
+
+	start = os_gettime_ns() - start;
+	interleave_free(&queue);
+	return start;
+}
+
+static bool same_order(const struct encoder_packet *a,
+		const struct encoder_packet *b, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (a[i].type      != b[i].type ||
+		    a[i].track_idx != b[i].track_idx ||
+		    a[i].dts       != b[i].dts) {
+			printf("order differs at packet %u\n", (unsigned)i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 600;
+	size_t backlog = argc > 2 ? (size_t)atoi(argv[2]) : 2000;
+	struct encoder_packet *sent_old;
+	struct encoder_packet *sent_heap;
+	struct arrival *stream;
+	uint64_t old_ns, heap_ns;
+	size_t count;
+	bool success;
+
+	if (seconds <= 0)
+		seconds = 600;
+
+	stream    = generate_stream(seconds, &count);
+	sent_old  = bzalloc(sizeof(*sent_old) * count);
+	sent_heap = bzalloc(sizeof(*sent_heap) * count);
+
+	printf("%d seconds, 1 video + %d audio tracks, %u packets, "
+	       "backlog of %u packets\n", seconds, MAX_AUDIO_MIXES,
+	       (unsigned)count, (unsigned)backlog);
+
+	old_ns  = run_old(stream, count, backlog, sent_old);
+	heap_ns = run_heap(stream, count, backlog, sent_heap);
+
+	printf("sorted array: %8.2f ms (%6.1f ns/packet)\n",
+			(double)old_ns / 1000000.0, (double)old_ns / count);
+	printf("heap merge:   %8.2f ms (%6.1f ns/packet)\n",
+			(double)heap_ns / 1000000.0, (double)heap_ns / count);
+	printf("speedup:      %8.2fx\n", (double)old_ns / (double)heap_ns);
+
+	success = same_order(sent_old, sent_heap, count);
+	printf("%s\n", success ? "output order matches" :
+			"output order MISMATCH");
+
+	bfree(sent_heap);
+	bfree(sent_old);
+	bfree(stream);
+	return success ? 0 : 1;
+}
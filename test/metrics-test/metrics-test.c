@@ -0,0 +1,193 @@
+/*
+ * Checks the metrics registry and its Prometheus output:
+ *
+ *   1. creating an existing metric adds a reference to it, and a name can't
+ *      be created again with another type or label name, whatever the label
+ *      value
+ *   2. counters, gauges and histograms keep the values written to them
+ *   3. the text output has one # TYPE line per name, exact 'le' bounds, and
+ *      histogram buckets that include values equal to their bound
+ *
+ * Returns non-zero if any check fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/dstr.h>
+#include <util/metrics.h>
+
+#include "test-check.h"
+
+static bool output_has(const char *output, const char *line)
+{
+	if (strstr(output, line))
+		return true;
+
+	printf("      missing line: %s", line);
+	return false;
+}
+
+static size_t output_count(const char *output, const char *str)
+{
+	size_t count = 0;
+
+	while ((output = strstr(output, str)) != NULL) {
+		output += strlen(str);
+		count++;
+	}
+
+	return count;
+}
+
+static bool test_registry(void)
+{
+	metric_t *a, *b, *c;
+	bool success = true;
+
+	a = metric_create(METRIC_COUNTER, "test_packets_total", "Packets",
+			"output", "rtmp");
+	b = metric_create(METRIC_COUNTER, "test_packets_total", "Packets",
+			"output", "rtmp");
+	success &= test_check(a && a == b, "existing metric is shared");
+	metric_release(b);
+
+	b = metric_create(METRIC_COUNTER, "test_packets_total", "Packets",
+			"output", "ffmpeg");
+	success &= test_check(b && a != b,
+			"other label value is a new metric");
+
+	c = metric_create(METRIC_GAUGE, "test_packets_total", NULL,
+			"output", "zzz");
+	success &= test_check(c == NULL,
+			"other type after every label value is rejected");
+	metric_release(c);
+
+	c = metric_create(METRIC_GAUGE, "test_packets_total", NULL,
+			"output", "aaa");
+	success &= test_check(c == NULL,
+			"other type before every label value is rejected");
+	metric_release(c);
+
+	c = metric_create(METRIC_COUNTER, "test_packets_total", NULL,
+			"encoder", "x264");
+	success &= test_check(c == NULL, "other label name is rejected");
+	metric_release(c);
+
+	metric_add(a, 5);
+	metric_add(a, 2);
+	success &= test_check(metric_get_value(a) == 7, "counter value");
+	success &= test_check(metric_get_value(b) == 0,
+			"reference outlives a release");
+
+	metric_release(a);
+	metric_release(b);
+
+	a = metric_create(METRIC_GAUGE, "test_packets_total", NULL, NULL, NULL);
+	success &= test_check(a != NULL, "name can be reused once released");
+	metric_set(a, -3);
+	success &= test_check(metric_get_value(a) == -3, "gauge value");
+	metric_release(a);
+
+	return success;
+}
+
+static bool test_histogram(void)
+{
+	struct dstr output = {0};
+	metric_t *metric;
+	bool success = true;
+
+	metric = metric_create(METRIC_HISTOGRAM, "test_render_seconds",
+			"Render time", NULL, NULL);
+
+	/* exactly 1024 ns, the first exported bound */
+	metric_record(metric, 1024);
+	metric_record(metric, 1025);
+	metric_record(metric, 2000);
+	metric_record(metric, 3000000000ULL);
+
+	success &= test_check(metric_get_count(metric) == 4,
+			"histogram count");
+	success &= test_check(metric_get_sum(metric) == 3000004049ULL,
+			"histogram sum");
+	success &= test_check(metric_get_quantile(metric, 0.25) == 1024,
+			"quantile of a bound is the bound");
+
+	metrics_dump_prometheus(&output);
+
+	success &= test_check(output_count(output.array,
+				"# TYPE test_render_seconds histogram\n") == 1,
+			"single type line");
+	success &= test_check(output_has(output.array,
+				"test_render_seconds_bucket"
+				"{le=\"0.000001024\"} 1\n"),
+			"bucket includes its bound");
+	success &= test_check(output_has(output.array,
+				"test_render_seconds_bucket"
+				"{le=\"0.000002048\"} 3\n"),
+			"next bucket");
+	success &= test_check(output_has(output.array,
+				"test_render_seconds_bucket"
+				"{le=\"17.179869184\"} 4\n"),
+			"largest bound is exact");
+	success &= test_check(output_has(output.array,
+				"test_render_seconds_bucket"
+				"{le=\"+Inf\"} 4\n"),
+			"inf bucket");
+	success &= test_check(output_has(output.array,
+				"test_render_seconds_sum 3.000004049\n"),
+			"sum is exact");
+
+	dstr_free(&output);
+	metric_release(metric);
+	return success;
+}
+
+static bool test_labels(void)
+{
+	struct dstr output = {0};
+	metric_t *a, *b;
+	bool success = true;
+
+	a = metric_create(METRIC_COUNTER, "test_frames_total", "Frames",
+			"output", "b");
+	b = metric_create(METRIC_COUNTER, "test_frames_total", "Frames",
+			"output", "a\"");
+	metric_add(a, 1);
+	metric_add(b, 2);
+
+	metrics_dump_prometheus(&output);
+
+	success &= test_check(output_count(output.array,
+				"# TYPE test_frames_total counter\n") == 1,
+			"labels share one type line");
+	success &= test_check(output_count(output.array,
+				"# HELP test_frames_total Frames\n") == 1,
+			"labels share one help line");
+	success &= test_check(output_has(output.array,
+				"test_frames_total{output=\"a\\\"\"} 2\n"
+				"test_frames_total{output=\"b\"} 1\n"),
+			"label values are sorted and escaped");
+
+	dstr_free(&output);
+	metric_release(a);
+	metric_release(b);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	bool success = true;
+
+	UNUSED_PARAMETER(argc);
+	UNUSED_PARAMETER(argv);
+
+	success &= test_registry();
+	success &= test_histogram();
+	success &= test_labels();
+
+	metrics_free();
+
+	return test_result(success);
+}
@@ -0,0 +1,493 @@
+/*
+ * Headless benchmark of the full libobs pipeline: a scene of test-input
+ * sources is rendered, encoded with obs-x264 and AAC, and sent either to a
+ * null output that discards the packets or through ffmpeg-mux to a file.
+ * After a fixed number of frames the profiler snapshot is written as CSV and
+ * the frame counters are printed, so runs can be compared between commits.
+ *
+ *   obs-bench [--frames N] [--width CX] [--height CY] [--fps N]
+ *             [--sources N] [--preset PRESET] [--bitrate KBPS]
+ *             [--graphics MODULE] [--module-path BIN DATA]
+ *             [--mux PATH] [--csv PATH] [--trace PATH]
+ *
+ * --trace also writes a Chrome trace of the last ten seconds of the run.
+ *
+ * The graphics module still needs a display to create its context on, use
+ * Xvfb when running without one.  Returns non-zero if the pipeline could not
+ * be set up or produced no frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <obs.h>
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+#include <graphics/vec2.h>
+
+struct bench_params {
+	uint32_t   frames;
+	uint32_t   cx, cy;
+	uint32_t   fps;
+	int        sources;
+	const char *preset;
+	int        bitrate;
+	const char *graphics;
+	const char *module_bin;
+	const char *module_data;
+	const char *mux_path;
+	const char *csv_path;
+	const char *trace_path;
+};
+
+struct frame_counters {
+	uint32_t   rendered;
+	uint32_t   lagged;
+	uint32_t   skipped;
+	uint32_t   output;
+};
+
+/* ------------------------------------------------------------------------- */
+/* null output, counts packets and drops them                                */
+
+struct null_output {
+	obs_output_t  *output;
+	volatile long video_packets;
+	volatile long audio_packets;
+	volatile long kbytes;
+	size_t        bytes;
+};
+
+/* the benchmark only ever creates one, kept so the counters can be read
+ * back once it's done */
+static struct null_output *null_output_instance = NULL;
+
+static const char *null_output_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return "Null Output";
+}
+
+static void *null_output_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct null_output *out = bzalloc(sizeof(*out));
+	out->output = output;
+	null_output_instance = out;
+
+	UNUSED_PARAMETER(settings);
+	return out;
+}
+
+static void null_output_destroy(void *data)
+{
+	if (null_output_instance == data)
+		null_output_instance = NULL;
+	bfree(data);
+}
+
+static bool null_output_start(void *data)
+{
+	struct null_output *out = data;
+
+	if (!obs_output_can_begin_data_capture(out->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(out->output, 0))
+		return false;
+
+	obs_output_begin_data_capture(out->output, 0);
+	return true;
+}
+
+static void null_output_stop(void *data)
+{
+	struct null_output *out = data;
+	obs_output_end_data_capture(out->output);
+}
+
+static void null_output_data(void *data, struct encoder_packet *packet)
+{
+	struct null_output *out = data;
+
+	if (packet->type == OBS_ENCODER_VIDEO)
+		os_atomic_inc_long(&out->video_packets);
+	else
+		os_atomic_inc_long(&out->audio_packets);
+
+	/* only called from the interleave thread */
+	out->bytes += packet->size;
+	os_atomic_set_long(&out->kbytes, (long)(out->bytes / 1024));
+}
+
+static struct obs_output_info null_output_info = {
+	.id             = "bench_null_output",
+	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+	.get_name       = null_output_getname,
+	.create         = null_output_create,
+	.destroy        = null_output_destroy,
+	.start          = null_output_start,
+	.stop           = null_output_stop,
+	.encoded_packet = null_output_data
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void parse_args(struct bench_params *params, int argc, char *argv[])
+{
+	params->frames   = 600;
+	params->cx       = 1280;
+	params->cy       = 720;
+	params->fps      = 60;
+	params->sources  = 4;
+	params->preset   = "veryfast";
+	params->bitrate  = 2500;
+	params->graphics = DL_OPENGL;
+	params->csv_path = "obs-bench.csv";
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg  = argv[i];
+		const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!next) {
+			printf("missing value for %s\n", arg);
+			exit(1);
+		}
+
+		if (strcmp(arg, "--frames") == 0)
+			params->frames = (uint32_t)atoi(next);
+		else if (strcmp(arg, "--width") == 0)
+			params->cx = (uint32_t)atoi(next);
+		else if (strcmp(arg, "--height") == 0)
+			params->cy = (uint32_t)atoi(next);
+		else if (strcmp(arg, "--fps") == 0)
+			params->fps = (uint32_t)atoi(next);
+		else if (strcmp(arg, "--sources") == 0)
+			params->sources = atoi(next);
+		else if (strcmp(arg, "--preset") == 0)
+			params->preset = next;
+		else if (strcmp(arg, "--bitrate") == 0)
+			params->bitrate = atoi(next);
+		else if (strcmp(arg, "--graphics") == 0)
+			params->graphics = next;
+		else if (strcmp(arg, "--mux") == 0)
+			params->mux_path = next;
+		else if (strcmp(arg, "--csv") == 0)
+			params->csv_path = next;
+		else if (strcmp(arg, "--trace") == 0)
+			params->trace_path = next;
+		else if (strcmp(arg, "--module-path") == 0 && i + 2 < argc) {
+			params->module_bin  = next;
+			params->module_data = argv[i + 2];
+			i++;
+		} else {
+			printf("unknown option %s\n", arg);
+			exit(1);
+		}
+
+		i++;
+	}
+}
+
+static bool init_obs(const struct bench_params *params,
+		profiler_name_store_t *names)
+{
+	struct obs_video_info ovi = {0};
+	struct obs_audio_info oai = {0};
+
+	if (!obs_startup("en-US", NULL, names)) {
+		printf("obs_startup failed\n");
+		return false;
+	}
+
+	ovi.graphics_module = params->graphics;
+	ovi.fps_num         = params->fps;
+	ovi.fps_den         = 1;
+	ovi.base_width      = params->cx;
+	ovi.base_height     = params->cy;
+	ovi.output_width    = params->cx;
+	ovi.output_height   = params->cy;
+	ovi.output_format   = VIDEO_FORMAT_NV12;
+	ovi.gpu_conversion  = true;
+	ovi.colorspace      = VIDEO_CS_709;
+	ovi.range           = VIDEO_RANGE_PARTIAL;
+	ovi.scale_type      = OBS_SCALE_BICUBIC;
+
+	if (obs_reset_video(&ovi) != OBS_VIDEO_SUCCESS) {
+		printf("could not initialize video with '%s'\n",
+				params->graphics);
+		return false;
+	}
+
+	oai.samples_per_sec = 48000;
+	oai.speakers        = SPEAKERS_STEREO;
+	if (!obs_reset_audio(&oai)) {
+		printf("could not initialize audio\n");
+		return false;
+	}
+
+	if (params->module_bin)
+		obs_add_module_path(params->module_bin, params->module_data);
+	obs_load_all_modules();
+
+	obs_register_output(&null_output_info);
+	return true;
+}
+
+static obs_scene_t *create_scene(const struct bench_params *params)
+{
+	obs_scene_t  *scene = obs_scene_create("bench scene");
+	obs_source_t *sine;
+	struct vec2  pos, scale;
+
+	/* random sources are 20x20, tile them across the canvas */
+	for (int i = 0; i < params->sources; i++) {
+		obs_source_t *source;
+		obs_sceneitem_t *item;
+		char name[32];
+
+		snprintf(name, sizeof(name), "random %d", i);
+		source = obs_source_create("random", name, NULL, NULL);
+		if (!source) {
+			printf("could not create random source, is "
+			       "test-input loaded?\n");
+			obs_scene_release(scene);
+			return NULL;
+		}
+
+		item = obs_scene_add(scene, source);
+		vec2_set(&scale, (float)params->cx / 20.0f / 2.0f,
+				(float)params->cy / 20.0f / 2.0f);
+		vec2_set(&pos, (float)(i % 2) * params->cx / 2.0f,
+				(float)((i / 2) % 2) * params->cy / 2.0f);
+		obs_sceneitem_set_scale(item, &scale);
+		obs_sceneitem_set_pos(item, &pos);
+		obs_source_release(source);
+	}
+
+	sine = obs_source_create("test_sinewave", "sine", NULL, NULL);
+	if (sine) {
+		obs_scene_add(scene, sine);
+		obs_source_release(sine);
+	}
+
+	return scene;
+}
+
+static obs_output_t *create_output(const struct bench_params *params,
+		obs_encoder_t **venc, obs_encoder_t **aenc)
+{
+	obs_data_t   *vsettings = obs_data_create();
+	obs_data_t   *osettings = obs_data_create();
+	obs_output_t *output;
+
+	obs_data_set_int(vsettings, "bitrate", params->bitrate);
+	obs_data_set_string(vsettings, "preset", params->preset);
+	obs_data_set_string(vsettings, "rate_control", "CBR");
+
+	*venc = obs_video_encoder_create("obs_x264", "bench video",
+			vsettings, NULL);
+	*aenc = obs_audio_encoder_create("ffmpeg_aac", "bench audio",
+			NULL, 0, NULL);
+	obs_data_release(vsettings);
+
+	if (params->mux_path) {
+		obs_data_set_string(osettings, "path", params->mux_path);
+		output = obs_output_create("ffmpeg_muxer", "bench output",
+				osettings, NULL);
+	} else {
+		output = obs_output_create("bench_null_output", "bench output",
+				osettings, NULL);
+	}
+	obs_data_release(osettings);
+
+	if (!*venc || !*aenc || !output) {
+		printf("could not create encoders or output, are obs-x264 "
+		       "and obs-ffmpeg loaded?\n");
+		obs_output_release(output);
+		return NULL;
+	}
+
+	obs_encoder_set_video(*venc, obs_get_video());
+	obs_encoder_set_audio(*aenc, obs_get_audio());
+	obs_output_set_video_encoder(output, *venc);
+	obs_output_set_audio_encoder(output, *aenc, 0);
+	return output;
+}
+
+static void get_frame_counters(struct frame_counters *counters)
+{
+	video_t *video = obs_get_video();
+
+	counters->rendered = obs_get_total_frames();
+	counters->lagged   = obs_get_lagged_frames();
+	counters->skipped  = video_output_get_skipped_frames(video);
+	counters->output   = video_output_get_total_frames(video);
+}
+
+/* fails if the output stops receiving frames for this long, e.g. because the
+ * video thread stalled or never started */
+#define STALL_TIMEOUT_NS 10000000000ULL
+
+static bool wait_for_frames(video_t *video, uint32_t start, uint32_t frames)
+{
+	uint32_t last = start;
+	uint32_t prev = start;
+	uint64_t last_report = os_gettime_ns();
+	uint64_t deadline = last_report + STALL_TIMEOUT_NS;
+
+	while (video_output_get_total_frames(video) - start < frames) {
+		uint32_t cur;
+
+		os_sleep_ms(10);
+
+		cur = video_output_get_total_frames(video);
+		if (cur != prev) {
+			prev = cur;
+			deadline = os_gettime_ns() + STALL_TIMEOUT_NS;
+
+		} else if (os_gettime_ns() >= deadline) {
+			printf("no frames for %llu s after %u/%u frames, "
+			       "giving up\n",
+			       STALL_TIMEOUT_NS / 1000000000ULL,
+			       cur - start, frames);
+			return false;
+		}
+
+		if (os_gettime_ns() - last_report >= 1000000000ULL) {
+			printf("  %u/%u frames (%u fps)\n", cur - start,
+					frames, cur - last);
+			last = cur;
+			last_report = os_gettime_ns();
+		}
+	}
+
+	return true;
+}
+
+static void print_results(const struct bench_params *params,
+		obs_output_t *output, uint64_t elapsed_ns,
+		const struct frame_counters *start)
+{
+	struct frame_counters end;
+	uint32_t rendered, lagged;
+
+	get_frame_counters(&end);
+	rendered = end.rendered - start->rendered;
+	lagged   = end.lagged - start->lagged;
+
+	printf("\n%ux%u @ %u fps, %d sources, x264 %s %d kbps, %s\n",
+			params->cx, params->cy, params->fps, params->sources,
+			params->preset, params->bitrate,
+			params->mux_path ? params->mux_path : "null output");
+	printf("elapsed:          %.2f s\n", (double)elapsed_ns / 1e9);
+	printf("frames rendered:  %u\n", rendered);
+	printf("frames lagged:    %u (%.2f%%)\n", lagged,
+			rendered ? lagged * 100.0 / rendered : 0.0);
+	printf("frames skipped:   %u (encoder)\n",
+			end.skipped - start->skipped);
+	printf("frames output:    %u\n", end.output - start->output);
+	printf("frames dropped:   %d (output)\n",
+			obs_output_get_frames_dropped(output));
+
+	if (!params->mux_path && null_output_instance) {
+		struct null_output *out = null_output_instance;
+		printf("packets:          %ld video, %ld audio, %ld KB\n",
+				os_atomic_load_long(&out->video_packets),
+				os_atomic_load_long(&out->audio_packets),
+				os_atomic_load_long(&out->kbytes));
+	}
+}
+
+static bool dump_profiler(const struct bench_params *params)
+{
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	bool success = profiler_snapshot_dump_csv(snap, params->csv_path);
+
+	profiler_print(snap);
+	profile_snapshot_free(snap);
+
+	if (success)
+		printf("profiler snapshot written to %s\n", params->csv_path);
+	else
+		printf("could not write %s\n", params->csv_path);
+
+	if (params->trace_path) {
+		profiler_trace_stop();
+
+		if (profiler_trace_dump_json(params->trace_path)) {
+			printf("trace written to %s\n", params->trace_path);
+		} else {
+			printf("could not write %s\n", params->trace_path);
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_params   params;
+	profiler_name_store_t *names;
+	obs_scene_t           *scene  = NULL;
+	obs_output_t          *output = NULL;
+	obs_encoder_t         *venc   = NULL;
+	obs_encoder_t         *aenc   = NULL;
+	struct frame_counters start;
+	uint64_t              start_ns;
+	int                   ret = 1;
+
+	parse_args(&params, argc, argv);
+
+	names = profiler_name_store_create();
+	profiler_start();
+
+	if (!init_obs(&params, names))
+		goto exit;
+
+	scene = create_scene(&params);
+	if (!scene)
+		goto exit;
+
+	obs_set_output_source(0, obs_scene_get_source(scene));
+
+	output = create_output(&params, &venc, &aenc);
+	if (!output)
+		goto exit;
+
+	get_frame_counters(&start);
+
+	if (params.trace_path)
+		profiler_trace_start(10000000000ULL);
+
+	if (!obs_output_start(output)) {
+		printf("could not start output\n");
+		goto exit;
+	}
+
+	start_ns = os_gettime_ns();
+	if (!wait_for_frames(obs_get_video(), start.output, params.frames)) {
+		obs_output_stop(output);
+		goto exit;
+	}
+	obs_output_stop(output);
+
+	print_results(&params, output, os_gettime_ns() - start_ns, &start);
+
+	if (obs_output_get_total_frames(output) > 0 && dump_profiler(&params))
+		ret = 0;
+
+exit:
+	obs_output_release(output);
+	obs_encoder_release(venc);
+	obs_encoder_release(aenc);
+	obs_set_output_source(0, NULL);
+	obs_scene_release(scene);
+	obs_shutdown();
+
+	profiler_stop();
+	profiler_free();
+	profiler_name_store_free(names);
+	return ret;
+}
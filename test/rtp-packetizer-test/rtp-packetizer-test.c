@@ -0,0 +1,314 @@
+/*
+ * Runs the FTL output's RTP packetizer on hand built H.264 and Opus data and
+ * checks the packets it hands to the send callback:
+ *
+ *   1. a NAL unit that fits is sent as one single NAL unit packet
+ *   2. the marker bit is only set on the last NAL unit of an access unit
+ *   3. a NAL unit that doesn't fit is split into FU-A fragments that
+ *      reassemble to the original NAL unit
+ *   4. sequence numbers increment (and wrap), timestamp and SSRC are kept
+ *   5. an Opus packet is sent as it is, one per RTP packet
+ *
+ * Returns non-zero if any check fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/c99defs.h>
+
+#include "test-check.h"
+#include "rtp-packetizer.h"
+
+#define MAX_PACKETS       16
+#define VIDEO_PT          96
+#define AUDIO_PT          97
+#define TEST_SSRC         0x12345678
+#define TEST_TIMESTAMP    0xCAFEBABE
+#define LARGE_NAL_SIZE    4000
+
+struct sent_packet {
+	uint8_t data[RTP_MAX_PACKET_SIZE];
+	size_t  size;
+};
+
+struct sink {
+	struct sent_packet packets[MAX_PACKETS];
+	size_t             count;
+	size_t             fail_after;
+};
+
+static bool sink_send(void *param, const uint8_t *packet, size_t size)
+{
+	struct sink *sink = param;
+
+	if (sink->count == sink->fail_after || sink->count == MAX_PACKETS)
+		return false;
+
+	memcpy(sink->packets[sink->count].data, packet, size);
+	sink->packets[sink->count].size = size;
+	sink->count++;
+	return true;
+}
+
+static inline uint16_t read_be16(const uint8_t *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline bool marker(const struct sent_packet *packet)
+{
+	return (packet->data[1] & 0x80) != 0;
+}
+
+static inline uint8_t payload_type(const struct sent_packet *packet)
+{
+	return packet->data[1] & 0x7F;
+}
+
+static inline const uint8_t *payload(const struct sent_packet *packet)
+{
+	return packet->data + RTP_HEADER_SIZE;
+}
+
+static inline size_t payload_size(const struct sent_packet *packet)
+{
+	return packet->size - RTP_HEADER_SIZE;
+}
+
+/* writes a 4 byte start code followed by a NAL unit of 'size' bytes */
+static size_t write_nal(uint8_t *out, uint8_t header, size_t size)
+{
+	out[0] = 0;
+	out[1] = 0;
+	out[2] = 0;
+	out[3] = 1;
+	out[4] = header;
+
+	/* no zero bytes, so no start codes inside the NAL unit */
+	for (size_t i = 1; i < size; i++)
+		out[4 + i] = (uint8_t)(1 + i % 250);
+
+	return 4 + size;
+}
+
+static void init(struct rtp_packetizer *rtp, struct sink *sink,
+		uint8_t pt)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->fail_after = (size_t)-1;
+	rtp_packetizer_init(rtp, pt, 90000, TEST_SSRC, sink_send, sink);
+}
+
+static bool test_single_nal(void)
+{
+	struct rtp_packetizer rtp;
+	struct sink sink;
+	uint8_t data[256];
+	size_t size = write_nal(data, 0x65, 100);
+	bool success = true;
+
+	init(&rtp, &sink, VIDEO_PT);
+	success &= test_check(rtp_packetize_h264(&rtp, data, size,
+				TEST_TIMESTAMP, true),
+			"small NAL unit: packetized");
+	success &= test_check(sink.count == 1,
+			"small NAL unit: one packet (%d)", (int)sink.count);
+	if (sink.count != 1)
+		return false;
+
+	struct sent_packet *p = &sink.packets[0];
+	success &= test_check(p->data[0] == 0x80, "RTP version 2");
+	success &= test_check(marker(p) && payload_type(p) == VIDEO_PT,
+			"small NAL unit: marker set, payload type %d",
+			payload_type(p));
+	success &= test_check(read_be32(p->data + 4) == TEST_TIMESTAMP &&
+			read_be32(p->data + 8) == TEST_SSRC,
+			"timestamp and SSRC written");
+	success &= test_check(payload_size(p) == 100 &&
+			memcmp(payload(p), data + 4, 100) == 0,
+			"small NAL unit: payload is the NAL unit");
+	return success;
+}
+
+static bool test_access_unit(void)
+{
+	struct rtp_packetizer rtp;
+	struct sink sink;
+	uint8_t data[256];
+	size_t size = 0;
+	bool success = true;
+
+	size += write_nal(data + size, 0x67, 10); /* SPS */
+	size += write_nal(data + size, 0x68, 4);  /* PPS */
+	size += write_nal(data + size, 0x65, 50); /* IDR slice */
+
+	init(&rtp, &sink, VIDEO_PT);
+	rtp_packetize_h264(&rtp, data, size, TEST_TIMESTAMP, true);
+
+	success &= test_check(sink.count == 3,
+			"access unit: one packet per NAL unit (%d)",
+			(int)sink.count);
+	if (sink.count != 3)
+		return false;
+
+	success &= test_check(!marker(&sink.packets[0]) &&
+			!marker(&sink.packets[1]) && marker(&sink.packets[2]),
+			"access unit: marker only on the last NAL unit");
+	success &= test_check(payload(&sink.packets[0])[0] == 0x67 &&
+			payload(&sink.packets[1])[0] == 0x68 &&
+			payload(&sink.packets[2])[0] == 0x65,
+			"access unit: NAL units sent in order");
+
+	/* headers sent in front of a keyframe don't end the access unit */
+	init(&rtp, &sink, VIDEO_PT);
+	rtp_packetize_h264(&rtp, data, size, TEST_TIMESTAMP, false);
+	success &= test_check(sink.count == 3 && !marker(&sink.packets[2]),
+			"no marker when the buffer doesn't end the frame");
+	return success;
+}
+
+static bool test_fu_a(void)
+{
+	static uint8_t data[LARGE_NAL_SIZE + 4];
+	static uint8_t reassembled[LARGE_NAL_SIZE];
+	struct rtp_packetizer rtp;
+	struct sink sink;
+	size_t size = write_nal(data, 0x65, LARGE_NAL_SIZE);
+	size_t expected = (LARGE_NAL_SIZE - 1 + RTP_MAX_PAYLOAD_SIZE - 3) /
+		(RTP_MAX_PAYLOAD_SIZE - 2);
+	size_t offset = 1;
+	bool headers_ok = true;
+	bool success = true;
+
+	init(&rtp, &sink, VIDEO_PT);
+	rtp_packetize_h264(&rtp, data, size, TEST_TIMESTAMP, true);
+
+	success &= test_check(sink.count == expected,
+			"large NAL unit: %d FU-A fragments (expected %d)",
+			(int)sink.count, (int)expected);
+	if (sink.count != expected)
+		return false;
+
+	reassembled[0] = 0x65;
+
+	for (size_t i = 0; i < sink.count; i++) {
+		struct sent_packet *p = &sink.packets[i];
+		const uint8_t *fu = payload(p);
+		bool first = i == 0;
+		bool last = i == sink.count - 1;
+
+		/* FU indicator keeps F and NRI, FU header keeps the type */
+		headers_ok &= fu[0] == ((0x65 & 0xE0) | 28);
+		headers_ok &= (fu[1] & 0x1F) == (0x65 & 0x1F);
+		headers_ok &= ((fu[1] & 0x80) != 0) == first;
+		headers_ok &= ((fu[1] & 0x40) != 0) == last;
+		headers_ok &= marker(p) == last;
+		headers_ok &= p->size <= RTP_MAX_PACKET_SIZE;
+
+		memcpy(reassembled + offset, fu + 2, payload_size(p) - 2);
+		offset += payload_size(p) - 2;
+	}
+
+	success &= test_check(headers_ok,
+			"large NAL unit: FU indicator/header, S/E bits and "
+			"marker");
+	success &= test_check(offset == LARGE_NAL_SIZE &&
+			memcmp(reassembled, data + 4, LARGE_NAL_SIZE) == 0,
+			"large NAL unit: fragments reassemble to the NAL unit");
+	return success;
+}
+
+static bool test_sequence(void)
+{
+	static uint8_t data[LARGE_NAL_SIZE + 4];
+	struct rtp_packetizer rtp;
+	struct sink sink;
+	size_t size = write_nal(data, 0x41, LARGE_NAL_SIZE);
+	bool seq_ok = true;
+	bool success = true;
+
+	init(&rtp, &sink, VIDEO_PT);
+	rtp.seq = 0xFFFE;
+	rtp_packetize_h264(&rtp, data, size, TEST_TIMESTAMP, true);
+
+	for (size_t i = 0; i < sink.count; i++) {
+		uint16_t seq = read_be16(sink.packets[i].data + 2);
+		seq_ok &= seq == (uint16_t)(0xFFFE + i);
+		seq_ok &= read_be32(sink.packets[i].data + 4) ==
+			TEST_TIMESTAMP;
+		seq_ok &= read_be32(sink.packets[i].data + 8) == TEST_SSRC;
+	}
+
+	success &= test_check(sink.count > 2 && seq_ok,
+			"sequence numbers increment and wrap, timestamp and "
+			"SSRC kept on every fragment");
+
+	/* a failed send stops packetizing */
+	init(&rtp, &sink, VIDEO_PT);
+	sink.fail_after = 1;
+	success &= test_check(!rtp_packetize_h264(&rtp, data, size,
+				TEST_TIMESTAMP, true) && sink.count == 1,
+			"send failure stops packetizing");
+	return success;
+}
+
+static bool test_opus(void)
+{
+	struct rtp_packetizer rtp;
+	struct sink sink;
+	uint8_t data[RTP_MAX_PAYLOAD_SIZE + 1];
+	bool success = true;
+
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)i;
+
+	init(&rtp, &sink, AUDIO_PT);
+	rtp.clock_rate = 48000;
+
+	success &= test_check(rtp_packetizer_timestamp(&rtp, 1024, 1,
+				48000) == 1024,
+			"audio timestamp in the 48 kHz clock");
+
+	rtp_packetize_opus(&rtp, data, 160, 1024);
+	success &= test_check(sink.count == 1 &&
+			marker(&sink.packets[0]) &&
+			payload_type(&sink.packets[0]) == AUDIO_PT &&
+			payload_size(&sink.packets[0]) == 160 &&
+			memcmp(payload(&sink.packets[0]), data, 160) == 0,
+			"Opus packet sent as it is");
+
+	success &= test_check(!rtp_packetize_opus(&rtp, data, sizeof(data),
+				2048) && sink.count == 1,
+			"oversized Opus packet rejected");
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rtp_packetizer rtp;
+	bool success = true;
+
+	UNUSED_PARAMETER(argc);
+	UNUSED_PARAMETER(argv);
+
+	rtp_packetizer_init(&rtp, VIDEO_PT, 90000, TEST_SSRC, sink_send,
+			NULL);
+	success &= test_check(rtp_packetizer_timestamp(&rtp, 30, 1, 30) ==
+			90000,
+			"video timestamp in the 90 kHz clock");
+
+	success &= test_single_nal();
+	success &= test_access_unit();
+	success &= test_fu_a();
+	success &= test_sequence();
+	success &= test_opus();
+
+	return test_result(success);
+}
@@ -0,0 +1,144 @@
+/*
+ * Checks the blending scene caches are rendered and drawn with, by blending
+ * one pixel on the CPU the way the graphics subsystem would:
+ *
+ *   1. overlapping semi-transparent layers drawn into a cache cover what
+ *      they'd cover on their own (alpha 0.75 for two 50% layers), and the
+ *      cache then drawn over a background gives the same pixel as the layers
+ *      drawn over it directly
+ *   2. the same holds for an item cache drawn into a scene cache, which is
+ *      then drawn over the background
+ *
+ * Returns non-zero if any check fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <graphics/graphics.h>
+#include <graphics/vec4.h>
+
+#include "test-check.h"
+
+struct blend {
+	enum gs_blend_type src_c;
+	enum gs_blend_type dest_c;
+	enum gs_blend_type src_a;
+	enum gs_blend_type dest_a;
+};
+
+/* gs_reset_blend_state, what sources are drawn with outside of caches */
+static const struct blend default_blend = {
+	GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA, GS_BLEND_ONE, GS_BLEND_ONE
+};
+
+/* set_cache_blend_state in obs-scene.c, for drawing into a cache */
+static const struct blend cache_blend = {
+	GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA, GS_BLEND_ONE, GS_BLEND_INVSRCALPHA
+};
+
+/* draw_cache and flush_batch, for drawing a premultiplied cache */
+static const struct blend premultiplied_blend = {
+	GS_BLEND_ONE, GS_BLEND_INVSRCALPHA, GS_BLEND_ONE, GS_BLEND_INVSRCALPHA
+};
+
+static float factor(enum gs_blend_type type, const struct vec4 *src,
+		const struct vec4 *dst)
+{
+	switch (type) {
+	case GS_BLEND_ZERO:        return 0.0f;
+	case GS_BLEND_ONE:         return 1.0f;
+	case GS_BLEND_SRCALPHA:    return src->w;
+	case GS_BLEND_INVSRCALPHA: return 1.0f - src->w;
+	case GS_BLEND_DSTALPHA:    return dst->w;
+	case GS_BLEND_INVDSTALPHA: return 1.0f - dst->w;
+	default:                   return 0.0f;
+	}
+}
+
+static void draw(struct vec4 *dst, const struct vec4 *src,
+		const struct blend *blend)
+{
+	float src_c  = factor(blend->src_c,  src, dst);
+	float dest_c = factor(blend->dest_c, src, dst);
+	float src_a  = factor(blend->src_a,  src, dst);
+	float dest_a = factor(blend->dest_a, src, dst);
+	struct vec4 out;
+
+	out.x = src->x * src_c + dst->x * dest_c;
+	out.y = src->y * src_c + dst->y * dest_c;
+	out.z = src->z * src_c + dst->z * dest_c;
+	out.w = src->w * src_a + dst->w * dest_a;
+
+	/* render targets are RGBA8, so the result is clamped */
+	out.x = fminf(out.x, 1.0f);
+	out.y = fminf(out.y, 1.0f);
+	out.z = fminf(out.z, 1.0f);
+	out.w = fminf(out.w, 1.0f);
+	*dst = out;
+}
+
+static bool near(float a, float b)
+{
+	return fabsf(a - b) < 0.5f / 255.0f;
+}
+
+static bool color_near(const struct vec4 *a, const struct vec4 *b)
+{
+	return near(a->x, b->x) && near(a->y, b->y) && near(a->z, b->z);
+}
+
+int main(void)
+{
+	struct vec4 background, red, blue;
+	struct vec4 direct, item_cache, scene_cache, cached;
+	bool success = true;
+
+	vec4_set(&background, 0.0f, 1.0f, 0.0f, 1.0f);
+	vec4_set(&red,        1.0f, 0.0f, 0.0f, 0.5f);
+	vec4_set(&blue,       0.0f, 0.0f, 1.0f, 0.5f);
+
+	direct = background;
+	draw(&direct, &red,  &default_blend);
+	draw(&direct, &blue, &default_blend);
+
+	/* 1. both layers in one cache */
+	vec4_zero(&scene_cache);
+	draw(&scene_cache, &red,  &cache_blend);
+	draw(&scene_cache, &blue, &cache_blend);
+
+	success &= test_check(near(scene_cache.w, 0.75f),
+			"two 50%% layers cover 75%% of a cache (alpha %.3f)",
+			scene_cache.w);
+
+	cached = background;
+	draw(&cached, &scene_cache, &premultiplied_blend);
+
+	success &= test_check(color_near(&cached, &direct),
+			"cache over the background matches the layers drawn "
+			"directly (%.3f %.3f %.3f, expected %.3f %.3f %.3f)",
+			cached.x, cached.y, cached.z,
+			direct.x, direct.y, direct.z);
+
+	/* 2. the blue layer cached by itself, drawn into the scene cache */
+	vec4_zero(&item_cache);
+	draw(&item_cache, &blue, &cache_blend);
+
+	vec4_zero(&scene_cache);
+	draw(&scene_cache, &red,        &cache_blend);
+	draw(&scene_cache, &item_cache, &premultiplied_blend);
+
+	success &= test_check(near(scene_cache.w, 0.75f),
+			"item cache in a scene cache covers 75%% (alpha %.3f)",
+			scene_cache.w);
+
+	cached = background;
+	draw(&cached, &scene_cache, &premultiplied_blend);
+
+	success &= test_check(color_near(&cached, &direct),
+			"nested caches over the background match the layers "
+			"drawn directly (%.3f %.3f %.3f)",
+			cached.x, cached.y, cached.z);
+
+	return test_result(success);
+}
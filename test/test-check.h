@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2016 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Reporting for the test executables that are run by ctest.  Each check
+ * prints one line, and main returns test_result() of all of them so that a
+ * failed check fails the test.
+ */
+
+/** Prints the result of a check, returns 'success' */
+static inline bool test_check(bool success, const char *format, ...)
+{
+	va_list args;
+
+	printf("%s: ", success ? "ok  " : "FAIL");
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+
+	printf("\n");
+	return success;
+}
+
+/** Prints the summary line, returns the exit code of the test */
+static inline int test_result(bool success)
+{
+	printf("\n%s\n", success ? "all checks passed" : "checks FAILED");
+	return success ? 0 : 1;
+}